@@ -0,0 +1,608 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <device.h>
+#include <personalize.h>
+#include <s96at.h>
+#include <sha.h>
+
+#define WAKE_RETRIES		10
+
+/*
+ * Commands are timed in an awake window of their own. An untimed idle-wake
+ * cycle is inserted once this much of the watchdog period has been used up.
+ */
+#define AWAKE_BUDGET_MS		(S96AT_WATCHDOG_TIME / 2)
+
+#define DEFAULT_ITERATIONS	100
+#define DEFAULT_WARMUP		10
+#define DEFAULT_READ_SLOT	12
+#define DEFAULT_OTP_WORD	8
+#define DEFAULT_LATE_MS		50
+
+#define MAX_SHA_LEN		1024
+
+struct bench {
+	const char *name;
+	size_t len;		/* message or transfer size, 0 if fixed */
+	bool writes;		/* wears the EEPROM, only run when asked to */
+	uint8_t (*setup)(struct bench *b);	/* untimed, before each run */
+	uint8_t (*run)(struct bench *b);
+};
+
+struct result {
+	unsigned int ok;
+	unsigned int errors;
+	uint8_t last_error;
+	uint64_t total_ns;
+	uint64_t *samples;	/* successful runs only */
+};
+
+static struct s96at_desc desc;
+static uint64_t awake_since;
+
+static uint8_t read_slot = DEFAULT_READ_SLOT;
+static int write_slot = -1;
+static uint8_t write_buf[S96AT_KEY_LEN];
+
+static const uint8_t challenge[S96AT_CHALLENGE_LEN] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+
+static uint8_t mac[S96AT_MAC_LEN];
+static uint8_t sha_buf[MAX_SHA_LEN + 2 * SHA_BLOCK_LEN];
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d path[@addr]  I2C bus and device address (default %s@0x%02x)\n"
+		"  -e id           use an emulated device with the given id,\n"
+		"                  personalized like the test device\n"
+		"  -n count        timed iterations per benchmark (default %d)\n"
+		"  -w count        untimed warm-up iterations (default %d)\n"
+		"  -f name         only run benchmarks whose name contains name\n"
+		"  -s slot         Data slot used by the read benchmarks\n"
+		"                  (default %d)\n"
+		"  -W slot         also benchmark 32-byte writes by rewriting\n"
+		"                  the current contents of slot\n"
+		"  -o path         write the JSON report to path instead of\n"
+		"                  stdout\n"
+		"  -F script       inject faults as listed in script, ie\n"
+		"                  \"crc@3,wake@1\"\n"
+		"  -r ppm          inject each kind of fault into ppm in a\n"
+		"                  million eligible calls\n"
+		"  -S seed         seed of the random faults (default 1)\n"
+		"  -L ms           delay of late responses (default %d)\n"
+		"  -l              list the benchmarks and exit\n",
+		prog, I2C_DEVICE, ATSHA204A_ADDR, DEFAULT_ITERATIONS,
+		DEFAULT_WARMUP, DEFAULT_READ_SLOT, DEFAULT_LATE_MS);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint8_t wake(void)
+{
+	int retries = WAKE_RETRIES;
+	uint8_t ret;
+
+	do {
+		ret = s96at_wake(&desc);
+	} while (ret != S96AT_STATUS_READY && --retries);
+
+	awake_since = now_ns();
+
+	return ret == S96AT_STATUS_READY ? S96AT_STATUS_OK : ret;
+}
+
+/* Idle keeps TempKey, so a setup step survives the cycle */
+static uint8_t keep_awake(void)
+{
+	if ((now_ns() - awake_since) / 1000000 < AWAKE_BUDGET_MS)
+		return S96AT_STATUS_OK;
+
+	s96at_idle(&desc);
+
+	return wake();
+}
+
+static uint8_t load_challenge(struct bench *b)
+{
+	return s96at_gen_nonce(&desc, S96AT_NONCE_MODE_PASSTHROUGH,
+			       (uint8_t *)challenge, NULL);
+}
+
+static uint8_t load_mac(struct bench *b)
+{
+	uint8_t ret;
+
+	ret = load_challenge(b);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	return s96at_get_mac(&desc, S96AT_MAC_MODE_0, 0, challenge,
+			     S96AT_FLAG_TEMPKEY_SOURCE_INPUT, mac);
+}
+
+static uint8_t run_wake_idle(struct bench *b)
+{
+	uint8_t ret;
+
+	ret = s96at_idle(&desc);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	return wake();
+}
+
+static uint8_t run_random(struct bench *b)
+{
+	uint8_t buf[S96AT_RANDOM_LEN];
+
+	return s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_NO_SEED, buf);
+}
+
+static uint8_t run_nonce(struct bench *b)
+{
+	uint8_t in[S96AT_NONCE_INPUT_LEN] = { 0 };
+	uint8_t random[S96AT_RANDOM_LEN];
+
+	return s96at_gen_nonce(&desc, S96AT_NONCE_MODE_RANDOM_NO_SEED, in,
+			       random);
+}
+
+static uint8_t run_mac(struct bench *b)
+{
+	uint8_t buf[S96AT_MAC_LEN];
+
+	return s96at_get_mac(&desc, S96AT_MAC_MODE_0, 0, challenge,
+			     S96AT_FLAG_TEMPKEY_SOURCE_INPUT, buf);
+}
+
+static uint8_t run_hmac(struct bench *b)
+{
+	uint8_t buf[S96AT_HMAC_LEN];
+
+	return s96at_get_hmac(&desc, 0, S96AT_FLAG_TEMPKEY_SOURCE_INPUT, buf);
+}
+
+static uint8_t run_check_mac(struct bench *b)
+{
+	struct s96at_check_mac_data data = {
+		.challenge = challenge,
+		.slot = 0,
+		.flags = S96AT_FLAG_TEMPKEY_SOURCE_INPUT,
+	};
+
+	return s96at_check_mac(&desc, S96AT_MAC_MODE_0, 0,
+			       S96AT_FLAG_TEMPKEY_SOURCE_INPUT, &data, mac);
+}
+
+static uint8_t run_sha(struct bench *b)
+{
+	uint8_t hash[S96AT_SHA_LEN];
+	size_t buf_len;
+
+	/* Room for the 0x80 marker and the 64-bit length */
+	buf_len = (b->len + 9 + SHA_BLOCK_LEN - 1) / SHA_BLOCK_LEN * SHA_BLOCK_LEN;
+	memset(sha_buf, 0x5a, b->len);
+
+	return s96at_get_sha(&desc, sha_buf, buf_len, b->len, hash);
+}
+
+static uint8_t run_read_config(struct bench *b)
+{
+	uint8_t buf[32];
+
+	return s96at_read_config(&desc, 0, buf, b->len);
+}
+
+static uint8_t run_read_data(struct bench *b)
+{
+	uint8_t buf[32];
+
+	return s96at_read_data(&desc, read_slot, 0, S96AT_FLAG_NONE, buf,
+			       b->len);
+}
+
+static uint8_t run_read_otp(struct bench *b)
+{
+	uint8_t buf[4];
+
+	return s96at_read_otp(&desc, DEFAULT_OTP_WORD, buf);
+}
+
+static uint8_t run_write_data(struct bench *b)
+{
+	return s96at_write_data(&desc, write_slot, 0, S96AT_FLAG_NONE,
+				write_buf, sizeof(write_buf));
+}
+
+static struct bench benches[] = {
+	{"wake_idle", 0, false, NULL, run_wake_idle},
+	{"random", S96AT_RANDOM_LEN, false, NULL, run_random},
+	{"nonce_random", S96AT_RANDOM_LEN, false, NULL, run_nonce},
+	{"mac", S96AT_MAC_LEN, false, load_challenge, run_mac},
+	{"hmac", S96AT_HMAC_LEN, false, load_challenge, run_hmac},
+	{"check_mac", S96AT_MAC_LEN, false, load_mac, run_check_mac},
+	{"sha_32", 32, false, NULL, run_sha},
+	{"sha_64", 64, false, NULL, run_sha},
+	{"sha_256", 256, false, NULL, run_sha},
+	{"sha_1024", 1024, false, NULL, run_sha},
+	{"read_config_4", 4, false, NULL, run_read_config},
+	{"read_config_32", 32, false, NULL, run_read_config},
+	{"read_data_4", 4, false, NULL, run_read_data},
+	{"read_data_32", 32, false, NULL, run_read_data},
+	{"read_otp_4", 4, false, NULL, run_read_otp},
+	{"write_data_32", 32, true, NULL, run_write_data},
+};
+
+#define NUM_BENCHES	(sizeof(benches) / sizeof(benches[0]))
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of sorted samples, in microseconds */
+static double percentile_us(const uint64_t *s, unsigned int n, double pct)
+{
+	unsigned int rank;
+
+	if (!n)
+		return 0;
+
+	rank = (unsigned int)ceil(pct / 100 * n);
+	if (rank)
+		rank--;
+	if (rank >= n)
+		rank = n - 1;
+
+	return s[rank] / 1000.0;
+}
+
+static uint8_t run_bench(struct bench *b, unsigned int warmup,
+			 unsigned int iterations, struct result *r)
+{
+	unsigned int i;
+	uint64_t start;
+	uint64_t t = 0;
+	uint8_t ret;
+
+	memset(r, 0, sizeof(*r));
+	r->samples = calloc(iterations ? iterations : 1, sizeof(*r->samples));
+	if (!r->samples)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	for (i = 0; i < warmup + iterations; i++) {
+		ret = keep_awake();
+		if (ret == S96AT_STATUS_OK && b->setup)
+			ret = b->setup(b);
+		if (ret == S96AT_STATUS_OK) {
+			start = now_ns();
+			ret = b->run(b);
+			t = now_ns() - start;
+		}
+
+		if (i < warmup)
+			continue;
+
+		if (ret != S96AT_STATUS_OK) {
+			r->errors++;
+			r->last_error = ret;
+			/* Start the next run from a known state */
+			s96at_idle(&desc);
+			wake();
+			continue;
+		}
+
+		r->samples[r->ok++] = t;
+		r->total_ns += t;
+	}
+
+	qsort(r->samples, r->ok, sizeof(*r->samples), cmp_u64);
+
+	return S96AT_STATUS_OK;
+}
+
+static const char *fault_names[S96AT_FAULT_NUM] = {
+	[S96AT_FAULT_CRC] = "crc",
+	[S96AT_FAULT_NACK] = "nack",
+	[S96AT_FAULT_ERROR] = "error",
+	[S96AT_FAULT_LATE] = "late",
+	[S96AT_FAULT_SLEEP] = "sleep",
+	[S96AT_FAULT_WAKE] = "wake",
+	[S96AT_FAULT_WOKEN] = "woken",
+};
+
+static void print_faults(FILE *f, const struct s96at_fault_report *r)
+{
+	const struct s96at_histogram *h;
+	int i;
+
+	fprintf(f, "  \"faults\": [\n");
+	for (i = 0; i < S96AT_FAULT_NUM; i++) {
+		h = &r->recovery[i];
+		fprintf(f, "    {\n");
+		fprintf(f, "      \"name\": \"%s\",\n", fault_names[i]);
+		fprintf(f, "      \"injected\": %llu,\n",
+			(unsigned long long)r->injected[i]);
+		fprintf(f, "      \"recovered\": %llu,\n",
+			(unsigned long long)r->recovered[i]);
+		fprintf(f, "      \"recovery_us\": {\n");
+		fprintf(f, "        \"mean\": %.3f,\n",
+			h->count ? (double)h->sum_us / h->count : 0.0);
+		fprintf(f, "        \"p50\": %llu,\n",
+			(unsigned long long)s96at_stats_percentile(h, 50));
+		fprintf(f, "        \"p99\": %llu,\n",
+			(unsigned long long)s96at_stats_percentile(h, 99));
+		fprintf(f, "        \"max\": %llu\n",
+			(unsigned long long)s96at_stats_percentile(h, 100));
+		fprintf(f, "      }\n");
+		fprintf(f, "    }%s\n", i == S96AT_FAULT_NUM - 1 ? "" : ",");
+	}
+	fprintf(f, "  ],\n");
+}
+
+static void print_result(FILE *f, const struct bench *b,
+			 const struct result *r, bool last)
+{
+	double mean = 0;
+	double var = 0;
+	double d;
+	unsigned int i;
+
+	if (r->ok) {
+		mean = (double)r->total_ns / r->ok;
+		for (i = 0; i < r->ok; i++) {
+			d = r->samples[i] - mean;
+			var += d * d;
+		}
+		var /= r->ok;
+	}
+
+	fprintf(f, "    {\n");
+	fprintf(f, "      \"name\": \"%s\",\n", b->name);
+	fprintf(f, "      \"bytes\": %zu,\n", b->len);
+	fprintf(f, "      \"iterations\": %u,\n", r->ok + r->errors);
+	fprintf(f, "      \"errors\": %u,\n", r->errors);
+	fprintf(f, "      \"last_error\": %u,\n", r->last_error);
+	fprintf(f, "      \"ops_per_sec\": %.3f,\n",
+		r->total_ns ? r->ok * 1e9 / r->total_ns : 0.0);
+	fprintf(f, "      \"latency_us\": {\n");
+	fprintf(f, "        \"min\": %.3f,\n", r->ok ? r->samples[0] / 1000.0 : 0.0);
+	fprintf(f, "        \"mean\": %.3f,\n", mean / 1000);
+	fprintf(f, "        \"stddev\": %.3f,\n", sqrt(var) / 1000);
+	fprintf(f, "        \"p50\": %.3f,\n", percentile_us(r->samples, r->ok, 50));
+	fprintf(f, "        \"p90\": %.3f,\n", percentile_us(r->samples, r->ok, 90));
+	fprintf(f, "        \"p99\": %.3f,\n", percentile_us(r->samples, r->ok, 99));
+	fprintf(f, "        \"max\": %.3f\n",
+		r->ok ? r->samples[r->ok - 1] / 1000.0 : 0.0);
+	fprintf(f, "      }\n");
+	fprintf(f, "    }%s\n", last ? "" : ",");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	const char *out_path = NULL;
+	const char *filter = NULL;
+	char device[80];
+	char *at;
+	long addr = ATSHA204A_ADDR;
+	long emu_id = -1;
+	unsigned int iterations = DEFAULT_ITERATIONS;
+	unsigned int warmup = DEFAULT_WARMUP;
+	unsigned int i;
+	unsigned int num_run = 0;
+	bool run[NUM_BENCHES];
+	bool faults = false;
+	struct s96at_fault_config fault_cfg = {
+		.seed = 1,
+		.late_ms = DEFAULT_LATE_MS,
+	};
+	struct s96at_fault_report fault_report;
+	struct result *results;
+	FILE *out = stdout;
+	uint8_t ret;
+	int opt;
+	int status = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "d:e:n:w:f:s:W:o:F:r:S:L:lh")) != -1) {
+		switch (opt) {
+		case 'd':
+			path = optarg;
+			at = strchr(optarg, '@');
+			if (at) {
+				*at = '\0';
+				addr = strtol(at + 1, NULL, 0);
+			}
+			break;
+		case 'e':
+			emu_id = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			warmup = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 's':
+			read_slot = strtoul(optarg, NULL, 0);
+			break;
+		case 'W':
+			write_slot = strtol(optarg, NULL, 0);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'F':
+			fault_cfg.script = optarg;
+			faults = true;
+			break;
+		case 'r':
+			for (i = 0; i < S96AT_FAULT_NUM; i++)
+				fault_cfg.ppm[i] = strtoul(optarg, NULL, 0);
+			faults = true;
+			break;
+		case 'S':
+			fault_cfg.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			fault_cfg.late_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			for (i = 0; i < NUM_BENCHES; i++)
+				printf("%s\n", benches[i].name);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!iterations || addr < 0 || addr > 0x7f || read_slot > 15 ||
+	    write_slot > 15) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < NUM_BENCHES; i++) {
+		run[i] = (!benches[i].writes || write_slot >= 0) &&
+			 (!filter || strstr(benches[i].name, filter));
+		num_run += run[i];
+	}
+
+	if (!num_run) {
+		fprintf(stderr, "No benchmark matches %s\n", filter);
+		return EXIT_FAILURE;
+	}
+
+	if (emu_id >= 0) {
+		snprintf(device, sizeof(device), "emulator:%ld", emu_id);
+		ret = s96at_init_emulator(S96AT_ATSHA204A, emu_id, &desc);
+	} else if (path) {
+		snprintf(device, sizeof(device), "%s@0x%02lx", path, addr);
+		ret = s96at_init_i2c(S96AT_ATSHA204A, path, addr, &desc);
+	} else {
+		snprintf(device, sizeof(device), "%s@0x%02x", I2C_DEVICE,
+			 ATSHA204A_ADDR);
+		ret = s96at_init(S96AT_ATSHA204A, S96AT_IO_I2C_LINUX, &desc);
+	}
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize %s\n", device);
+		return EXIT_FAILURE;
+	}
+
+	results = calloc(NUM_BENCHES, sizeof(*results));
+	if (!results)
+		goto out;
+
+	/* Emulated devices get the personalization of the test device */
+	if (emu_id >= 0 && atsha204a_personalize(desc.ioif) != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not personalize %s\n", device);
+		goto out;
+	}
+
+	if (wake() != S96AT_STATUS_OK) {
+		fprintf(stderr, "%s does not wake up\n", device);
+		goto out;
+	}
+
+	/* Rewrite what is already there, so the benchmark leaves no trace */
+	if (write_slot >= 0 && run[NUM_BENCHES - 1]) {
+		ret = s96at_read_data(&desc, write_slot, 0, S96AT_FLAG_NONE,
+				      write_buf, sizeof(write_buf));
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Could not read slot %d\n", write_slot);
+			goto out;
+		}
+	}
+
+	/* Faults only hit the benchmarks, not the setup above */
+	if (faults && s96at_fault_attach(&desc, &fault_cfg) != S96AT_STATUS_OK) {
+		fprintf(stderr, "Invalid fault script %s\n", fault_cfg.script);
+		goto out;
+	}
+
+	for (i = 0; i < NUM_BENCHES; i++) {
+		if (!run[i])
+			continue;
+		fprintf(stderr, "%s\n", benches[i].name);
+		if (run_bench(&benches[i], warmup, iterations, &results[i]))
+			goto out;
+	}
+
+	s96at_idle(&desc);
+
+	if (faults)
+		s96at_fault_report(&desc, &fault_report);
+
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (!out) {
+			fprintf(stderr, "Could not open %s\n", out_path);
+			out = stdout;
+			goto out;
+		}
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"library\": \"s96at\",\n");
+	fprintf(out, "  \"version\": \"%s\",\n", S96AT_VERSION);
+	fprintf(out, "  \"device\": \"%s\",\n", device);
+	fprintf(out, "  \"emulated\": %s,\n", emu_id >= 0 ? "true" : "false");
+	fprintf(out, "  \"timestamp\": %lld,\n", (long long)time(NULL));
+	fprintf(out, "  \"warmup\": %u,\n", warmup);
+	fprintf(out, "  \"iterations\": %u,\n", iterations);
+	if (faults) {
+		fprintf(out, "  \"fault_seed\": %u,\n", fault_cfg.seed);
+		print_faults(out, &fault_report);
+	}
+	fprintf(out, "  \"benchmarks\": [\n");
+	for (i = 0; i < NUM_BENCHES; i++) {
+		if (!run[i])
+			continue;
+		print_result(out, &benches[i], &results[i], !--num_run);
+	}
+	fprintf(out, "  ]\n");
+	fprintf(out, "}\n");
+
+	status = EXIT_SUCCESS;
+out:
+	if (out != stdout && fclose(out))
+		status = EXIT_FAILURE;
+	if (results) {
+		for (i = 0; i < NUM_BENCHES; i++)
+			free(results[i].samples);
+		free(results);
+	}
+	s96at_cleanup(&desc);
+
+	return status;
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cmd.h>
+#include <crc.h>
+#include <io.h>
+#include <mac.h>
+#include <packet.h>
+#include <s96at.h>
+#include <sha.h>
+#include <status.h>
+
+/*
+ * Host-side costs of the library, without a device. Each kernel runs in
+ * repetitions of at least min_ms; the per operation time and allocations
+ * are reported over the repetitions. Allocations are counted by wrapping
+ * malloc(), calloc() and realloc() at link time.
+ */
+#define DEFAULT_REPETITIONS	15
+#define DEFAULT_MIN_MS		20
+
+#define MAX_REPETITIONS		1000
+
+struct kernel {
+	const char *name;
+	size_t len;
+	void (*run)(const struct kernel *k);
+};
+
+static uint64_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __real_realloc(ptr, size);
+}
+
+/* Results end up here, so that the compiler keeps the work */
+static volatile uint32_t sink;
+
+static uint8_t buf[1024];
+static uint8_t data[77];
+
+/*
+ * An io interface that accepts every write and answers every read with a
+ * valid all-zero response of the expected size, right away.
+ */
+struct noop_ctx {
+	size_t size;
+	uint8_t resp[1 + 32 + CRC_LEN];
+};
+
+static uint32_t noop_open(void *ctx)
+{
+	return STATUS_OK;
+}
+
+static size_t noop_write(void *ctx, const void *buf, size_t size)
+{
+	return size;
+}
+
+static size_t noop_read(void *ctx, void *buf, size_t size)
+{
+	struct noop_ctx *c = ctx;
+	uint16_t crc;
+
+	if (size > sizeof(c->resp))
+		return 0;
+
+	if (size != c->size) {
+		memset(c->resp, 0, sizeof(c->resp));
+		c->resp[0] = size;
+		crc = calculate_crc16(c->resp, size - CRC_LEN, 0);
+		c->resp[size - 2] = crc & 0xff;
+		c->resp[size - 1] = crc >> 8;
+		c->size = size;
+	}
+
+	memcpy(buf, c->resp, size);
+
+	return size;
+}
+
+static uint32_t noop_close(void *ctx)
+{
+	return STATUS_OK;
+}
+
+static uint32_t noop_wake(void *ctx)
+{
+	return STATUS_OK;
+}
+
+static void noop_wait(void *ctx, uint32_t ms)
+{
+}
+
+static struct noop_ctx noop_ctx;
+
+static struct io_interface noop = {
+	.ctx = &noop_ctx,
+	.open = noop_open,
+	.write = noop_write,
+	.read = noop_read,
+	.close = noop_close,
+	.wake = noop_wake,
+	.wait = noop_wait,
+};
+
+static struct s96at_desc desc = {
+	.ioif = &noop,
+};
+
+static void run_crc(const struct kernel *k)
+{
+	sink += calculate_crc16(buf, k->len, 0);
+}
+
+static void run_serialize(const struct kernel *k)
+{
+	struct cmd_packet p;
+	uint8_t pkt[PKT_MAX_SIZE];
+
+	get_command(&p, k->len ? OPCODE_CHECKMAC : OPCODE_RANDOM);
+	p.data = data;
+	p.data_length = k->len;
+
+	sink += serialize(&p, pkt, sizeof(pkt));
+	sink += pkt[1];
+}
+
+static void run_packet_size(const struct kernel *k)
+{
+	struct cmd_packet p;
+
+	get_command(&p, OPCODE_CHECKMAC);
+	p.data_length = k->len;
+
+	sink += get_total_packet_size(&p);
+}
+
+static void run_sha_padding(const struct kernel *k)
+{
+	size_t padded;
+
+	sha_apply_padding(buf, sizeof(buf), k->len, &padded);
+	sink += padded;
+}
+
+static void run_check_mac_data(const struct kernel *k)
+{
+	uint8_t out[CHECK_MAC_DATA_LEN];
+
+	mac_check_mac_data(out, data, data + 32, S96AT_MAC_MODE_0, 0, NULL,
+			   NULL);
+	sink += out[64];
+}
+
+static void run_msg(const struct kernel *k)
+{
+	struct cmd_packet p;
+	uint8_t resp[32];
+
+	get_command(&p, k->len == 32 ? OPCODE_RANDOM : OPCODE_CHECKMAC);
+	p.data = data;
+	p.data_length = k->len == 32 ? 0 : sizeof(data);
+
+	sink += at204_msg(&noop, &p, resp, k->len);
+}
+
+static void run_check_mac(const struct kernel *k)
+{
+	struct s96at_check_mac_data cmd = {
+		.challenge = data,
+		.slot = 0,
+		.flags = S96AT_FLAG_TEMPKEY_SOURCE_INPUT,
+	};
+
+	sink += s96at_check_mac(&desc, S96AT_MAC_MODE_0, 0,
+				S96AT_FLAG_TEMPKEY_SOURCE_INPUT, &cmd,
+				data + 32);
+}
+
+static const struct kernel kernels[] = {
+	{"crc16_7", 7, run_crc},
+	{"crc16_35", 35, run_crc},
+	{"crc16_82", 82, run_crc},
+	{"crc16_512", 512, run_crc},
+	{"serialize_random", 0, run_serialize},
+	{"serialize_check_mac", 77, run_serialize},
+	{"packet_size", 77, run_packet_size},
+	{"sha_padding_32", 32, run_sha_padding},
+	{"sha_padding_64", 64, run_sha_padding},
+	{"sha_padding_256", 256, run_sha_padding},
+	{"check_mac_data", 77, run_check_mac_data},
+	{"msg_random", 32, run_msg},
+	{"msg_check_mac", 1, run_msg},
+	{"check_mac", 77, run_check_mac},
+};
+
+#define NUM_KERNELS	(sizeof(kernels) / sizeof(kernels[0]))
+
+struct result {
+	uint64_t ops;		/* per repetition */
+	double ns[MAX_REPETITIONS];
+	double allocs;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double median(const double *v, unsigned int n)
+{
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static uint64_t run_ops(const struct kernel *k, uint64_t ops)
+{
+	uint64_t i;
+	uint64_t start = now_ns();
+
+	for (i = 0; i < ops; i++)
+		k->run(k);
+
+	return now_ns() - start;
+}
+
+static void run_kernel(const struct kernel *k, unsigned int reps,
+		       unsigned int min_ms, struct result *r)
+{
+	unsigned int i;
+	uint64_t start_allocs;
+
+	/* Double the batch until it takes long enough to time reliably */
+	r->ops = 1;
+	while (run_ops(k, r->ops) < min_ms * 1000000ULL)
+		r->ops *= 2;
+
+	start_allocs = allocs;
+	for (i = 0; i < reps; i++)
+		r->ns[i] = (double)run_ops(k, r->ops) / r->ops;
+	r->allocs = (double)(allocs - start_allocs) / (r->ops * reps);
+
+	qsort(r->ns, reps, sizeof(r->ns[0]), cmp_double);
+}
+
+static void print_result(FILE *f, const struct kernel *k,
+			 const struct result *r, unsigned int reps, bool last)
+{
+	double dev[MAX_REPETITIONS];
+	double med = median(r->ns, reps);
+	unsigned int i;
+
+	/* Median absolute deviation, robust against the odd preemption */
+	for (i = 0; i < reps; i++)
+		dev[i] = r->ns[i] > med ? r->ns[i] - med : med - r->ns[i];
+	qsort(dev, reps, sizeof(dev[0]), cmp_double);
+
+	fprintf(f, "    {\n");
+	fprintf(f, "      \"name\": \"%s\",\n", k->name);
+	fprintf(f, "      \"bytes\": %zu,\n", k->len);
+	fprintf(f, "      \"ops_per_repetition\": %llu,\n",
+		(unsigned long long)r->ops);
+	fprintf(f, "      \"allocs_per_op\": %.3f,\n", r->allocs);
+	fprintf(f, "      \"ns_per_op\": {\n");
+	fprintf(f, "        \"min\": %.3f,\n", r->ns[0]);
+	fprintf(f, "        \"median\": %.3f,\n", med);
+	fprintf(f, "        \"mad\": %.3f,\n", median(dev, reps));
+	fprintf(f, "        \"max\": %.3f\n", r->ns[reps - 1]);
+	fprintf(f, "      }\n");
+	fprintf(f, "    }%s\n", last ? "" : ",");
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -r count        repetitions per kernel (default %d)\n"
+		"  -t ms           minimum time of a repetition (default %d)\n"
+		"  -f name         only run kernels whose name contains name\n"
+		"  -o path         write the JSON report to path instead of\n"
+		"                  stdout\n"
+		"  -l              list the kernels and exit\n",
+		prog, DEFAULT_REPETITIONS, DEFAULT_MIN_MS);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *out_path = NULL;
+	const char *filter = NULL;
+	unsigned int reps = DEFAULT_REPETITIONS;
+	unsigned int min_ms = DEFAULT_MIN_MS;
+	unsigned int i;
+	unsigned int num_run = 0;
+	bool run[NUM_KERNELS];
+	struct result *results;
+	FILE *out = stdout;
+	int opt;
+	int status = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "r:t:f:o:lh")) != -1) {
+		switch (opt) {
+		case 'r':
+			reps = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			min_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'l':
+			for (i = 0; i < NUM_KERNELS; i++)
+				printf("%s\n", kernels[i].name);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!reps || reps > MAX_REPETITIONS) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < NUM_KERNELS; i++) {
+		run[i] = !filter || strstr(kernels[i].name, filter);
+		num_run += run[i];
+	}
+
+	if (!num_run) {
+		fprintf(stderr, "No kernel matches %s\n", filter);
+		return EXIT_FAILURE;
+	}
+
+	results = calloc(NUM_KERNELS, sizeof(*results));
+	if (!results)
+		return EXIT_FAILURE;
+
+	memset(buf, 0x5a, sizeof(buf));
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i;
+
+	for (i = 0; i < NUM_KERNELS; i++) {
+		if (!run[i])
+			continue;
+		fprintf(stderr, "%s\n", kernels[i].name);
+		run_kernel(&kernels[i], reps, min_ms, &results[i]);
+	}
+
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (!out) {
+			fprintf(stderr, "Could not open %s\n", out_path);
+			out = stdout;
+			goto out;
+		}
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"library\": \"s96at\",\n");
+	fprintf(out, "  \"version\": \"%s\",\n", S96AT_VERSION);
+	fprintf(out, "  \"timestamp\": %lld,\n", (long long)time(NULL));
+	fprintf(out, "  \"repetitions\": %u,\n", reps);
+	fprintf(out, "  \"min_ms\": %u,\n", min_ms);
+	fprintf(out, "  \"kernels\": [\n");
+	for (i = 0; i < NUM_KERNELS; i++) {
+		if (!run[i])
+			continue;
+		print_result(out, &kernels[i], &results[i], reps, !--num_run);
+	}
+	fprintf(out, "  ]\n");
+	fprintf(out, "}\n");
+
+	status = EXIT_SUCCESS;
+out:
+	if (out != stdout && fclose(out))
+		status = EXIT_FAILURE;
+	free(results);
+
+	return status;
+}
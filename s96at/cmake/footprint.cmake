@@ -0,0 +1,37 @@
+# Reports the code and RAM footprint of the freestanding library, and fails
+# the build if it pulls in the heap, stdio or the clock of the C library.
+#
+#   cmake -DLIB=libs96at.a -DNM=nm -DSIZE=size -P footprint.cmake
+
+execute_process(COMMAND ${SIZE} -t ${LIB} OUTPUT_VARIABLE out RESULT_VARIABLE res)
+if(res)
+	message(FATAL_ERROR "${SIZE} ${LIB} failed")
+endif()
+
+# text data bss dec hex (TOTALS)
+string(REGEX MATCH "([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)[ \t]+[0-9]+[ \t]+[0-9a-f]+[ \t]+\\(TOTALS\\)"
+       totals "${out}")
+if(NOT totals)
+	message(FATAL_ERROR "No totals in the output of ${SIZE}")
+endif()
+
+set(text ${CMAKE_MATCH_1})
+set(data ${CMAKE_MATCH_2})
+set(bss ${CMAKE_MATCH_3})
+math(EXPR ram "${data} + ${bss}")
+
+message("s96at footprint: ${text} bytes of code and constants, "
+	"${ram} bytes of RAM (${data} data, ${bss} bss)")
+
+execute_process(COMMAND ${NM} -u ${LIB} OUTPUT_VARIABLE out RESULT_VARIABLE res)
+if(res)
+	message(FATAL_ERROR "${NM} ${LIB} failed")
+endif()
+
+string(REGEX MATCHALL "U (malloc|calloc|realloc|free|printf|fprintf|vfprintf|sprintf|snprintf|vsnprintf|puts|fputs|putchar|fwrite|perror|stdout|stderr|__assert_fail|__assert_func|clock_gettime|gettimeofday|time|usleep|nanosleep|sleep)\n"
+       bad "${out}")
+if(bad)
+	string(REGEX REPLACE "U ([^\n]+)\n" "\\1" bad "${bad}")
+	string(REPLACE ";" ", " bad "${bad}")
+	message(FATAL_ERROR "The freestanding library uses ${bad}")
+endif()
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <io.h>
+#include <packet.h>
+#include <s96at.h>
+
+/* Keep a safety margin of the watchdog budget for wake, idle and I2C */
+#define BATCH_WATCHDOG_MARGIN_PCT	10
+
+/* Time to transfer a command and its response, rounded up */
+#define BATCH_IO_TIME			1 /* msec */
+
+/*
+ * Returns true if the worst case execution time of the commands, including
+ * a safety margin, fits in a single watchdog window.
+ */
+bool batch_fits(const struct s96at_batch_cmd *cmds, size_t num);
+
+/* Returns true if the opcode of cmd is known and its buffers fit a packet */
+bool batch_valid(const struct s96at_batch_cmd *cmd);
+
+/* Fills in the packet of cmd, max_time included */
+void batch_packet(struct cmd_packet *p, const struct s96at_batch_cmd *cmd);
+
+/*
+ * Reads the response of cmd, sent as p, into cmd->out, or the status byte
+ * if there is no out buffer. Returns the status of the command.
+ */
+uint8_t batch_recv(struct io_interface *ioif, struct cmd_packet *p,
+		   struct s96at_batch_cmd *cmd);
+
+#endif
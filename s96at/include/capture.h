@@ -0,0 +1,17 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#include <io.h>
+#include <s96at.h>
+
+/*
+ * Allocate an IO interface that plays back the capture file at path, see
+ * s96at_record_start(). The interface is freed through its release hook.
+ */
+struct io_interface *replay_create(const char *path,
+				   enum s96at_replay_mode mode);
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <s96at.h>
+
+/*
+ * Time as seen by the io layer, the TempKey watchdog and the emulator. A
+ * NULL clock is the monotonic clock of the host and sleeps for real, see
+ * s96at_set_clock() for the others. Freestanding builds take the NULL clock
+ * from the target, see s96at_platform_now_us().
+ */
+uint64_t clock_now_us(const struct s96at_clock *clock);
+void clock_sleep_us(const struct s96at_clock *clock, uint64_t us);
+
+/* Whether there is any time at all, only ever false in freestanding builds */
+bool clock_available(const struct s96at_clock *clock);
+
+#endif
@@ -72,6 +72,28 @@ enum {
 #define OPCODE_UPDATEEXTRA	0x20
 #define OPCODE_WRITE		0x12
 
+/*
+ * Commands built into the library, all of them unless the build picks a
+ * subset, see S96AT_COMMANDS in CMakeLists.txt. The functions that issue a
+ * command left out are left out as well.
+ */
+#ifndef S96AT_SUBSET
+#define S96AT_CMD_CHECKMAC
+#define S96AT_CMD_DERIVEKEY
+#define S96AT_CMD_DEVREV
+#define S96AT_CMD_GENDIG
+#define S96AT_CMD_HMAC
+#define S96AT_CMD_LOCK
+#define S96AT_CMD_MAC
+#define S96AT_CMD_NONCE
+#define S96AT_CMD_PAUSE
+#define S96AT_CMD_RANDOM
+#define S96AT_CMD_READ
+#define S96AT_CMD_SHA
+#define S96AT_CMD_UPDATEEXTRA
+#define S96AT_CMD_WRITE
+#endif
+
 /* Addresses etc for the configuration zone. */
 #define OTP_CONFIG_ADDR		0x4
 #define OTP_CONFIG_OFFSET	0x2
@@ -111,6 +133,24 @@ uint8_t SLOT_CONFIG_ADDR(uint8_t slotnbr);
 
 #define OTP_ADDR(addr) (4 * addr)
 
+struct cmd_packet;
+
+/*
+ * Initializes a command packet for opcode, including the maximum execution
+ * time of the command. Returns STATUS_EXEC_ERROR if the opcode is not known,
+ * the packet then has a max_time of 0.
+ */
+uint8_t get_command(struct cmd_packet *p, uint8_t opcode);
+
+/*
+ * Sends an arbitrary command and reads back out_size bytes of response. For
+ * commands that only return a status, out_size is 1 and out holds the status
+ * byte reported by the device.
+ */
+uint8_t cmd_exec(struct io_interface *ioif, uint8_t opcode, uint8_t param1,
+		 uint16_t param2, const uint8_t *in, size_t in_size,
+		 uint8_t *out, size_t out_size);
+
 uint8_t cmd_read(struct io_interface *ioif, uint8_t zone, uint8_t addr,
 		 uint8_t offset, size_t size, void *data, size_t data_size);
 
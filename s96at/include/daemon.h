@@ -0,0 +1,146 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __DAEMON_H
+#define __DAEMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <io.h>
+#include <tempkey.h>
+
+/*
+ * s96atd owns the devices and runs the io calls of its clients on them. A
+ * client talks to it through a remote io interface, see remote_create(),
+ * so that every s96at_* function works the same through the daemon.
+ *
+ * A session starts with the first call of a client and ends when the
+ * client puts the device to idle or sleep, or disconnects. A device serves
+ * one session at a time, which keeps the TempKey of a client to itself for
+ * as long as the device is awake.
+ *
+ * A new session goes to the waiting client of the most urgent priority
+ * class, see s96at_set_priority(), and within a class to the one that has
+ * used the least device time for its weight. A critical client does not
+ * wait for the session of a less urgent one to end: the session is put
+ * aside between two of its calls, with the device in idle so that TempKey
+ * and the SHA context survive, and it goes on once the critical session is
+ * over.
+ *
+ * Messages go over a SOCK_SEQPACKET Unix socket, one call per message, or
+ * over a ring in memory shared with the daemon, see struct s96atd_ring.
+ */
+#define S96ATD_SOCKET			"/run/s96atd.sock"
+
+/* Large enough for the longest command packet */
+#define S96ATD_MAX_DATA			128
+
+#define S96ATD_RING_SLOTS		8
+
+enum s96atd_op {
+	S96ATD_WAKE,
+	/* A write that is not a command: reset, sleep or idle */
+	S96ATD_WRITE,
+	/* Command packet, wait for its execution and read the response */
+	S96ATD_XFER,
+	/* Switch to the ring passed along the message */
+	S96ATD_RING,
+	/* Priority class and weight of the client, in data[0] and data[1] */
+	S96ATD_PRIORITY,
+};
+
+/* Response flag: the session started on a device TempKey was lost on */
+#define S96ATD_FLAG_NEW_DEVICE		0x01
+
+struct s96atd_msg {
+	uint8_t op;
+	uint8_t flags;
+	/* Bytes in data */
+	uint16_t len;
+	/* XFER: bytes to read and msec to wait for the execution */
+	uint16_t read_len;
+	uint16_t wait_ms;
+	/* Response: return value of the call */
+	uint32_t ret;
+	uint8_t data[S96ATD_MAX_DATA];
+};
+
+#define S96ATD_MSG_HDR_LEN		offsetof(struct s96atd_msg, data)
+
+/*
+ * Single producer, single consumer rings of messages. Heads are advanced
+ * by the producer and tails by the consumer; the heads double as futexes
+ * the consumer sleeps on while its ring is empty.
+ */
+struct s96atd_ring {
+	uint32_t req_head;
+	uint32_t req_tail;
+	uint32_t resp_head;
+	uint32_t resp_tail;
+	/* Set by the daemon once it stops serving the ring */
+	uint32_t closed;
+	struct s96atd_msg req[S96ATD_RING_SLOTS];
+	struct s96atd_msg resp[S96ATD_RING_SLOTS];
+};
+
+struct s96atd_class_stats {
+	/* Calls queued right now, and the most there have been */
+	uint32_t depth;
+	uint32_t max_depth;
+	uint64_t calls;
+	/* Sessions of the class put aside for a critical one */
+	uint64_t preempted;
+	/* From the arrival of a call to the start of its execution */
+	struct s96at_histogram wait;
+};
+
+/* Sleeps while *futex is val, for at most ms msec */
+void ring_wait(uint32_t *futex, uint32_t val, uint32_t ms);
+void ring_wake(uint32_t *futex);
+
+struct server;
+
+/*
+ * Allocate a server listening on the Unix socket at path, running calls on
+ * the given io interfaces. The interfaces must be open and stay owned by
+ * the caller.
+ */
+struct server *server_create(const char *path, struct io_interface **ioifs,
+			     unsigned int num);
+
+/*
+ * Allow the clients running as uid, or with gid as their group, in the
+ * critical priority class; (uid_t)-1 and (gid_t)-1 match no one. Only the
+ * user of the server is allowed by default.
+ */
+void server_allow_critical(struct server *srv, uid_t uid, gid_t gid);
+
+/* Serve clients until server_stop(). Returns 0, or -1 on error. */
+int server_run(struct server *srv);
+
+/* Make server_run() return. Safe to call from a signal handler. */
+void server_stop(struct server *srv);
+
+void server_free(struct server *srv);
+
+/*
+ * Copy the statistics of each priority class, indexed by enum
+ * s96at_priority, to stats and reset them if reset is set. The current
+ * queue depths are never reset.
+ */
+void server_stats(struct server *srv, struct s96atd_class_stats *stats,
+		  bool reset);
+
+/*
+ * Allocate an IO interface that forwards its calls to the daemon listening
+ * at path, over a ring if ring is set. The TempKey shadow at tk is
+ * invalidated when a session starts on a device the client did not leave
+ * TempKey in. The interface is freed through its release hook.
+ */
+struct io_interface *remote_create(const char *path, bool ring,
+				   struct s96at_tempkey *tk);
+#endif
@@ -4,9 +4,15 @@
  */
 #ifndef __DEBUG_H
 #define __DEBUG_H
+#include <stdint.h>
+
+/* Freestanding builds have no stdio, messages are compiled out */
+#ifdef S96AT_FREESTANDING
+#undef DEBUG
+#else
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdint.h>
+#endif
 
 #ifndef EXT_DEBUG_INFO
 
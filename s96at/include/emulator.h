@@ -0,0 +1,38 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __EMULATOR_H
+#define __EMULATOR_H
+
+#include <stdint.h>
+
+#include <io.h>
+
+/*
+ * Allocate an IO interface backed by a software model of a factory fresh
+ * ATSHA204A. The serial number of the emulated device is derived from id.
+ * The interface is freed through its release hook.
+ */
+struct io_interface *emulator_create(uint32_t id);
+
+/*
+ * Set the time an emulated device takes to execute opcode. The device does
+ * not acknowledge its address until the time has passed. Defaults to the
+ * typical execution time of the datasheet.
+ */
+uint32_t emulator_set_exec_time(struct io_interface *ioif, uint8_t opcode,
+				uint32_t us);
+
+/*
+ * Set the watchdog period of an emulated device, after which it goes to
+ * sleep. Defaults to S96AT_WATCHDOG_TIME.
+ */
+uint32_t emulator_set_watchdog(struct io_interface *ioif, uint32_t ms);
+
+/*
+ * Put the emulated device of ioif on the bus of the one of other, so that a
+ * wake pulse on either of them wakes every device on the bus.
+ */
+uint32_t emulator_join(struct io_interface *ioif, struct io_interface *other);
+#endif
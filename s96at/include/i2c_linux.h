@@ -5,7 +5,20 @@
 #ifndef __I2C_LINUX_H
 #define __I2C_LINUX_H
 
+#include <stdint.h>
+
+#include <io.h>
+
 struct i2c_linux_ctx {
 	int fd;
+	const char *device;
+	uint8_t addr;
 };
+
+/*
+ * Allocate an IO interface that talks to the device at addr on the I2C bus
+ * exposed through the device node at path. The interface is freed through
+ * its release hook.
+ */
+struct io_interface *i2c_linux_create(const char *device, uint8_t addr);
 #endif
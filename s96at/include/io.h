@@ -4,12 +4,20 @@
  */
 #ifndef __IO_H
 #define __IO_H
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define IO_I2C_LINUX 0
 
 struct cmd_packet;
+struct io_stats;
+struct s96at_clock;
+struct s96at_retry_policy;
 
 /*
  * IO block, section 8.1
@@ -28,17 +36,43 @@ struct io_interface {
 	size_t (*read)(void *ctx, void *buf, size_t size);
 	uint32_t (*close)(void *ctx);
 	uint32_t (*wake)(void *ctx);
+	/* Optional, waits for the execution of a command instead of a sleep */
+	void (*wait)(void *ctx, uint32_t ms);
+	/* Optional, frees interfaces that were allocated at runtime */
+	void (*release)(struct io_interface *ioif);
+	/* Performance counters, NULL unless enabled */
+	struct io_stats *stats;
+	/* Retry policy of commands, NULL unless set */
+	struct s96at_retry_policy *retry;
+	/* Time of the waits and the retry backoff, NULL for the host's clock */
+	const struct s96at_clock *clock;
+	/* A retry or a command woke the device up, see tempkey_update() */
+	bool woken;
+	/* Interface wrapped by fault injection or recording, if any */
+	struct io_interface *inner;
 };
 
-uint32_t register_io_interface(uint8_t io_interface_type,
-			       struct io_interface **ioif);
-
 int at204_open(struct io_interface *ioif);
 int at204_write(struct io_interface *ioif, void *buf, size_t size);
 int at204_write2(struct io_interface *ioif, struct cmd_packet *p);
+/*
+ * at204_write2() and the read of the response are split in two for callers
+ * that do something else while the command executes: at204_send() writes
+ * the command and returns right away, at204_recv() reads the response once
+ * p->max_time has passed. Neither one retries.
+ */
+int at204_send(struct io_interface *ioif, struct cmd_packet *p);
+int at204_recv(struct io_interface *ioif, struct cmd_packet *p, void *resp_buf,
+	       size_t size);
 int at204_read(struct io_interface *ioif, void *buf, size_t size);
 int at204_close(struct io_interface *ioif);
+void at204_release(struct io_interface *ioif);
 int at204_wake(struct io_interface *ioif);
 int at204_msg(struct io_interface *ioif, struct cmd_packet *p, void *resp_buf,
 	      size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __MAC_H
+#define __MAC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Host-side computation of the MAC command output, see section 8.5.8 of
+ * the datasheet. first and second are the two 32-byte values selected by
+ * the mode (slot key, challenge or TempKey). otp (11 bytes) and sn (9
+ * bytes) are only used if the corresponding mode bits are set and may be
+ * NULL otherwise.
+ */
+void mac_compute(const uint8_t *first, const uint8_t *second, uint8_t mode,
+		 uint16_t slot, const uint8_t *otp, const uint8_t *sn,
+		 uint8_t *mac);
+
+/* Size of the data of a CheckMac command */
+#define CHECK_MAC_DATA_LEN	77
+
+/*
+ * Assembles the data of a CheckMac command in buf: the challenge sent to
+ * the client, the MAC the client responded with and the OtherData of the
+ * MAC command the client ran, from its mode and slot and the bytes of otp
+ * and sn it used. challenge, otp and sn may be NULL, in which case their
+ * bytes are zero.
+ */
+void mac_check_mac_data(uint8_t *buf, const uint8_t *challenge,
+			const uint8_t *mac, uint8_t mac_mode, uint8_t slot,
+			const uint8_t *otp, const uint8_t *sn);
+
+/* Compares two MACs in constant time */
+bool mac_equal(const uint8_t *a, const uint8_t *b, size_t len);
+
+#endif
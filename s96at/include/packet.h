@@ -33,8 +33,21 @@ struct __attribute__ ((__packed__)) cmd_packet {
 	uint16_t checksum;
 };
 
+/* Longest data of a command, the 77 bytes of CheckMac */
+#define PKT_MAX_DATA_LEN	77
+/* Longest response data, the 32 bytes of Read, MAC, HMAC and the like */
+#define PKT_MAX_RESP_LEN	32
+
+/* command, count, opcode, param1, param2, data and checksum */
+#define PKT_MAX_SIZE		(6 + PKT_MAX_DATA_LEN + 2)
+
 size_t get_total_packet_size(struct cmd_packet *p);
 size_t get_payload_size(struct cmd_packet *p);
-uint8_t *serialize(struct cmd_packet *p);
+
+/*
+ * Serializes the packet into pkt, which must hold at least size bytes.
+ * Returns the size of the packet, or 0 if it does not fit.
+ */
+size_t serialize(struct cmd_packet *p, uint8_t *pkt, size_t size);
 
 #endif
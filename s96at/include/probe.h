@@ -0,0 +1,44 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __PROBE_H
+#define __PROBE_H
+
+/*
+ * Static USDT probes of provider "s96at" on the command path, for tracing
+ * with bpftrace, perf or systemtap, ie:
+ *
+ *   bpftrace -e 'usdt:./libs96at.so:s96at:wait__end { ... }'
+ *
+ * Each probe is a single nop until a tracer attaches to it. Without
+ * sys/sdt.h the probes and their arguments compile away.
+ *
+ *  command__submit(opcode, param1, param2, data_len)
+ *  command__done(opcode, status)
+ *  packet__serialized(opcode, size)
+ *  write__done(opcode, bytes written)
+ *  wait__start(opcode, max_time in ms)
+ *  wait__end(opcode)
+ *  response__read(expected size, bytes read, status)
+ *  crc__failure(count byte, bytes read)
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE1(name, a) \
+	DTRACE_PROBE1(s96at, name, a)
+#define PROBE2(name, a, b) \
+	DTRACE_PROBE2(s96at, name, a, b)
+#define PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(s96at, name, a, b, c)
+#define PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(s96at, name, a, b, c, d)
+#else
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#define PROBE4(name, a, b, c, d)
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __RETRY_H
+#define __RETRY_H
+
+#include <stdint.h>
+
+#include <io.h>
+#include <s96at.h>
+
+/* Idle-wake cycles tried before a command is issued again */
+#define RETRY_WAKE_ATTEMPTS	10
+
+/* What went wrong with a command */
+enum retry_failure {
+	RETRY_NONE,
+	RETRY_WRITE_NACK,	/* The command was not taken */
+	RETRY_READ_NACK,	/* No response, the device may still be busy */
+	RETRY_BAD_RESPONSE,	/* Response with a bad count or CRC */
+	RETRY_NOT_EXECUTED,	/* Device status says the command did not run */
+	RETRY_FATAL		/* Any other error, it would happen again */
+};
+
+enum retry_step {
+	RETRY_STOP,
+	RETRY_READ,		/* Read the same response again */
+	RETRY_COMMAND,		/* Issue the command again */
+	RETRY_WAKE		/* Idle-wake cycle, then issue the command again */
+};
+
+struct retry_state {
+	const struct s96at_retry_policy *policy;
+	const struct s96at_clock *clock;
+	uint8_t reads;
+	uint8_t commands;
+	uint8_t wakes;
+	uint32_t backoff_us;
+};
+
+void retry_init(struct retry_state *rs, const struct s96at_retry_policy *policy,
+		const struct s96at_clock *clock);
+
+/*
+ * Picks the next step to recover from a failed command and waits for the
+ * backoff. Commands that change the state of the device are only issued
+ * again if they are known not to have run.
+ */
+enum retry_step retry_next(struct retry_state *rs, uint8_t opcode,
+			   enum retry_failure fail);
+
+void retry_wake(struct io_interface *ioif);
+#endif
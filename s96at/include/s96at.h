@@ -5,10 +5,16 @@
 #ifndef __S96AT_H
 #define __S96AT_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "s96at_private.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define S96AT_VERSION				PROJECT_VERSION
 
 #define S96AT_STATUS_OK				0x00
@@ -41,10 +47,30 @@
 #define S96AT_FLAG_USE_OTP_88_BITS		0x08
 #define S96AT_FLAG_USE_SN			0x10
 #define S96AT_FLAG_ENCRYPT			0x12
+#define S96AT_FLAG_GENDIG			0x20
+#define S96AT_FLAG_STOP_ON_ERROR		0x40
+#define S96AT_FLAG_IDLE				0x80
+
+/* WriteConfig bits of struct s96at_slot_config */
+#define S96AT_WRITE_CONFIG_CREATE		0x01 /* DeriveKey parent is WriteKey */
+#define S96AT_WRITE_CONFIG_DERIVEKEY		0x02
+#define S96AT_WRITE_CONFIG_ENCRYPT		0x04
+#define S96AT_WRITE_CONFIG_NEVER		0x08
 
 #define	S96AT_ZONE_LOCKED			0x00
 #define S96AT_ZONE_UNLOCKED			0x55
 
+#define S96AT_MERKLE_MAX_DEPTH			20
+
+/* Latency histograms: 8 linear sub-buckets per power of two of usec */
+#define S96AT_STATS_SUB_BUCKETS			8
+#define S96AT_STATS_NUM_BUCKETS			192
+/* One slot per opcode of enum s96at_opcode, plus one for the others */
+#define S96AT_STATS_NUM_OPCODES			15
+
+/* Most entries in a fault injection script */
+#define S96AT_FAULT_MAX_SCRIPT			32
+
 #define S96AT_OTP_MODE_LEGACY			0x00
 #define S96AT_OTP_MODE_CONSUMPTION		0x55
 #define S96AT_OTP_MODE_READONLY			0xAA
@@ -54,7 +80,8 @@ enum s96at_device {
 };
 
 enum s96at_io_interface_type {
-	S96AT_IO_I2C_LINUX
+	S96AT_IO_I2C_LINUX,
+	S96AT_IO_EMULATOR
 };
 
 enum s96at_zone {
@@ -84,6 +111,154 @@ enum s96at_nonce_mode {
 	S96AT_NONCE_MODE_PASSTHROUGH = 0x03
 };
 
+enum s96at_opcode {
+	S96AT_OPCODE_PAUSE = 0x01,
+	S96AT_OPCODE_READ = 0x02,
+	S96AT_OPCODE_MAC = 0x08,
+	S96AT_OPCODE_HMAC = 0x11,
+	S96AT_OPCODE_WRITE = 0x12,
+	S96AT_OPCODE_GENDIG = 0x15,
+	S96AT_OPCODE_NONCE = 0x16,
+	S96AT_OPCODE_LOCK = 0x17,
+	S96AT_OPCODE_RANDOM = 0x1b,
+	S96AT_OPCODE_DERIVEKEY = 0x1c,
+	S96AT_OPCODE_UPDATEEXTRA = 0x20,
+	S96AT_OPCODE_CHECKMAC = 0x28,
+	S96AT_OPCODE_DEVREV = 0x30,
+	S96AT_OPCODE_SHA = 0x47
+};
+
+struct s96at_batch_cmd {
+	uint8_t opcode;
+	uint8_t param1;
+	uint16_t param2;
+	const uint8_t *data;
+	size_t data_len;
+	uint8_t *out;
+	size_t out_len;
+	uint8_t status;
+};
+
+/* Commands to run on one chip of a bus, see s96at_bus_run() */
+struct s96at_bus_job {
+	uint8_t chip;
+	struct s96at_batch_cmd *cmds;
+	size_t num;
+	uint8_t status;
+};
+
+struct s96at_attestation {
+	uint32_t index;
+	uint32_t num_leaves;
+	uint8_t slot;
+	uint8_t depth;
+	uint8_t path[S96AT_MERKLE_MAX_DEPTH][32];
+	uint8_t root[32];
+	uint8_t mac[32];
+};
+
+struct s96at_log_checkpoint {
+	uint64_t seq;
+	uint8_t head[32];
+	uint8_t mac[32];
+};
+
+enum s96at_stats_phase {
+	S96AT_STATS_PHASE_WRITE,
+	S96AT_STATS_PHASE_WAIT,
+	S96AT_STATS_PHASE_READ,
+	S96AT_STATS_NUM_PHASES
+};
+
+enum s96at_stats_error {
+	S96AT_STATS_ERROR_CHECKMAC_FAIL,
+	S96AT_STATS_ERROR_PARSE,
+	S96AT_STATS_ERROR_EXEC,
+	S96AT_STATS_ERROR_AFTER_WAKE,
+	S96AT_STATS_ERROR_CRC,		/* Reported by the device */
+	S96AT_STATS_ERROR_RESPONSE_CRC,	/* Response with a bad CRC */
+	S96AT_STATS_ERROR_NO_RESPONSE,
+	S96AT_STATS_ERROR_REFUSED,	/* Not permitted by SlotConfig */
+	S96AT_STATS_NUM_ERRORS
+};
+
+struct s96at_histogram {
+	uint64_t count;
+	uint64_t sum_us;
+	uint32_t buckets[S96AT_STATS_NUM_BUCKETS];
+};
+
+struct s96at_stats {
+	uint64_t commands[S96AT_STATS_NUM_OPCODES];
+	uint64_t errors[S96AT_STATS_NUM_ERRORS];
+	uint64_t wakes;
+	uint64_t wake_retries;
+	uint64_t retries;
+	uint64_t idles;
+	uint64_t sleeps;
+	uint64_t bytes_written;
+	uint64_t bytes_read;
+	struct s96at_histogram latency[S96AT_STATS_NUM_OPCODES][S96AT_STATS_NUM_PHASES];
+};
+
+enum s96at_fault {
+	S96AT_FAULT_CRC,	/* Response with a corrupted CRC */
+	S96AT_FAULT_NACK,	/* Read not acknowledged, nothing is read */
+	S96AT_FAULT_ERROR,	/* Response replaced by an execution error */
+	S96AT_FAULT_LATE,	/* Response held back for late_ms */
+	S96AT_FAULT_SLEEP,	/* Watchdog expires before a command */
+	S96AT_FAULT_WAKE,	/* Wake pulse lost */
+	S96AT_FAULT_WOKEN,	/* Command lost waking the device up */
+	S96AT_FAULT_NUM
+};
+
+struct s96at_fault_config {
+	uint32_t seed;
+	/* Probability of each fault per eligible call, in parts per million */
+	uint32_t ppm[S96AT_FAULT_NUM];
+	uint32_t late_ms;
+	const char *script;
+};
+
+struct s96at_fault_report {
+	uint64_t injected[S96AT_FAULT_NUM];
+	uint64_t recovered[S96AT_FAULT_NUM];
+	struct s96at_histogram recovery[S96AT_FAULT_NUM];
+};
+
+/* Time source of a descriptor, see s96at_set_clock() */
+struct s96at_clock {
+	void *ctx;
+	uint64_t (*now_us)(void *ctx);
+	void (*sleep_us)(void *ctx, uint64_t us);
+};
+
+/* Clock that only moves when it is slept on or advanced */
+struct s96at_virtual_clock {
+	struct s96at_clock clock;
+	uint64_t now_us;
+};
+
+struct s96at_retry_policy {
+	uint8_t read_retries;		/* Reads of the same response */
+	uint8_t command_retries;	/* Commands issued again */
+	uint8_t wake_retries;		/* Idle-wake cycles, then issued again */
+	uint32_t backoff_us;		/* Before the first retry */
+	uint32_t max_backoff_us;	/* Cap of the doubling backoff, 0 for none */
+};
+
+enum s96at_priority {
+	S96AT_PRIORITY_CRITICAL,	/* Authentication and the like */
+	S96AT_PRIORITY_NORMAL,		/* The default */
+	S96AT_PRIORITY_BULK,		/* Random pool refills, hashing, provisioning */
+	S96AT_PRIORITY_NUM
+};
+
+enum s96at_replay_mode {
+	S96AT_REPLAY_ORIGINAL_TIMING,
+	S96AT_REPLAY_FAST
+};
+
 enum s96at_random_mode {
 	S96AT_RANDOM_MODE_UPDATE_SEED,
 	S96AT_RANDOM_MODE_UPDATE_NO_SEED
@@ -95,6 +270,241 @@ enum s96at_update_extra_mode {
 	S96AT_UPDATE_EXTRA_MODE_LIMIT
 };
 
+/* Add a challenge to an attestation batch
+ *
+ * Adds a client challenge to the current batch. The position of the
+ * challenge in the batch is stored in index and is used to retrieve the
+ * attestation once the batch has been sealed.
+ *
+ * Returns S96AT_STATUS_OK on success, S96AT_STATUS_EXEC_ERROR if the batch
+ * is full or already sealed.
+ */
+uint8_t s96at_attest_add(struct s96at_attest *att, const uint8_t *challenge,
+			 uint32_t *index);
+
+/* Clean up an attestation batch
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_attest_cleanup(struct s96at_attest *att);
+
+/* Get the attestation of a challenge
+ *
+ * Fills in the Merkle root, its MAC and the inclusion proof for the
+ * challenge at position index of a sealed batch. The result is sent to the
+ * client as is and checked using s96at_attest_verify().
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_attest_get(struct s96at_attest *att, uint32_t index,
+			 struct s96at_attestation *out);
+
+/* Initialize an attestation batch
+ *
+ * Challenges from many clients are collected in a batch and a SHA-256
+ * Merkle tree is built over them on the host. The device computes a single
+ * MAC (mode 1, TempKey source input) over the root of the tree using the
+ * key in the given slot, so the cost of a Nonce and a MAC is shared by all
+ * challenges in the batch.
+ *
+ * A batch holds up to max_leaves challenges, at most 2^S96AT_MERKLE_MAX_DEPTH.
+ * It is ready to be sealed once it is full or window_ms have passed since
+ * the first challenge was added.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_attest_init(struct s96at_attest *att, struct s96at_desc *desc,
+			  uint8_t slot, size_t max_leaves, uint32_t window_ms);
+
+/* Check if an attestation batch should be sealed
+ *
+ * Returns true if the batch is full or its time window has expired.
+ */
+bool s96at_attest_ready(struct s96at_attest *att);
+
+/* Start a new attestation batch
+ *
+ * Drops all challenges and the result of the previous batch.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_attest_reset(struct s96at_attest *att);
+
+/* Seal an attestation batch
+ *
+ * Builds the Merkle tree, loads its root into TempKey and has the device
+ * MAC it. The device is woken up for the operation and put back into the
+ * idle state. No challenges can be added until the batch is reset.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_attest_seal(struct s96at_attest *att);
+
+/* Verify an attestation
+ *
+ * Host-side check of an attestation: the inclusion proof must lead from the
+ * challenge to the root and the MAC of the root must match the one computed
+ * with key, the 32-byte key stored in the slot used by the device.
+ *
+ * Returns S96AT_STATUS_OK if the attestation is valid, otherwise
+ * S96AT_STATUS_CHECKMAC_FAIL.
+ */
+uint8_t s96at_attest_verify(const uint8_t *key, const uint8_t *challenge,
+			    const struct s96at_attestation *a);
+
+/* Run a batch of commands in a single wake window
+ *
+ * Executes the num commands in cmds back to back. Each entry holds the raw
+ * opcode and parameters of a command, its optional input data and a buffer
+ * for the response. Commands that only return a status byte may leave out
+ * NULL; the status reported by the device is then stored in the status
+ * field of the entry. For commands that return data, out_len must match the
+ * size of the response.
+ *
+ * The sum of the maximum execution times of the commands is checked against
+ * the watchdog before anything is sent to the device. The device is then
+ * woken up with a fresh watchdog window, so TempKey is retained across the
+ * batch boundary, and the commands are run with no host-side gaps. The
+ * device is left awake, unless S96AT_FLAG_IDLE is set.
+ *
+ * If S96AT_FLAG_STOP_ON_ERROR is set, execution stops at the first command
+ * that fails and the status of the remaining entries is set to
+ * S96AT_STATUS_EXEC_ERROR.
+ *
+ * The commands go to the device as they are: the slot configuration loaded
+ * with s96at_load_config() is not checked, so the device has the last word
+ * on what it permits.
+ *
+ * Returns S96AT_STATUS_OK if all commands were successful,
+ * S96AT_STATUS_BAD_PARAMETERS if an opcode is not known, a buffer is
+ * missing or too long, or the batch does not fit in the watchdog window,
+ * otherwise the status of the first failing command.
+ */
+uint8_t s96at_batch(struct s96at_desc *desc, struct s96at_batch_cmd *cmds,
+		    size_t num, uint32_t flags);
+
+/* Clean up a bus
+ *
+ * Cleans up the descriptors of every chip on the bus.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise the status of the first
+ * descriptor that failed to clean up.
+ */
+uint8_t s96at_bus_cleanup(struct s96at_bus *bus);
+
+/* Initialize the chips sharing an I2C bus
+ *
+ * Sets up a descriptor for each of the num chips at addrs on the I2C bus
+ * exposed through the device node at path, ie "/dev/i2c-1", for use with
+ * s96at_bus_run(). The descriptor of chip i is bus->chips[i] and may be
+ * used on its own as well, see s96at_init_i2c().
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_bus_init(struct s96at_bus *bus, enum s96at_device device_type,
+		       const char *path, const uint8_t *addrs, size_t num);
+
+/* Initialize emulated chips sharing a bus
+ *
+ * Same as s96at_bus_init(), but on num emulated devices with the given ids,
+ * see s96at_init_emulator(). A wake pulse reaches all of them, as it does
+ * on a real bus.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_bus_init_emulator(struct s96at_bus *bus,
+				enum s96at_device device_type,
+				const uint32_t *ids, size_t num);
+
+/* Run commands on the chips of a bus
+ *
+ * Executes the num jobs, each one a batch of commands for one chip of the
+ * bus, see s96at_batch() for the commands. Jobs for the same chip run in
+ * order. While a chip executes a command, the next command of another chip
+ * is issued, and each response is read once the maximum execution time of
+ * its command has passed, so the chips work in parallel on a single bus.
+ *
+ * A wake pulse reaches every chip on the bus. Each round of commands starts
+ * by putting all chips to idle, which retains TempKey, and waking them
+ * with a single pulse; the chips that have nothing left to do are put back
+ * to idle right away and so are the others once they are done. A chip that
+ * has more work than fits in the watchdog window continues in the next
+ * round. Every chip of the bus is left idle. Retry policies are not applied.
+ * The rounds are timed on the clock of bus->chips[0], see s96at_set_clock(),
+ * so all chips of a bus must be given the same clock.
+ *
+ * If S96AT_FLAG_STOP_ON_ERROR is set, a job stops at the first command that
+ * fails and the status of its remaining entries is set to
+ * S96AT_STATUS_EXEC_ERROR. The status of a job is the status of its first
+ * failing command, or S96AT_STATUS_OK.
+ *
+ * Returns S96AT_STATUS_OK if all commands were successful,
+ * S96AT_STATUS_BAD_PARAMETERS on invalid jobs, otherwise the status of the
+ * first command that failed.
+ */
+uint8_t s96at_bus_run(struct s96at_bus *bus, struct s96at_bus_job *jobs,
+		      size_t num, uint32_t flags);
+
+/* Close a key bundle
+ *
+ * Unmaps the bundle. Records returned by s96at_bundle_find() are no longer
+ * valid afterwards.
+ */
+void s96at_bundle_close(struct s96at_bundle *bundle);
+
+/* Create a key bundle
+ *
+ * Writes num per-device records to a new bundle file at path. The serial,
+ * data and otp fields of each record must be set. The records are updated
+ * in place: the lock CRC of the Data zone is computed and stored in
+ * data_crc, and flags is cleared. Serial numbers must be unique.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_bundle_create(const char *path,
+			    struct s96at_bundle_record *records, size_t num);
+
+/* Look up a record in a key bundle
+ *
+ * Finds the record of the device with the given serial number through a
+ * binary search of the bundle index. rec points into the mapped file, no
+ * key material is copied.
+ *
+ * Returns S96AT_STATUS_OK on success, S96AT_STATUS_EXEC_ERROR if there is
+ * no record for the device or it has already been wiped, otherwise
+ * S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_bundle_find(struct s96at_bundle *bundle, const uint8_t *serial,
+			  const struct s96at_bundle_record **rec);
+
+/* Open a key bundle
+ *
+ * A key bundle holds the Data and OTP contents of many devices as fixed-size
+ * records, together with an index sorted by serial number. The file is
+ * mapped into memory and only the header is checked, so opening does not
+ * depend on the number of records.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_bundle_open(struct s96at_bundle *bundle, const char *path);
+
+/* Wipe a record of a key bundle
+ *
+ * Overwrites the key material of the record with zeros, marks it as used
+ * and writes it back to the file before returning.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_bundle_wipe(struct s96at_bundle *bundle,
+			  const struct s96at_bundle_record *rec);
+
 /* Check a MAC generated by another device
  *
  * Generates a MAC and compares it with the value stored in the mac buffer.
@@ -121,6 +531,55 @@ uint8_t s96at_check_mac(struct s96at_desc *desc, enum s96at_mac_mode mode,
  */
 uint8_t s96at_cleanup(struct s96at_desc *desc);
 
+/* Advance a virtual clock
+ *
+ * Moves the clock forward by us usec, as if that time had passed while
+ * nothing was sent to the devices using it. This is how a test lets the
+ * watchdog of a device expire without waiting for it.
+ */
+void s96at_clock_advance(struct s96at_virtual_clock *vc, uint64_t us);
+
+/* Initialize a virtual clock
+ *
+ * The clock starts at start_us and only moves when a descriptor using it
+ * sleeps, ie while a command executes or before a retry, or when it is
+ * advanced with s96at_clock_advance(). A sleep returns right away having
+ * moved the clock to its end, so commands complete as fast as the io
+ * interface allows while their timing stays that of the device. Pass
+ * &vc->clock to s96at_set_clock().
+ */
+void s96at_clock_virtual_init(struct s96at_virtual_clock *vc, uint64_t start_us);
+
+/* Read the response of a command started with s96at_cmd_start()
+ *
+ * Reads the response of cmd into cmd->out, or its status byte into
+ * cmd->status if there is no out buffer, and accounts for the command in
+ * the TempKey state of the descriptor. Call it once the wait_ms returned
+ * by s96at_cmd_start() have passed, with the same cmd.
+ *
+ * Returns the status of the command, which is stored in cmd->status, or
+ * S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_cmd_finish(struct s96at_desc *desc, struct s96at_batch_cmd *cmd);
+
+/* Start a command without waiting for its execution
+ *
+ * Sends cmd, see s96at_batch(), to the device, which has to be awake, and
+ * returns right away. The response can be read with s96at_cmd_finish()
+ * once wait_ms msec have passed, which the caller may spend on something
+ * else than sleeping, ie on other devices. Nothing else may be sent to the
+ * device in between. Interfaces that wait for the execution on their own,
+ * such as a descriptor of the s96atd daemon, return a wait_ms of 0 and
+ * s96at_cmd_finish() waits instead. Retry policies do not apply, and
+ * neither does the slot configuration loaded with s96at_load_config(), as
+ * in s96at_batch().
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_cmd_start(struct s96at_desc *desc,
+			const struct s96at_batch_cmd *cmd, uint32_t *wait_ms);
+
 /* Calculate a CRC value
  *
  * Calculates the CRC of the data stored in buf, using the same CRC-16
@@ -153,6 +612,129 @@ uint16_t s96at_crc(const uint8_t *buf, size_t buf_len, uint16_t current_crc);
 uint8_t s96at_derive_key(struct s96at_desc *desc, uint8_t slot, uint8_t *mac,
 			 uint32_t flags);
 
+/* Clean up a DRBG
+ *
+ * Wipes the internal state of a DRBG instance. The instance must be
+ * initialized again before it can be used.
+ */
+void s96at_drbg_cleanup(struct s96at_drbg *drbg);
+
+/* Generate random bytes from a DRBG
+ *
+ * Fills buf with len bytes generated by an HMAC_DRBG (SHA-256) as specified
+ * in NIST SP 800-90A. Requests larger than the maximum request size allowed
+ * by the specification are split internally.
+ *
+ * Before each request the DRBG checks whether a reseed is due, either
+ * because reseed_bytes bytes have been generated or because reseed_ms msec
+ * have elapsed since the last reseed, and if so pulls fresh entropy from
+ * the device through the entropy queue. Each thread should use its own
+ * DRBG instance; instances can share the same entropy queue.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ * On error the contents of buf are zeroed.
+ */
+uint8_t s96at_drbg_generate(struct s96at_drbg *drbg, uint8_t *buf, size_t len);
+
+/* Initialize a DRBG
+ *
+ * Instantiates an HMAC_DRBG (SHA-256) seeded with entropy and a nonce taken
+ * from the entropy queue src. An optional personalization string can be
+ * passed through pers.
+ *
+ * The reseed_bytes parameter specifies the number of bytes after which the
+ * DRBG is automatically reseeded, and reseed_ms the time in msec after which
+ * the DRBG is automatically reseeded. Setting either to zero disables the
+ * corresponding trigger.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_drbg_init(struct s96at_drbg *drbg, struct s96at_entropy *src,
+			const uint8_t *pers, size_t pers_len,
+			uint64_t reseed_bytes, uint32_t reseed_ms);
+
+/* Reseed a DRBG
+ *
+ * Forces a reseed of the DRBG with fresh entropy taken from the device. An
+ * optional additional input can be passed through add.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_drbg_reseed(struct s96at_drbg *drbg, const uint8_t *add,
+			  size_t add_len);
+
+/* Clean up an entropy queue
+ *
+ * Releases the resources held by the entropy queue and wipes any buffered
+ * entropy. All DRBG instances using the queue must be cleaned up first.
+ *
+ * Returns S96AT_STATUS_OK on success.
+ */
+uint8_t s96at_entropy_cleanup(struct s96at_entropy *src);
+
+/* Initialize an entropy queue
+ *
+ * Sets up an entropy queue that serves random data produced by the device
+ * to one or more DRBG instances. The queue is thread-safe; requests are
+ * served in order and each byte is handed out only once.
+ *
+ * When the queue runs dry, the device is woken up, a batch of
+ * S96AT_ENTROPY_BATCH Random commands is issued within the same wake window,
+ * and the device is put back into the idle state. The descriptor must
+ * therefore not be in use elsewhere while the queue is refilled.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_entropy_init(struct s96at_entropy *src, struct s96at_desc *desc);
+
+/* Inject faults into the io interface of a descriptor
+ *
+ * Puts a fault injector in front of the io interface of the descriptor,
+ * whatever backend it uses. Faults hit reads (S96AT_FAULT_CRC, _NACK,
+ * _ERROR and _LATE), command writes (S96AT_FAULT_SLEEP, which puts the
+ * device to sleep just before the command, and S96AT_FAULT_WOKEN, which
+ * also has the command wake the device up and get lost, so that the wake
+ * status is read in place of the response) or wake pulses (S96AT_FAULT_WAKE).
+ *
+ * Each eligible call gets fault f with a probability of ppm[f] per million,
+ * drawn from a generator seeded with seed, so that a run can be repeated.
+ * On top of that, script lists faults at fixed points as comma separated
+ * "name@n" entries, where name is one of crc, nack, error, late, sleep, wake
+ * or woken and n counts the eligible calls from 1, ie "crc@3,wake@1" corrupts
+ * the third read and drops the first wake pulse. A late response is not
+ * acknowledged until late_ms have passed.
+ *
+ * The time from each fault to the next good response read from the device
+ * is recorded, see s96at_fault_report(). Statistics that are enabled stay
+ * enabled.
+ *
+ * Returns S96AT_STATUS_OK on success, S96AT_STATUS_BAD_PARAMETERS if the
+ * script can not be parsed, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_fault_attach(struct s96at_desc *desc,
+			   const struct s96at_fault_config *cfg);
+
+/* Stop injecting faults
+ *
+ * Removes the fault injector added by s96at_fault_attach() and gives the
+ * descriptor its original io interface back. Does nothing if no faults are
+ * injected.
+ */
+void s96at_fault_detach(struct s96at_desc *desc);
+
+/* Get the fault injection report
+ *
+ * Copies the number of faults injected and recovered from, and the
+ * histograms of the recovery times, into report. Recovery is the first
+ * response read from the device with a valid CRC and a status other than
+ * an execution or parse error.
+ *
+ * Returns S96AT_STATUS_OK on success, S96AT_STATUS_EXEC_ERROR if no faults
+ * are injected, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_fault_report(struct s96at_desc *desc,
+			   struct s96at_fault_report *report);
+
 /* Get Device Revision
  *
  * Retrieves the device revision and stores it into the buffer pointed by
@@ -198,9 +780,14 @@ uint8_t s96at_gen_digest(struct s96at_desc *desc, enum s96at_zone zone,
  * S96AT_FLAG_USE_OTP_88_BITS	Include OTP[0:10]
  * S96AT_FLAG_USE_SN		Include SN[2:3] and SN[4:7]
  *
+ * The flags parameter may also specify the input source of TempKey as
+ * defined when executing the Nonce command, see s96at_mac_mode(). Without
+ * a source flag, TempKey is taken to come from a random Nonce.
+ *
  * The resulting HMAC is written into the hmac buffer.
  *
- * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
  */
 uint8_t s96at_get_hmac(struct s96at_desc *desc, uint8_t slot,
 		       uint32_t flags, uint8_t *hmac);
@@ -254,9 +841,13 @@ uint8_t s96at_get_lock_data(struct s96at_desc *desc, uint8_t *lock_data);
  * S96AT_FLAG_USE_OTP_88_BITS	Include OTP[0:10]
  * S96AT_FLAG_USE_SN		Include SN[2:3] and SN[4:7]
  *
+ * The flags parameter must also specify the input source of TempKey as
+ * defined when executing the Nonce command, see s96at_mac_mode().
+ *
  * The resulting MAC is written into the mac buffer.
  *
- * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
  */
 uint8_t s96at_get_mac(struct s96at_desc *desc, enum s96at_mac_mode mode, uint8_t slot,
 		      const uint8_t *challenge, uint32_t flags, uint8_t *mac);
@@ -275,6 +866,9 @@ uint8_t s96at_get_mac(struct s96at_desc *desc, enum s96at_mac_mode mode, uint8_t
  *
  * The value produced by the RNG is stored into buf.
  *
+ * In Passthrough mode the command is skipped if TempKey is known to already
+ * hold the same value.
+ *
  * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
  */
 uint8_t s96at_gen_nonce(struct s96at_desc *desc, enum s96at_nonce_mode mode,
@@ -292,6 +886,19 @@ uint8_t s96at_gen_nonce(struct s96at_desc *desc, enum s96at_nonce_mode mode,
  */
 uint8_t s96at_get_otp_mode(struct s96at_desc *desc, uint8_t *opt_mode);
 
+/* Time of the target in freestanding builds
+ *
+ * A freestanding build has no clock of its own. Descriptors without a
+ * clock, see s96at_set_clock(), take the time from these two functions,
+ * which the target defines if it wants such a default: the monotonic time
+ * in usec and a sleep of us usec. Both are weak references, so a target
+ * that does not define them sets a clock on every descriptor, and commands
+ * fail with S96AT_STATUS_EXEC_ERROR on a descriptor without one. They are
+ * not used by hosted builds.
+ */
+uint64_t s96at_platform_now_us(void);
+void s96at_platform_sleep_us(uint64_t us);
+
 /* Send the Pause command
  *
  * Upon receiving the Pause command, devices with Selector byte in the
@@ -303,6 +910,101 @@ uint8_t s96at_get_otp_mode(struct s96at_desc *desc, uint8_t *opt_mode);
  */
 uint8_t s96at_pause(struct s96at_desc *desc, uint8_t selector);
 
+/* Build a provisioning plan
+ *
+ * Reads the Config zone once and computes the minimal list of commands that
+ * bring the device to the state described by the profile:
+ *
+ * - Config words that already hold the right value are skipped. Block 1
+ *   (words 8-15) is written with a single 32-byte write if more than one of
+ *   its words differs.
+ * - The Data and OTP zones cannot be read before they are locked and only
+ *   accept 32-byte writes, so every slot and OTP block set by the profile is
+ *   written. If the Data zone is to be locked, all the others are written
+ *   with zeros so that the lock CRC is known in advance.
+ * - The lock CRCs are computed on the host from the target images.
+ * - Slots with a random key get a fresh key from /dev/urandom, held in the
+ *   plan's Data image.
+ *
+ * Nothing is done for zones that are already locked, but a locked Config
+ * zone that does not match the profile is an error.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_plan_build(struct s96at_desc *desc,
+			 const struct s96at_profile *prof,
+			 struct s96at_plan *plan);
+
+/* Build a provisioning plan from a key bundle record
+ *
+ * Same as s96at_plan_build(), but the Data and OTP zones are taken in full
+ * from rec instead of the profile, and the Data lock uses the CRC stored in
+ * the record. The plan refers to rec, which must stay valid until the plan
+ * has been run.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_plan_build_bundle(struct s96at_desc *desc,
+				const struct s96at_profile *prof,
+				const struct s96at_bundle_record *rec,
+				struct s96at_plan *plan);
+
+/* Clean up a provisioning plan
+ *
+ * Wipes the plan, including any key material it holds.
+ */
+void s96at_plan_cleanup(struct s96at_plan *plan);
+
+/* Run a provisioning plan
+ *
+ * Executes the commands of the plan, packing as many as fit in each wake
+ * window, and stops at the first failure. The device is left in the idle
+ * state.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise the status of the failing
+ * command.
+ */
+uint8_t s96at_plan_run(struct s96at_desc *desc, struct s96at_plan *plan);
+
+/* Clean up a provisioning profile
+ *
+ * Wipes the profile, including any key material it holds.
+ */
+void s96at_profile_cleanup(struct s96at_profile *prof);
+
+/* Load a provisioning profile from a file
+ *
+ * See s96at_profile_parse() for the format.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_profile_load(struct s96at_profile *prof, const char *path);
+
+/* Parse a provisioning profile
+ *
+ * A profile describes the target contents of a device, one statement per
+ * line. Everything after a '#' is a comment. Values are given in hex.
+ *
+ * config <word> <value>	Config word 4-19, as 4 bytes
+ * slot <n> config <value>	SlotConfig of slot n, as a 16-bit value
+ * slot <n> key <value>		Key of slot n, as 32 bytes
+ * slot <n> key file <path>	Key of slot n, read from a 32-byte file
+ * slot <n> key random		Key of slot n, drawn from /dev/urandom for
+ *				each device by s96at_plan_build()
+ * otp <word> <value>		OTP word 0-15, as 4 bytes
+ * lock config			Lock the Config zone
+ * lock data			Lock the Data and OTP zones
+ *
+ * Config bytes not set by the profile are left untouched.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_profile_parse(struct s96at_profile *prof, const char *text);
+
 /* Generate a random number
  *
  * Random numbers are generated by combining the output of a hardware RNG
@@ -327,6 +1029,17 @@ uint8_t s96at_get_random(struct s96at_desc *desc, enum s96at_random_mode mode,
  */
 uint8_t s96at_get_serialnbr(struct s96at_desc *desc, uint8_t *serial);
 
+/* Get the configuration of a slot
+ *
+ * Copies the SlotConfig of the slot, as decoded by s96at_load_config(),
+ * into cfg. Nothing is sent to the device.
+ *
+ * Returns S96AT_STATUS_OK on success, S96AT_STATUS_BAD_PARAMETERS if the
+ * slot is out of range or no locked configuration has been loaded.
+ */
+uint8_t s96at_get_slot_config(struct s96at_desc *desc, uint8_t slot,
+			      struct s96at_slot_config *cfg);
+
 /* Generate a hash (SHA-256)
  *
  * Generates a SHA-256 hash of the input message contained in buf.
@@ -345,13 +1058,219 @@ uint8_t s96at_get_sha(struct s96at_desc *desc, uint8_t *buf,
 /* Initialize a device descriptor
  *
  * Selects a device and registers with an io interface. Upon successful initialization,
- * the descriptor can be used in subsequent operations.
+ * the descriptor can be used in subsequent operations. S96AT_IO_EMULATOR selects
+ * an emulated device, see s96at_init_emulator(). Otherwise the descriptor gets
+ * an io interface of its own on the default I2C bus and address, see
+ * s96at_init_i2c(), so that its statistics, retry policy and clock are not
+ * shared with other descriptors.
  *
  * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
  */
 uint8_t s96at_init(enum s96at_device device_type, enum s96at_io_interface_type iface,
 		   struct s96at_desc *desc);
 
+/* Initialize a device descriptor on a given I2C bus
+ *
+ * Same as s96at_init(), but instead of the default bus and address, the
+ * descriptor talks to the device at addr on the I2C bus exposed through
+ * the device node at path, ie "/dev/i2c-1". Each descriptor gets its own
+ * io interface, so several devices can be used at the same time.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_init_i2c(enum s96at_device device_type, const char *path,
+		       uint8_t addr, struct s96at_desc *desc);
+
+/* Initialize a device descriptor on a caller provided io interface
+ *
+ * Same as s96at_init(), but the descriptor talks through ioif, see struct
+ * io_interface in io.h, which is opened here and closed by s96at_cleanup().
+ * The interface stays owned by the caller unless it has a release hook.
+ * Freestanding builds have no io interfaces of their own and are only
+ * initialized this way.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_init_io(enum s96at_device device_type, struct io_interface *ioif,
+		      struct s96at_desc *desc);
+
+/* Initialize a device descriptor through the s96atd daemon
+ *
+ * Same as s96at_init(), but the descriptor talks to the devices owned by
+ * the s96atd daemon listening on the Unix socket at path, ie
+ * "/run/s96atd.sock", so that several processes can share them. Calls go
+ * over the socket, or over a ring in shared memory if ring is set, which
+ * saves a system call per call for clients with a high rate of commands.
+ *
+ * The daemon keeps a device to the descriptor from the wake until it is
+ * put to idle or to sleep, so that TempKey is not shared with other
+ * clients. A wake may land on another device than the previous one, and
+ * TempKey is then considered lost.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_init_daemon(enum s96at_device device_type, const char *path,
+			  bool ring, struct s96at_desc *desc);
+
+/* Initialize a device descriptor on an emulated device
+ *
+ * Same as s96at_init(), but the descriptor talks to a software model of a
+ * factory fresh ATSHA204A instead of real hardware. The serial number of the
+ * emulated device is derived from id, so that several emulated devices can
+ * be told apart. The model keeps its state in memory until s96at_cleanup()
+ * and supports the commands needed to provision a device.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_init_emulator(enum s96at_device device_type, uint32_t id,
+			    struct s96at_desc *desc);
+
+/* Initialize a device descriptor on a recorded capture
+ *
+ * Same as s96at_init(), but the descriptor plays back the bus capture at
+ * path, see s96at_record_start(), instead of talking to a device. The
+ * library has to issue the same calls as when the capture was recorded;
+ * a write that differs from the capture fails, as does every call after it.
+ *
+ * With S96AT_REPLAY_ORIGINAL_TIMING each call is delayed and takes as long
+ * as it did during the capture. With S96AT_REPLAY_FAST responses are served
+ * right away and the library does not wait for commands to execute, which
+ * leaves only the host side of each command to measure.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_init_replay(enum s96at_device device_type, const char *path,
+			  enum s96at_replay_mode mode, struct s96at_desc *desc);
+
+/* Invalidate the TempKey state
+ *
+ * The library keeps track of the value held in TempKey and uses it to skip
+ * Nonce and GenDig commands that would recreate the same value. Call this
+ * function whenever the device may have been accessed outside of this
+ * descriptor, e.g. by another process or after a power cycle, so that the
+ * next s96at_load_tempkey() call reloads TempKey unconditionally.
+ *
+ * Returns S96AT_STATUS_OK.
+ */
+uint8_t s96at_invalidate_tempkey(struct s96at_desc *desc);
+
+/* Load the slot configuration of the device
+ *
+ * Reads the Config zone and decodes the SlotConfig of every slot, see
+ * s96at_get_slot_config(). Once the configuration is loaded, the calls to
+ * s96at_read_data(), s96at_write_data(), s96at_get_mac(), s96at_get_hmac()
+ * and s96at_derive_key() that it does not permit fail with
+ * S96AT_STATUS_EXEC_ERROR without any bus traffic, as the device would
+ * have failed them.
+ *
+ * Only what the device is certain to refuse is refused: nothing is loaded
+ * while the Config zone is unlocked, and the slot permissions are only
+ * applied once the Data zone is known to be locked, either when loading or
+ * after locking it through the descriptor. SingleUse is decoded, but the
+ * remaining uses of a key are left to the device. The device must be awake.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_load_config(struct s96at_desc *desc);
+
+/* Load a value into TempKey
+ *
+ * Loads the 32-byte value into TempKey using a Nonce in Passthrough mode.
+ * If S96AT_FLAG_GENDIG is set in flags, TempKey is then combined with the
+ * key stored in the given zone and slot using GenDig.
+ *
+ * The commands are only sent to the device if TempKey is not known to
+ * already hold the requested value; the state is lost when the device goes
+ * to sleep or when the watchdog expires. The device must be awake.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_load_tempkey(struct s96at_desc *desc, const uint8_t *value,
+			   uint32_t flags, enum s96at_zone zone, uint8_t slot);
+
+/* Append a record to a sealed log
+ *
+ * Adds the record to the hash chain of the log. Once the configured number
+ * of records has been appended, or the configured interval has passed since
+ * the last checkpoint, a checkpoint is taken as with s96at_log_checkpoint(),
+ * stored in cp, and sealed is set to true. The checkpoint must be stored
+ * along with the log.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_log_append(struct s96at_log *log, const void *rec, size_t len,
+			 struct s96at_log_checkpoint *cp, bool *sealed);
+
+/* Take a checkpoint of a sealed log
+ *
+ * Loads the head of the hash chain into TempKey and has the device MAC it
+ * (mode 1, TempKey source input) using the key in the slot of the log. The
+ * device is woken up for the operation and put back into the idle state.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_log_checkpoint(struct s96at_log *log,
+			     struct s96at_log_checkpoint *cp);
+
+/* Clean up a sealed log
+ */
+void s96at_log_cleanup(struct s96at_log *log);
+
+/* Initialize a sealed log
+ *
+ * Records appended to the log are chained on the host as
+ * head = SHA-256(head || len || record), with len the record length as a
+ * 64-bit little endian value, starting from the 32-byte iv, or from zeros if
+ * iv is NULL. Only the checkpoints need the device, so records can be
+ * appended at host speed.
+ *
+ * A checkpoint is taken every every records and every interval_ms
+ * milliseconds; either of them can be set to 0 to disable it.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_log_init(struct s96at_log *log, struct s96at_desc *desc,
+		       uint8_t slot, const uint8_t *iv, uint32_t every,
+		       uint32_t interval_ms);
+
+/* Verify a checkpoint of a sealed log
+ *
+ * Checks that the checkpoint was taken after the records fed so far, and
+ * that its MAC matches the one computed on the host.
+ *
+ * Returns S96AT_STATUS_OK if the checkpoint is valid, otherwise
+ * S96AT_STATUS_CHECKMAC_FAIL.
+ */
+uint8_t s96at_log_verify_checkpoint(struct s96at_log_verifier *v,
+				    const struct s96at_log_checkpoint *cp);
+
+/* Clean up a log verifier
+ */
+void s96at_log_verify_cleanup(struct s96at_log_verifier *v);
+
+/* Initialize a log verifier
+ *
+ * A log is verified in a single pass, on the host only. Records are fed in
+ * order with s96at_log_verify_record() and every checkpoint is checked with
+ * s96at_log_verify_checkpoint() right after the record it covers. key is the
+ * 32-byte key stored in the slot used by the device and iv is the one used
+ * to initialize the log.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_log_verify_init(struct s96at_log_verifier *v, const uint8_t *key,
+			      uint8_t slot, const uint8_t *iv);
+
+/* Feed a record to a log verifier
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_log_verify_record(struct s96at_log_verifier *v, const void *rec,
+				size_t len);
+
 /* Lock a zone
  *
  * Locks a zone specified by the zone parameter. Device personalization requires
@@ -366,6 +1285,19 @@ uint8_t s96at_init(enum s96at_device device_type, enum s96at_io_interface_type i
  */
 uint8_t s96at_lock_zone(struct s96at_desc *desc, enum s96at_zone zone, uint16_t crc);
 
+/* Compute the mode of a MAC or HMAC command
+ *
+ * Combines mode with the flags of s96at_get_mac() into the param1 byte of
+ * the MAC command, for commands that are not sent through s96at_get_mac(),
+ * ie by s96at_batch() or s96at_cmd_start(). HMAC takes the same bits with
+ * mode set to S96AT_MAC_MODE_0. Exactly one TempKey source flag must be
+ * given, and at most one of the OTP flags.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_mac_mode(enum s96at_mac_mode mode, uint32_t flags,
+		       uint8_t *param1);
+
 /* Read from the Configuration zone
  *
  * The Config zone is organized into 4-byte words. The id parameter specifies
@@ -406,6 +1338,29 @@ uint8_t s96at_read_data(struct s96at_desc *desc, uint8_t id, uint8_t offset,
  */
 uint8_t s96at_read_otp(struct s96at_desc *desc, uint8_t id, uint8_t *buf);
 
+/* Record the bus traffic of a descriptor
+ *
+ * Writes every open, write, read, wake and close call of the io interface
+ * of the descriptor, with its payload, result, start time and duration, to
+ * a capture file at path. The capture can be played back with
+ * s96at_init_replay(). Recording stops with s96at_record_stop() or
+ * s96at_cleanup().
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_record_start(struct s96at_desc *desc, const char *path);
+
+/* Stop recording the bus traffic of a descriptor
+ *
+ * Closes the capture file opened by s96at_record_start() and gives the
+ * descriptor its original io interface back.
+ *
+ * Returns S96AT_STATUS_OK on success, S96AT_STATUS_EXEC_ERROR if the
+ * descriptor is not being recorded or the capture could not be written
+ * completely, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_record_stop(struct s96at_desc *desc);
+
 /* Put the device into the sleep state
  *
  * Puts the device in low-power sleep. The device does not respond until the
@@ -434,6 +1389,135 @@ uint8_t s96at_idle(struct s96at_desc *desc);
  */
 uint8_t s96at_reset(struct s96at_desc *desc);
 
+/* Set the clock of a descriptor
+ *
+ * Replaces the time source of the io layer, the TempKey watchdog tracking
+ * and, on emulated devices, of the device itself: the execution times of
+ * commands, the wait for them and the retry backoff all run on clock. A
+ * NULL clock, the default, is the monotonic clock of the host, see
+ * s96at_clock_virtual_init() for one that runs in virtual time. Interfaces
+ * that wait for the execution on their own, such as a descriptor of the
+ * s96atd daemon, keep doing so. Performance counters and the C++ executor
+ * measure real time.
+ *
+ * The clock is set on the io interface in use and on the ones fault
+ * injection or recording wrap, down to the device. All chips of a bus run
+ * on the clock of the first one. The clock is not copied and has
+ * to stay valid until it is replaced or s96at_cleanup() is called.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_set_clock(struct s96at_desc *desc,
+			const struct s96at_clock *clock);
+
+/* Set the scheduling priority of a daemon descriptor
+ *
+ * Puts a descriptor from s96at_init_daemon() in a priority class of the
+ * daemon. Waiting sessions of a more urgent class always start first, and
+ * within a class the devices are shared in proportion to weight (1-255).
+ * Clients start out as S96AT_PRIORITY_NORMAL with a weight of 1.
+ *
+ * A critical client does not wait for the session of a less urgent one,
+ * which is put aside between two commands, ie between the blocks of
+ * s96at_get_sha(), and goes on afterwards. The device is put to idle in the
+ * meantime, which keeps TempKey. Critical sessions that only use commands
+ * which leave TempKey alone, such as MAC in mode 0 or a Read outside the
+ * data zone, never cost the session they put aside its TempKey or its SHA
+ * context; otherwise its TempKey is considered lost. Only the clients the
+ * daemon allows, by default those running as its own user, may join
+ * S96AT_PRIORITY_CRITICAL.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_set_priority(struct s96at_desc *desc,
+			   enum s96at_priority priority, uint8_t weight);
+
+/* Set the retry policy of a descriptor
+ *
+ * Makes commands recover from transient bus errors by themselves. When the
+ * response is missing or has a bad CRC, it is read again, up to
+ * read_retries times. If that does not help, or the command was not taken
+ * at all, the command is issued again up to command_retries times, and
+ * then up to wake_retries times after an idle-wake cycle. The wait before
+ * each retry starts at backoff_us and doubles up to max_backoff_us.
+ *
+ * Commands that change the state of the device (DeriveKey, GenDig, Lock,
+ * Nonce, SHA, UpdateExtra and Write) or use a key that may have a limited
+ * number of uses (CheckMac, HMAC and MAC) are only issued again if the
+ * device did not take them or reported that they did not run. After an
+ * idle-wake cycle, TempKey is considered lost. A NULL policy, the
+ * default, disables retries. The policy must not be changed while commands
+ * are in flight. Freestanding builds do not copy the policy, it has to stay
+ * valid until it is replaced or s96at_cleanup() is called.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_set_retry_policy(struct s96at_desc *desc,
+			       const struct s96at_retry_policy *policy);
+
+/* Get a percentile of a latency histogram
+ *
+ * Returns the upper bound, in usec, of the bucket that holds the given
+ * percentile (0-100) of the recorded values, or 0 if the histogram is empty.
+ * Buckets are at most 12.5% wide.
+ */
+uint64_t s96at_stats_percentile(const struct s96at_histogram *h, double pct);
+
+/* Disable performance counters
+ *
+ * Stops collecting statistics for the descriptor and frees them. This is
+ * done by s96at_cleanup() as well.
+ */
+void s96at_stats_disable(struct s96at_desc *desc);
+
+/* Enable performance counters
+ *
+ * Starts collecting statistics for the descriptor: commands per opcode,
+ * errors by status, wake, idle and sleep counts, bytes on the wire and
+ * latency histograms of the write, wait and read phases of each command.
+ * Each thread using the descriptor updates its own set of counters, so
+ * collecting them takes no locks. Without this call no statistics are
+ * collected at all. Freestanding builds have no statistics.
+ *
+ * Returns S96AT_STATUS_OK on success, otherwise S96AT_STATUS_BAD_PARAMETERS
+ * or S96AT_STATUS_EXEC_ERROR.
+ */
+uint8_t s96at_stats_enable(struct s96at_desc *desc);
+
+/* Get the index of an opcode in the statistics
+ *
+ * Returns the index of opcode in the commands and latency arrays of
+ * struct s96at_stats. All opcodes not in enum s96at_opcode share the last
+ * index.
+ */
+int s96at_stats_index(uint8_t opcode);
+
+/* Format statistics as OpenMetrics text
+ *
+ * Writes the counters and histograms of stats to buf in the OpenMetrics
+ * text format, terminated by "# EOF". If device is not NULL, it is added
+ * as a "device" label to every sample. Empty histograms and buckets are
+ * left out.
+ *
+ * Returns the length of the text, not counting the terminating NUL. As with
+ * snprintf(), the text was truncated if this is len or more.
+ */
+size_t s96at_stats_openmetrics(const struct s96at_stats *stats,
+			       const char *device, char *buf, size_t len);
+
+/* Take a snapshot of the performance counters
+ *
+ * Sums up the counters of all the threads using the descriptor into stats.
+ * If reset is true, the counters start over from zero after the snapshot.
+ *
+ * Returns S96AT_STATUS_OK on success, S96AT_STATUS_EXEC_ERROR if statistics
+ * are not enabled, otherwise S96AT_STATUS_BAD_PARAMETERS.
+ */
+uint8_t s96at_stats_snapshot(struct s96at_desc *desc, struct s96at_stats *stats,
+			     bool reset);
+
 /* Update extra configuration bytes
  *
  * Updates the extra configuration bytes. When mode is set to S96AT_UPDATE_EXTRA_MODE_USER,
@@ -513,4 +1597,8 @@ uint8_t s96at_write_data(struct s96at_desc *desc, uint8_t id, uint8_t offset,
 uint8_t s96at_write_otp(struct s96at_desc *desc, uint8_t id, const uint8_t *buf,
 			size_t length);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,625 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __S96AT_HPP
+#define __S96AT_HPP
+
+/*
+ * C++20 layer over the C API, header only.
+ *
+ * device owns a descriptor, session a wake window of a device. Commands of
+ * a session are awaitables that send the command, let the executor run
+ * other coroutines for its execution time and read the response, see
+ * s96at_cmd_start(). Buffers are std::span of the size of the command
+ * response, so that a std::array of the wrong size does not compile.
+ *
+ *	s96at::task<uint8_t> auth(s96at::pool &p, const challenge_t &c,
+ *				  std::array<uint8_t, S96AT_MAC_LEN> &mac)
+ *	{
+ *		s96at::session s = co_await p.session();
+ *		co_return co_await s.mac(S96AT_MAC_MODE_0, 0, c, mac);
+ *	}
+ *
+ * Everything runs on the thread of executor::run(), nothing here is thread
+ * safe. Errors are S96AT_STATUS_* codes as in the C API, only constructors
+ * throw, an s96at::error.
+ */
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "s96at.h"
+
+namespace s96at {
+
+class error : public std::runtime_error {
+public:
+	error(const char *what, uint8_t status)
+		: std::runtime_error(what), status(status) {}
+
+	const uint8_t status;
+};
+
+using challenge_t = std::array<uint8_t, S96AT_CHALLENGE_LEN>;
+
+/* Single threaded executor of coroutines, with timers */
+class executor {
+public:
+	using clock = std::chrono::steady_clock;
+
+	executor() = default;
+	executor(const executor &) = delete;
+	executor &operator=(const executor &) = delete;
+
+	/* Resume h from run(), after the coroutines already there */
+	void post(std::coroutine_handle<> h)
+	{
+		ready.push_back(h);
+	}
+
+	/* Resume h from run() once when has passed */
+	void at(clock::time_point when, std::coroutine_handle<> h)
+	{
+		timers.push({ when, seq++, h });
+	}
+
+	/* Run coroutines until there are none left to resume */
+	void run()
+	{
+		std::coroutine_handle<> h;
+
+		while (!ready.empty() || !timers.empty()) {
+			if (ready.empty())
+				std::this_thread::sleep_until(timers.top().when);
+
+			while (!timers.empty() &&
+			       timers.top().when <= clock::now()) {
+				ready.push_back(timers.top().h);
+				timers.pop();
+			}
+
+			while (!ready.empty()) {
+				h = ready.front();
+				ready.pop_front();
+				h.resume();
+			}
+		}
+	}
+
+private:
+	struct timer {
+		clock::time_point when;
+		/* Timers due at the same time run in order */
+		uint64_t seq;
+		std::coroutine_handle<> h;
+
+		bool operator>(const timer &o) const
+		{
+			return when != o.when ? when > o.when : seq > o.seq;
+		}
+	};
+
+	std::deque<std::coroutine_handle<>> ready;
+	std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers;
+	uint64_t seq = 0;
+};
+
+/*
+ * Coroutine returning a T, which starts once it is awaited and resumes its
+ * awaiter when it is done. See spawn() to run one on its own.
+ */
+template <typename T = void>
+class task;
+
+namespace detail {
+
+template <typename T>
+struct promise_base {
+	std::coroutine_handle<> next;
+	std::exception_ptr exception;
+
+	struct final_awaiter {
+		bool await_ready() noexcept { return false; }
+
+		template <typename P>
+		std::coroutine_handle<>
+		await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			if (h.promise().next)
+				return h.promise().next;
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	final_awaiter final_suspend() noexcept { return {}; }
+
+	void unhandled_exception()
+	{
+		exception = std::current_exception();
+	}
+};
+
+template <typename T>
+struct promise : promise_base<T> {
+	std::optional<T> value;
+
+	task<T> get_return_object();
+
+	void return_value(T v)
+	{
+		value = std::move(v);
+	}
+
+	T result()
+	{
+		if (this->exception)
+			std::rethrow_exception(this->exception);
+		return std::move(*value);
+	}
+};
+
+template <>
+struct promise<void> : promise_base<void> {
+	task<void> get_return_object();
+
+	void return_void() {}
+
+	void result()
+	{
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+};
+
+/* Frame of spawn(), which frees itself once the task is done */
+struct detached {
+	struct promise_type {
+		detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+} /* namespace detail */
+
+template <typename T>
+class task {
+public:
+	using promise_type = detail::promise<T>;
+
+	explicit task(std::coroutine_handle<promise_type> h) : h(h) {}
+	task(task &&o) noexcept : h(std::exchange(o.h, nullptr)) {}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+
+	~task()
+	{
+		if (h)
+			h.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> next)
+	{
+		h.promise().next = next;
+		return h;
+	}
+
+	T await_resume()
+	{
+		return h.promise().result();
+	}
+
+private:
+	std::coroutine_handle<promise_type> h;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object()
+{
+	return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object()
+{
+	return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+inline detached run_detached(task<void> t)
+{
+	co_await t;
+}
+
+} /* namespace detail */
+
+/*
+ * Runs t on its own. It starts right away, up to the first time it has to
+ * wait, and goes on from executor::run(). Exceptions terminate.
+ */
+inline void spawn(task<void> t)
+{
+	detail::run_detached(std::move(t));
+}
+
+/* Owns a device descriptor, which stays at the same address */
+class device {
+public:
+	/* See s96at_init() */
+	explicit device(enum s96at_io_interface_type iface = S96AT_IO_I2C_LINUX,
+			enum s96at_device type = S96AT_ATSHA204A)
+		: desc(new s96at_desc())
+	{
+		check(s96at_init(type, iface, desc.get()));
+	}
+
+	static device i2c(const char *path, uint8_t addr,
+			  enum s96at_device type = S96AT_ATSHA204A)
+	{
+		device d(nullptr);
+
+		d.check(s96at_init_i2c(type, path, addr, d.desc.get()));
+
+		return d;
+	}
+
+	static device daemon(const char *path, bool ring = false,
+			     enum s96at_device type = S96AT_ATSHA204A)
+	{
+		device d(nullptr);
+
+		d.check(s96at_init_daemon(type, path, ring, d.desc.get()));
+
+		return d;
+	}
+
+	static device emulator(uint32_t id,
+			       enum s96at_device type = S96AT_ATSHA204A)
+	{
+		device d(nullptr);
+
+		d.check(s96at_init_emulator(type, id, d.desc.get()));
+
+		return d;
+	}
+
+	device(device &&) noexcept = default;
+
+	/* The descriptor of this one is cleaned up along with o */
+	device &operator=(device &&o) noexcept
+	{
+		std::swap(desc, o.desc);
+
+		return *this;
+	}
+
+	~device()
+	{
+		if (desc && desc->ioif)
+			s96at_cleanup(desc.get());
+	}
+
+	s96at_desc *get() const { return desc.get(); }
+
+private:
+	explicit device(std::nullptr_t) : desc(new s96at_desc()) {}
+
+	void check(uint8_t ret)
+	{
+		if (ret != S96AT_STATUS_OK)
+			throw error("Could not initialize the device", ret);
+	}
+
+	std::unique_ptr<s96at_desc> desc;
+};
+
+class pool;
+
+/*
+ * Awaitable command of a session. Returns the status of the command once
+ * its response has been read into the buffer it was given.
+ */
+class command {
+public:
+	command(executor &exec, s96at_desc *desc, const s96at_batch_cmd &cmd)
+		: exec(exec), desc(desc), cmd(cmd) {}
+
+	/* A command that is not sent and completes with status */
+	command(executor &exec, uint8_t status)
+		: exec(exec), desc(nullptr), cmd(), status(status) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		uint32_t ms;
+
+		if (!desc)
+			return false;
+
+		status = s96at_cmd_start(desc, &cmd, &ms);
+		if (status != S96AT_STATUS_OK)
+			return false;
+
+		started = true;
+		exec.at(executor::clock::now() + std::chrono::milliseconds(ms), h);
+
+		return true;
+	}
+
+	uint8_t await_resume()
+	{
+		return started ? s96at_cmd_finish(desc, &cmd) : status;
+	}
+
+private:
+	executor &exec;
+	s96at_desc *desc;
+	s96at_batch_cmd cmd;
+	uint8_t status = S96AT_STATUS_EXEC_ERROR;
+	bool started = false;
+};
+
+/*
+ * Wake window of a device, which is put to idle, keeping TempKey, when the
+ * session goes away. Sessions of a pool give the device back to the pool.
+ */
+class session {
+public:
+	/* Wakes the device up, see awake() */
+	session(device &dev, executor &exec)
+		: session(dev.get(), exec, nullptr, 0) {}
+
+	session(session &&o) noexcept
+		: exec(o.exec), desc(std::exchange(o.desc, nullptr)),
+		  owner(o.owner), index(o.index), woken(o.woken) {}
+
+	session(const session &) = delete;
+	session &operator=(const session &) = delete;
+
+	~session();
+
+	/* Whether the device answered the wake */
+	bool awake() const { return woken; }
+
+	s96at_desc *get() const { return desc; }
+
+	/* Any command, see s96at_batch() for the fields of cmd */
+	command run(const s96at_batch_cmd &cmd)
+	{
+		return command(exec, desc, cmd);
+	}
+
+	command devrev(std::span<uint8_t, S96AT_DEVREV_LEN> out)
+	{
+		return run(make(S96AT_OPCODE_DEVREV, 0, 0, {}, out));
+	}
+
+	/*
+	 * Modes 0 and 2 send the challenge, flags as in s96at_get_mac().
+	 * Flags it refuses complete with S96AT_STATUS_BAD_PARAMETERS.
+	 */
+	command mac(enum s96at_mac_mode mode, uint8_t slot,
+		    std::span<const uint8_t, S96AT_CHALLENGE_LEN> challenge,
+		    std::span<uint8_t, S96AT_MAC_LEN> out,
+		    uint32_t flags = S96AT_FLAG_TEMPKEY_SOURCE_INPUT)
+	{
+		bool send = mode == S96AT_MAC_MODE_0 || mode == S96AT_MAC_MODE_2;
+		uint8_t param1;
+		uint8_t ret = s96at_mac_mode(mode, flags, &param1);
+
+		if (ret != S96AT_STATUS_OK)
+			return command(exec, ret);
+
+		return run(make(S96AT_OPCODE_MAC, param1, slot,
+				send ? std::span<const uint8_t>(challenge) :
+				std::span<const uint8_t>(), out));
+	}
+
+	/* Flags as in s96at_get_hmac(), see mac() */
+	command hmac(uint8_t slot, std::span<uint8_t, S96AT_HMAC_LEN> out,
+		     uint32_t flags = S96AT_FLAG_TEMPKEY_SOURCE_INPUT)
+	{
+		uint8_t param1;
+		uint8_t ret;
+
+		if (!(flags & (S96AT_FLAG_TEMPKEY_SOURCE_INPUT |
+			       S96AT_FLAG_TEMPKEY_SOURCE_RANDOM)))
+			flags |= S96AT_FLAG_TEMPKEY_SOURCE_RANDOM;
+
+		ret = s96at_mac_mode(S96AT_MAC_MODE_0, flags, &param1);
+
+		if (ret != S96AT_STATUS_OK)
+			return command(exec, ret);
+
+		return run(make(S96AT_OPCODE_HMAC, param1, slot, {}, out));
+	}
+
+	/* Nonce in passthrough mode, TempKey is set to in */
+	command nonce(std::span<const uint8_t, S96AT_CHALLENGE_LEN> in)
+	{
+		return run(make(S96AT_OPCODE_NONCE, S96AT_NONCE_MODE_PASSTHROUGH,
+				0, in, {}));
+	}
+
+	command random(std::span<uint8_t, S96AT_RANDOM_LEN> out,
+		       enum s96at_random_mode mode = S96AT_RANDOM_MODE_UPDATE_SEED)
+	{
+		return run(make(S96AT_OPCODE_RANDOM, mode, 0, {}, out));
+	}
+
+	/* A word or a block of a zone, addr counts words as in the datasheet */
+	template <size_t N>
+		requires (N == 4 || N == 32)
+	command read(enum s96at_zone zone, uint8_t addr,
+		     std::span<uint8_t, N> out)
+	{
+		uint8_t param1 = zone;
+
+		/* Bit 7 selects a block read, OTP takes words only */
+		if (N == 32 && zone != S96AT_ZONE_OTP)
+			param1 |= 0x80;
+
+		return run(make(S96AT_OPCODE_READ, param1, addr, {}, out));
+	}
+
+	template <size_t N>
+		requires (N == 4 || N == 32)
+	command read(enum s96at_zone zone, uint8_t addr,
+		     std::array<uint8_t, N> &out)
+	{
+		return read(zone, addr, std::span<uint8_t, N>(out));
+	}
+
+private:
+	friend class pool;
+
+	session(s96at_desc *desc, executor &exec, pool *owner, size_t index)
+		: exec(exec), desc(desc), owner(owner), index(index)
+	{
+		for (int i = 0; i < 10 && !woken; i++)
+			woken = s96at_wake(desc) == S96AT_STATUS_READY;
+	}
+
+	static s96at_batch_cmd make(uint8_t opcode, uint8_t param1,
+				    uint16_t param2,
+				    std::span<const uint8_t> data,
+				    std::span<uint8_t> out)
+	{
+		s96at_batch_cmd cmd = {};
+
+		cmd.opcode = opcode;
+		cmd.param1 = param1;
+		cmd.param2 = param2;
+		cmd.data = data.data();
+		cmd.data_len = data.size();
+		cmd.out = out.data();
+		cmd.out_len = out.size();
+
+		return cmd;
+	}
+
+	executor &exec;
+	s96at_desc *desc;
+	pool *owner;
+	size_t index;
+	bool woken = false;
+};
+
+/*
+ * Devices shared by the coroutines of an executor, one session per device
+ * at a time. Sessions go to the coroutines in the order they asked.
+ */
+class pool {
+public:
+	explicit pool(executor &exec) : exec(exec) {}
+
+	pool(const pool &) = delete;
+	pool &operator=(const pool &) = delete;
+
+	void add(device &&dev)
+	{
+		devices.push_back(std::move(dev));
+		release(devices.size() - 1);
+	}
+
+	size_t size() const { return devices.size(); }
+
+	class acquire {
+	public:
+		explicit acquire(pool &p) : p(p) {}
+
+		bool await_ready()
+		{
+			if (p.free.empty() || !p.waiters.empty())
+				return false;
+
+			index = p.free.back();
+			p.free.pop_back();
+
+			return true;
+		}
+
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			this->h = h;
+			p.waiters.push_back(this);
+		}
+
+		/* Wakes the device up, see session::awake() */
+		s96at::session await_resume()
+		{
+			return s96at::session(p.devices[index].get(), p.exec,
+					      &p, index);
+		}
+
+	private:
+		friend class pool;
+
+		pool &p;
+		std::coroutine_handle<> h;
+		size_t index = 0;
+	};
+
+	/* Awaitable session on the next free device */
+	acquire session()
+	{
+		return acquire(*this);
+	}
+
+private:
+	friend class s96at::session;
+
+	void release(size_t index)
+	{
+		acquire *a;
+
+		if (waiters.empty()) {
+			free.push_back(index);
+			return;
+		}
+
+		a = waiters.front();
+		waiters.pop_front();
+		a->index = index;
+		exec.post(a->h);
+	}
+
+	executor &exec;
+	std::vector<device> devices;
+	std::vector<size_t> free;
+	std::deque<acquire *> waiters;
+};
+
+inline session::~session()
+{
+	if (!desc)
+		return;
+
+	s96at_idle(desc);
+	if (owner)
+		owner->release(index);
+}
+
+} /* namespace s96at */
+
+#endif
@@ -5,9 +5,244 @@
 #ifndef __S96AT_PRIVATE_H
 #define __S96AT_PRIVATE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "s96at_config.h"
+
+#ifndef S96AT_FREESTANDING
+#include <pthread.h>
+#endif
+
+struct s96at_clock;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Shadow state of the device's TempKey register */
+struct s96at_tempkey {
+	bool valid;
+	bool known;
+	uint8_t source;
+	bool gendig;
+	uint8_t gendig_zone;
+	uint8_t gendig_slot;
+	uint8_t value_hash[32];
+	bool awake;
+	uint64_t wake_ms;
+	/* Runs the watchdog, NULL for the host's clock */
+	const struct s96at_clock *clock;
+};
+
+#define S96AT_NUM_SLOTS				16
+
+/* SlotConfig of a Data zone slot, section 2.2.1 of the datasheet */
+struct s96at_slot_config {
+	uint8_t read_key;
+	bool check_only;
+	bool single_use;
+	bool encrypt_read;
+	bool is_secret;
+	uint8_t write_key;
+	uint8_t write_config;	/* S96AT_WRITE_CONFIG_* bits */
+};
+
+/* Slot permissions of the device, see s96at_load_config() */
+struct s96at_config {
+	bool loaded;
+	bool data_locked;
+	struct s96at_slot_config slots[S96AT_NUM_SLOTS];
+};
+
 struct s96at_desc {
 	uint8_t dev;
 	struct io_interface *ioif;
+	struct s96at_tempkey tempkey;
+	struct s96at_config config;
+};
+
+#define S96AT_BUS_MAX_CHIPS			8
+
+/* Devices sharing one bus, see s96at_bus_init() */
+struct s96at_bus {
+	struct s96at_desc chips[S96AT_BUS_MAX_CHIPS];
+	size_t num_chips;
+};
+
+/* The entropy queue, the DRBG and attestations need threads */
+#ifndef S96AT_FREESTANDING
+/* Number of Random commands issued each time the entropy queue runs dry */
+#define S96AT_ENTROPY_BATCH			4
+
+struct s96at_entropy {
+	struct s96at_desc *desc;
+	pthread_mutex_t lock;
+	uint8_t buf[S96AT_ENTROPY_BATCH * 32];
+	size_t avail;
+	uint8_t last[32];
+};
+
+struct s96at_drbg {
+	struct s96at_entropy *src;
+	uint8_t key[32];
+	uint8_t v[32];
+	uint64_t reseed_counter;
+	uint64_t reseed_bytes;
+	uint64_t bytes_since_reseed;
+	uint32_t reseed_ms;
+	uint64_t last_reseed_ms;
 };
 
+struct s96at_attest {
+	struct s96at_desc *desc;
+	uint8_t slot;
+	pthread_mutex_t lock;
+	uint8_t (*tree)[32];
+	size_t max_leaves;
+	size_t num_leaves;
+	uint32_t window_ms;
+	uint64_t first_ms;
+	bool sealed;
+	uint8_t root[32];
+	uint8_t mac[32];
+};
+#else
+struct s96at_entropy;
+struct s96at_drbg;
+struct s96at_attest;
+#endif
+
+/*
+ * Key bundle file, see s96at_bundle_open(). The file holds the header, the
+ * index sorted by serial number and the records, in that order. Multi-byte
+ * fields are little endian.
+ */
+#define S96AT_BUNDLE_MAGIC			"S96B"
+#define S96AT_BUNDLE_VERSION			1
+
+/* Set in the record flags once the record has been wiped */
+#define S96AT_BUNDLE_RECORD_USED		0x01
+
+struct __attribute__ ((__packed__)) s96at_bundle_header {
+	uint8_t magic[4];
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t num_records;
+	uint32_t reserved;
+	uint64_t index_offset;
+	uint64_t records_offset;
+};
+
+struct __attribute__ ((__packed__)) s96at_bundle_index {
+	uint8_t serial[9];
+	uint8_t reserved[3];
+	uint32_t record;
+};
+
+struct __attribute__ ((__packed__)) s96at_bundle_record {
+	uint8_t serial[9];
+	uint8_t flags;
+	uint16_t data_crc;	/* Lock CRC over data and otp */
+	uint8_t data[512];
+	uint8_t otp[64];
+};
+
+struct s96at_bundle {
+	uint8_t *map;
+	size_t size;
+	const struct s96at_bundle_index *index;
+	struct s96at_bundle_record *records;
+	uint32_t num_records;
+};
+
+/*
+ * Bus capture file, see s96at_record_start(). The header is followed by a
+ * record per call of the io interface, each one followed by len bytes of
+ * payload: the bytes written or read. Multi-byte fields are little endian.
+ */
+#define S96AT_CAPTURE_MAGIC			"S96C"
+#define S96AT_CAPTURE_VERSION			1
+
+enum s96at_capture_op {
+	S96AT_CAPTURE_OPEN,
+	S96AT_CAPTURE_WRITE,
+	S96AT_CAPTURE_READ,
+	S96AT_CAPTURE_WAKE,
+	S96AT_CAPTURE_CLOSE
+};
+
+struct __attribute__ ((__packed__)) s96at_capture_header {
+	uint8_t magic[4];
+	uint16_t version;
+	uint16_t reserved;
+	uint64_t start_us;	/* Wall clock time of the first record */
+};
+
+struct __attribute__ ((__packed__)) s96at_capture_record {
+	uint8_t op;
+	uint8_t reserved;
+	uint16_t len;
+	uint32_t delta_us;	/* Since the start of the previous call */
+	uint32_t duration_us;
+	uint32_t ret;
+};
+
+/* Provisioning profile, see s96at_profile_parse() */
+struct s96at_profile {
+	uint8_t config[88];
+	uint8_t config_mask[88];
+	uint8_t data[512];
+	uint16_t slots;
+	uint16_t random_slots;
+	uint8_t otp[64];
+	uint16_t otp_words;
+	bool lock_config;
+	bool lock_data;
+};
+
+/* Config words, Config lock, Data slots, OTP blocks and Data lock */
+#define S96AT_PLAN_MAX_STEPS			(16 + 1 + 16 + 2 + 1)
+
+struct s96at_plan_step {
+	uint8_t opcode;
+	uint8_t param1;
+	uint16_t param2;
+	const uint8_t *data;	/* Points into the plan or a bundle record */
+	uint8_t len;
+};
+
+struct s96at_plan {
+	struct s96at_plan_step steps[S96AT_PLAN_MAX_STEPS];
+	size_t num_steps;
+	uint8_t config[88];
+	uint8_t data[512];
+	uint8_t otp[64];
+	uint16_t config_crc;
+	uint16_t data_crc;
+};
+
+struct s96at_log {
+	struct s96at_desc *desc;
+	uint8_t slot;
+	uint8_t head[32];
+	uint64_t seq;
+	uint32_t pending;
+	uint32_t every;
+	uint32_t interval_ms;
+	uint64_t last_ms;
+};
+
+struct s96at_log_verifier {
+	uint8_t key[32];
+	uint8_t slot;
+	uint8_t head[32];
+	uint64_t seq;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
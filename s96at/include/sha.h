@@ -5,13 +5,46 @@
 #ifndef __SHA_H
 #define __SHA_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define SHA_BLOCK_LEN		64
+#define SHA_DIGEST_LEN		32
 #define SHA_PADDING_LENGTH_LEN	8
 
+/*
+ * Host-side SHA-256 state, used where the library needs to compute or
+ * verify values without a round-trip to the device.
+ */
+struct sha256_ctx {
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t block[SHA_BLOCK_LEN];
+	size_t block_len;
+};
+
+struct hmac_sha256_ctx {
+	struct sha256_ctx inner;
+	struct sha256_ctx outer;
+};
+
 /* Apply SHA padding as defined in FIPS 180-2.
  * The message buffer is modified in-place.
  */
 int sha_apply_padding(uint8_t *buf, size_t buf_len, size_t msg_len,
 		      size_t *padded_msg_len);
 
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len);
+void sha256_final(struct sha256_ctx *ctx, uint8_t *digest);
+void sha256(const void *data, size_t len, uint8_t *digest);
+
+void hmac_sha256_init(struct hmac_sha256_ctx *ctx, const uint8_t *key,
+		      size_t key_len);
+void hmac_sha256_update(struct hmac_sha256_ctx *ctx, const void *data,
+			size_t len);
+void hmac_sha256_final(struct hmac_sha256_ctx *ctx, uint8_t *mac);
+void hmac_sha256(const uint8_t *key, size_t key_len, const void *data,
+		 size_t len, uint8_t *mac);
+
 #endif
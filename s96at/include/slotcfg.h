@@ -0,0 +1,32 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __SLOTCFG_H
+#define __SLOTCFG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <s96at.h>
+
+/*
+ * Host side copy of the slot permissions of the device, decoded from its
+ * Config zone, see s96at_load_config(). The checks below only refuse a
+ * command that the device would refuse as well: they apply once the
+ * Config zone is locked, so that SlotConfig can no longer change, and the
+ * Data zone is known to be locked, which cannot be undone either.
+ */
+void slotcfg_decode(struct s96at_config *cfg, const uint8_t *zone);
+void slotcfg_update(struct s96at_config *cfg, uint8_t opcode, uint8_t param1,
+		    uint8_t status);
+
+bool slotcfg_can_read(const struct s96at_config *cfg, uint8_t slot,
+		      size_t length);
+bool slotcfg_can_write(const struct s96at_config *cfg, uint8_t slot,
+		       size_t length, bool encrypted);
+bool slotcfg_can_use_key(const struct s96at_config *cfg, uint8_t slot);
+bool slotcfg_can_derive(const struct s96at_config *cfg, uint8_t slot);
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __STATS_H
+#define __STATS_H
+#include <stdint.h>
+
+#include <io.h>
+#include <s96at.h>
+
+/*
+ * Counters are only ever written by the thread that owns them, but they
+ * are read by s96at_stats_snapshot() from other threads, so stores have to
+ * be single copy atomic.
+ */
+#define STATS_ADD(var, n) \
+	__atomic_store_n(&(var), (var) + (n), __ATOMIC_RELAXED)
+
+#ifndef S96AT_FREESTANDING
+/*
+ * Returns the counters of the calling thread, or NULL if statistics are
+ * not enabled on the interface.
+ */
+struct s96at_stats *stats_local(struct io_interface *ioif);
+
+void stats_record(struct s96at_histogram *h, uint64_t us);
+
+uint64_t stats_now_us(void);
+#else
+/*
+ * Statistics take the heap and threads, freestanding builds go without and
+ * the compiler drops the code that updates them.
+ */
+static inline struct s96at_stats *stats_local(struct io_interface *ioif)
+{
+	return NULL;
+}
+
+static inline void stats_record(struct s96at_histogram *h, uint64_t us)
+{
+}
+
+static inline uint64_t stats_now_us(void)
+{
+	return 0;
+}
+#endif
+#endif
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __TEMPKEY_H
+#define __TEMPKEY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <io.h>
+#include <s96at.h>
+
+/*
+ * Shadow copy of the device's TempKey register. The state is derived from
+ * the commands issued through the descriptor and from the wake, idle and
+ * sleep transitions, and it is used to skip Nonce / GenDig commands that
+ * would recreate the value already held in TempKey.
+ *
+ * The model is conservative: any command that may consume or modify
+ * TempKey in a way that is not tracked invalidates the shadow state.
+ */
+void tempkey_invalidate(struct s96at_tempkey *tk);
+void tempkey_wake(struct s96at_tempkey *tk);
+void tempkey_idle(struct s96at_tempkey *tk);
+void tempkey_sleep(struct s96at_tempkey *tk);
+/*
+ * ioif is the interface the commands went through. An idle-wake cycle of
+ * a retry on it, even one of a command that is not tracked, invalidates
+ * the state.
+ */
+void tempkey_update(struct s96at_tempkey *tk, struct io_interface *ioif,
+		    uint8_t opcode, uint8_t param1, uint16_t param2,
+		    const uint8_t *data, size_t data_len, uint8_t status);
+bool tempkey_matches(struct s96at_tempkey *tk, struct io_interface *ioif,
+		     const uint8_t *value, bool gendig, uint8_t zone,
+		     uint8_t slot);
+
+#endif
@@ -0,0 +1,932 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <openssl/core.h>
+#include <openssl/core_dispatch.h>
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmd.h>
+#include <device.h>
+#include <personalize.h>
+#include <s96at.h>
+#include <sha.h>
+#include <stats.h>
+
+/*
+ * OpenSSL 3 provider "s96at", exposing a pool of devices as:
+ *
+ *  EVP_RAND "S96AT"      the RNG of the devices, usable as a seed source
+ *  EVP_MAC "S96AT-HMAC"  HMAC-SHA256 keyed by a slot of the devices, over
+ *                        the SHA-256 digest of the input. The slot is set
+ *                        through the "slot" parameter (default 0).
+ *
+ * The devices are taken from the "devices" parameter of the provider
+ * section in openssl.cnf, or else from the S96AT_DEVICES environment
+ * variable, as a comma separated list of path[@addr] or emulator:id.
+ * Emulated devices get the personalization of the test device. All devices
+ * of the pool must hold the same keys.
+ *
+ * Devices are opened once, when the provider is loaded, and are only woken
+ * up again once half of the watchdog budget has passed, so most calls pay
+ * for the commands alone. Random bytes are prefetched in the background and
+ * concurrent requests are served from the same batch of Random commands.
+ */
+#define POOL_MAX_DEVICES	16
+#define WAKE_RETRIES		10
+
+/* Random commands per refill, all within the same wake window */
+#define REFILL_BATCH		8
+
+#define PREFETCH_LEN		(4 * REFILL_BATCH * S96AT_RANDOM_LEN)
+
+/* The background refill starts once less than this is left */
+#define PREFETCH_LOW		(PREFETCH_LEN / 2)
+
+#define RAND_MAX_REQUEST	(1 << 16)
+#define RAND_STRENGTH		256
+
+#define S96AT_MAC_PARAM_SLOT	"slot"
+#define S96AT_PROV_PARAM_DEVICES	"devices"
+
+enum {
+	S96AT_R_DEVICE_FAILURE = 1,
+	S96AT_R_KEY_NOT_ALLOWED,
+	S96AT_R_BAD_SLOT,
+	S96AT_R_NOT_INSTANTIATED,
+};
+
+struct pool_dev {
+	struct s96at_desc desc;
+	bool busy;
+	bool awake;
+	uint64_t woken_us;
+	uint8_t last[S96AT_RANDOM_LEN];
+};
+
+struct s96at_pool {
+	const OSSL_CORE_HANDLE *handle;
+	OSSL_FUNC_core_new_error_fn *new_error;
+	OSSL_FUNC_core_vset_error_fn *vset_error;
+	pthread_mutex_t lock;
+	/* A device was released or random bytes were added */
+	pthread_cond_t cond;
+	/* The prefetched random bytes run low */
+	pthread_cond_t low;
+	struct pool_dev devs[POOL_MAX_DEVICES];
+	unsigned int num_devs;
+	unsigned int next;
+	/* Bytes are served from the end and refills are appended */
+	uint8_t rnd[PREFETCH_LEN];
+	size_t avail;
+	size_t pending;
+	pthread_t prefetch;
+	bool started;
+	bool stop;
+};
+
+struct rand_ctx {
+	struct s96at_pool *pool;
+	int state;
+};
+
+struct mac_ctx {
+	struct s96at_pool *pool;
+	struct sha256_ctx sha;
+	uint8_t slot;
+};
+
+static void prov_error(struct s96at_pool *pool, uint32_t reason,
+		       const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!pool->new_error || !pool->vset_error)
+		return;
+
+	va_start(ap, fmt);
+	pool->new_error(pool->handle);
+	pool->vset_error(pool->handle, reason, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * Makes sure the device is awake and has at least half of the watchdog
+ * budget left. A device that may still be awake is put to idle first, as
+ * it would ignore the wake otherwise.
+ */
+static bool dev_wake(struct pool_dev *d)
+{
+	int i;
+	uint64_t now = stats_now_us();
+
+	if (d->awake && now - d->woken_us < S96AT_WATCHDOG_TIME * 1000ULL / 2)
+		return true;
+
+	s96at_idle(&d->desc);
+
+	for (i = 0; i < WAKE_RETRIES; i++) {
+		if (s96at_wake(&d->desc) == S96AT_STATUS_READY)
+			break;
+	}
+
+	d->awake = i < WAKE_RETRIES;
+	d->woken_us = now;
+
+	return d->awake;
+}
+
+/* Takes a free device of the pool, awake. Called with the lock held. */
+static struct pool_dev *pool_acquire(struct s96at_pool *pool)
+{
+	struct pool_dev *d = NULL;
+	unsigned int i;
+
+	while (!d) {
+		for (i = 0; i < pool->num_devs; i++) {
+			d = &pool->devs[(pool->next + i) % pool->num_devs];
+			if (!d->busy)
+				break;
+			d = NULL;
+		}
+		if (!d)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+	}
+
+	d->busy = true;
+	pool->next = (d - pool->devs + 1) % pool->num_devs;
+
+	pthread_mutex_unlock(&pool->lock);
+	if (!dev_wake(d)) {
+		pthread_mutex_lock(&pool->lock);
+		d->busy = false;
+		pthread_cond_broadcast(&pool->cond);
+		return NULL;
+	}
+	pthread_mutex_lock(&pool->lock);
+
+	return d;
+}
+
+/* Returns a device to the pool. Called with the lock held. */
+static void pool_release(struct s96at_pool *pool, struct pool_dev *d,
+			 bool ok)
+{
+	/* After a failure, the state of the device is unknown */
+	if (!ok)
+		d->awake = false;
+
+	d->busy = false;
+	pthread_cond_broadcast(&pool->cond);
+}
+
+/*
+ * Runs a batch of Random commands on one device and appends the result to
+ * the prefetched bytes. Called with the lock held, which is dropped while
+ * the commands run so that other devices can refill at the same time.
+ * Errors are left to the caller to report, the prefetch thread has no one
+ * to report them to.
+ */
+static bool pool_refill(struct s96at_pool *pool)
+{
+	uint8_t buf[REFILL_BATCH * S96AT_RANDOM_LEN];
+	struct pool_dev *d;
+	size_t space;
+	size_t n = 0;
+	uint8_t ret = S96AT_STATUS_OK;
+
+	space = sizeof(pool->rnd) - pool->avail - pool->pending;
+	space -= space % S96AT_RANDOM_LEN;
+	if (space > sizeof(buf))
+		space = sizeof(buf);
+	if (!space)
+		return true;
+
+	pool->pending += space;
+
+	d = pool_acquire(pool);
+	if (!d) {
+		pool->pending -= space;
+		pthread_cond_broadcast(&pool->cond);
+		return false;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	while (n < space) {
+		ret = s96at_get_random(&d->desc, S96AT_RANDOM_MODE_UPDATE_SEED,
+				       buf + n);
+		if (ret != S96AT_STATUS_OK)
+			break;
+
+		/*
+		 * Continuous test: an unlocked device returns a fixed pattern
+		 * and a stuck RNG returns the same block over and over again.
+		 */
+		if (!memcmp(buf + n, d->last, S96AT_RANDOM_LEN)) {
+			ret = S96AT_STATUS_EXEC_ERROR;
+			break;
+		}
+		memcpy(d->last, buf + n, S96AT_RANDOM_LEN);
+		n += S96AT_RANDOM_LEN;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+
+	/* Bytes are only taken from the end, so the space is still there */
+	memcpy(pool->rnd + pool->avail, buf, n);
+	OPENSSL_cleanse(buf, sizeof(buf));
+	pool->avail += n;
+	pool->pending -= space;
+
+	pool_release(pool, d, ret == S96AT_STATUS_OK);
+
+	return ret == S96AT_STATUS_OK;
+}
+
+static void *pool_prefetch(void *arg)
+{
+	struct s96at_pool *pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (!pool->stop) {
+		if (pool->avail + pool->pending >= PREFETCH_LOW) {
+			pthread_cond_wait(&pool->low, &pool->lock);
+			continue;
+		}
+
+		/* Requests fill in on their own until the devices are back */
+		if (!pool_refill(pool))
+			pthread_cond_wait(&pool->low, &pool->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/*
+ * Serves len bytes out of the prefetched ones. When there are none left,
+ * the request either waits for a refill in flight or runs one itself;
+ * requests that arrive meanwhile are all served from the same batch.
+ */
+static bool pool_random(struct s96at_pool *pool, uint8_t *out, size_t len)
+{
+	uint8_t *p;
+	size_t n;
+	bool ok = true;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (len) {
+		if (!pool->avail) {
+			if (pool->pending)
+				pthread_cond_wait(&pool->cond, &pool->lock);
+			else
+				ok = pool_refill(pool);
+			if (!ok) {
+				prov_error(pool, S96AT_R_DEVICE_FAILURE,
+					   "could not get random bytes");
+				break;
+			}
+			continue;
+		}
+
+		n = len < pool->avail ? len : pool->avail;
+		p = pool->rnd + pool->avail - n;
+
+		memcpy(out, p, n);
+		OPENSSL_cleanse(p, n);
+
+		pool->avail -= n;
+		out += n;
+		len -= n;
+	}
+
+	if (pool->avail + pool->pending < PREFETCH_LOW)
+		pthread_cond_signal(&pool->low);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return ok;
+}
+
+static int pool_add(struct s96at_pool *pool, char *spec)
+{
+	struct pool_dev *d;
+	char *at;
+	char *end;
+	long id;
+	uint8_t addr = ATSHA204A_ADDR;
+	uint8_t ret;
+
+	if (pool->num_devs == POOL_MAX_DEVICES)
+		return -1;
+
+	d = &pool->devs[pool->num_devs];
+
+	if (!strncmp(spec, "emulator:", 9)) {
+		id = strtol(spec + 9, &end, 0);
+		if (end == spec + 9 || *end || id < 0)
+			return -1;
+
+		ret = s96at_init_emulator(S96AT_ATSHA204A, id, &d->desc);
+		if (ret != S96AT_STATUS_OK)
+			return -1;
+
+		/* Emulated devices get the personalization of the test device */
+		if (atsha204a_personalize(d->desc.ioif) != S96AT_STATUS_OK) {
+			s96at_cleanup(&d->desc);
+			return -1;
+		}
+	} else {
+		at = strchr(spec, '@');
+		if (at) {
+			*at = '\0';
+			addr = strtoul(at + 1, NULL, 0);
+		}
+
+		ret = s96at_init_i2c(S96AT_ATSHA204A, spec, addr, &d->desc);
+		if (ret != S96AT_STATUS_OK)
+			return -1;
+	}
+
+	pool->num_devs++;
+
+	return 0;
+}
+
+static void pool_free(struct s96at_pool *pool)
+{
+	unsigned int i;
+
+	if (pool->started) {
+		pthread_mutex_lock(&pool->lock);
+		pool->stop = true;
+		pthread_cond_signal(&pool->low);
+		pthread_mutex_unlock(&pool->lock);
+		pthread_join(pool->prefetch, NULL);
+	}
+
+	for (i = 0; i < pool->num_devs; i++) {
+		s96at_idle(&pool->devs[i].desc);
+		s96at_cleanup(&pool->devs[i].desc);
+	}
+
+	pthread_cond_destroy(&pool->low);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	OPENSSL_cleanse(pool, sizeof(*pool));
+	free(pool);
+}
+
+static struct s96at_pool *pool_create(const char *devices)
+{
+	struct s96at_pool *pool;
+	char *list;
+	char *spec;
+	char *save;
+
+	pool = calloc(1, sizeof(*pool));
+	list = strdup(devices);
+	if (!pool || !list)
+		goto err;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pthread_cond_init(&pool->low, NULL);
+
+	for (spec = strtok_r(list, ",", &save); spec;
+	     spec = strtok_r(NULL, ",", &save)) {
+		if (pool_add(pool, spec)) {
+			free(list);
+			pool_free(pool);
+			return NULL;
+		}
+	}
+	free(list);
+
+	if (!pool->num_devs ||
+	    pthread_create(&pool->prefetch, NULL, pool_prefetch, pool)) {
+		pool_free(pool);
+		return NULL;
+	}
+	pool->started = true;
+
+	return pool;
+err:
+	free(list);
+	free(pool);
+
+	return NULL;
+}
+
+/* EVP_RAND */
+
+static void *rand_newctx(void *provctx, void *parent,
+			 const OSSL_DISPATCH *parent_calls)
+{
+	struct rand_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->pool = provctx;
+	ctx->state = EVP_RAND_STATE_UNINITIALISED;
+
+	return ctx;
+}
+
+static void rand_freectx(void *vctx)
+{
+	free(vctx);
+}
+
+static int rand_instantiate(void *vctx, unsigned int strength,
+			    int prediction_resistance,
+			    const unsigned char *pstr, size_t pstr_len,
+			    const OSSL_PARAM params[])
+{
+	struct rand_ctx *ctx = vctx;
+
+	if (strength > RAND_STRENGTH)
+		return 0;
+
+	ctx->state = EVP_RAND_STATE_READY;
+
+	return 1;
+}
+
+static int rand_uninstantiate(void *vctx)
+{
+	struct rand_ctx *ctx = vctx;
+
+	ctx->state = EVP_RAND_STATE_UNINITIALISED;
+
+	return 1;
+}
+
+static int rand_generate(void *vctx, unsigned char *out, size_t outlen,
+			 unsigned int strength, int prediction_resistance,
+			 const unsigned char *addin, size_t addin_len)
+{
+	struct rand_ctx *ctx = vctx;
+
+	if (ctx->state != EVP_RAND_STATE_READY) {
+		prov_error(ctx->pool, S96AT_R_NOT_INSTANTIATED, NULL);
+		return 0;
+	}
+
+	if (strength > RAND_STRENGTH)
+		return 0;
+
+	if (!pool_random(ctx->pool, out, outlen)) {
+		ctx->state = EVP_RAND_STATE_ERROR;
+		OPENSSL_cleanse(out, outlen);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int rand_reseed(void *vctx, int prediction_resistance,
+		       const unsigned char *ent, size_t ent_len,
+		       const unsigned char *addin, size_t addin_len)
+{
+	struct rand_ctx *ctx = vctx;
+
+	/* Every byte comes straight from the device, there is no state */
+	if (ctx->state == EVP_RAND_STATE_ERROR)
+		ctx->state = EVP_RAND_STATE_READY;
+
+	return 1;
+}
+
+static size_t rand_get_seed(void *vctx, unsigned char **buffer, int entropy,
+			    size_t min_len, size_t max_len,
+			    int prediction_resistance,
+			    const unsigned char *adin, size_t adin_len)
+{
+	struct rand_ctx *ctx = vctx;
+	unsigned char *buf;
+
+	buf = OPENSSL_secure_malloc(min_len);
+	if (!buf)
+		return 0;
+
+	if (!rand_generate(ctx, buf, min_len, entropy, prediction_resistance,
+			   adin, adin_len)) {
+		OPENSSL_secure_clear_free(buf, min_len);
+		return 0;
+	}
+
+	*buffer = buf;
+
+	return min_len;
+}
+
+static void rand_clear_seed(void *vctx, unsigned char *buffer, size_t b_len)
+{
+	OPENSSL_secure_clear_free(buffer, b_len);
+}
+
+/* The pool has its own locks, the ones of OpenSSL are not needed */
+static int rand_enable_locking(void *vctx)
+{
+	return 1;
+}
+
+static int rand_lock(void *vctx)
+{
+	return 1;
+}
+
+static void rand_unlock(void *vctx)
+{
+}
+
+static const OSSL_PARAM *rand_gettable_ctx_params(void *vctx, void *provctx)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_int(OSSL_RAND_PARAM_STATE, NULL),
+		OSSL_PARAM_uint(OSSL_RAND_PARAM_STRENGTH, NULL),
+		OSSL_PARAM_size_t(OSSL_RAND_PARAM_MAX_REQUEST, NULL),
+		OSSL_PARAM_END
+	};
+
+	return params;
+}
+
+static int rand_get_ctx_params(void *vctx, OSSL_PARAM params[])
+{
+	struct rand_ctx *ctx = vctx;
+	OSSL_PARAM *p;
+
+	p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_STATE);
+	if (p && !OSSL_PARAM_set_int(p, ctx->state))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_STRENGTH);
+	if (p && !OSSL_PARAM_set_uint(p, RAND_STRENGTH))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_MAX_REQUEST);
+	if (p && !OSSL_PARAM_set_size_t(p, RAND_MAX_REQUEST))
+		return 0;
+
+	return 1;
+}
+
+static const OSSL_DISPATCH rand_functions[] = {
+	{ OSSL_FUNC_RAND_NEWCTX, (void (*)(void))rand_newctx },
+	{ OSSL_FUNC_RAND_FREECTX, (void (*)(void))rand_freectx },
+	{ OSSL_FUNC_RAND_INSTANTIATE, (void (*)(void))rand_instantiate },
+	{ OSSL_FUNC_RAND_UNINSTANTIATE, (void (*)(void))rand_uninstantiate },
+	{ OSSL_FUNC_RAND_GENERATE, (void (*)(void))rand_generate },
+	{ OSSL_FUNC_RAND_RESEED, (void (*)(void))rand_reseed },
+	{ OSSL_FUNC_RAND_GET_SEED, (void (*)(void))rand_get_seed },
+	{ OSSL_FUNC_RAND_CLEAR_SEED, (void (*)(void))rand_clear_seed },
+	{ OSSL_FUNC_RAND_ENABLE_LOCKING, (void (*)(void))rand_enable_locking },
+	{ OSSL_FUNC_RAND_LOCK, (void (*)(void))rand_lock },
+	{ OSSL_FUNC_RAND_UNLOCK, (void (*)(void))rand_unlock },
+	{ OSSL_FUNC_RAND_GETTABLE_CTX_PARAMS,
+	  (void (*)(void))rand_gettable_ctx_params },
+	{ OSSL_FUNC_RAND_GET_CTX_PARAMS, (void (*)(void))rand_get_ctx_params },
+	{ 0, NULL }
+};
+
+/* EVP_MAC */
+
+static void *mac_newctx(void *provctx)
+{
+	struct mac_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->pool = provctx;
+
+	return ctx;
+}
+
+static void *mac_dupctx(void *vctx)
+{
+	struct mac_ctx *ctx;
+
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	memcpy(ctx, vctx, sizeof(*ctx));
+
+	return ctx;
+}
+
+static void mac_freectx(void *vctx)
+{
+	OPENSSL_cleanse(vctx, sizeof(struct mac_ctx));
+	free(vctx);
+}
+
+static int mac_set_ctx_params(void *vctx, const OSSL_PARAM params[])
+{
+	struct mac_ctx *ctx = vctx;
+	const OSSL_PARAM *p;
+	unsigned int slot;
+
+	p = OSSL_PARAM_locate_const(params, S96AT_MAC_PARAM_SLOT);
+	if (p) {
+		if (!OSSL_PARAM_get_uint(p, &slot))
+			return 0;
+		if (slot >= ZONE_DATA_NUM_SLOTS) {
+			prov_error(ctx->pool, S96AT_R_BAD_SLOT, "slot %u", slot);
+			return 0;
+		}
+		ctx->slot = slot;
+	}
+
+	return 1;
+}
+
+static int mac_init(void *vctx, const unsigned char *key, size_t keylen,
+		    const OSSL_PARAM params[])
+{
+	struct mac_ctx *ctx = vctx;
+
+	/* The key never leaves the device */
+	if (key && keylen) {
+		prov_error(ctx->pool, S96AT_R_KEY_NOT_ALLOWED, NULL);
+		return 0;
+	}
+
+	if (!mac_set_ctx_params(ctx, params))
+		return 0;
+
+	sha256_init(&ctx->sha);
+
+	return 1;
+}
+
+static int mac_update(void *vctx, const unsigned char *in, size_t inl)
+{
+	struct mac_ctx *ctx = vctx;
+
+	sha256_update(&ctx->sha, in, inl);
+
+	return 1;
+}
+
+/*
+ * The digest of the input goes into TempKey through a Nonce in passthrough
+ * mode and the device runs HMAC over it, with the key of the slot.
+ */
+static int mac_final(void *vctx, unsigned char *out, size_t *outl,
+		     size_t outsize)
+{
+	struct mac_ctx *ctx = vctx;
+	struct s96at_pool *pool = ctx->pool;
+	struct pool_dev *d;
+	uint8_t digest[S96AT_SHA_LEN];
+	uint8_t ret;
+
+	if (outsize < S96AT_HMAC_LEN)
+		return 0;
+
+	sha256_final(&ctx->sha, digest);
+
+	pthread_mutex_lock(&pool->lock);
+	d = pool_acquire(pool);
+	pthread_mutex_unlock(&pool->lock);
+	if (!d) {
+		prov_error(pool, S96AT_R_DEVICE_FAILURE,
+			   "could not wake up the device");
+		return 0;
+	}
+
+	ret = s96at_load_tempkey(&d->desc, digest, S96AT_FLAG_NONE,
+				 S96AT_ZONE_DATA, 0);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_get_hmac(&d->desc, ctx->slot,
+				     S96AT_FLAG_TEMPKEY_SOURCE_INPUT, out);
+
+	pthread_mutex_lock(&pool->lock);
+	pool_release(pool, d, ret == S96AT_STATUS_OK);
+	pthread_mutex_unlock(&pool->lock);
+
+	OPENSSL_cleanse(digest, sizeof(digest));
+
+	if (ret != S96AT_STATUS_OK) {
+		prov_error(pool, S96AT_R_DEVICE_FAILURE, "HMAC failed: 0x%02x",
+			   ret);
+		return 0;
+	}
+
+	*outl = S96AT_HMAC_LEN;
+
+	return 1;
+}
+
+static const OSSL_PARAM *mac_gettable_ctx_params(void *vctx, void *provctx)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_size_t(OSSL_MAC_PARAM_SIZE, NULL),
+		OSSL_PARAM_END
+	};
+
+	return params;
+}
+
+static int mac_get_ctx_params(void *vctx, OSSL_PARAM params[])
+{
+	OSSL_PARAM *p;
+
+	p = OSSL_PARAM_locate(params, OSSL_MAC_PARAM_SIZE);
+	if (p && !OSSL_PARAM_set_size_t(p, S96AT_HMAC_LEN))
+		return 0;
+
+	return 1;
+}
+
+static const OSSL_PARAM *mac_settable_ctx_params(void *vctx, void *provctx)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_uint(S96AT_MAC_PARAM_SLOT, NULL),
+		OSSL_PARAM_END
+	};
+
+	return params;
+}
+
+static const OSSL_DISPATCH mac_functions[] = {
+	{ OSSL_FUNC_MAC_NEWCTX, (void (*)(void))mac_newctx },
+	{ OSSL_FUNC_MAC_DUPCTX, (void (*)(void))mac_dupctx },
+	{ OSSL_FUNC_MAC_FREECTX, (void (*)(void))mac_freectx },
+	{ OSSL_FUNC_MAC_INIT, (void (*)(void))mac_init },
+	{ OSSL_FUNC_MAC_UPDATE, (void (*)(void))mac_update },
+	{ OSSL_FUNC_MAC_FINAL, (void (*)(void))mac_final },
+	{ OSSL_FUNC_MAC_GETTABLE_CTX_PARAMS,
+	  (void (*)(void))mac_gettable_ctx_params },
+	{ OSSL_FUNC_MAC_GET_CTX_PARAMS, (void (*)(void))mac_get_ctx_params },
+	{ OSSL_FUNC_MAC_SETTABLE_CTX_PARAMS,
+	  (void (*)(void))mac_settable_ctx_params },
+	{ OSSL_FUNC_MAC_SET_CTX_PARAMS, (void (*)(void))mac_set_ctx_params },
+	{ 0, NULL }
+};
+
+/* Provider */
+
+static const OSSL_ALGORITHM rands[] = {
+	{ "S96AT", "provider=s96at", rand_functions, "Secure96 device RNG" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static const OSSL_ALGORITHM macs[] = {
+	{ "S96AT-HMAC", "provider=s96at", mac_functions,
+	  "Secure96 device keyed HMAC-SHA256" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static const OSSL_ITEM reason_strings[] = {
+	{ S96AT_R_DEVICE_FAILURE, "device failure" },
+	{ S96AT_R_KEY_NOT_ALLOWED, "keys are held by the device" },
+	{ S96AT_R_BAD_SLOT, "invalid slot" },
+	{ S96AT_R_NOT_INSTANTIATED, "not instantiated" },
+	{ 0, NULL }
+};
+
+static const OSSL_ALGORITHM *prov_query(void *provctx, int operation_id,
+					int *no_cache)
+{
+	*no_cache = 0;
+
+	switch (operation_id) {
+	case OSSL_OP_RAND:
+		return rands;
+	case OSSL_OP_MAC:
+		return macs;
+	}
+
+	return NULL;
+}
+
+static const OSSL_ITEM *prov_reason_strings(void *provctx)
+{
+	return reason_strings;
+}
+
+static const OSSL_PARAM *prov_gettable_params(void *provctx)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_NAME, NULL, 0),
+		OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_VERSION, NULL, 0),
+		OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_BUILDINFO, NULL, 0),
+		OSSL_PARAM_int(OSSL_PROV_PARAM_STATUS, NULL),
+		OSSL_PARAM_END
+	};
+
+	return params;
+}
+
+static int prov_get_params(void *provctx, OSSL_PARAM params[])
+{
+	OSSL_PARAM *p;
+
+	p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_NAME);
+	if (p && !OSSL_PARAM_set_utf8_ptr(p, "Secure96 s96at provider"))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_VERSION);
+	if (p && !OSSL_PARAM_set_utf8_ptr(p, S96AT_VERSION))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_BUILDINFO);
+	if (p && !OSSL_PARAM_set_utf8_ptr(p, S96AT_VERSION))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_STATUS);
+	if (p && !OSSL_PARAM_set_int(p, 1))
+		return 0;
+
+	return 1;
+}
+
+static void prov_teardown(void *provctx)
+{
+	pool_free(provctx);
+}
+
+static const OSSL_DISPATCH prov_functions[] = {
+	{ OSSL_FUNC_PROVIDER_TEARDOWN, (void (*)(void))prov_teardown },
+	{ OSSL_FUNC_PROVIDER_QUERY_OPERATION, (void (*)(void))prov_query },
+	{ OSSL_FUNC_PROVIDER_GET_REASON_STRINGS,
+	  (void (*)(void))prov_reason_strings },
+	{ OSSL_FUNC_PROVIDER_GETTABLE_PARAMS,
+	  (void (*)(void))prov_gettable_params },
+	{ OSSL_FUNC_PROVIDER_GET_PARAMS, (void (*)(void))prov_get_params },
+	{ 0, NULL }
+};
+
+__attribute__((visibility("default")))
+int OSSL_provider_init(const OSSL_CORE_HANDLE *handle,
+		       const OSSL_DISPATCH *in, const OSSL_DISPATCH **out,
+		       void **provctx)
+{
+	OSSL_FUNC_core_get_params_fn *get_params = NULL;
+	OSSL_FUNC_core_new_error_fn *new_error = NULL;
+	OSSL_FUNC_core_vset_error_fn *vset_error = NULL;
+	struct s96at_pool *pool;
+	char default_devices[64];
+	char *devices = NULL;
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_utf8_ptr(S96AT_PROV_PARAM_DEVICES, &devices, 0),
+		OSSL_PARAM_END
+	};
+
+	for (; in->function_id; in++) {
+		switch (in->function_id) {
+		case OSSL_FUNC_CORE_GET_PARAMS:
+			get_params = OSSL_FUNC_core_get_params(in);
+			break;
+		case OSSL_FUNC_CORE_NEW_ERROR:
+			new_error = OSSL_FUNC_core_new_error(in);
+			break;
+		case OSSL_FUNC_CORE_VSET_ERROR:
+			vset_error = OSSL_FUNC_core_vset_error(in);
+			break;
+		}
+	}
+
+	if (!get_params || !get_params(handle, params) || !devices || !*devices)
+		devices = getenv("S96AT_DEVICES");
+
+	if (!devices) {
+		snprintf(default_devices, sizeof(default_devices), "%s@0x%02x",
+			 I2C_DEVICE, ATSHA204A_ADDR);
+		devices = default_devices;
+	}
+
+	pool = pool_create(devices);
+	if (!pool)
+		return 0;
+
+	pool->handle = handle;
+	pool->new_error = new_error;
+	pool->vset_error = vset_error;
+
+	*out = prov_functions;
+	*provctx = pool;
+
+	return 1;
+}
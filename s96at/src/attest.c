@@ -0,0 +1,311 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cmd.h>
+#include <debug.h>
+#include <mac.h>
+#include <s96at.h>
+#include <sha.h>
+
+/* Domain separation between leaves and interior nodes, as in RFC 6962 */
+#define MERKLE_LEAF_PREFIX		0x00
+#define MERKLE_NODE_PREFIX		0x01
+
+/* MAC over Slot[slot] and TempKey, where TempKey holds the root */
+#define ATTEST_MAC_MODE			(S96AT_MAC_MODE_1 | \
+					 (TEMPKEY_SOURCE_INPUT << MAC_MODE_TEMPKEY_SOURCE_SHIFT))
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void merkle_leaf(const uint8_t *challenge, uint8_t *hash)
+{
+	struct sha256_ctx ctx;
+	uint8_t prefix = MERKLE_LEAF_PREFIX;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, &prefix, sizeof(prefix));
+	sha256_update(&ctx, challenge, S96AT_CHALLENGE_LEN);
+	sha256_final(&ctx, hash);
+}
+
+static void merkle_node(const uint8_t *left, const uint8_t *right,
+			uint8_t *hash)
+{
+	struct sha256_ctx ctx;
+	uint8_t prefix = MERKLE_NODE_PREFIX;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, &prefix, sizeof(prefix));
+	sha256_update(&ctx, left, SHA_DIGEST_LEN);
+	sha256_update(&ctx, right, SHA_DIGEST_LEN);
+	sha256_final(&ctx, hash);
+}
+
+/*
+ * The levels of the tree are stored one after the other, leaves first. A
+ * node without a sibling is promoted to the next level unchanged.
+ */
+static void merkle_build(struct s96at_attest *att)
+{
+	size_t i;
+	size_t n = att->num_leaves;
+	size_t off = 0;
+	size_t next;
+
+	while (n > 1) {
+		next = off + n;
+
+		for (i = 0; i < n / 2; i++)
+			merkle_node(att->tree[off + 2 * i], att->tree[off + 2 * i + 1],
+				    att->tree[next + i]);
+
+		if (n & 1)
+			memcpy(att->tree[next + n / 2], att->tree[off + n - 1],
+			       SHA_DIGEST_LEN);
+
+		off = next;
+		n = (n + 1) / 2;
+	}
+
+	memcpy(att->root, att->tree[off], SHA_DIGEST_LEN);
+}
+
+/* Load the root into TempKey and MAC it, within a single wake window */
+static uint8_t attest_mac(struct s96at_attest *att)
+{
+	struct s96at_batch_cmd cmds[] = {
+		{ .opcode = S96AT_OPCODE_NONCE,
+		  .param1 = S96AT_NONCE_MODE_PASSTHROUGH,
+		  .data = att->root, .data_len = SHA_DIGEST_LEN },
+		{ .opcode = S96AT_OPCODE_MAC, .param1 = ATTEST_MAC_MODE,
+		  .param2 = att->slot, .out = att->mac, .out_len = S96AT_MAC_LEN },
+	};
+
+	return s96at_batch(att->desc, cmds, 2,
+			   S96AT_FLAG_STOP_ON_ERROR | S96AT_FLAG_IDLE);
+}
+
+uint8_t s96at_attest_init(struct s96at_attest *att, struct s96at_desc *desc,
+			  uint8_t slot, size_t max_leaves, uint32_t window_ms)
+{
+	if (!att || !desc || !max_leaves ||
+	    max_leaves > (1 << S96AT_MERKLE_MAX_DEPTH))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(att, 0, sizeof(*att));
+	att->desc = desc;
+	att->slot = slot;
+	att->max_leaves = max_leaves;
+	att->window_ms = window_ms;
+
+	/* Each level is at most half the size of the previous one, rounded up */
+	att->tree = calloc(2 * max_leaves + S96AT_MERKLE_MAX_DEPTH,
+			   sizeof(*att->tree));
+	if (!att->tree)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	if (pthread_mutex_init(&att->lock, NULL)) {
+		free(att->tree);
+		att->tree = NULL;
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_attest_cleanup(struct s96at_attest *att)
+{
+	if (!att || !att->tree)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	pthread_mutex_destroy(&att->lock);
+	free(att->tree);
+	memset(att, 0, sizeof(*att));
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_attest_add(struct s96at_attest *att, const uint8_t *challenge,
+			 uint32_t *index)
+{
+	uint8_t ret = S96AT_STATUS_OK;
+
+	if (!att || !att->tree || !challenge || !index)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	pthread_mutex_lock(&att->lock);
+
+	if (att->sealed || att->num_leaves == att->max_leaves) {
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto out;
+	}
+
+	if (!att->num_leaves)
+		att->first_ms = now_ms();
+
+	merkle_leaf(challenge, att->tree[att->num_leaves]);
+	*index = att->num_leaves++;
+out:
+	pthread_mutex_unlock(&att->lock);
+
+	return ret;
+}
+
+bool s96at_attest_ready(struct s96at_attest *att)
+{
+	bool ready;
+
+	if (!att || !att->tree)
+		return false;
+
+	pthread_mutex_lock(&att->lock);
+
+	ready = !att->sealed && att->num_leaves &&
+		(att->num_leaves == att->max_leaves ||
+		 now_ms() - att->first_ms >= att->window_ms);
+
+	pthread_mutex_unlock(&att->lock);
+
+	return ready;
+}
+
+uint8_t s96at_attest_seal(struct s96at_attest *att)
+{
+	uint8_t ret;
+
+	if (!att || !att->tree)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	pthread_mutex_lock(&att->lock);
+
+	if (att->sealed || !att->num_leaves) {
+		ret = S96AT_STATUS_BAD_PARAMETERS;
+		goto out;
+	}
+
+	merkle_build(att);
+
+	ret = attest_mac(att);
+	if (ret != S96AT_STATUS_OK) {
+		loge("Could not MAC the Merkle root: 0x%02x\n", ret);
+		goto out;
+	}
+
+	logd("Sealed %zu challenges\n", att->num_leaves);
+	att->sealed = true;
+out:
+	pthread_mutex_unlock(&att->lock);
+
+	return ret;
+}
+
+uint8_t s96at_attest_get(struct s96at_attest *att, uint32_t index,
+			 struct s96at_attestation *out)
+{
+	uint8_t ret = S96AT_STATUS_OK;
+	size_t n;
+	size_t off = 0;
+	uint32_t i = index;
+
+	if (!att || !att->tree || !out)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	pthread_mutex_lock(&att->lock);
+
+	if (!att->sealed || index >= att->num_leaves) {
+		ret = S96AT_STATUS_BAD_PARAMETERS;
+		goto out;
+	}
+
+	memset(out, 0, sizeof(*out));
+	out->index = index;
+	out->num_leaves = att->num_leaves;
+	out->slot = att->slot;
+	memcpy(out->root, att->root, SHA_DIGEST_LEN);
+	memcpy(out->mac, att->mac, S96AT_MAC_LEN);
+
+	for (n = att->num_leaves; n > 1; n = (n + 1) / 2) {
+		if ((i ^ 1) < n)
+			memcpy(out->path[out->depth++], att->tree[off + (i ^ 1)],
+			       SHA_DIGEST_LEN);
+		off += n;
+		i >>= 1;
+	}
+out:
+	pthread_mutex_unlock(&att->lock);
+
+	return ret;
+}
+
+uint8_t s96at_attest_reset(struct s96at_attest *att)
+{
+	if (!att || !att->tree)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	pthread_mutex_lock(&att->lock);
+
+	att->num_leaves = 0;
+	att->sealed = false;
+	memset(att->root, 0, sizeof(att->root));
+	memset(att->mac, 0, sizeof(att->mac));
+
+	pthread_mutex_unlock(&att->lock);
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_attest_verify(const uint8_t *key, const uint8_t *challenge,
+			    const struct s96at_attestation *a)
+{
+	uint8_t hash[SHA_DIGEST_LEN];
+	uint8_t mac[S96AT_MAC_LEN];
+	uint32_t i;
+	uint32_t n;
+	uint8_t depth = 0;
+
+	if (!key || !challenge || !a)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	if (a->index >= a->num_leaves || a->depth > S96AT_MERKLE_MAX_DEPTH)
+		return S96AT_STATUS_CHECKMAC_FAIL;
+
+	merkle_leaf(challenge, hash);
+
+	for (i = a->index, n = a->num_leaves; n > 1; n = (n + 1) / 2, i >>= 1) {
+		if ((i ^ 1) >= n)
+			continue;
+
+		if (depth == a->depth)
+			return S96AT_STATUS_CHECKMAC_FAIL;
+
+		if (i & 1)
+			merkle_node(a->path[depth], hash, hash);
+		else
+			merkle_node(hash, a->path[depth], hash);
+		depth++;
+	}
+
+	if (depth != a->depth || !mac_equal(hash, a->root, SHA_DIGEST_LEN))
+		return S96AT_STATUS_CHECKMAC_FAIL;
+
+	mac_compute(key, a->root, ATTEST_MAC_MODE, a->slot, NULL, NULL, mac);
+
+	if (!mac_equal(mac, a->mac, S96AT_MAC_LEN))
+		return S96AT_STATUS_CHECKMAC_FAIL;
+
+	return S96AT_STATUS_OK;
+}
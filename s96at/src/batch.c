@@ -0,0 +1,195 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdbool.h>
+#include <string.h>
+
+#include <batch.h>
+#include <cmd.h>
+#include <debug.h>
+#include <packet.h>
+#include <s96at.h>
+#include <slotcfg.h>
+#include <stats.h>
+#include <status.h>
+#include <tempkey.h>
+
+/* Number of wake attempts before giving up on the device */
+#define BATCH_WAKE_RETRIES		10
+
+static uint32_t batch_time(const struct s96at_batch_cmd *cmds, size_t num)
+{
+	size_t i;
+	uint32_t total = 0;
+	struct cmd_packet p;
+
+	for (i = 0; i < num; i++) {
+		get_command(&p, cmds[i].opcode);
+		total += p.max_time + BATCH_IO_TIME;
+	}
+
+	return total;
+}
+
+bool batch_fits(const struct s96at_batch_cmd *cmds, size_t num)
+{
+	return batch_time(cmds, num) <=
+	       S96AT_WATCHDOG_TIME * (100 - BATCH_WATCHDOG_MARGIN_PCT) / 100;
+}
+
+bool batch_valid(const struct s96at_batch_cmd *cmd)
+{
+	struct cmd_packet p;
+
+	return get_command(&p, cmd->opcode) == STATUS_OK &&
+	       (!cmd->data_len || cmd->data) &&
+	       cmd->data_len <= PKT_MAX_DATA_LEN &&
+	       (!cmd->out_len || cmd->out) &&
+	       cmd->out_len <= PKT_MAX_RESP_LEN;
+}
+
+void batch_packet(struct cmd_packet *p, const struct s96at_batch_cmd *cmd)
+{
+	get_command(p, cmd->opcode);
+	p->param1 = cmd->param1;
+	p->param2[0] = cmd->param2 & 0xff;
+	p->param2[1] = cmd->param2 >> 8;
+	p->data = cmd->data;
+	p->data_length = cmd->data_len;
+}
+
+uint8_t batch_recv(struct io_interface *ioif, struct cmd_packet *p,
+		   struct s96at_batch_cmd *cmd)
+{
+	uint8_t status;
+	uint8_t resp;
+
+	if (cmd->out_len)
+		return at204_recv(ioif, p, cmd->out, cmd->out_len);
+
+	/* The response is a single status byte */
+	status = at204_recv(ioif, p, &resp, sizeof(resp));
+
+	return status == STATUS_OK ? resp : status;
+}
+
+uint8_t s96at_batch(struct s96at_desc *desc, struct s96at_batch_cmd *cmds,
+		    size_t num, uint32_t flags)
+{
+	int i;
+	size_t n;
+	uint8_t ret = S96AT_STATUS_OK;
+	uint8_t resp;
+	struct s96at_batch_cmd *c;
+
+	if (!desc || (num && !cmds))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	for (n = 0; n < num; n++) {
+		if (!batch_valid(&cmds[n]))
+			return S96AT_STATUS_BAD_PARAMETERS;
+		cmds[n].status = S96AT_STATUS_EXEC_ERROR;
+	}
+
+	if (!batch_fits(cmds, num)) {
+		loge("Batch takes up to %u ms, does not fit in the watchdog\n",
+		     batch_time(cmds, num));
+		return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	/*
+	 * Waking up an already awake device does not restart the watchdog.
+	 * Going through idle does, and unlike sleep it retains TempKey.
+	 */
+	s96at_idle(desc);
+
+	for (i = 0; i < BATCH_WAKE_RETRIES; i++) {
+		if (s96at_wake(desc) == S96AT_STATUS_READY)
+			break;
+	}
+
+	if (i == BATCH_WAKE_RETRIES) {
+		loge("Could not wake up the device\n");
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	for (n = 0; n < num; n++) {
+		c = &cmds[n];
+
+		if (c->out_len) {
+			c->status = cmd_exec(desc->ioif, c->opcode, c->param1,
+					     c->param2, c->data, c->data_len,
+					     c->out, c->out_len);
+		} else {
+			/* The response is a single status byte */
+			c->status = cmd_exec(desc->ioif, c->opcode, c->param1,
+					     c->param2, c->data, c->data_len,
+					     &resp, sizeof(resp));
+			if (c->status == STATUS_OK)
+				c->status = resp;
+		}
+
+		tempkey_update(&desc->tempkey, desc->ioif, c->opcode, c->param1,
+			       c->param2, c->data, c->data_len, c->status);
+		slotcfg_update(&desc->config, c->opcode, c->param1, c->status);
+
+		if (c->status != STATUS_OK) {
+			logd("Batch step %zu (opcode 0x%02x) failed: 0x%02x\n",
+			     n, c->opcode, c->status);
+			if (ret == S96AT_STATUS_OK)
+				ret = c->status;
+			if (flags & S96AT_FLAG_STOP_ON_ERROR)
+				break;
+		}
+	}
+
+	if (flags & S96AT_FLAG_IDLE)
+		s96at_idle(desc);
+
+	return ret;
+}
+
+uint8_t s96at_cmd_finish(struct s96at_desc *desc, struct s96at_batch_cmd *cmd)
+{
+	struct cmd_packet p;
+
+	if (!desc || !cmd || !batch_valid(cmd))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	batch_packet(&p, cmd);
+
+	/* Interfaces that wait on their own are only told to do so now */
+	if (desc->ioif->wait)
+		desc->ioif->wait(desc->ioif->ctx, p.max_time);
+
+	cmd->status = batch_recv(desc->ioif, &p, cmd);
+	tempkey_update(&desc->tempkey, desc->ioif, cmd->opcode, cmd->param1,
+		       cmd->param2, cmd->data, cmd->data_len, cmd->status);
+	slotcfg_update(&desc->config, cmd->opcode, cmd->param1, cmd->status);
+
+	return cmd->status;
+}
+
+uint8_t s96at_cmd_start(struct s96at_desc *desc,
+			const struct s96at_batch_cmd *cmd, uint32_t *wait_ms)
+{
+	struct cmd_packet p;
+	struct s96at_stats *st;
+
+	if (!desc || !cmd || !wait_ms || !batch_valid(cmd))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	batch_packet(&p, cmd);
+
+	st = stats_local(desc->ioif);
+	if (st)
+		STATS_ADD(st->commands[s96at_stats_index(cmd->opcode)], 1);
+
+	if (at204_send(desc->ioif, &p) != STATUS_OK)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	*wait_ms = desc->ioif->wait ? 0 : p.max_time;
+
+	return S96AT_STATUS_OK;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <endian.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <crc.h>
+#include <debug.h>
+#include <s96at.h>
+
+static int index_cmp(const void *a, const void *b)
+{
+	const struct s96at_bundle_index *x = a;
+	const struct s96at_bundle_index *y = b;
+
+	return memcmp(x->serial, y->serial, sizeof(x->serial));
+}
+
+uint8_t s96at_bundle_create(const char *path,
+			    struct s96at_bundle_record *records, size_t num)
+{
+	FILE *f;
+	size_t i;
+	uint16_t crc;
+	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
+	struct s96at_bundle_header hdr;
+	struct s96at_bundle_index *index;
+
+	if (!path || (num && !records) || num > UINT32_MAX)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	index = calloc(num ? num : 1, sizeof(*index));
+	if (!index)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	for (i = 0; i < num; i++) {
+		crc = calculate_crc16(records[i].data, sizeof(records[i].data), 0);
+		crc = calculate_crc16(records[i].otp, sizeof(records[i].otp), crc);
+		records[i].data_crc = htole16(crc);
+		records[i].flags = 0;
+
+		memcpy(index[i].serial, records[i].serial, sizeof(index[i].serial));
+		index[i].record = htole32(i);
+	}
+
+	qsort(index, num, sizeof(*index), index_cmp);
+
+	for (i = 1; i < num; i++) {
+		if (!index_cmp(&index[i - 1], &index[i])) {
+			loge("Duplicate serial number in bundle\n");
+			free(index);
+			return S96AT_STATUS_BAD_PARAMETERS;
+		}
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, S96AT_BUNDLE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole16(S96AT_BUNDLE_VERSION);
+	hdr.record_size = htole16(sizeof(*records));
+	hdr.num_records = htole32(num);
+	hdr.index_offset = htole64(sizeof(hdr));
+	hdr.records_offset = htole64(sizeof(hdr) + num * sizeof(*index));
+
+	f = fopen(path, "wb");
+	if (!f) {
+		free(index);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+	    fwrite(index, sizeof(*index), num, f) == num &&
+	    fwrite(records, sizeof(*records), num, f) == num)
+		ret = S96AT_STATUS_OK;
+
+	if (fclose(f))
+		ret = S96AT_STATUS_EXEC_ERROR;
+
+	free(index);
+
+	return ret;
+}
+
+uint8_t s96at_bundle_open(struct s96at_bundle *bundle, const char *path)
+{
+	int fd;
+	struct stat st;
+	const struct s96at_bundle_header *hdr;
+	uint64_t index_offset;
+	uint64_t records_offset;
+	uint32_t num;
+
+	if (!bundle || !path)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(bundle, 0, sizeof(*bundle));
+
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		loge("Could not open %s\n", path);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	/* Shared and writable, so that wiped records are wiped in the file */
+	bundle->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+	close(fd);
+	if (bundle->map == MAP_FAILED) {
+		bundle->map = NULL;
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+	bundle->size = st.st_size;
+
+	hdr = (const struct s96at_bundle_header *)bundle->map;
+	num = le32toh(hdr->num_records);
+	index_offset = le64toh(hdr->index_offset);
+	records_offset = le64toh(hdr->records_offset);
+
+	if (memcmp(hdr->magic, S96AT_BUNDLE_MAGIC, sizeof(hdr->magic)) ||
+	    le16toh(hdr->version) != S96AT_BUNDLE_VERSION ||
+	    le16toh(hdr->record_size) != sizeof(struct s96at_bundle_record) ||
+	    index_offset > bundle->size ||
+	    (bundle->size - index_offset) / sizeof(*bundle->index) < num ||
+	    records_offset > bundle->size ||
+	    (bundle->size - records_offset) / sizeof(*bundle->records) < num) {
+		loge("%s is not a valid key bundle\n", path);
+		s96at_bundle_close(bundle);
+		return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	bundle->index = (const struct s96at_bundle_index *)(bundle->map +
+							    index_offset);
+	bundle->records = (struct s96at_bundle_record *)(bundle->map +
+							 records_offset);
+	bundle->num_records = num;
+
+	/* Lookups jump around the index and touch a single record each */
+	madvise(bundle->map, bundle->size, MADV_RANDOM);
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_bundle_find(struct s96at_bundle *bundle, const uint8_t *serial,
+			  const struct s96at_bundle_record **rec)
+{
+	size_t lo = 0;
+	size_t hi;
+	size_t mid;
+	uint32_t r;
+	int cmp;
+	struct s96at_bundle_record *found;
+
+	if (!bundle || !bundle->map || !serial || !rec)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	*rec = NULL;
+	hi = bundle->num_records;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = memcmp(serial, bundle->index[mid].serial,
+			     S96AT_SERIAL_NUMBER_LEN);
+		if (!cmp)
+			break;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	if (lo >= hi) {
+		logd("Serial number not in the bundle\n");
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	r = le32toh(bundle->index[mid].record);
+	if (r >= bundle->num_records)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	found = &bundle->records[r];
+	if (memcmp(found->serial, serial, S96AT_SERIAL_NUMBER_LEN) ||
+	    (found->flags & S96AT_BUNDLE_RECORD_USED)) {
+		logd("Bundle record is inconsistent or already used\n");
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	*rec = found;
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_bundle_wipe(struct s96at_bundle *bundle,
+			  const struct s96at_bundle_record *rec)
+{
+	struct s96at_bundle_record *r;
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start;
+	uintptr_t end;
+
+	if (!bundle || !bundle->map || !rec || rec < bundle->records ||
+	    rec >= bundle->records + bundle->num_records)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	r = &bundle->records[rec - bundle->records];
+	memset(r->data, 0, sizeof(r->data));
+	memset(r->otp, 0, sizeof(r->otp));
+	r->data_crc = 0;
+	r->flags |= S96AT_BUNDLE_RECORD_USED;
+
+	/* Write the wiped pages back now rather than at some later point */
+	start = (uintptr_t)r & ~(page - 1);
+	end = (uintptr_t)(r + 1);
+	if (msync((void *)start, end - start, MS_SYNC))
+		return S96AT_STATUS_EXEC_ERROR;
+
+	return S96AT_STATUS_OK;
+}
+
+void s96at_bundle_close(struct s96at_bundle *bundle)
+{
+	if (!bundle)
+		return;
+
+	if (bundle->map)
+		munmap(bundle->map, bundle->size);
+
+	memset(bundle, 0, sizeof(*bundle));
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdbool.h>
+#include <string.h>
+
+#include <batch.h>
+#include <clock.h>
+#include <cmd.h>
+#include <debug.h>
+#include <emulator.h>
+#include <io.h>
+#include <packet.h>
+#include <s96at.h>
+#include <slotcfg.h>
+#include <stats.h>
+#include <status.h>
+#include <tempkey.h>
+
+/* Number of wake pulses before giving up on the chips that did not wake */
+#define BUS_WAKE_RETRIES		10
+
+/* Per chip state of a run */
+struct bus_chip {
+	struct s96at_desc *desc;
+	/* Job being run, num_jobs once the chip is done */
+	size_t job;
+	/* Next command of the job */
+	size_t cmd;
+	bool awake;
+	/* A command is executing, its response is ready at ready_us */
+	bool busy;
+	uint64_t ready_us;
+	struct cmd_packet p;
+};
+
+struct bus_run {
+	struct s96at_bus *bus;
+	/* The clock of the first chip, the rounds are the same for all */
+	const struct s96at_clock *clock;
+	struct bus_chip chips[S96AT_BUS_MAX_CHIPS];
+	struct s96at_bus_job *jobs;
+	size_t num_jobs;
+	uint32_t flags;
+	uint8_t ret;
+};
+
+/* Jobs without commands are skipped, they are done from the start */
+static size_t next_job(struct bus_run *r, uint8_t chip, size_t from)
+{
+	size_t j;
+
+	for (j = from; j < r->num_jobs; j++) {
+		if (r->jobs[j].chip == chip && r->jobs[j].num)
+			break;
+	}
+
+	return j;
+}
+
+static bool chip_done(struct bus_run *r, struct bus_chip *c)
+{
+	return c->job == r->num_jobs;
+}
+
+static void chip_idle(struct bus_chip *c)
+{
+	s96at_idle(c->desc);
+	c->awake = false;
+}
+
+/* Records the status of the current command and moves on to the next one */
+static void chip_advance(struct bus_run *r, struct bus_chip *c, uint8_t status)
+{
+	struct s96at_bus_job *job = &r->jobs[c->job];
+	struct s96at_batch_cmd *cmd = &job->cmds[c->cmd];
+
+	cmd->status = status;
+	tempkey_update(&c->desc->tempkey, c->desc->ioif, cmd->opcode,
+		       cmd->param1, cmd->param2, cmd->data, cmd->data_len,
+		       status);
+	slotcfg_update(&c->desc->config, cmd->opcode, cmd->param1, status);
+
+	c->cmd++;
+
+	if (status != STATUS_OK) {
+		logd("Bus chip %u step %zu (opcode 0x%02x) failed: 0x%02x\n",
+		     job->chip, c->cmd - 1, cmd->opcode, status);
+		if (job->status == S96AT_STATUS_OK)
+			job->status = status;
+		if (r->ret == S96AT_STATUS_OK)
+			r->ret = status;
+		if (r->flags & S96AT_FLAG_STOP_ON_ERROR)
+			c->cmd = job->num;
+	}
+
+	if (c->cmd < job->num)
+		return;
+
+	c->job = next_job(r, job->chip, c->job + 1);
+	c->cmd = 0;
+
+	/* Nothing left to do, leave the chip out of the watchdog budget */
+	if (chip_done(r, c) && c->awake)
+		chip_idle(c);
+}
+
+/* Fails the rest of the work of a chip that cannot be woken up */
+static void chip_fail(struct bus_run *r, struct bus_chip *c)
+{
+	while (!chip_done(r, c))
+		chip_advance(r, c, S96AT_STATUS_EXEC_ERROR);
+}
+
+/*
+ * Starts a round: puts every chip to idle, which restarts the watchdog
+ * while retaining TempKey, and wakes them all with a single pulse. The
+ * chips that have nothing to do go back to idle right away. Returns the
+ * time of the first pulse, which all watchdogs of the round run from.
+ */
+static uint64_t bus_wake(struct bus_run *r)
+{
+	struct s96at_bus *bus = r->bus;
+	struct bus_chip *c;
+	uint64_t start = 0;
+	uint8_t status;
+	bool pending;
+	size_t i;
+	int n;
+
+	for (i = 0; i < bus->num_chips; i++)
+		chip_idle(&r->chips[i]);
+
+	for (n = 0; n < BUS_WAKE_RETRIES; n++) {
+		if (!n)
+			start = clock_now_us(r->clock);
+
+		/* Any chip will do, the pulse is on the bus */
+		at204_wake(bus->chips[0].ioif);
+
+		pending = false;
+		for (i = 0; i < bus->num_chips; i++) {
+			c = &r->chips[i];
+			if (c->awake)
+				continue;
+
+			if (chip_done(r, c)) {
+				/* Woken by the pulse all the same */
+				tempkey_wake(&c->desc->tempkey);
+				chip_idle(c);
+				continue;
+			}
+
+			if (at204_read(c->desc->ioif, &status,
+				       sizeof(status)) == STATUS_OK &&
+			    status == STATUS_AFTER_WAKE) {
+				tempkey_wake(&c->desc->tempkey);
+				c->awake = true;
+			} else {
+				pending = true;
+			}
+		}
+
+		if (!pending)
+			break;
+	}
+
+	for (i = 0; i < bus->num_chips; i++) {
+		c = &r->chips[i];
+		if (!chip_done(r, c) && !c->awake) {
+			loge("Could not wake up chip %zu\n", i);
+			chip_fail(r, c);
+		}
+	}
+
+	return start;
+}
+
+/*
+ * Keeps a command executing on the chip, as long as it completes before
+ * end_us. Otherwise the chip waits for the next round.
+ */
+static void chip_issue(struct bus_run *r, struct bus_chip *c, uint64_t end_us)
+{
+	struct s96at_batch_cmd *cmd;
+	struct s96at_stats *st = stats_local(c->desc->ioif);
+	uint64_t now;
+
+	while (!chip_done(r, c) && c->awake && !c->busy) {
+		cmd = &r->jobs[c->job].cmds[c->cmd];
+		batch_packet(&c->p, cmd);
+
+		now = clock_now_us(r->clock);
+		if (now + (c->p.max_time + BATCH_IO_TIME) * 1000ULL > end_us)
+			return;
+
+		if (st)
+			STATS_ADD(st->commands[s96at_stats_index(cmd->opcode)], 1);
+
+		if (at204_send(c->desc->ioif, &c->p) != STATUS_OK) {
+			chip_advance(r, c, S96AT_STATUS_EXEC_ERROR);
+			continue;
+		}
+
+		c->busy = true;
+		c->ready_us = now + c->p.max_time * 1000ULL;
+	}
+}
+
+static void chip_collect(struct bus_run *r, struct bus_chip *c)
+{
+	struct s96at_batch_cmd *cmd = &r->jobs[c->job].cmds[c->cmd];
+	uint64_t now = clock_now_us(r->clock);
+
+	if (now < c->ready_us) {
+		if (c->desc->ioif->wait)
+			c->desc->ioif->wait(c->desc->ioif->ctx,
+					    (c->ready_us - now + 999) / 1000);
+		else
+			clock_sleep_us(r->clock, c->ready_us - now);
+	}
+
+	c->busy = false;
+
+	chip_advance(r, c, batch_recv(c->desc->ioif, &c->p, cmd));
+}
+
+uint8_t s96at_bus_run(struct s96at_bus *bus, struct s96at_bus_job *jobs,
+		      size_t num, uint32_t flags)
+{
+	struct bus_run r;
+	struct bus_chip *c;
+	struct bus_chip *next;
+	uint64_t end_us;
+	bool left;
+	size_t i;
+	size_t n;
+
+	if (!bus || !bus->num_chips || (num && !jobs))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	for (i = 0; i < num; i++) {
+		if (jobs[i].chip >= bus->num_chips ||
+		    (jobs[i].num && !jobs[i].cmds))
+			return S96AT_STATUS_BAD_PARAMETERS;
+
+		for (n = 0; n < jobs[i].num; n++) {
+			if (!batch_valid(&jobs[i].cmds[n]))
+				return S96AT_STATUS_BAD_PARAMETERS;
+			jobs[i].cmds[n].status = S96AT_STATUS_EXEC_ERROR;
+		}
+		jobs[i].status = S96AT_STATUS_OK;
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.bus = bus;
+	r.clock = bus->chips[0].ioif->clock;
+	r.jobs = jobs;
+	r.num_jobs = num;
+	r.flags = flags;
+	r.ret = S96AT_STATUS_OK;
+
+	for (i = 0; i < bus->num_chips; i++) {
+		c = &r.chips[i];
+		c->desc = &bus->chips[i];
+		c->job = next_job(&r, i, 0);
+	}
+
+	for (;;) {
+		left = false;
+		for (i = 0; i < bus->num_chips; i++)
+			left |= !chip_done(&r, &r.chips[i]);
+		if (!left)
+			break;
+
+		end_us = bus_wake(&r) + S96AT_WATCHDOG_TIME * 1000ULL *
+			 (100 - BATCH_WATCHDOG_MARGIN_PCT) / 100;
+
+		/*
+		 * Keep a command executing on every chip that has work left
+		 * and collect the response that is ready first. A chip whose
+		 * next command would outlast the round waits for the next one.
+		 */
+		for (;;) {
+			next = NULL;
+			for (i = 0; i < bus->num_chips; i++) {
+				c = &r.chips[i];
+				chip_issue(&r, c, end_us);
+				if (c->busy && (!next || c->ready_us < next->ready_us))
+					next = c;
+			}
+
+			if (!next)
+				break;
+
+			chip_collect(&r, next);
+		}
+	}
+
+	return r.ret;
+}
+
+uint8_t s96at_bus_cleanup(struct s96at_bus *bus)
+{
+	uint8_t ret = S96AT_STATUS_OK;
+	uint8_t r;
+	size_t i;
+
+	if (!bus)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	for (i = 0; i < bus->num_chips; i++) {
+		r = s96at_cleanup(&bus->chips[i]);
+		if (ret == S96AT_STATUS_OK)
+			ret = r;
+	}
+	bus->num_chips = 0;
+
+	return ret;
+}
+
+uint8_t s96at_bus_init(struct s96at_bus *bus, enum s96at_device device,
+		       const char *path, const uint8_t *addrs, size_t num)
+{
+	uint8_t ret;
+	size_t i;
+
+	if (!bus || !path || !addrs || !num || num > S96AT_BUS_MAX_CHIPS)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	bus->num_chips = 0;
+
+	for (i = 0; i < num; i++) {
+		ret = s96at_init_i2c(device, path, addrs[i], &bus->chips[i]);
+		if (ret != S96AT_STATUS_OK) {
+			s96at_bus_cleanup(bus);
+			return ret;
+		}
+		bus->num_chips++;
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_bus_init_emulator(struct s96at_bus *bus, enum s96at_device device,
+				const uint32_t *ids, size_t num)
+{
+	uint8_t ret;
+	size_t i;
+
+	if (!bus || !ids || !num || num > S96AT_BUS_MAX_CHIPS)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	bus->num_chips = 0;
+
+	for (i = 0; i < num; i++) {
+		ret = s96at_init_emulator(device, ids[i], &bus->chips[i]);
+		if (ret != S96AT_STATUS_OK) {
+			s96at_bus_cleanup(bus);
+			return ret;
+		}
+		bus->num_chips++;
+
+		if (i)
+			emulator_join(bus->chips[i].ioif, bus->chips[0].ioif);
+	}
+
+	return S96AT_STATUS_OK;
+}
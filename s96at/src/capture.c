@@ -0,0 +1,444 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <endian.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <capture.h>
+#include <debug.h>
+#include <io.h>
+#include <s96at.h>
+#include <stats.h>
+#include <status.h>
+
+struct record_ctx {
+	struct io_interface *inner;
+	pthread_mutex_t lock;
+	FILE *f;
+	bool failed;
+	uint64_t last_us;
+};
+
+struct replay_ctx {
+	uint8_t *map;
+	size_t size;
+	size_t pos;
+	enum s96at_replay_mode mode;
+	uint64_t last_us;
+	bool diverged;
+};
+
+static uint32_t clamp_us(uint64_t us)
+{
+	return us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+/* Called with the lock held, right after the call that is recorded */
+static void record_call(struct record_ctx *c, uint8_t op, const void *buf,
+			size_t len, uint64_t start, uint32_t ret)
+{
+	struct s96at_capture_record rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.op = op;
+	rec.len = htole16(len);
+	rec.delta_us = htole32(c->last_us ? clamp_us(start - c->last_us) : 0);
+	rec.duration_us = htole32(clamp_us(stats_now_us() - start));
+	rec.ret = htole32(ret);
+	c->last_us = start;
+
+	if (fwrite(&rec, sizeof(rec), 1, c->f) != 1 ||
+	    (len && fwrite(buf, len, 1, c->f) != 1))
+		c->failed = true;
+}
+
+static uint32_t record_open(void *ctx)
+{
+	struct record_ctx *c = ctx;
+	uint64_t start;
+	uint32_t ret;
+
+	pthread_mutex_lock(&c->lock);
+	start = stats_now_us();
+	ret = c->inner->open(c->inner->ctx);
+	record_call(c, S96AT_CAPTURE_OPEN, NULL, 0, start, ret);
+	pthread_mutex_unlock(&c->lock);
+
+	return ret;
+}
+
+static size_t record_write(void *ctx, const void *buf, size_t size)
+{
+	struct record_ctx *c = ctx;
+	uint64_t start;
+	size_t n;
+
+	pthread_mutex_lock(&c->lock);
+	start = stats_now_us();
+	n = c->inner->write(c->inner->ctx, buf, size);
+	record_call(c, S96AT_CAPTURE_WRITE, buf, size, start, n);
+	pthread_mutex_unlock(&c->lock);
+
+	return n;
+}
+
+static size_t record_read(void *ctx, void *buf, size_t size)
+{
+	struct record_ctx *c = ctx;
+	uint64_t start;
+	size_t n;
+
+	pthread_mutex_lock(&c->lock);
+	start = stats_now_us();
+	n = c->inner->read(c->inner->ctx, buf, size);
+	/* A failed read, ie -1 from read(2), has nothing to record but n */
+	record_call(c, S96AT_CAPTURE_READ, buf, n <= size ? n : 0, start, n);
+	pthread_mutex_unlock(&c->lock);
+
+	return n;
+}
+
+static uint32_t record_close(void *ctx)
+{
+	struct record_ctx *c = ctx;
+	uint64_t start;
+	uint32_t ret;
+
+	pthread_mutex_lock(&c->lock);
+	start = stats_now_us();
+	ret = c->inner->close(c->inner->ctx);
+	record_call(c, S96AT_CAPTURE_CLOSE, NULL, 0, start, ret);
+	pthread_mutex_unlock(&c->lock);
+
+	return ret;
+}
+
+static uint32_t record_wake(void *ctx)
+{
+	struct record_ctx *c = ctx;
+	uint64_t start;
+	uint32_t ret;
+
+	pthread_mutex_lock(&c->lock);
+	start = stats_now_us();
+	ret = c->inner->wake(c->inner->ctx);
+	record_call(c, S96AT_CAPTURE_WAKE, NULL, 0, start, ret);
+	pthread_mutex_unlock(&c->lock);
+
+	return ret;
+}
+
+static void record_wait(void *ctx, uint32_t ms)
+{
+	struct record_ctx *c = ctx;
+
+	c->inner->wait(c->inner->ctx, ms);
+}
+
+static uint8_t record_free(struct io_interface *ioif)
+{
+	struct record_ctx *c = ioif->ctx;
+	uint8_t ret = S96AT_STATUS_OK;
+
+	if (fclose(c->f) || c->failed)
+		ret = S96AT_STATUS_EXEC_ERROR;
+
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+	free(ioif);
+
+	return ret;
+}
+
+static void record_release(struct io_interface *ioif)
+{
+	struct record_ctx *c = ioif->ctx;
+
+	at204_release(c->inner);
+	record_free(ioif);
+}
+
+uint8_t s96at_record_start(struct s96at_desc *desc, const char *path)
+{
+	struct io_interface *ioif;
+	struct record_ctx *c;
+	struct s96at_capture_header hdr;
+	struct timeval tv;
+
+	if (!desc || !desc->ioif || !path)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	ioif = calloc(1, sizeof(*ioif));
+	c = calloc(1, sizeof(*c));
+	if (!ioif || !c)
+		goto err;
+
+	c->f = fopen(path, "wb");
+	if (!c->f) {
+		loge("Could not open %s\n", path);
+		goto err;
+	}
+
+	gettimeofday(&tv, NULL);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, S96AT_CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole16(S96AT_CAPTURE_VERSION);
+	hdr.start_us = htole64((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, c->f) != 1 ||
+	    pthread_mutex_init(&c->lock, NULL)) {
+		fclose(c->f);
+		goto err;
+	}
+
+	c->inner = desc->ioif;
+
+	ioif->ctx = c;
+	ioif->open = record_open;
+	ioif->write = record_write;
+	ioif->read = record_read;
+	ioif->close = record_close;
+	ioif->wake = record_wake;
+	if (c->inner->wait)
+		ioif->wait = record_wait;
+	ioif->release = record_release;
+
+	/* Commands keep being counted, retried and timed the same way */
+	ioif->stats = c->inner->stats;
+	ioif->retry = c->inner->retry;
+	ioif->clock = c->inner->clock;
+	ioif->woken = c->inner->woken;
+	ioif->inner = c->inner;
+	c->inner->stats = NULL;
+	c->inner->retry = NULL;
+
+	desc->ioif = ioif;
+
+	return S96AT_STATUS_OK;
+err:
+	free(c);
+	free(ioif);
+
+	return S96AT_STATUS_EXEC_ERROR;
+}
+
+uint8_t s96at_record_stop(struct s96at_desc *desc)
+{
+	struct io_interface *ioif;
+	struct record_ctx *c;
+
+	if (!desc || !desc->ioif)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	if (desc->ioif->write != record_write)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ioif = desc->ioif;
+	c = ioif->ctx;
+
+	c->inner->stats = ioif->stats;
+	c->inner->retry = ioif->retry;
+	c->inner->clock = ioif->clock;
+	c->inner->woken = ioif->woken;
+	desc->ioif = c->inner;
+
+	return record_free(ioif);
+}
+
+/*
+ * Returns the next record if it is of the given op, otherwise NULL. Once
+ * the replay has diverged from the capture there are no more records. In
+ * original timing, the call is delayed to its offset from the previous call
+ * and then takes as long as it did.
+ */
+static const struct s96at_capture_record *replay_next(struct replay_ctx *c,
+						      uint8_t op)
+{
+	const struct s96at_capture_record *rec;
+	uint64_t now;
+	uint64_t due;
+
+	if (c->diverged || c->size - c->pos < sizeof(*rec))
+		return NULL;
+
+	rec = (const struct s96at_capture_record *)(c->map + c->pos);
+	if (rec->op != op ||
+	    c->size - c->pos - sizeof(*rec) < le16toh(rec->len))
+		return NULL;
+
+	c->pos += sizeof(*rec) + le16toh(rec->len);
+
+	if (c->mode == S96AT_REPLAY_ORIGINAL_TIMING) {
+		now = stats_now_us();
+		due = c->last_us + le32toh(rec->delta_us);
+		if (c->last_us && now < due) {
+			usleep(due - now);
+			now = due;
+		}
+		c->last_us = now;
+		usleep(le32toh(rec->duration_us));
+	}
+
+	return rec;
+}
+
+static uint32_t replay_open(void *ctx)
+{
+	const struct s96at_capture_record *rec;
+
+	/* Captures started on an open interface have no open to play back */
+	rec = replay_next(ctx, S96AT_CAPTURE_OPEN);
+
+	return rec ? le32toh(rec->ret) : STATUS_OK;
+}
+
+static size_t replay_write(void *ctx, const void *buf, size_t size)
+{
+	struct replay_ctx *c = ctx;
+	const struct s96at_capture_record *rec;
+
+	rec = replay_next(c, S96AT_CAPTURE_WRITE);
+	if (!rec || le16toh(rec->len) != size || memcmp(rec + 1, buf, size)) {
+		loge("Replay diverged from the capture on write\n");
+		c->diverged = true;
+		return 0;
+	}
+
+	return le32toh(rec->ret);
+}
+
+static size_t replay_read(void *ctx, void *buf, size_t size)
+{
+	struct replay_ctx *c = ctx;
+	const struct s96at_capture_record *rec;
+	size_t n;
+
+	rec = replay_next(c, S96AT_CAPTURE_READ);
+	if (!rec) {
+		loge("Replay diverged from the capture on read\n");
+		c->diverged = true;
+		return 0;
+	}
+
+	/* The read failed when it was recorded */
+	if (le32toh(rec->ret) != le16toh(rec->len))
+		return (size_t)-1;
+
+	n = le16toh(rec->len) < size ? le16toh(rec->len) : size;
+	memcpy(buf, rec + 1, n);
+
+	return n;
+}
+
+static uint32_t replay_close(void *ctx)
+{
+	const struct s96at_capture_record *rec;
+
+	rec = replay_next(ctx, S96AT_CAPTURE_CLOSE);
+
+	return rec ? le32toh(rec->ret) : STATUS_OK;
+}
+
+static uint32_t replay_wake(void *ctx)
+{
+	struct replay_ctx *c = ctx;
+	const struct s96at_capture_record *rec;
+
+	rec = replay_next(c, S96AT_CAPTURE_WAKE);
+	if (!rec) {
+		loge("Replay diverged from the capture on wake\n");
+		c->diverged = true;
+		return STATUS_EXEC_ERROR;
+	}
+
+	return le32toh(rec->ret);
+}
+
+/* Responses are already there, there is nothing to wait for */
+static void replay_wait(void *ctx, uint32_t ms)
+{
+}
+
+static void replay_release(struct io_interface *ioif)
+{
+	struct replay_ctx *c = ioif->ctx;
+
+	munmap(c->map, c->size);
+	free(c);
+	free(ioif);
+}
+
+struct io_interface *replay_create(const char *path,
+				   enum s96at_replay_mode mode)
+{
+	int fd;
+	struct stat st;
+	struct io_interface *ioif;
+	struct replay_ctx *c;
+	const struct s96at_capture_header *hdr;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		loge("Could not open %s\n", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+
+	ioif = calloc(1, sizeof(*ioif));
+	c = calloc(1, sizeof(*c));
+	if (!ioif || !c) {
+		close(fd);
+		goto err;
+	}
+
+	c->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (c->map == MAP_FAILED)
+		goto err;
+	c->size = st.st_size;
+
+	hdr = (const struct s96at_capture_header *)c->map;
+	if (memcmp(hdr->magic, S96AT_CAPTURE_MAGIC, sizeof(hdr->magic)) ||
+	    le16toh(hdr->version) != S96AT_CAPTURE_VERSION) {
+		loge("%s is not a bus capture\n", path);
+		munmap(c->map, c->size);
+		goto err;
+	}
+
+	/* Records are played back once, front to back */
+	madvise(c->map, c->size, MADV_SEQUENTIAL);
+
+	c->pos = sizeof(*hdr);
+	c->mode = mode;
+
+	ioif->ctx = c;
+	ioif->open = replay_open;
+	ioif->write = replay_write;
+	ioif->read = replay_read;
+	ioif->close = replay_close;
+	ioif->wake = replay_wake;
+	if (mode == S96AT_REPLAY_FAST)
+		ioif->wait = replay_wait;
+	ioif->release = replay_release;
+
+	return ioif;
+err:
+	free(c);
+	free(ioif);
+
+	return NULL;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef S96AT_FREESTANDING
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <clock.h>
+#include <io.h>
+#include <s96at.h>
+
+#ifdef S96AT_FREESTANDING
+/* Defined by the target, if at all */
+extern uint64_t s96at_platform_now_us(void) __attribute__((weak));
+extern void s96at_platform_sleep_us(uint64_t us) __attribute__((weak));
+#endif
+
+bool clock_available(const struct s96at_clock *clock)
+{
+#ifdef S96AT_FREESTANDING
+	return clock || (s96at_platform_now_us && s96at_platform_sleep_us);
+#else
+	return true;
+#endif
+}
+
+uint64_t clock_now_us(const struct s96at_clock *clock)
+{
+#ifdef S96AT_FREESTANDING
+	if (clock)
+		return clock->now_us(clock->ctx);
+
+	return s96at_platform_now_us ? s96at_platform_now_us() : 0;
+#else
+	struct timespec ts;
+
+	if (clock)
+		return clock->now_us(clock->ctx);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void clock_sleep_us(const struct s96at_clock *clock, uint64_t us)
+{
+	if (clock)
+		clock->sleep_us(clock->ctx, us);
+#ifdef S96AT_FREESTANDING
+	else if (us && s96at_platform_sleep_us)
+		s96at_platform_sleep_us(us);
+#else
+	else if (us)
+		usleep(us);
+#endif
+}
+
+static uint64_t virtual_now_us(void *ctx)
+{
+	struct s96at_virtual_clock *vc = ctx;
+
+	return __atomic_load_n(&vc->now_us, __ATOMIC_ACQUIRE);
+}
+
+/* Nothing else happens while sleeping, time jumps to the wake up */
+static void virtual_sleep_us(void *ctx, uint64_t us)
+{
+	struct s96at_virtual_clock *vc = ctx;
+
+	__atomic_fetch_add(&vc->now_us, us, __ATOMIC_ACQ_REL);
+}
+
+void s96at_clock_virtual_init(struct s96at_virtual_clock *vc, uint64_t start_us)
+{
+	vc->clock.ctx = vc;
+	vc->clock.now_us = virtual_now_us;
+	vc->clock.sleep_us = virtual_sleep_us;
+	vc->now_us = start_us;
+}
+
+void s96at_clock_advance(struct s96at_virtual_clock *vc, uint64_t us)
+{
+	virtual_sleep_us(vc, us);
+}
+
+uint8_t s96at_set_clock(struct s96at_desc *desc,
+			const struct s96at_clock *clock)
+{
+	struct io_interface *ioif;
+
+	if (!desc || !desc->ioif)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	/* Down to the device, which may keep its own time */
+	for (ioif = desc->ioif; ioif; ioif = ioif->inner)
+		ioif->clock = clock;
+	desc->tempkey.clock = clock;
+
+	return S96AT_STATUS_OK;
+}
@@ -28,7 +28,7 @@ uint8_t SLOT_CONFIG_ADDR(uint8_t slotnbr)
 /*
  * Initializes a command packet.
  */
-void get_command(struct cmd_packet *p, uint8_t opcode)
+uint8_t get_command(struct cmd_packet *p, uint8_t opcode)
 {
 	assert(p);
 
@@ -99,10 +99,30 @@ void get_command(struct cmd_packet *p, uint8_t opcode)
 		break;
 
 	default:
-		break;
+		p->max_time = 0;
+		return STATUS_EXEC_ERROR;
 	}
+
+	return STATUS_OK;
+}
+
+uint8_t cmd_exec(struct io_interface *ioif, uint8_t opcode, uint8_t param1,
+		 uint16_t param2, const uint8_t *in, size_t in_size,
+		 uint8_t *out, size_t out_size)
+{
+	struct cmd_packet p;
+
+	get_command(&p, opcode);
+	p.param1 = param1;
+	p.param2[0] = param2 & 0xff;
+	p.param2[1] = param2 >> 8;
+	p.data = in;
+	p.data_length = in_size;
+
+	return at204_msg(ioif, &p, out, out_size);
 }
 
+#ifdef S96AT_CMD_READ
 uint8_t cmd_read(struct io_interface *ioif, uint8_t zone, uint8_t addr,
 		 uint8_t offset, size_t size, void *data, size_t data_size)
 {
@@ -137,7 +157,9 @@ uint8_t cmd_read(struct io_interface *ioif, uint8_t zone, uint8_t addr,
 
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_DERIVEKEY
 uint8_t cmd_derive_key(struct io_interface *ioif, uint8_t random, uint8_t slotnbr,
 		       uint8_t *buf, size_t size)
 {
@@ -153,7 +175,9 @@ uint8_t cmd_derive_key(struct io_interface *ioif, uint8_t random, uint8_t slotnb
 
 	return at204_msg(ioif, &p, &resp, sizeof(resp));
 }
+#endif
 
+#ifdef S96AT_CMD_CHECKMAC
 uint8_t cmd_check_mac(struct io_interface *ioif, uint8_t *in, size_t in_size,
 		      uint8_t mode, uint16_t slotnbr, uint8_t *out, size_t out_size)
 {
@@ -167,7 +191,9 @@ uint8_t cmd_check_mac(struct io_interface *ioif, uint8_t *in, size_t in_size,
 
 	return at204_msg(ioif, &p, out, out_size);
 }
+#endif
 
+#ifdef S96AT_CMD_DEVREV
 uint8_t cmd_get_devrev(struct io_interface *ioif, uint8_t *buf, size_t size)
 {
 	struct cmd_packet p;
@@ -176,7 +202,9 @@ uint8_t cmd_get_devrev(struct io_interface *ioif, uint8_t *buf, size_t size)
 
 	return at204_msg(ioif, &p, buf, size);
 }
+#endif
 
+#ifdef S96AT_CMD_HMAC
 uint8_t cmd_get_hmac(struct io_interface *ioif, uint8_t mode, uint16_t slotnbr, uint8_t *hmac)
 {
 	struct cmd_packet p;
@@ -194,7 +222,9 @@ uint8_t cmd_get_hmac(struct io_interface *ioif, uint8_t mode, uint16_t slotnbr,
 
 	return at204_msg(ioif, &p, hmac, HMAC_LEN);
 }
+#endif
 
+#ifdef S96AT_CMD_LOCK
 uint8_t cmd_lock_zone(struct io_interface *ioif, uint8_t zone,
 		      const uint16_t *expected_crc)
 {
@@ -242,7 +272,9 @@ uint8_t cmd_lock_zone(struct io_interface *ioif, uint8_t zone,
 out:
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_MAC
 uint8_t cmd_get_mac(struct io_interface *ioif, const uint8_t *in, size_t in_size,
 		    uint8_t mode, uint16_t slotnbr, uint8_t *out, size_t out_size)
 {
@@ -261,7 +293,9 @@ uint8_t cmd_get_mac(struct io_interface *ioif, const uint8_t *in, size_t in_size
 
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_NONCE
 uint8_t cmd_get_nonce(struct io_interface *ioif, const uint8_t *in, size_t in_size,
 		      uint8_t mode, uint8_t *out, size_t out_size)
 {
@@ -278,7 +312,9 @@ uint8_t cmd_get_nonce(struct io_interface *ioif, const uint8_t *in, size_t in_si
 
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_RANDOM
 uint8_t cmd_get_random(struct io_interface *ioif, uint8_t mode,
 		       uint8_t *buf, size_t size)
 {
@@ -289,7 +325,9 @@ uint8_t cmd_get_random(struct io_interface *ioif, uint8_t mode,
 
 	return at204_msg(ioif, &p, buf, size);
 }
+#endif
 
+#ifdef S96AT_CMD_GENDIG
 uint8_t cmd_gen_dig(struct io_interface *ioif, const uint8_t *in, size_t in_size,
 		    uint8_t zone, uint16_t slotnbr)
 {
@@ -305,7 +343,9 @@ uint8_t cmd_gen_dig(struct io_interface *ioif, const uint8_t *in, size_t in_size
 
 	return at204_msg(ioif, &p, &resp, sizeof(resp));
 }
+#endif
 
+#ifdef S96AT_CMD_PAUSE
 uint8_t cmd_pause(struct io_interface *ioif, uint8_t selector)
 {
 	struct cmd_packet p;
@@ -316,7 +356,9 @@ uint8_t cmd_pause(struct io_interface *ioif, uint8_t selector)
 
 	return at204_msg(ioif, &p, &resp_buf, 1);
 }
+#endif
 
+#ifdef S96AT_CMD_SHA
 uint8_t cmd_sha(struct io_interface *ioif, uint8_t mode, const uint8_t *in,
 		size_t in_size, uint8_t *out, size_t out_size)
 {
@@ -329,7 +371,9 @@ uint8_t cmd_sha(struct io_interface *ioif, uint8_t mode, const uint8_t *in,
 
 	return at204_msg(ioif, &p, out, out_size);
 }
+#endif
 
+#ifdef S96AT_CMD_UPDATEEXTRA
 uint8_t cmd_update_extra(struct io_interface *ioif, uint8_t mode, uint8_t value)
 {
 	uint8_t resp_buf;
@@ -341,7 +385,9 @@ uint8_t cmd_update_extra(struct io_interface *ioif, uint8_t mode, uint8_t value)
 
 	return at204_msg(ioif, &p, &resp_buf, sizeof(resp_buf));
 }
+#endif
 
+#ifdef S96AT_CMD_WRITE
 uint8_t cmd_write(struct io_interface *ioif, uint8_t zone, uint8_t addr,
 		  bool encrypted, const uint8_t *data, size_t size)
 {
@@ -365,3 +411,4 @@ uint8_t cmd_write(struct io_interface *ioif, uint8_t zone, uint8_t addr,
 
 	return at204_msg(ioif, &p, &resp, 1);
 }
+#endif
@@ -0,0 +1,1010 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/* struct ucred, F_GET_SEALS */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmd.h>
+#include <daemon.h>
+#include <debug.h>
+#include <device.h>
+#include <io.h>
+#include <s96at.h>
+#include <stats.h>
+#include <status.h>
+
+#define MAX_CLIENTS		64
+
+/* Longest execution wait a client may ask for, in msec */
+#define MAX_WAIT_MS		1000
+
+/*
+ * A waiting session counts this much less device time, in usec, on the
+ * device that still holds its TempKey, which saves it the Nonce or GenDig.
+ */
+#define AFFINITY_BONUS_US	100000
+
+/* Wake pulses before a session that was put aside gives up on the device */
+#define WAKE_RETRIES		10
+
+/* How often a device with an idle session looks for other work */
+#define SESSION_POLL_MS		50
+
+struct chip;
+
+struct client {
+	struct server *srv;
+	int fd;
+	/* Credentials of the peer, see client_priority() */
+	uid_t uid;
+	gid_t gid;
+	struct s96atd_ring *ring;
+	pthread_t ring_thread;
+	/* Calls not run yet, in order */
+	struct s96atd_msg queue[S96ATD_RING_SLOTS];
+	unsigned int head;
+	unsigned int len;
+	/* Arrival of each queued call */
+	uint64_t queued_us[S96ATD_RING_SLOTS];
+	/* Order in which the client started waiting */
+	uint64_t seq;
+	/* Priority class and weight, see s96at_set_priority() */
+	uint8_t prio;
+	uint8_t weight;
+	/* Device time used, in usec divided by the weight */
+	uint64_t vtime;
+	/* Device of the session, if any, including one put aside */
+	struct chip *chip;
+	bool new_device;
+	bool busy;
+	bool closed;
+};
+
+struct chip {
+	struct server *srv;
+	struct io_interface *ioif;
+	struct client *owner;
+	/* Client whose TempKey the device holds */
+	struct client *last;
+	/* Session put aside for a critical one, see chip_preempt() */
+	struct client *suspended;
+	/* The critical session changed TempKey under the one put aside */
+	bool tk_lost;
+	uint64_t session_us;
+	pthread_t worker;
+};
+
+struct server {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int listen_fd;
+	int notify[2];
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	struct chip *chips;
+	unsigned int num_chips;
+	struct client *clients[MAX_CLIENTS];
+	unsigned int num_clients;
+	uint64_t seq;
+	/* Peers allowed in the critical class, see server_allow_critical() */
+	uid_t crit_uid;
+	gid_t crit_gid;
+	/* Per class, the device time of the last call started */
+	uint64_t vclock[S96AT_PRIORITY_NUM];
+	struct s96atd_class_stats stats[S96AT_PRIORITY_NUM];
+	bool stop;
+};
+
+void ring_wait(uint32_t *futex, uint32_t val, uint32_t ms)
+{
+	struct timespec ts = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = (ms % 1000) * 1000000L,
+	};
+
+	syscall(SYS_futex, futex, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+void ring_wake(uint32_t *futex)
+{
+	syscall(SYS_futex, futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* Wakes up the main loop, to reap clients or to stop */
+static void server_notify(struct server *srv)
+{
+	char c = 0;
+
+	if (write(srv->notify[1], &c, 1) < 0)
+		logd("Could not notify the server\n");
+}
+
+/* Called with the lock held */
+static void client_close(struct server *srv, struct client *c)
+{
+	if (c->closed)
+		return;
+
+	c->closed = true;
+	srv->stats[c->prio].depth -= c->len;
+	c->len = 0;
+
+	if (c->ring) {
+		__atomic_store_n(&c->ring->closed, 1, __ATOMIC_RELEASE);
+		ring_wake(&c->ring->req_head);
+		ring_wake(&c->ring->resp_head);
+	}
+
+	pthread_cond_broadcast(&srv->cond);
+	server_notify(srv);
+}
+
+/* Called with the lock held */
+static bool client_enqueue(struct server *srv, struct client *c,
+			   const struct s96atd_msg *msg)
+{
+	struct s96atd_class_stats *st;
+	unsigned int i;
+
+	if (c->closed)
+		return false;
+
+	/* Clients have no more than a ring of calls in flight */
+	if (c->len == S96ATD_RING_SLOTS || msg->len > S96ATD_MAX_DATA ||
+	    msg->read_len > S96ATD_MAX_DATA) {
+		client_close(srv, c);
+		return false;
+	}
+
+	if (!c->len) {
+		c->seq = ++srv->seq;
+		/* Time spent without calls does not count as a credit */
+		if (c->vtime < srv->vclock[c->prio])
+			c->vtime = srv->vclock[c->prio];
+	}
+
+	i = (c->head + c->len) % S96ATD_RING_SLOTS;
+	memcpy(&c->queue[i], msg, sizeof(*msg));
+	c->queued_us[i] = stats_now_us();
+	c->len++;
+
+	st = &srv->stats[c->prio];
+	if (++st->depth > st->max_depth)
+		st->max_depth = st->depth;
+
+	pthread_cond_broadcast(&srv->cond);
+
+	return true;
+}
+
+/* Called with the lock held */
+static bool client_respond(struct client *c, const struct s96atd_msg *msg)
+{
+	struct s96atd_ring *ring = c->ring;
+	uint32_t head;
+	ssize_t n;
+
+	if (!ring) {
+		n = send(c->fd, msg, S96ATD_MSG_HDR_LEN + msg->len,
+			 MSG_DONTWAIT | MSG_NOSIGNAL);
+		return n == S96ATD_MSG_HDR_LEN + msg->len;
+	}
+
+	head = ring->resp_head;
+	if (head - __atomic_load_n(&ring->resp_tail, __ATOMIC_ACQUIRE) >=
+	    S96ATD_RING_SLOTS)
+		return false;
+
+	memcpy(&ring->resp[head % S96ATD_RING_SLOTS], msg, sizeof(*msg));
+	__atomic_store_n(&ring->resp_head, head + 1, __ATOMIC_RELEASE);
+	ring_wake(&ring->resp_head);
+
+	return true;
+}
+
+/*
+ * Called with the lock held, msg is turned into the response. The critical
+ * class holds up everyone else, so only the peers the server allows may
+ * join it.
+ */
+static void client_priority(struct server *srv, struct client *c,
+			    struct s96atd_msg *msg)
+{
+	msg->ret = STATUS_EXEC_ERROR;
+
+	if (msg->len == 2 && msg->data[0] < S96AT_PRIORITY_NUM &&
+	    msg->data[1] && (msg->data[0] != S96AT_PRIORITY_CRITICAL ||
+			     c->uid == srv->crit_uid ||
+			     c->gid == srv->crit_gid)) {
+		srv->stats[c->prio].depth -= c->len;
+		c->prio = msg->data[0];
+		c->weight = msg->data[1];
+		srv->stats[c->prio].depth += c->len;
+		msg->ret = STATUS_OK;
+	}
+
+	msg->flags = 0;
+	msg->len = 0;
+
+	if (!client_respond(c, msg))
+		client_close(srv, c);
+}
+
+static bool client_closed(struct server *srv, struct client *c)
+{
+	bool closed;
+
+	pthread_mutex_lock(&srv->lock);
+	closed = c->closed;
+	pthread_mutex_unlock(&srv->lock);
+
+	return closed;
+}
+
+/*
+ * The ring is mapped by the client as well, which can write anything into
+ * it. Only req_head and the calls are taken from it, the calls once copied
+ * out. The index of the next call and whether to stop are kept here.
+ */
+static void *ring_worker(void *arg)
+{
+	struct client *c = arg;
+	struct server *srv = c->srv;
+	struct s96atd_ring *ring = c->ring;
+	struct s96atd_msg msg;
+	uint32_t head;
+	uint32_t tail = 0;
+
+	while (!client_closed(srv, c)) {
+		head = __atomic_load_n(&ring->req_head, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			/* Timed, a close may race with going to sleep */
+			ring_wait(&ring->req_head, head, SESSION_POLL_MS);
+			continue;
+		}
+
+		memcpy(&msg, &ring->req[tail % S96ATD_RING_SLOTS], sizeof(msg));
+		tail++;
+		__atomic_store_n(&ring->req_tail, tail, __ATOMIC_RELEASE);
+
+		pthread_mutex_lock(&srv->lock);
+		if (head - tail >= S96ATD_RING_SLOTS)
+			client_close(srv, c);
+		else if (msg.op == S96ATD_PRIORITY)
+			client_priority(srv, c, &msg);
+		else
+			client_enqueue(srv, c, &msg);
+		pthread_mutex_unlock(&srv->lock);
+	}
+
+	return NULL;
+}
+
+/* Runs one call of a client on the device, msg is turned into the response */
+static void chip_run(struct chip *chip, struct s96atd_msg *msg)
+{
+	struct io_interface *ioif = chip->ioif;
+	size_t n;
+	uint32_t ms;
+
+	switch (msg->op) {
+	case S96ATD_WAKE:
+		msg->ret = ioif->wake(ioif->ctx);
+		msg->len = 0;
+		break;
+	case S96ATD_WRITE:
+		msg->ret = ioif->write(ioif->ctx, msg->data, msg->len);
+		msg->len = 0;
+		break;
+	case S96ATD_XFER:
+		/* Without a packet, the response is read again */
+		if (msg->len) {
+			n = ioif->write(ioif->ctx, msg->data, msg->len);
+			if (n != msg->len) {
+				msg->ret = 0;
+				msg->len = 0;
+				break;
+			}
+
+			ms = msg->wait_ms < MAX_WAIT_MS ? msg->wait_ms : MAX_WAIT_MS;
+			if (ioif->wait)
+				ioif->wait(ioif->ctx, ms);
+			else
+				usleep(ms * 1000);
+		}
+
+		n = ioif->read(ioif->ctx, msg->data, msg->read_len);
+		msg->ret = n;
+		msg->len = n <= msg->read_len ? n : 0;
+		break;
+	default:
+		msg->ret = STATUS_EXEC_ERROR;
+		msg->len = 0;
+	}
+}
+
+/* Whether a call leaves TempKey, and the SHA context held in it, alone */
+static bool call_keeps_tempkey(const struct s96atd_msg *msg)
+{
+	switch (msg->op) {
+	case S96ATD_WAKE:
+		return true;
+	case S96ATD_WRITE:
+		return !msg->len || msg->data[0] != PKT_FUNC_SLEEP;
+	case S96ATD_XFER:
+		break;
+	default:
+		return false;
+	}
+
+	/* Another read of the previous response */
+	if (!msg->len)
+		return true;
+
+	/* Word address, count, opcode and param1 */
+	if (msg->len < 4)
+		return false;
+
+	switch (msg->data[2]) {
+	case OPCODE_DEVREV:
+		return true;
+	case OPCODE_MAC:
+		return (msg->data[3] & 0x03) == S96AT_MAC_MODE_0;
+	case OPCODE_READ:
+		/* Reads of the data zone may be encrypted with TempKey */
+		return (msg->data[3] & 0x03) != ZONE_DATA;
+	default:
+		return false;
+	}
+}
+
+/* Called with the lock held */
+static void session_start(struct chip *chip, struct client *c)
+{
+	chip->owner = c;
+	chip->session_us = stats_now_us();
+	c->chip = chip;
+	c->new_device = chip->last != c;
+	chip->last = c;
+}
+
+/*
+ * Called with the lock held. Whose TempKey the device holds is left to the
+ * caller.
+ */
+static void session_end(struct chip *chip)
+{
+	struct client *c = chip->owner;
+
+	chip->owner = NULL;
+	c->chip = NULL;
+
+	/* Closed clients are reaped once they are out of their session */
+	if (c->closed)
+		server_notify(chip->srv);
+	pthread_cond_broadcast(&chip->srv->cond);
+}
+
+/* Called with the lock held */
+static bool chip_free_exists(struct server *srv)
+{
+	unsigned int i;
+
+	for (i = 0; i < srv->num_chips; i++)
+		if (!srv->chips[i].owner && !srv->chips[i].suspended)
+			return true;
+
+	return false;
+}
+
+/*
+ * Called with the lock held, which is dropped. Puts the session on the
+ * device aside for the one of the critical client crit, which starts right
+ * away so that no other device takes the client while the lock is dropped.
+ * Idle keeps TempKey, and the SHA context along with it, until the session
+ * goes on in session_resume().
+ */
+static void chip_preempt(struct chip *chip, struct client *crit)
+{
+	struct server *srv = chip->srv;
+	struct client *c = chip->owner;
+
+	chip->suspended = c;
+	chip->tk_lost = false;
+	srv->stats[c->prio].preempted++;
+	session_start(chip, crit);
+
+	pthread_mutex_unlock(&srv->lock);
+	device_idle(chip->ioif);
+	pthread_mutex_lock(&srv->lock);
+}
+
+/*
+ * Called with the lock held, which is dropped. Wakes the device up again
+ * for the session put aside by chip_preempt(), unless its client is gone
+ * by now. Returns whether the session goes on.
+ */
+static bool session_resume(struct chip *chip)
+{
+	struct server *srv = chip->srv;
+	struct client *c = chip->suspended;
+	bool awake = false;
+	uint8_t status;
+	int n;
+
+	chip->suspended = NULL;
+
+	if (c->closed) {
+		c->chip = NULL;
+		chip->last = NULL;
+		server_notify(srv);
+		return false;
+	}
+
+	pthread_mutex_unlock(&srv->lock);
+	for (n = 0; n < WAKE_RETRIES && !awake; n++) {
+		at204_wake(chip->ioif);
+		awake = at204_read(chip->ioif, &status, sizeof(status)) ==
+			STATUS_OK && status == STATUS_AFTER_WAKE;
+	}
+	pthread_mutex_lock(&srv->lock);
+
+	chip->owner = c;
+	chip->session_us = stats_now_us();
+	chip->last = c;
+
+	/* The client left the device awake, with its TempKey */
+	if (chip->tk_lost || !awake)
+		c->new_device = true;
+
+	return true;
+}
+
+/*
+ * Picks the next client to run a call of on the device, or NULL if there is
+ * nothing to do. The session on the device runs first, back to back, so
+ * that the calls of a wake window are not spread out, unless a critical
+ * client waits and no device is free. A new session goes to the waiting
+ * client of the most urgent class, and within the class to the one that
+ * has used the least device time for its weight, where the device that
+ * still holds the TempKey of a client gives it AFFINITY_BONUS_US. A session
+ * put aside goes on once no critical client waits. Called with the lock
+ * held, which may be dropped.
+ */
+static struct client *chip_next(struct chip *chip)
+{
+	struct server *srv = chip->srv;
+	struct client *c = chip->owner;
+	struct client *best = NULL;
+	struct client *crit = NULL;
+	struct client *w;
+	uint64_t key;
+	uint64_t best_key = 0;
+	uint64_t bonus;
+	bool waiting = chip->suspended != NULL;
+	unsigned int i;
+
+	for (i = 0; i < srv->num_clients; i++) {
+		w = srv->clients[i];
+		if (!w->len || w->chip || w->closed)
+			continue;
+
+		waiting = true;
+		if (w->prio == S96AT_PRIORITY_CRITICAL &&
+		    (!crit || w->vtime < crit->vtime ||
+		     (w->vtime == crit->vtime && w->seq < crit->seq)))
+			crit = w;
+	}
+
+	if (c && crit && c->prio != S96AT_PRIORITY_CRITICAL && !c->closed &&
+	    !chip->suspended && !chip_free_exists(srv)) {
+		chip_preempt(chip, crit);
+		c = chip->owner;
+	}
+
+	if (c) {
+		if (c->len) {
+			return c;
+		} else if (c->closed) {
+			pthread_mutex_unlock(&srv->lock);
+			device_idle(chip->ioif);
+			pthread_mutex_lock(&srv->lock);
+			chip->last = NULL;
+			session_end(chip);
+		} else if (waiting && stats_now_us() - chip->session_us >=
+			   S96AT_WATCHDOG_TIME * 1000ULL) {
+			/* The device has gone to sleep on its own by now */
+			chip->last = NULL;
+			chip->tk_lost = true;
+			session_end(chip);
+		} else {
+			return NULL;
+		}
+	}
+
+	for (;;) {
+		for (i = 0; i < srv->num_clients; i++) {
+			c = srv->clients[i];
+			if (!c->len || c->chip || c->closed)
+				continue;
+
+			/* Only critical sessions go ahead of one put aside */
+			if (chip->suspended && c->prio != S96AT_PRIORITY_CRITICAL)
+				continue;
+
+			key = c->vtime;
+			if (chip->last == c) {
+				bonus = AFFINITY_BONUS_US / c->weight;
+				key = key > bonus ? key - bonus : 0;
+			}
+
+			if (!best || c->prio < best->prio ||
+			    (c->prio == best->prio &&
+			     (key < best_key ||
+			      (key == best_key && c->seq < best->seq)))) {
+				best = c;
+				best_key = key;
+			}
+		}
+
+		if (best) {
+			session_start(chip, best);
+			return best;
+		}
+
+		if (!chip->suspended)
+			return NULL;
+
+		if (session_resume(chip))
+			return chip->owner->len ? chip->owner : NULL;
+	}
+}
+
+static void *chip_worker(void *arg)
+{
+	struct chip *chip = arg;
+	struct server *srv = chip->srv;
+	struct client *c;
+	struct s96atd_class_stats *st;
+	struct s96atd_msg msg;
+	struct timespec ts;
+	uint64_t t0;
+	uint8_t func;
+	bool keeps;
+
+	pthread_mutex_lock(&srv->lock);
+
+	while (!srv->stop) {
+		c = chip_next(chip);
+		if (!c) {
+			if (!chip->owner) {
+				pthread_cond_wait(&srv->cond, &srv->lock);
+				continue;
+			}
+
+			/* An idle session gives way once the watchdog has expired */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += SESSION_POLL_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&srv->cond, &srv->lock, &ts);
+			continue;
+		}
+
+		t0 = stats_now_us();
+
+		st = &srv->stats[c->prio];
+		st->depth--;
+		st->calls++;
+		stats_record(&st->wait, t0 - c->queued_us[c->head]);
+
+		memcpy(&msg, &c->queue[c->head], sizeof(msg));
+		c->head = (c->head + 1) % S96ATD_RING_SLOTS;
+		c->len--;
+		c->busy = true;
+
+		if (srv->vclock[c->prio] < c->vtime)
+			srv->vclock[c->prio] = c->vtime;
+
+		func = msg.op == S96ATD_WRITE && msg.len ? msg.data[0] :
+			PKT_FUNC_COMMAND;
+		keeps = call_keeps_tempkey(&msg);
+
+		pthread_mutex_unlock(&srv->lock);
+		chip_run(chip, &msg);
+		pthread_mutex_lock(&srv->lock);
+
+		c->busy = false;
+		c->vtime += (stats_now_us() - t0) / c->weight;
+
+		if (chip->suspended && !keeps)
+			chip->tk_lost = true;
+
+		msg.flags = c->new_device ? S96ATD_FLAG_NEW_DEVICE : 0;
+		c->new_device = false;
+
+		if (!c->closed && !client_respond(c, &msg))
+			client_close(srv, c);
+
+		/* The session ends with the wake window, idle keeps TempKey */
+		if (func == PKT_FUNC_IDLE || func == PKT_FUNC_SLEEP) {
+			if (func == PKT_FUNC_SLEEP)
+				chip->last = NULL;
+			session_end(chip);
+		}
+	}
+
+	pthread_mutex_unlock(&srv->lock);
+
+	return NULL;
+}
+
+/* Called from the main loop only, which owns the list of clients */
+static void client_free(struct server *srv, unsigned int i)
+{
+	struct client *c = srv->clients[i];
+	unsigned int j;
+
+	if (c->ring) {
+		pthread_join(c->ring_thread, NULL);
+		munmap(c->ring, sizeof(*c->ring));
+	}
+	close(c->fd);
+
+	pthread_mutex_lock(&srv->lock);
+	for (j = 0; j < srv->num_chips; j++)
+		if (srv->chips[j].last == c)
+			srv->chips[j].last = NULL;
+	srv->clients[i] = srv->clients[--srv->num_clients];
+	pthread_mutex_unlock(&srv->lock);
+
+	free(c);
+}
+
+static void server_accept(struct server *srv)
+{
+	struct client *c;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	int fd;
+
+	fd = accept(srv->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ||
+	    len != sizeof(cred)) {
+		loge("Could not get the credentials of a client\n");
+		close(fd);
+		return;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c || srv->num_clients == MAX_CLIENTS) {
+		loge("Too many clients\n");
+		free(c);
+		close(fd);
+		return;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	c->srv = srv;
+	c->fd = fd;
+	c->uid = cred.uid;
+	c->gid = cred.gid;
+	c->prio = S96AT_PRIORITY_NORMAL;
+	c->weight = 1;
+
+	pthread_mutex_lock(&srv->lock);
+	srv->clients[srv->num_clients++] = c;
+	pthread_mutex_unlock(&srv->lock);
+}
+
+/*
+ * Maps the ring passed along the message and serves it from now on. The ring
+ * must be large enough and sealed against resizing, or a client shrinking it
+ * later would fault the daemon on its next access.
+ */
+static int client_ring(struct client *c, struct msghdr *mh)
+{
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(mh);
+	struct s96atd_ring *ring;
+	struct stat st;
+	int seals;
+	int fd;
+
+	if (c->ring || !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+		return -1;
+
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+	seals = fcntl(fd, F_GET_SEALS);
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*ring) || seals < 0 ||
+	    (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) !=
+	    (F_SEAL_SHRINK | F_SEAL_GROW)) {
+		close(fd);
+		return -1;
+	}
+
+	ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED)
+		return -1;
+
+	c->ring = ring;
+	if (pthread_create(&c->ring_thread, NULL, ring_worker, c)) {
+		munmap(ring, sizeof(*ring));
+		c->ring = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void client_recv(struct server *srv, struct client *c)
+{
+	struct s96atd_msg msg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctrl;
+	struct iovec iov = {
+		.iov_base = &msg,
+		.iov_len = sizeof(msg),
+	};
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctrl.buf,
+		.msg_controllen = sizeof(ctrl.buf),
+	};
+	ssize_t n;
+
+	n = recvmsg(c->fd, &mh, MSG_CMSG_CLOEXEC);
+	if (n < 0 && errno == EINTR)
+		return;
+
+	pthread_mutex_lock(&srv->lock);
+
+	if (n < (ssize_t)S96ATD_MSG_HDR_LEN ||
+	    n != S96ATD_MSG_HDR_LEN + msg.len) {
+		client_close(srv, c);
+	} else if (msg.op == S96ATD_RING) {
+		msg.ret = client_ring(c, &mh) ? STATUS_EXEC_ERROR : STATUS_OK;
+		msg.len = 0;
+		if (send(c->fd, &msg, S96ATD_MSG_HDR_LEN, MSG_NOSIGNAL) !=
+		    S96ATD_MSG_HDR_LEN || msg.ret != STATUS_OK)
+			client_close(srv, c);
+	} else if (msg.op == S96ATD_PRIORITY) {
+		client_priority(srv, c, &msg);
+	} else {
+		client_enqueue(srv, c, &msg);
+	}
+
+	pthread_mutex_unlock(&srv->lock);
+}
+
+struct server *server_create(const char *path, struct io_interface **ioifs,
+			     unsigned int num)
+{
+	struct server *srv;
+	struct sockaddr_un addr;
+	unsigned int i;
+
+	if (!path || !ioifs || !num || strlen(path) >= sizeof(addr.sun_path))
+		return NULL;
+
+	srv = calloc(1, sizeof(*srv));
+	if (!srv)
+		return NULL;
+
+	srv->chips = calloc(num, sizeof(*srv->chips));
+	if (!srv->chips)
+		goto err;
+
+	for (i = 0; i < num; i++) {
+		srv->chips[i].srv = srv;
+		srv->chips[i].ioif = ioifs[i];
+	}
+	srv->num_chips = num;
+
+	srv->notify[0] = srv->notify[1] = -1;
+	if (pipe(srv->notify))
+		goto err;
+	fcntl(srv->notify[0], F_SETFL, O_NONBLOCK);
+	fcntl(srv->notify[1], F_SETFL, O_NONBLOCK);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	strcpy(srv->path, path);
+
+	srv->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (srv->listen_fd < 0)
+		goto err_pipe;
+
+	/* A socket left behind by a previous instance */
+	unlink(path);
+
+	if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(srv->listen_fd, MAX_CLIENTS)) {
+		loge("Could not listen on %s\n", path);
+		close(srv->listen_fd);
+		goto err_pipe;
+	}
+
+	srv->crit_uid = geteuid();
+	srv->crit_gid = (gid_t)-1;
+
+	pthread_mutex_init(&srv->lock, NULL);
+	pthread_cond_init(&srv->cond, NULL);
+
+	return srv;
+err_pipe:
+	close(srv->notify[0]);
+	close(srv->notify[1]);
+err:
+	free(srv->chips);
+	free(srv);
+
+	return NULL;
+}
+
+void server_allow_critical(struct server *srv, uid_t uid, gid_t gid)
+{
+	pthread_mutex_lock(&srv->lock);
+	srv->crit_uid = uid;
+	srv->crit_gid = gid;
+	pthread_mutex_unlock(&srv->lock);
+}
+
+int server_run(struct server *srv)
+{
+	struct pollfd fds[2 + MAX_CLIENTS];
+	struct client *polled[MAX_CLIENTS];
+	struct client *c;
+	unsigned int started;
+	unsigned int num;
+	unsigned int i;
+	char buf[16];
+	int ret = 0;
+
+	for (started = 0; started < srv->num_chips; started++) {
+		if (pthread_create(&srv->chips[started].worker, NULL,
+				   chip_worker, &srv->chips[started]))
+			break;
+	}
+
+	if (started < srv->num_chips) {
+		__atomic_store_n(&srv->stop, true, __ATOMIC_RELAXED);
+		ret = -1;
+	}
+
+	while (!__atomic_load_n(&srv->stop, __ATOMIC_RELAXED)) {
+		fds[0].fd = srv->notify[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = srv->listen_fd;
+		fds[1].events = POLLIN;
+
+		/* Closed clients are reaped once their session is over */
+		pthread_mutex_lock(&srv->lock);
+		for (i = 0; i < srv->num_clients;) {
+			c = srv->clients[i];
+			if (!c->closed || c->chip || c->busy) {
+				i++;
+				continue;
+			}
+			pthread_mutex_unlock(&srv->lock);
+			client_free(srv, i);
+			pthread_mutex_lock(&srv->lock);
+		}
+
+		num = 0;
+		for (i = 0; i < srv->num_clients; i++) {
+			if (srv->clients[i]->closed)
+				continue;
+			polled[num] = srv->clients[i];
+			fds[2 + num].fd = srv->clients[i]->fd;
+			fds[2 + num].events = POLLIN;
+			num++;
+		}
+		pthread_mutex_unlock(&srv->lock);
+
+		if (poll(fds, 2 + num, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -1;
+			break;
+		}
+
+		if (fds[0].revents)
+			while (read(srv->notify[0], buf, sizeof(buf)) > 0)
+				;
+
+		if (fds[1].revents & POLLIN)
+			server_accept(srv);
+
+		for (i = 0; i < num; i++)
+			if (fds[2 + i].revents)
+				client_recv(srv, polled[i]);
+	}
+
+	pthread_mutex_lock(&srv->lock);
+	srv->stop = true;
+	for (i = 0; i < srv->num_clients; i++)
+		client_close(srv, srv->clients[i]);
+	pthread_cond_broadcast(&srv->cond);
+	pthread_mutex_unlock(&srv->lock);
+
+	for (i = 0; i < started; i++)
+		pthread_join(srv->chips[i].worker, NULL);
+
+	while (srv->num_clients)
+		client_free(srv, 0);
+
+	return ret;
+}
+
+void server_stop(struct server *srv)
+{
+	__atomic_store_n(&srv->stop, true, __ATOMIC_RELAXED);
+	server_notify(srv);
+}
+
+void server_free(struct server *srv)
+{
+	if (!srv)
+		return;
+
+	close(srv->listen_fd);
+	unlink(srv->path);
+	close(srv->notify[0]);
+	close(srv->notify[1]);
+	pthread_cond_destroy(&srv->cond);
+	pthread_mutex_destroy(&srv->lock);
+	free(srv->chips);
+	free(srv);
+}
+
+void server_stats(struct server *srv, struct s96atd_class_stats *stats,
+		  bool reset)
+{
+	unsigned int i;
+	uint32_t depth;
+
+	pthread_mutex_lock(&srv->lock);
+
+	memcpy(stats, srv->stats, sizeof(srv->stats));
+
+	if (reset) {
+		for (i = 0; i < S96AT_PRIORITY_NUM; i++) {
+			depth = srv->stats[i].depth;
+			memset(&srv->stats[i], 0, sizeof(srv->stats[i]));
+			srv->stats[i].depth = depth;
+			srv->stats[i].max_depth = depth;
+		}
+	}
+
+	pthread_mutex_unlock(&srv->lock);
+}
@@ -8,6 +8,7 @@
 #include <device.h>
 #include <io.h>
 #include <packet.h>
+#include <stats.h>
 #include <status.h>
 
 uint8_t device_idle(struct io_interface *ioif)
@@ -15,6 +16,10 @@ uint8_t device_idle(struct io_interface *ioif)
 	uint8_t ret;
 	uint8_t data;
 	uint8_t word_addr = PKT_FUNC_IDLE;
+	struct s96at_stats *st = stats_local(ioif);
+
+	if (st)
+		STATS_ADD(st->idles, 1);
 
 	at204_write(ioif, &word_addr, sizeof(word_addr));
 
@@ -34,6 +39,10 @@ uint8_t device_sleep(struct io_interface *ioif)
 	uint8_t ret;
 	uint8_t data;
 	uint8_t word_addr = PKT_FUNC_SLEEP;
+	struct s96at_stats *st = stats_local(ioif);
+
+	if (st)
+		STATS_ADD(st->sleeps, 1);
 
 	at204_write(ioif, &word_addr, sizeof(word_addr));
 
@@ -0,0 +1,305 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <debug.h>
+#include <s96at.h>
+#include <sha.h>
+
+/* Number of wake attempts before giving up on the device */
+#define ENTROPY_WAKE_RETRIES		10
+
+/* SP 800-90A Table 2: max_number_of_bits_per_request is 2^19 */
+#define DRBG_MAX_REQUEST_LEN		(1 << 16)
+
+/* SP 800-90A Table 2: reseed_interval is at most 2^48 */
+#define DRBG_RESEED_INTERVAL		(1ULL << 48)
+
+#define DRBG_ENTROPY_LEN		32
+#define DRBG_NONCE_LEN			16
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Refill the entropy queue. The device is woken up, a batch of Random
+ * commands is issued back to back within the same wake window and the
+ * device is then put back into the idle state. Must be called with the
+ * queue lock held.
+ */
+static uint8_t entropy_refill(struct s96at_entropy *src)
+{
+	int i;
+	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
+	uint8_t *block;
+
+	for (i = 0; i < ENTROPY_WAKE_RETRIES; i++) {
+		if (s96at_wake(src->desc) == S96AT_STATUS_READY)
+			break;
+	}
+
+	if (i == ENTROPY_WAKE_RETRIES) {
+		loge("Could not wake up the device\n");
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	for (i = 0; i < S96AT_ENTROPY_BATCH; i++) {
+		block = src->buf + i * S96AT_RANDOM_LEN;
+
+		ret = s96at_get_random(src->desc, S96AT_RANDOM_MODE_UPDATE_SEED,
+				       block);
+		if (ret != S96AT_STATUS_OK)
+			break;
+
+		/*
+		 * Continuous test: an unlocked device returns a fixed pattern
+		 * and a stuck RNG returns the same block over and over again.
+		 */
+		if (!memcmp(block, src->last, S96AT_RANDOM_LEN)) {
+			loge("RNG returned a repeated block\n");
+			ret = S96AT_STATUS_EXEC_ERROR;
+			break;
+		}
+		memcpy(src->last, block, S96AT_RANDOM_LEN);
+	}
+
+	s96at_idle(src->desc);
+
+	if (ret != S96AT_STATUS_OK) {
+		memset(src->buf, 0, sizeof(src->buf));
+		return ret;
+	}
+
+	src->avail = sizeof(src->buf);
+
+	return S96AT_STATUS_OK;
+}
+
+/*
+ * Take len bytes out of the entropy queue. Bytes are served exactly once
+ * and wiped from the queue as soon as they have been handed out.
+ */
+static uint8_t entropy_get(struct s96at_entropy *src, uint8_t *buf, size_t len)
+{
+	uint8_t ret = S96AT_STATUS_OK;
+	uint8_t *p;
+	size_t n;
+
+	pthread_mutex_lock(&src->lock);
+
+	while (len) {
+		if (!src->avail) {
+			ret = entropy_refill(src);
+			if (ret != S96AT_STATUS_OK)
+				break;
+		}
+
+		n = len < src->avail ? len : src->avail;
+		p = src->buf + sizeof(src->buf) - src->avail;
+
+		memcpy(buf, p, n);
+		memset(p, 0, n);
+
+		src->avail -= n;
+		buf += n;
+		len -= n;
+	}
+
+	pthread_mutex_unlock(&src->lock);
+
+	return ret;
+}
+
+uint8_t s96at_entropy_init(struct s96at_entropy *src, struct s96at_desc *desc)
+{
+	if (!src || !desc)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(src, 0, sizeof(*src));
+	src->desc = desc;
+
+	if (pthread_mutex_init(&src->lock, NULL))
+		return S96AT_STATUS_EXEC_ERROR;
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_entropy_cleanup(struct s96at_entropy *src)
+{
+	if (!src)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	pthread_mutex_destroy(&src->lock);
+	memset(src, 0, sizeof(*src));
+
+	return S96AT_STATUS_OK;
+}
+
+/* HMAC_DRBG_Update, SP 800-90A Sect 10.1.2.2 */
+static void drbg_update(struct s96at_drbg *drbg, const uint8_t *data1,
+			size_t data1_len, const uint8_t *data2, size_t data2_len)
+{
+	uint8_t i;
+	struct hmac_sha256_ctx ctx;
+
+	for (i = 0; i < 2; i++) {
+		hmac_sha256_init(&ctx, drbg->key, sizeof(drbg->key));
+		hmac_sha256_update(&ctx, drbg->v, sizeof(drbg->v));
+		hmac_sha256_update(&ctx, &i, sizeof(i));
+		if (data1_len)
+			hmac_sha256_update(&ctx, data1, data1_len);
+		if (data2_len)
+			hmac_sha256_update(&ctx, data2, data2_len);
+		hmac_sha256_final(&ctx, drbg->key);
+
+		hmac_sha256(drbg->key, sizeof(drbg->key), drbg->v,
+			    sizeof(drbg->v), drbg->v);
+
+		if (!data1_len && !data2_len)
+			break;
+	}
+}
+
+/* HMAC_DRBG_Reseed, SP 800-90A Sect 10.1.2.4 */
+static uint8_t drbg_reseed(struct s96at_drbg *drbg, const uint8_t *add,
+			   size_t add_len)
+{
+	uint8_t ret;
+	uint8_t entropy[DRBG_ENTROPY_LEN];
+
+	ret = entropy_get(drbg->src, entropy, sizeof(entropy));
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	drbg_update(drbg, entropy, sizeof(entropy), add, add_len);
+	memset(entropy, 0, sizeof(entropy));
+
+	drbg->reseed_counter = 1;
+	drbg->bytes_since_reseed = 0;
+	drbg->last_reseed_ms = now_ms();
+
+	return S96AT_STATUS_OK;
+}
+
+static bool drbg_reseed_required(struct s96at_drbg *drbg)
+{
+	if (drbg->reseed_counter > DRBG_RESEED_INTERVAL)
+		return true;
+
+	if (drbg->reseed_bytes && drbg->bytes_since_reseed >= drbg->reseed_bytes)
+		return true;
+
+	if (drbg->reseed_ms && now_ms() - drbg->last_reseed_ms >= drbg->reseed_ms)
+		return true;
+
+	return false;
+}
+
+uint8_t s96at_drbg_init(struct s96at_drbg *drbg, struct s96at_entropy *src,
+			const uint8_t *pers, size_t pers_len,
+			uint64_t reseed_bytes, uint32_t reseed_ms)
+{
+	uint8_t ret;
+	uint8_t seed[DRBG_ENTROPY_LEN + DRBG_NONCE_LEN];
+
+	if (!drbg || !src || (pers_len && !pers))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(drbg, 0, sizeof(*drbg));
+	drbg->src = src;
+	drbg->reseed_bytes = reseed_bytes;
+	drbg->reseed_ms = reseed_ms;
+
+	/* HMAC_DRBG_Instantiate, SP 800-90A Sect 10.1.2.3 */
+	ret = entropy_get(src, seed, sizeof(seed));
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	memset(drbg->key, 0x00, sizeof(drbg->key));
+	memset(drbg->v, 0x01, sizeof(drbg->v));
+
+	drbg_update(drbg, seed, sizeof(seed), pers, pers_len);
+	memset(seed, 0, sizeof(seed));
+
+	drbg->reseed_counter = 1;
+	drbg->last_reseed_ms = now_ms();
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_drbg_reseed(struct s96at_drbg *drbg, const uint8_t *add,
+			  size_t add_len)
+{
+	if (!drbg || !drbg->src || (add_len && !add))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	return drbg_reseed(drbg, add, add_len);
+}
+
+/* HMAC_DRBG_Generate, SP 800-90A Sect 10.1.2.5 */
+uint8_t s96at_drbg_generate(struct s96at_drbg *drbg, uint8_t *buf, size_t len)
+{
+	uint8_t ret;
+	size_t req_len;
+	size_t n;
+	struct hmac_sha256_ctx keyed;
+	struct hmac_sha256_ctx ctx;
+
+	if (!drbg || !drbg->src || (len && !buf))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	while (len) {
+		if (drbg_reseed_required(drbg)) {
+			ret = drbg_reseed(drbg, NULL, 0);
+			if (ret != S96AT_STATUS_OK) {
+				memset(buf, 0, len);
+				return ret;
+			}
+		}
+
+		req_len = len < DRBG_MAX_REQUEST_LEN ? len : DRBG_MAX_REQUEST_LEN;
+		len -= req_len;
+		drbg->bytes_since_reseed += req_len;
+
+		/*
+		 * K is fixed for the whole request, so the padded key blocks
+		 * are only hashed once and copied for every output block.
+		 */
+		hmac_sha256_init(&keyed, drbg->key, sizeof(drbg->key));
+
+		while (req_len) {
+			ctx = keyed;
+			hmac_sha256_update(&ctx, drbg->v, sizeof(drbg->v));
+			hmac_sha256_final(&ctx, drbg->v);
+
+			n = req_len < sizeof(drbg->v) ? req_len : sizeof(drbg->v);
+			memcpy(buf, drbg->v, n);
+			buf += n;
+			req_len -= n;
+		}
+
+		drbg_update(drbg, NULL, 0, NULL, 0);
+		drbg->reseed_counter++;
+	}
+
+	memset(&keyed, 0, sizeof(keyed));
+
+	return S96AT_STATUS_OK;
+}
+
+void s96at_drbg_cleanup(struct s96at_drbg *drbg)
+{
+	if (drbg)
+		memset(drbg, 0, sizeof(*drbg));
+}
@@ -0,0 +1,1156 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <clock.h>
+#include <cmd.h>
+#include <crc.h>
+#include <debug.h>
+#include <device.h>
+#include <emulator.h>
+#include <io.h>
+#include <mac.h>
+#include <s96at.h>
+#include <sha.h>
+#include <status.h>
+
+/* Largest command: count, opcode, param1, param2, 32 + 32 + 13 bytes, CRC */
+#define EMU_MAX_CMD_SIZE	(1 + 1 + 1 + 2 + 77 + CRC_LEN)
+#define EMU_MAX_RESP_SIZE	(1 + 32 + CRC_LEN)
+
+#define CONFIG_FIRST_WRITABLE_WORD	4
+#define CONFIG_LAST_WRITABLE_WORD	19
+
+#define CONFIG_OTP_MODE_BYTE	18
+#define CONFIG_SLOT_CONFIG_BYTE	20
+#define CONFIG_USER_EXTRA_BYTE	84
+#define CONFIG_SELECTOR_BYTE	85
+#define CONFIG_LOCK_DATA_BYTE	86
+#define CONFIG_LOCK_CONFIG_BYTE	87
+
+#define OTP_MODE_READ_ONLY	0xaa
+#define OTP_MODE_CONSUMPTION	0x55
+#define OTP_MODE_LEGACY		0x00
+
+#define ZONE_MASK		0x03
+#define ZONE_ENCRYPTED		(1 << 6)
+#define ZONE_32_BYTES		(1 << 7)
+#define LOCK_ZONE_DATA		(1 << 0)
+#define LOCK_NO_CRC		(1 << 7)
+
+/* Mode bits shared by MAC, HMAC, CheckMac and DeriveKey */
+#define MODE_SECOND_TEMPKEY	(1 << 0)
+#define MODE_FIRST_TEMPKEY	(1 << 1)
+#define MODE_SOURCE_INPUT	(1 << MAC_MODE_TEMPKEY_SOURCE_SHIFT)
+#define MODE_OTP_88		(1 << MAC_MODE_USE_OTP_88_BITS_SHIFT)
+#define MODE_OTP_64		(1 << MAC_MODE_USE_OTP_64_BITS_SHIFT)
+#define MODE_SN			(1 << MAC_MODE_USE_SN_SHIFT)
+
+/* SlotConfig bits, section 2.2.1 of the datasheet */
+#define SLOT_READ_KEY(c)	((c) & 0x0f)
+#define SLOT_CHECK_ONLY		(1 << 4)
+#define SLOT_ENCRYPT_READ	(1 << 6)
+#define SLOT_IS_SECRET		(1 << 7)
+#define SLOT_WRITE_KEY(c)	((c) >> 8 & 0x0f)
+#define SLOT_WRITE_CREATE	(1 << 12)	/* DeriveKey parent is WriteKey */
+#define SLOT_WRITE_DERIVEKEY	(1 << 13)
+#define SLOT_WRITE_ENCRYPT	(1 << 14)
+#define SLOT_WRITE_NEVER	(1 << 15)
+
+#define CHECKMAC_DATA_LEN	77
+#define DIGEST_ZEROS_LEN	25
+
+enum emu_state {
+	EMU_SLEEP,
+	EMU_IDLE,
+	EMU_AWAKE
+};
+
+struct emu_tempkey {
+	uint8_t value[32];
+	bool valid;
+	bool source_input;	/* SourceFlag */
+	bool gendig;		/* GenData */
+	uint8_t key_id;
+};
+
+struct emu_chip {
+	enum emu_state state;
+	uint8_t config[ZONE_CONFIG_SIZE];
+	uint8_t data[ZONE_DATA_SIZE];
+	uint8_t otp[ZONE_OTP_SIZE];
+	struct emu_tempkey tempkey;
+	/* The SHA command keeps its context in place of TempKey */
+	struct sha256_ctx sha;
+	bool sha_started;
+	uint32_t rng;
+	uint8_t resp[EMU_MAX_RESP_SIZE];
+	size_t resp_len;
+	size_t resp_pos;
+	uint64_t wake_us;
+	uint64_t busy_until_us;
+	uint32_t watchdog_ms;
+	uint32_t exec_us[256];
+	/* Devices on the same bus, in a ring, see emulator_join() */
+	struct emu_chip *bus_next;
+	/* Its time is the clock of the interface, see s96at_set_clock() */
+	struct io_interface *ioif;
+};
+
+/* Typical execution times, table 8-4 of the datasheet */
+static const struct {
+	uint8_t opcode;
+	uint32_t us;
+} exec_times[] = {
+	{ OPCODE_CHECKMAC, 12000 },
+	{ OPCODE_DERIVEKEY, 14000 },
+	{ OPCODE_DEVREV, 400 },
+	{ OPCODE_GENDIG, 11000 },
+	{ OPCODE_HMAC, 27000 },
+	{ OPCODE_LOCK, 5000 },
+	{ OPCODE_MAC, 12000 },
+	{ OPCODE_NONCE, 22000 },
+	{ OPCODE_PAUSE, 400 },
+	{ OPCODE_RANDOM, 11000 },
+	{ OPCODE_READ, 400 },
+	{ OPCODE_SHA, 11000 },
+	{ OPCODE_UPDATEEXTRA, 8000 },
+	{ OPCODE_WRITE, 4000 },
+};
+
+static uint64_t now_us(struct emu_chip *chip)
+{
+	return clock_now_us(chip->ioif->clock);
+}
+
+/* Factory defaults of the Config zone, section 2.2 of the datasheet */
+static void emu_factory_config(struct emu_chip *chip, uint32_t id)
+{
+	int i;
+	uint8_t *c = chip->config;
+
+	memset(c, 0, ZONE_CONFIG_SIZE);
+
+	c[0] = 0x01;
+	c[1] = 0x23;
+	c[2] = id >> 24;
+	c[3] = id >> 16;
+	c[5] = 0x09;		/* RevNum */
+	c[6] = 0x04;
+	c[8] = id >> 8;
+	c[9] = id;
+	c[10] = 0x5a;
+	c[11] = 0xa5;
+	c[12] = 0xee;		/* SN[8] */
+	c[14] = 0x01;		/* I2C_Enable */
+	c[16] = ATSHA204A_ADDR << 1;
+	c[CONFIG_OTP_MODE_BYTE] = OTP_MODE_CONSUMPTION;
+
+	for (i = 52; i < 68; i += 2)
+		c[i] = 0xff;	/* UseFlag */
+	for (i = 68; i < 84; i++)
+		c[i] = 0xff;	/* LastKeyUse */
+
+	c[CONFIG_LOCK_DATA_BYTE] = LOCK_DATA_UNLOCKED;
+	c[CONFIG_LOCK_CONFIG_BYTE] = LOCK_CONFIG_UNLOCKED;
+}
+
+static bool config_locked(const struct emu_chip *chip)
+{
+	return chip->config[CONFIG_LOCK_CONFIG_BYTE] == LOCK_CONFIG_LOCKED;
+}
+
+static bool data_locked(const struct emu_chip *chip)
+{
+	return chip->config[CONFIG_LOCK_DATA_BYTE] == LOCK_DATA_LOCKED;
+}
+
+static uint16_t slot_config(const struct emu_chip *chip, uint8_t slot)
+{
+	const uint8_t *c = chip->config + CONFIG_SLOT_CONFIG_BYTE + 2 * slot;
+
+	return c[0] | c[1] << 8;
+}
+
+static uint8_t *slot_key(struct emu_chip *chip, uint8_t slot)
+{
+	return chip->data + slot * SLOT_DATA_SIZE;
+}
+
+static void emu_serial(const struct emu_chip *chip, uint8_t *sn)
+{
+	memcpy(sn, chip->config, 4);
+	memcpy(sn + 4, chip->config + 8, 5);
+}
+
+static void tempkey_clear(struct emu_chip *chip)
+{
+	memset(&chip->tempkey, 0, sizeof(chip->tempkey));
+	chip->sha_started = false;
+}
+
+/*
+ * Checks that TempKey holds a value and that it was produced the way mode
+ * claims it was.
+ */
+static bool tempkey_usable(const struct emu_chip *chip, uint8_t mode)
+{
+	return chip->tempkey.valid &&
+	       chip->tempkey.source_input == !!(mode & MODE_SOURCE_INPUT);
+}
+
+/* Keys can only be used once the Data zone is locked */
+static bool key_usable(const struct emu_chip *chip, uint16_t slot)
+{
+	return data_locked(chip) && slot < ZONE_DATA_NUM_SLOTS &&
+	       !(slot_config(chip, slot) & SLOT_CHECK_ONLY);
+}
+
+static void emu_respond(struct emu_chip *chip, const uint8_t *buf, size_t len)
+{
+	uint16_t crc;
+
+	chip->resp[0] = 1 + len + CRC_LEN;
+	memcpy(chip->resp + 1, buf, len);
+
+	crc = calculate_crc16(chip->resp, 1 + len, 0);
+	chip->resp[1 + len] = crc & 0xff;
+	chip->resp[2 + len] = crc >> 8;
+
+	chip->resp_len = chip->resp[0];
+	chip->resp_pos = 0;
+}
+
+static void emu_status(struct emu_chip *chip, uint8_t status)
+{
+	emu_respond(chip, &status, sizeof(status));
+}
+
+/* xorshift32, the emulator only needs distinct values, not secure ones */
+static uint8_t emu_rand(struct emu_chip *chip)
+{
+	chip->rng ^= chip->rng << 13;
+	chip->rng ^= chip->rng >> 17;
+	chip->rng ^= chip->rng << 5;
+
+	return chip->rng;
+}
+
+static void emu_random_bytes(struct emu_chip *chip, uint8_t *buf)
+{
+	int i;
+
+	/* Until the Config zone is locked the RNG returns a fixed pattern */
+	for (i = 0; i < RANDOM_LEN; i++) {
+		if (config_locked(chip))
+			buf[i] = emu_rand(chip);
+		else
+			buf[i] = i % 4 < 2 ? 0xff : 0x00;
+	}
+}
+
+/*
+ * The digest used by GenDig, DeriveKey and encrypted writes: a 32-byte
+ * value, the command header, SN[8], SN[0:1], 25 zero bytes and the value
+ * in TempKey or the data being written.
+ */
+static void emu_digest(struct emu_chip *chip, const uint8_t *value,
+		       uint8_t opcode, uint8_t param1, uint16_t param2,
+		       const uint8_t *last, uint8_t *out)
+{
+	uint8_t msg[32 + 4 + 3 + DIGEST_ZEROS_LEN + 32] = { 0 };
+	uint8_t sn[SERIALNUM_LEN];
+
+	emu_serial(chip, sn);
+
+	memcpy(msg, value, 32);
+	msg[32] = opcode;
+	msg[33] = param1;
+	msg[34] = param2 & 0xff;
+	msg[35] = param2 >> 8;
+	msg[36] = sn[8];
+	msg[37] = sn[0];
+	msg[38] = sn[1];
+	memcpy(msg + 39 + DIGEST_ZEROS_LEN, last, 32);
+
+	sha256(msg, sizeof(msg), out);
+}
+
+/* Maps a zone and word address to the backing memory of the zone */
+static uint8_t *emu_zone(struct emu_chip *chip, uint8_t param1, uint16_t addr,
+			 size_t len)
+{
+	uint8_t *base;
+	size_t size;
+	size_t off = addr * WORD_SIZE;
+
+	switch (param1 & ZONE_MASK) {
+	case ZONE_CONFIG:
+		base = chip->config;
+		size = sizeof(chip->config);
+		break;
+	case ZONE_OTP:
+		base = chip->otp;
+		size = sizeof(chip->otp);
+		break;
+	case ZONE_DATA:
+		base = chip->data;
+		size = sizeof(chip->data);
+		break;
+	default:
+		return NULL;
+	}
+
+	if (len == MAX_READ_SIZE)
+		off &= ~(MAX_READ_SIZE - 1);
+
+	if (off + len > size)
+		return NULL;
+
+	return base + off;
+}
+
+static void emu_read(struct emu_chip *chip, uint8_t param1, uint16_t param2)
+{
+	int i;
+	size_t len = param1 & ZONE_32_BYTES ? MAX_READ_SIZE : WORD_SIZE;
+	uint8_t *p = emu_zone(chip, param1, param2, len);
+	uint8_t buf[MAX_READ_SIZE];
+	uint16_t slot;
+	uint16_t cfg;
+
+	if (!p) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	if ((param1 & ZONE_MASK) == ZONE_CONFIG) {
+		emu_respond(chip, p, len);
+		return;
+	}
+
+	/* Data and OTP are unreadable until the Data zone is locked */
+	if (!data_locked(chip)) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	if ((param1 & ZONE_MASK) == ZONE_OTP) {
+		if (chip->config[CONFIG_OTP_MODE_BYTE] == OTP_MODE_LEGACY &&
+		    (len != WORD_SIZE || p < chip->otp + 2 * WORD_SIZE)) {
+			emu_status(chip, STATUS_EXEC_ERROR);
+			return;
+		}
+
+		emu_respond(chip, p, len);
+		return;
+	}
+
+	slot = (p - chip->data) / SLOT_DATA_SIZE;
+	cfg = slot_config(chip, slot);
+
+	if (!(cfg & SLOT_IS_SECRET)) {
+		emu_respond(chip, p, len);
+		return;
+	}
+
+	/* Secrets only leave the device encrypted with the ReadKey digest */
+	if (!(cfg & SLOT_ENCRYPT_READ) || len != MAX_READ_SIZE ||
+	    !chip->tempkey.valid || !chip->tempkey.gendig ||
+	    chip->tempkey.key_id != SLOT_READ_KEY(cfg)) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	for (i = 0; i < MAX_READ_SIZE; i++)
+		buf[i] = p[i] ^ chip->tempkey.value[i];
+
+	tempkey_clear(chip);
+	emu_respond(chip, buf, sizeof(buf));
+}
+
+static uint8_t emu_write_config(struct emu_chip *chip, uint8_t *p,
+				const uint8_t *data, size_t len)
+{
+	size_t i;
+	size_t word;
+
+	if (config_locked(chip))
+		return STATUS_EXEC_ERROR;
+
+	word = (p - chip->config) / WORD_SIZE;
+	if (word + len / WORD_SIZE - 1 > CONFIG_LAST_WRITABLE_WORD)
+		return STATUS_EXEC_ERROR;
+
+	/* Writes to the read-only words are silently ignored */
+	for (i = 0; i < len / WORD_SIZE; i++)
+		if (word + i >= CONFIG_FIRST_WRITABLE_WORD)
+			memcpy(p + i * WORD_SIZE, data + i * WORD_SIZE,
+			       WORD_SIZE);
+
+	return STATUS_OK;
+}
+
+/* Only consumption mode allows OTP writes once the Data zone is locked */
+static uint8_t emu_write_otp(struct emu_chip *chip, uint8_t *p,
+			     const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	if (chip->config[CONFIG_OTP_MODE_BYTE] != OTP_MODE_CONSUMPTION ||
+	    len != WORD_SIZE)
+		return STATUS_EXEC_ERROR;
+
+	/* Bits can only go from zero to one */
+	for (i = 0; i < len; i++)
+		p[i] |= data[i];
+
+	return STATUS_OK;
+}
+
+static uint8_t emu_write_slot(struct emu_chip *chip, uint8_t param1,
+			      uint16_t param2, uint8_t *p,
+			      const uint8_t *data, size_t data_len)
+{
+	int i;
+	uint16_t slot = (p - chip->data) / SLOT_DATA_SIZE;
+	uint16_t cfg = slot_config(chip, slot);
+	uint8_t plain[MAX_WRITE_SIZE];
+	uint8_t mac[MAC_LEN];
+
+	if (cfg & SLOT_WRITE_NEVER)
+		return STATUS_EXEC_ERROR;
+
+	if (!(cfg & SLOT_WRITE_ENCRYPT)) {
+		if (param1 & ZONE_ENCRYPTED || data_len != (param1 & ZONE_32_BYTES ?
+							    MAX_WRITE_SIZE : WORD_SIZE))
+			return STATUS_EXEC_ERROR;
+
+		memcpy(p, data, data_len);
+		return STATUS_OK;
+	}
+
+	/* Encrypted writes carry the data and a MAC over the plain text */
+	if (!(param1 & ZONE_ENCRYPTED) || !(param1 & ZONE_32_BYTES) ||
+	    data_len != MAX_WRITE_SIZE + MAC_LEN)
+		return STATUS_EXEC_ERROR;
+
+	if (!chip->tempkey.valid || !chip->tempkey.gendig ||
+	    chip->tempkey.key_id != SLOT_WRITE_KEY(cfg))
+		return STATUS_EXEC_ERROR;
+
+	for (i = 0; i < MAX_WRITE_SIZE; i++)
+		plain[i] = data[i] ^ chip->tempkey.value[i];
+
+	emu_digest(chip, chip->tempkey.value, OPCODE_WRITE, param1, param2,
+		   plain, mac);
+	tempkey_clear(chip);
+
+	if (!mac_equal(mac, data + MAX_WRITE_SIZE, MAC_LEN))
+		return STATUS_EXEC_ERROR;
+
+	memcpy(p, plain, MAX_WRITE_SIZE);
+
+	return STATUS_OK;
+}
+
+static void emu_write(struct emu_chip *chip, uint8_t param1, uint16_t param2,
+		      const uint8_t *data, size_t data_len)
+{
+	uint8_t ret;
+	size_t len = param1 & ZONE_32_BYTES ? MAX_WRITE_SIZE : WORD_SIZE;
+	uint8_t *p = emu_zone(chip, param1, param2, len);
+
+	if (!p || (data_len != len && data_len != len + MAC_LEN)) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	if ((param1 & ZONE_MASK) == ZONE_CONFIG) {
+		ret = data_len == len ?
+		      emu_write_config(chip, p, data, len) : STATUS_EXEC_ERROR;
+	} else if (!config_locked(chip)) {
+		ret = STATUS_EXEC_ERROR;
+	} else if (!data_locked(chip)) {
+		/* Only 32-byte plain writes between Config and Data lock */
+		if (len == MAX_WRITE_SIZE && data_len == len &&
+		    !(param1 & ZONE_ENCRYPTED)) {
+			memcpy(p, data, len);
+			ret = STATUS_OK;
+		} else {
+			ret = STATUS_EXEC_ERROR;
+		}
+	} else if ((param1 & ZONE_MASK) == ZONE_OTP) {
+		ret = data_len == len ?
+		      emu_write_otp(chip, p, data, len) : STATUS_EXEC_ERROR;
+	} else {
+		ret = emu_write_slot(chip, param1, param2, p, data, data_len);
+	}
+
+	emu_status(chip, ret);
+}
+
+static void emu_lock(struct emu_chip *chip, uint8_t param1, uint16_t param2)
+{
+	uint16_t crc;
+
+	if (param1 & LOCK_ZONE_DATA) {
+		if (!config_locked(chip) || data_locked(chip)) {
+			emu_status(chip, STATUS_EXEC_ERROR);
+			return;
+		}
+
+		crc = calculate_crc16(chip->data, sizeof(chip->data), 0);
+		crc = calculate_crc16(chip->otp, sizeof(chip->otp), crc);
+	} else {
+		if (config_locked(chip)) {
+			emu_status(chip, STATUS_EXEC_ERROR);
+			return;
+		}
+
+		crc = calculate_crc16(chip->config, sizeof(chip->config), 0);
+	}
+
+	if (!(param1 & LOCK_NO_CRC) && crc != param2) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	if (param1 & LOCK_ZONE_DATA)
+		chip->config[CONFIG_LOCK_DATA_BYTE] = LOCK_DATA_LOCKED;
+	else
+		chip->config[CONFIG_LOCK_CONFIG_BYTE] = LOCK_CONFIG_LOCKED;
+
+	emu_status(chip, STATUS_OK);
+}
+
+static void emu_random(struct emu_chip *chip, uint8_t param1)
+{
+	uint8_t buf[RANDOM_LEN];
+
+	if (param1 > 1) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	emu_random_bytes(chip, buf);
+	emu_respond(chip, buf, sizeof(buf));
+}
+
+static void emu_nonce(struct emu_chip *chip, uint8_t param1,
+		      const uint8_t *data, size_t data_len)
+{
+	uint8_t msg[RANDOM_LEN + S96AT_NONCE_INPUT_LEN + 3] = { 0 };
+	uint8_t rand_out[RANDOM_LEN];
+	uint8_t mode = param1 & 0x03;
+
+	if (mode == NONCE_MODE_PASSTHROUGH && data_len == 32) {
+		tempkey_clear(chip);
+		memcpy(chip->tempkey.value, data, 32);
+		chip->tempkey.valid = true;
+		chip->tempkey.source_input = true;
+		emu_status(chip, STATUS_OK);
+		return;
+	}
+
+	if (mode > NONCE_MODE_RANDOM_NO_SEED ||
+	    data_len != S96AT_NONCE_INPUT_LEN) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	emu_random_bytes(chip, rand_out);
+
+	memcpy(msg, rand_out, RANDOM_LEN);
+	memcpy(msg + RANDOM_LEN, data, data_len);
+	msg[RANDOM_LEN + data_len] = OPCODE_NONCE;
+	msg[RANDOM_LEN + data_len + 1] = param1;
+
+	tempkey_clear(chip);
+	sha256(msg, sizeof(msg), chip->tempkey.value);
+	chip->tempkey.valid = true;
+
+	emu_respond(chip, rand_out, sizeof(rand_out));
+}
+
+static void emu_gendig(struct emu_chip *chip, uint8_t param1, uint16_t param2,
+		       size_t data_len)
+{
+	uint8_t value[32] = { 0 };
+	size_t off = param2 * 32;
+
+	if (data_len != 0 && data_len != S96AT_GENDIG_INPUT_LEN) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	if (!chip->tempkey.valid) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	switch (param1) {
+	case ZONE_CONFIG:
+		if (off >= sizeof(chip->config))
+			goto err;
+		memcpy(value, chip->config + off,
+		       sizeof(chip->config) - off < 32 ?
+		       sizeof(chip->config) - off : 32);
+		break;
+	case ZONE_OTP:
+		if (off >= sizeof(chip->otp))
+			goto err;
+		memcpy(value, chip->otp + off, 32);
+		break;
+	case ZONE_DATA:
+		if (!key_usable(chip, param2))
+			goto err;
+		memcpy(value, slot_key(chip, param2), 32);
+		break;
+	default:
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	emu_digest(chip, value, OPCODE_GENDIG, param1, param2,
+		   chip->tempkey.value, chip->tempkey.value);
+	chip->tempkey.gendig = true;
+	chip->tempkey.key_id = param2;
+
+	emu_status(chip, STATUS_OK);
+	return;
+err:
+	emu_status(chip, STATUS_EXEC_ERROR);
+}
+
+/*
+ * The fields after the two 32-byte values that MAC and HMAC hash, as
+ * selected by the mode bits.
+ */
+static void emu_mac_tail(const struct emu_chip *chip, uint8_t opcode,
+			 uint8_t mode, uint16_t slot, uint8_t *tail)
+{
+	uint8_t sn[SERIALNUM_LEN];
+
+	emu_serial(chip, sn);
+
+	memset(tail, 0, 24);
+	tail[0] = opcode;
+	tail[1] = mode;
+	tail[2] = slot & 0xff;
+	tail[3] = slot >> 8;
+	if (mode & MODE_OTP_64)
+		memcpy(tail + 4, chip->otp, 8);
+	if (mode & MODE_OTP_88)
+		memcpy(tail + 4, chip->otp, 11);
+	tail[15] = sn[8];
+	if (mode & MODE_SN)
+		memcpy(tail + 16, sn + 4, 4);
+	tail[20] = sn[0];
+	tail[21] = sn[1];
+	if (mode & MODE_SN)
+		memcpy(tail + 22, sn + 2, 2);
+}
+
+/* Picks the two 32-byte values the mode asks for */
+static bool emu_mac_inputs(struct emu_chip *chip, uint8_t mode, uint16_t slot,
+			   const uint8_t *challenge, const uint8_t **first,
+			   const uint8_t **second)
+{
+	if ((mode & (MODE_FIRST_TEMPKEY | MODE_SECOND_TEMPKEY)) &&
+	    !tempkey_usable(chip, mode))
+		return false;
+
+	if (mode & MODE_FIRST_TEMPKEY) {
+		*first = chip->tempkey.value;
+	} else {
+		if (!key_usable(chip, slot))
+			return false;
+		*first = slot_key(chip, slot);
+	}
+
+	*second = mode & MODE_SECOND_TEMPKEY ? chip->tempkey.value : challenge;
+
+	return true;
+}
+
+static void emu_mac(struct emu_chip *chip, uint8_t param1, uint16_t param2,
+		    const uint8_t *data, size_t data_len)
+{
+	uint8_t msg[88];
+	uint8_t mac[MAC_LEN];
+	const uint8_t *first;
+	const uint8_t *second;
+
+	if ((param1 & 0x88) ||
+	    data_len != (param1 & MODE_SECOND_TEMPKEY ? 0 : 32)) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	if (!emu_mac_inputs(chip, param1, param2, data, &first, &second)) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	memcpy(msg, first, 32);
+	memcpy(msg + 32, second, 32);
+	emu_mac_tail(chip, OPCODE_MAC, param1, param2, msg + 64);
+	sha256(msg, sizeof(msg), mac);
+
+	if (param1 & (MODE_FIRST_TEMPKEY | MODE_SECOND_TEMPKEY))
+		tempkey_clear(chip);
+
+	emu_respond(chip, mac, sizeof(mac));
+}
+
+static void emu_hmac(struct emu_chip *chip, uint8_t param1, uint16_t param2,
+		     size_t data_len)
+{
+	uint8_t msg[88] = { 0 };
+	uint8_t hmac[HMAC_LEN];
+
+	if ((param1 & 0x8b) || data_len) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	if (!tempkey_usable(chip, param1) || !key_usable(chip, param2)) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	/* 32 zero bytes, then TempKey */
+	memcpy(msg + 32, chip->tempkey.value, 32);
+	emu_mac_tail(chip, OPCODE_HMAC, param1, param2, msg + 64);
+	hmac_sha256(slot_key(chip, param2), 32, msg, sizeof(msg), hmac);
+
+	tempkey_clear(chip);
+	emu_respond(chip, hmac, sizeof(hmac));
+}
+
+static void emu_checkmac(struct emu_chip *chip, uint8_t param1,
+			 uint16_t param2, const uint8_t *data, size_t data_len)
+{
+	uint8_t msg[88] = { 0 };
+	uint8_t mac[MAC_LEN];
+	uint8_t sn[SERIALNUM_LEN];
+	const uint8_t *first;
+	const uint8_t *second;
+	const uint8_t *other = data + 64;
+	bool match;
+
+	if ((param1 & 0xd8) || data_len != CHECKMAC_DATA_LEN) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	if (!emu_mac_inputs(chip, param1, param2, data, &first, &second)) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	emu_serial(chip, sn);
+
+	/* The client's MAC command header and SN / OTP come from OtherData */
+	memcpy(msg, first, 32);
+	memcpy(msg + 32, second, 32);
+	memcpy(msg + 64, other, 4);
+	if (param1 & MODE_OTP_64)
+		memcpy(msg + 68, chip->otp, 8);
+	memcpy(msg + 76, other + 4, 3);
+	msg[79] = sn[8];
+	memcpy(msg + 80, other + 7, 4);
+	msg[84] = sn[0];
+	msg[85] = sn[1];
+	memcpy(msg + 86, other + 11, 2);
+	sha256(msg, sizeof(msg), mac);
+
+	match = mac_equal(mac, data + 32, MAC_LEN);
+
+	tempkey_clear(chip);
+	emu_status(chip, match ? STATUS_OK : STATUS_CHECKMAC_FAIL);
+}
+
+static void emu_derivekey(struct emu_chip *chip, uint8_t param1,
+			  uint16_t param2, size_t data_len)
+{
+	uint16_t cfg;
+	uint8_t parent;
+
+	if ((param1 & ~MODE_SOURCE_INPUT) || (data_len && data_len != MAC_LEN) ||
+	    param2 >= ZONE_DATA_NUM_SLOTS) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	cfg = slot_config(chip, param2);
+	parent = cfg & SLOT_WRITE_CREATE ? SLOT_WRITE_KEY(cfg) : param2;
+
+	/* The authorizing MAC that some configurations require is not checked */
+	if (!data_locked(chip) || !(cfg & SLOT_WRITE_DERIVEKEY) ||
+	    !tempkey_usable(chip, param1)) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	emu_digest(chip, slot_key(chip, parent), OPCODE_DERIVEKEY, param1,
+		   param2, chip->tempkey.value, slot_key(chip, param2));
+
+	tempkey_clear(chip);
+	emu_status(chip, STATUS_OK);
+}
+
+static void emu_sha(struct emu_chip *chip, uint8_t param1,
+		    const uint8_t *data, size_t data_len)
+{
+	int i;
+	uint8_t digest[SHA_LEN];
+
+	if (param1 == SHA_MODE_INIT && !data_len) {
+		tempkey_clear(chip);
+		sha256_init(&chip->sha);
+		chip->sha_started = true;
+		emu_status(chip, STATUS_OK);
+		return;
+	}
+
+	if (param1 != SHA_MODE_COMPUTE || data_len != SHA_BLOCK_LEN) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	if (!chip->sha_started) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	/* The host pads the message, so the state is the digest */
+	sha256_update(&chip->sha, data, data_len);
+	for (i = 0; i < 8; i++) {
+		digest[4 * i] = chip->sha.state[i] >> 24;
+		digest[4 * i + 1] = chip->sha.state[i] >> 16;
+		digest[4 * i + 2] = chip->sha.state[i] >> 8;
+		digest[4 * i + 3] = chip->sha.state[i];
+	}
+
+	emu_respond(chip, digest, sizeof(digest));
+}
+
+static void emu_update_extra(struct emu_chip *chip, uint8_t param1,
+			     uint16_t param2)
+{
+	uint8_t *p;
+
+	if (param1 > 1) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	p = chip->config + (param1 ? CONFIG_SELECTOR_BYTE :
+					 CONFIG_USER_EXTRA_BYTE);
+
+	/* Each byte can be updated once, and only after the Config lock */
+	if (!config_locked(chip) || *p) {
+		emu_status(chip, STATUS_EXEC_ERROR);
+		return;
+	}
+
+	*p = param2 & 0xff;
+	emu_status(chip, STATUS_OK);
+}
+
+static void emu_pause(struct emu_chip *chip, uint8_t param1)
+{
+	/* Devices that are not selected go idle and do not respond */
+	if (chip->config[CONFIG_SELECTOR_BYTE] != param1) {
+		chip->state = EMU_IDLE;
+		return;
+	}
+
+	emu_status(chip, STATUS_OK);
+}
+
+static void emu_command(struct emu_chip *chip, const uint8_t *buf, size_t size)
+{
+	uint8_t count = buf[0];
+	uint8_t opcode;
+	uint8_t param1;
+	uint16_t param2;
+	const uint8_t *data;
+	size_t data_len;
+
+	if (count < 7 || count != size) {
+		emu_status(chip, STATUS_PARSE_ERROR);
+		return;
+	}
+
+	if (!crc_valid(buf, (uint8_t *)buf + count - CRC_LEN, count - CRC_LEN)) {
+		emu_status(chip, STATUS_CRC_ERROR);
+		return;
+	}
+
+	opcode = buf[1];
+	param1 = buf[2];
+	param2 = buf[3] | buf[4] << 8;
+	data = buf + 5;
+	data_len = count - 7;
+
+	chip->busy_until_us = now_us(chip) + chip->exec_us[opcode];
+
+	switch (opcode) {
+	case OPCODE_CHECKMAC:
+		emu_checkmac(chip, param1, param2, data, data_len);
+		break;
+	case OPCODE_DERIVEKEY:
+		emu_derivekey(chip, param1, param2, data_len);
+		break;
+	case OPCODE_DEVREV:
+		emu_respond(chip, chip->config + 4, DEVREV_LEN);
+		break;
+	case OPCODE_GENDIG:
+		emu_gendig(chip, param1, param2, data_len);
+		break;
+	case OPCODE_HMAC:
+		emu_hmac(chip, param1, param2, data_len);
+		break;
+	case OPCODE_LOCK:
+		emu_lock(chip, param1, param2);
+		break;
+	case OPCODE_MAC:
+		emu_mac(chip, param1, param2, data, data_len);
+		break;
+	case OPCODE_NONCE:
+		emu_nonce(chip, param1, data, data_len);
+		break;
+	case OPCODE_PAUSE:
+		emu_pause(chip, param1);
+		break;
+	case OPCODE_RANDOM:
+		emu_random(chip, param1);
+		break;
+	case OPCODE_READ:
+		emu_read(chip, param1, param2);
+		break;
+	case OPCODE_SHA:
+		emu_sha(chip, param1, data, data_len);
+		break;
+	case OPCODE_UPDATEEXTRA:
+		emu_update_extra(chip, param1, param2);
+		break;
+	case OPCODE_WRITE:
+		emu_write(chip, param1, param2, data, data_len);
+		break;
+	default:
+		logd("Emulator: unknown opcode 0x%02x\n", opcode);
+		emu_status(chip, STATUS_PARSE_ERROR);
+	}
+}
+
+/*
+ * The watchdog puts the device to sleep a fixed time after the wake,
+ * whatever it is doing at that point. Sleep loses the volatile state.
+ */
+static void emu_watchdog(struct emu_chip *chip)
+{
+	if (chip->state == EMU_AWAKE &&
+	    now_us(chip) - chip->wake_us >= chip->watchdog_ms * 1000ULL) {
+		logd("Emulator: watchdog expired\n");
+		chip->state = EMU_SLEEP;
+		chip->resp_len = 0;
+		tempkey_clear(chip);
+	}
+}
+
+static uint32_t emulator_open(void *ctx)
+{
+	return STATUS_OK;
+}
+
+static size_t emulator_write(void *ctx, const void *buf, size_t size)
+{
+	struct emu_chip *chip = ctx;
+	const uint8_t *b = buf;
+
+	emu_watchdog(chip);
+
+	/* A device that is not awake or still busy does not acknowledge */
+	if (chip->state != EMU_AWAKE || now_us(chip) < chip->busy_until_us ||
+	    !size || size > EMU_MAX_CMD_SIZE + 1)
+		return 0;
+
+	switch (b[0]) {
+	case PKT_FUNC_COMMAND:
+		chip->resp_len = 0;
+		if (size > 1)
+			emu_command(chip, b + 1, size - 1);
+		break;
+	case PKT_FUNC_RESET:
+		/* The output buffer can be read again from the start */
+		chip->resp_pos = 0;
+		break;
+	case PKT_FUNC_IDLE:
+		chip->state = EMU_IDLE;
+		chip->resp_len = 0;
+		break;
+	case PKT_FUNC_SLEEP:
+		chip->state = EMU_SLEEP;
+		chip->resp_len = 0;
+		tempkey_clear(chip);
+		break;
+	default:
+		break;
+	}
+
+	return size;
+}
+
+static size_t emulator_read(void *ctx, void *buf, size_t size)
+{
+	struct emu_chip *chip = ctx;
+	size_t n;
+
+	emu_watchdog(chip);
+
+	if (chip->state != EMU_AWAKE || now_us(chip) < chip->busy_until_us ||
+	    chip->resp_pos >= chip->resp_len)
+		return 0;
+
+	n = chip->resp_len - chip->resp_pos;
+	if (n > size)
+		n = size;
+	memcpy(buf, chip->resp + chip->resp_pos, n);
+	chip->resp_pos += n;
+
+	return n;
+}
+
+static uint32_t emulator_close(void *ctx)
+{
+	return STATUS_OK;
+}
+
+static uint32_t emulator_wake(void *ctx)
+{
+	struct emu_chip *chip = ctx;
+
+	/* The wake pulse reaches every device on the bus */
+	do {
+		emu_watchdog(chip);
+
+		/* A wake token does not restart the watchdog of an awake device */
+		if (chip->state != EMU_AWAKE) {
+			chip->state = EMU_AWAKE;
+			chip->wake_us = now_us(chip);
+			chip->busy_until_us = 0;
+			emu_status(chip, STATUS_AFTER_WAKE);
+		}
+
+		chip = chip->bus_next;
+	} while (chip != ctx);
+
+	return STATUS_OK;
+}
+
+static void emu_leave(struct emu_chip *chip)
+{
+	struct emu_chip *prev = chip;
+
+	while (prev->bus_next != chip)
+		prev = prev->bus_next;
+
+	prev->bus_next = chip->bus_next;
+	chip->bus_next = chip;
+}
+
+static void emulator_release(struct io_interface *ioif)
+{
+	emu_leave(ioif->ctx);
+	memset(ioif->ctx, 0, sizeof(struct emu_chip));
+	free(ioif->ctx);
+	free(ioif);
+}
+
+static struct emu_chip *emu_chip(struct io_interface *ioif)
+{
+	return ioif && ioif->write == emulator_write ? ioif->ctx : NULL;
+}
+
+struct io_interface *emulator_create(uint32_t id)
+{
+	int i;
+	struct io_interface *ioif;
+	struct emu_chip *chip;
+
+	ioif = calloc(1, sizeof(*ioif));
+	chip = calloc(1, sizeof(*chip));
+	if (!ioif || !chip) {
+		free(chip);
+		free(ioif);
+		return NULL;
+	}
+
+	emu_factory_config(chip, id);
+	chip->state = EMU_SLEEP;
+	chip->rng = id * 2654435761u | 1;
+	chip->watchdog_ms = S96AT_WATCHDOG_TIME;
+	chip->bus_next = chip;
+	for (i = 0; i < sizeof(exec_times) / sizeof(exec_times[0]); i++)
+		chip->exec_us[exec_times[i].opcode] = exec_times[i].us;
+
+	chip->ioif = ioif;
+
+	ioif->ctx = chip;
+	ioif->open = emulator_open;
+	ioif->write = emulator_write;
+	ioif->read = emulator_read;
+	ioif->close = emulator_close;
+	ioif->wake = emulator_wake;
+	ioif->release = emulator_release;
+
+	return ioif;
+}
+
+uint32_t emulator_set_exec_time(struct io_interface *ioif, uint8_t opcode,
+				uint32_t us)
+{
+	struct emu_chip *chip = emu_chip(ioif);
+
+	if (!chip)
+		return STATUS_EXEC_ERROR;
+
+	chip->exec_us[opcode] = us;
+
+	return STATUS_OK;
+}
+
+uint32_t emulator_set_watchdog(struct io_interface *ioif, uint32_t ms)
+{
+	struct emu_chip *chip = emu_chip(ioif);
+
+	if (!chip || !ms)
+		return STATUS_EXEC_ERROR;
+
+	chip->watchdog_ms = ms;
+
+	return STATUS_OK;
+}
+
+uint32_t emulator_join(struct io_interface *ioif, struct io_interface *other)
+{
+	struct emu_chip *chip = emu_chip(ioif);
+	struct emu_chip *bus = emu_chip(other);
+
+	if (!chip || !bus || chip == bus)
+		return STATUS_EXEC_ERROR;
+
+	emu_leave(chip);
+	chip->bus_next = bus->bus_next;
+	bus->bus_next = chip;
+
+	return STATUS_OK;
+}
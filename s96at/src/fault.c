@@ -0,0 +1,406 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <crc.h>
+#include <debug.h>
+#include <device.h>
+#include <io.h>
+#include <s96at.h>
+#include <stats.h>
+#include <status.h>
+
+/* The calls of the io interface that faults are injected into */
+enum fault_hook {
+	HOOK_READ,
+	HOOK_WRITE,
+	HOOK_WAKE,
+	NUM_HOOKS
+};
+
+static const struct {
+	const char *name;
+	enum fault_hook hook;
+} faults[S96AT_FAULT_NUM] = {
+	[S96AT_FAULT_CRC] = { "crc", HOOK_READ },
+	[S96AT_FAULT_NACK] = { "nack", HOOK_READ },
+	[S96AT_FAULT_ERROR] = { "error", HOOK_READ },
+	[S96AT_FAULT_LATE] = { "late", HOOK_READ },
+	[S96AT_FAULT_SLEEP] = { "sleep", HOOK_WRITE },
+	[S96AT_FAULT_WAKE] = { "wake", HOOK_WAKE },
+	[S96AT_FAULT_WOKEN] = { "woken", HOOK_WRITE },
+};
+
+struct fault_ctx {
+	struct io_interface *inner;
+	pthread_mutex_t lock;
+	uint32_t rng;
+	uint32_t ppm[S96AT_FAULT_NUM];
+	uint32_t late_ms;
+	struct {
+		enum s96at_fault fault;
+		uint64_t n;
+	} script[S96AT_FAULT_MAX_SCRIPT];
+	size_t script_len;
+	uint64_t calls[NUM_HOOKS];
+	uint64_t late_until_us;
+	/* Time of the first fault of each kind not recovered from yet */
+	bool pending[S96AT_FAULT_NUM];
+	uint64_t pending_us[S96AT_FAULT_NUM];
+	struct s96at_fault_report report;
+};
+
+static int parse_script(struct fault_ctx *ctx, const char *script)
+{
+	const char *p = script;
+	char *end;
+	size_t len;
+	unsigned long long n;
+	int f;
+
+	while (*p) {
+		if (ctx->script_len == S96AT_FAULT_MAX_SCRIPT)
+			return -1;
+
+		len = strcspn(p, "@");
+		for (f = 0; f < S96AT_FAULT_NUM; f++)
+			if (strlen(faults[f].name) == len &&
+			    !strncmp(p, faults[f].name, len))
+				break;
+		if (f == S96AT_FAULT_NUM || p[len] != '@')
+			return -1;
+
+		p += len + 1;
+		n = strtoull(p, &end, 10);
+		if (end == p || !n || (*end && *end != ','))
+			return -1;
+
+		ctx->script[ctx->script_len].fault = f;
+		ctx->script[ctx->script_len].n = n;
+		ctx->script_len++;
+
+		p = *end ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+/* xorshift32, good enough to spread faults over a run */
+static uint32_t fault_rand(struct fault_ctx *ctx)
+{
+	ctx->rng ^= ctx->rng << 13;
+	ctx->rng ^= ctx->rng >> 17;
+	ctx->rng ^= ctx->rng << 5;
+
+	return ctx->rng;
+}
+
+/*
+ * Counts a call of the given hook and decides which fault, if any, it gets.
+ * Returns S96AT_FAULT_NUM for none.
+ */
+static enum s96at_fault fault_pick(struct fault_ctx *ctx, enum fault_hook hook)
+{
+	size_t i;
+	int f;
+	uint64_t n = ++ctx->calls[hook];
+
+	for (i = 0; i < ctx->script_len; i++)
+		if (ctx->script[i].n == n &&
+		    faults[ctx->script[i].fault].hook == hook)
+			return ctx->script[i].fault;
+
+	for (f = 0; f < S96AT_FAULT_NUM; f++)
+		if (faults[f].hook == hook && ctx->ppm[f] &&
+		    fault_rand(ctx) % 1000000 < ctx->ppm[f])
+			return f;
+
+	return S96AT_FAULT_NUM;
+}
+
+static void fault_inject(struct fault_ctx *ctx, enum s96at_fault f)
+{
+	logd("Injecting fault: %s\n", faults[f].name);
+
+	ctx->report.injected[f]++;
+	if (!ctx->pending[f]) {
+		ctx->pending[f] = true;
+		ctx->pending_us[f] = stats_now_us();
+	}
+}
+
+/*
+ * A good response ends all pending faults. Faults of the same kind that hit
+ * before recovery are counted once, from the first of them.
+ */
+static void fault_recovered(struct fault_ctx *ctx)
+{
+	int f;
+	uint64_t now = stats_now_us();
+
+	for (f = 0; f < S96AT_FAULT_NUM; f++) {
+		if (!ctx->pending[f])
+			continue;
+
+		stats_record(&ctx->report.recovery[f], now - ctx->pending_us[f]);
+		ctx->report.recovered[f]++;
+		ctx->pending[f] = false;
+	}
+}
+
+static bool response_good(uint8_t *buf, size_t n)
+{
+	if (n < 4 || buf[0] < 4 || buf[0] > n)
+		return false;
+
+	if (!crc_valid(buf, buf + buf[0] - CRC_LEN, buf[0] - CRC_LEN))
+		return false;
+
+	return buf[0] != 4 || (buf[1] != STATUS_EXEC_ERROR &&
+			       buf[1] != STATUS_PARSE_ERROR &&
+			       buf[1] != STATUS_CRC_ERROR &&
+			       buf[1] != STATUS_AFTER_WAKE);
+}
+
+static uint32_t fault_open(void *ctx)
+{
+	struct fault_ctx *c = ctx;
+
+	return c->inner->open(c->inner->ctx);
+}
+
+static size_t fault_write(void *ctx, const void *buf, size_t size)
+{
+	struct fault_ctx *c = ctx;
+	uint8_t sleep = PKT_FUNC_SLEEP;
+	enum s96at_fault f = S96AT_FAULT_NUM;
+	size_t n;
+
+	pthread_mutex_lock(&c->lock);
+
+	if (size && *(const uint8_t *)buf == PKT_FUNC_COMMAND)
+		f = fault_pick(c, HOOK_WRITE);
+
+	if (f == S96AT_FAULT_SLEEP || f == S96AT_FAULT_WOKEN) {
+		fault_inject(c, f);
+		c->inner->write(c->inner->ctx, &sleep, sizeof(sleep));
+	}
+
+	/* The command only wakes the device up, which answers the wake */
+	if (f == S96AT_FAULT_WOKEN) {
+		c->inner->wake(c->inner->ctx);
+		n = size;
+	} else {
+		n = c->inner->write(c->inner->ctx, buf, size);
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return n;
+}
+
+static size_t fault_read(void *ctx, void *buf, size_t size)
+{
+	struct fault_ctx *c = ctx;
+	uint8_t *resp = buf;
+	enum s96at_fault f;
+	uint16_t crc;
+	/* A NACK fails the read(2) of the i2c-dev driver */
+	size_t n = (size_t)-1;
+
+	pthread_mutex_lock(&c->lock);
+
+	/* A late response is not acknowledged until its time has come */
+	if (c->late_until_us) {
+		if (stats_now_us() < c->late_until_us)
+			goto out;
+		c->late_until_us = 0;
+	}
+
+	f = fault_pick(c, HOOK_READ);
+	if (f == S96AT_FAULT_NACK) {
+		fault_inject(c, f);
+		goto out;
+	}
+
+	if (f == S96AT_FAULT_LATE) {
+		fault_inject(c, f);
+		c->late_until_us = stats_now_us() + c->late_ms * 1000ULL;
+		goto out;
+	}
+
+	n = c->inner->read(c->inner->ctx, buf, size);
+	if (!n || n > size)
+		goto out;
+
+	if (f == S96AT_FAULT_CRC) {
+		fault_inject(c, f);
+		resp[n - 1] ^= 0xff;
+	} else if (f == S96AT_FAULT_ERROR && size >= 4) {
+		fault_inject(c, f);
+		resp[0] = 4;
+		resp[1] = STATUS_EXEC_ERROR;
+		crc = calculate_crc16(resp, 2, 0);
+		resp[2] = crc & 0xff;
+		resp[3] = crc >> 8;
+		n = 4;
+	} else if (response_good(resp, n)) {
+		fault_recovered(c);
+	}
+out:
+	pthread_mutex_unlock(&c->lock);
+
+	return n;
+}
+
+static uint32_t fault_close(void *ctx)
+{
+	struct fault_ctx *c = ctx;
+
+	return c->inner->close(c->inner->ctx);
+}
+
+static uint32_t fault_wake(void *ctx)
+{
+	struct fault_ctx *c = ctx;
+	uint32_t ret = STATUS_OK;
+
+	pthread_mutex_lock(&c->lock);
+
+	if (fault_pick(c, HOOK_WAKE) == S96AT_FAULT_WAKE)
+		fault_inject(c, S96AT_FAULT_WAKE);
+	else
+		ret = c->inner->wake(c->inner->ctx);
+
+	pthread_mutex_unlock(&c->lock);
+
+	return ret;
+}
+
+static void fault_wait(void *ctx, uint32_t ms)
+{
+	struct fault_ctx *c = ctx;
+
+	c->inner->wait(c->inner->ctx, ms);
+}
+
+static void fault_free(struct io_interface *ioif)
+{
+	struct fault_ctx *c = ioif->ctx;
+
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+	free(ioif);
+}
+
+static void fault_release(struct io_interface *ioif)
+{
+	struct fault_ctx *c = ioif->ctx;
+
+	at204_release(c->inner);
+	fault_free(ioif);
+}
+
+uint8_t s96at_fault_attach(struct s96at_desc *desc,
+			   const struct s96at_fault_config *cfg)
+{
+	struct io_interface *ioif;
+	struct fault_ctx *c;
+
+	if (!desc || !desc->ioif || !cfg)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	ioif = calloc(1, sizeof(*ioif));
+	c = calloc(1, sizeof(*c));
+	if (!ioif || !c) {
+		free(c);
+		free(ioif);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	if (cfg->script && parse_script(c, cfg->script)) {
+		loge("Invalid fault script: %s\n", cfg->script);
+		free(c);
+		free(ioif);
+		return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	if (pthread_mutex_init(&c->lock, NULL)) {
+		free(c);
+		free(ioif);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	c->inner = desc->ioif;
+	c->rng = cfg->seed * 2654435761u | 1;
+	memcpy(c->ppm, cfg->ppm, sizeof(c->ppm));
+	c->late_ms = cfg->late_ms;
+
+	ioif->ctx = c;
+	ioif->open = fault_open;
+	ioif->write = fault_write;
+	ioif->read = fault_read;
+	ioif->close = fault_close;
+	ioif->wake = fault_wake;
+	if (c->inner->wait)
+		ioif->wait = fault_wait;
+	ioif->release = fault_release;
+
+	/* Commands keep being counted, retried and timed the same way */
+	ioif->stats = c->inner->stats;
+	ioif->retry = c->inner->retry;
+	ioif->clock = c->inner->clock;
+	ioif->woken = c->inner->woken;
+	ioif->inner = c->inner;
+	c->inner->stats = NULL;
+	c->inner->retry = NULL;
+
+	desc->ioif = ioif;
+
+	return S96AT_STATUS_OK;
+}
+
+void s96at_fault_detach(struct s96at_desc *desc)
+{
+	struct io_interface *ioif;
+	struct fault_ctx *c;
+
+	if (!desc || !desc->ioif || desc->ioif->write != fault_write)
+		return;
+
+	ioif = desc->ioif;
+	c = ioif->ctx;
+
+	c->inner->stats = ioif->stats;
+	c->inner->retry = ioif->retry;
+	c->inner->clock = ioif->clock;
+	c->inner->woken = ioif->woken;
+	desc->ioif = c->inner;
+
+	fault_free(ioif);
+}
+
+uint8_t s96at_fault_report(struct s96at_desc *desc,
+			   struct s96at_fault_report *report)
+{
+	struct fault_ctx *c;
+
+	if (!desc || !desc->ioif || !report)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	if (desc->ioif->write != fault_write)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	c = desc->ioif->ctx;
+
+	pthread_mutex_lock(&c->lock);
+	memcpy(report, &c->report, sizeof(*report));
+	pthread_mutex_unlock(&c->lock);
+
+	return S96AT_STATUS_OK;
+}
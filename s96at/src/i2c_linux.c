@@ -6,6 +6,8 @@
 #include <fcntl.h>
 #include <i2c_linux.h>
 #include <linux/i2c-dev.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
@@ -18,13 +20,13 @@ static uint32_t i2c_linux_open(void *ctx)
 {
 	struct i2c_linux_ctx *ictx = ctx;
 
-	ictx->fd = open(I2C_DEVICE, O_RDWR);
+	ictx->fd = open(ictx->device, O_RDWR);
 	if (ictx->fd < 0) {
 		logd("Couldn't open the device\n");
 		return STATUS_EXEC_ERROR;
 	}
 
-	if (ioctl(ictx->fd, I2C_SLAVE, ATSHA204A_ADDR) < 0) {
+	if (ioctl(ictx->fd, I2C_SLAVE, ictx->addr) < 0) {
 		logd("Couldn't talk to the slave\n");
 		return STATUS_EXEC_ERROR;
 	}
@@ -73,16 +75,18 @@ static uint32_t i2c_linux_close(void *ctx)
  */
 static uint32_t i2c_linux_wake(void *ctx)
 {
+	struct i2c_linux_ctx *ictx = ctx;
 	int fd;
 	uint8_t data = 0;
 
-	fd = open(I2C_DEVICE, O_RDWR);
+	fd = open(ictx->device, O_RDWR);
 	if (fd < 0) {
 		loge("Couldn't open the device\n");
 		return STATUS_EXEC_ERROR;
 	}
 	if (ioctl(fd, I2C_SLAVE, 0) < 0) {
 		loge("Couldn't talk to the slave\n");
+		close(fd);
 		return STATUS_EXEC_ERROR;
 	}
 	write(fd, &data, sizeof(data));
@@ -91,13 +95,51 @@ static uint32_t i2c_linux_wake(void *ctx)
 	return STATUS_OK;
 }
 
-static struct i2c_linux_ctx i2c_ctx;
-
-struct io_interface i2c_linux = {
-	.ctx = &i2c_ctx,
+static const struct io_interface i2c_linux = {
 	.open = i2c_linux_open,
 	.write = i2c_linux_write,
 	.read = i2c_linux_read,
 	.close = i2c_linux_close,
 	.wake = i2c_linux_wake
 };
+
+static void i2c_linux_release(struct io_interface *ioif)
+{
+	struct i2c_linux_ctx *ictx = ioif->ctx;
+
+	free((char *)ictx->device);
+	free(ictx);
+	free(ioif);
+}
+
+struct io_interface *i2c_linux_create(const char *device, uint8_t addr)
+{
+	struct io_interface *ioif;
+	struct i2c_linux_ctx *ictx;
+
+	assert(device);
+
+	ioif = calloc(1, sizeof(*ioif));
+	ictx = calloc(1, sizeof(*ictx));
+	if (!ioif || !ictx)
+		goto err;
+
+	ictx->device = strdup(device);
+	if (!ictx->device)
+		goto err;
+
+	ictx->fd = -1;
+	ictx->addr = addr;
+
+	*ioif = i2c_linux;
+	ioif->ctx = ictx;
+	ioif->release = i2c_linux_release;
+	ioif->stats = NULL;
+
+	return ioif;
+err:
+	free(ictx);
+	free(ioif);
+
+	return NULL;
+}
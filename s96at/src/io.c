@@ -3,32 +3,21 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include <assert.h>
+#include <stdbool.h>
 #include <string.h>
-#include <unistd.h>
 
+#include <clock.h>
 #include <crc.h>
 #include <debug.h>
+#include <device.h>
 #include <io.h>
 #include <packet.h>
+#include <probe.h>
+#include <retry.h>
+#include <s96at.h>
+#include <stats.h>
 #include <status.h>
 
-extern struct io_interface i2c_linux;
-
-uint32_t register_io_interface(uint8_t io_interface_type,
-			       struct io_interface **ioif)
-{
-	switch (io_interface_type) {
-	case 0:
-		*ioif = (struct io_interface *)&i2c_linux;
-		break;
-
-	default:
-		logd("Unknown IO interface\n");
-	}
-
-	return STATUS_OK;
-}
-
 int at204_open(struct io_interface *ioif)
 {
 	return ioif->open(ioif->ctx);
@@ -36,37 +25,83 @@ int at204_open(struct io_interface *ioif)
 
 int at204_write(struct io_interface *ioif, void *buf, size_t size)
 {
-	return ioif->write(ioif->ctx, buf, size);
+	int n;
+	struct s96at_stats *st = stats_local(ioif);
+
+	n = ioif->write(ioif->ctx, buf, size);
+	if (st && n > 0)
+		STATS_ADD(st->bytes_written, n);
+
+	return n;
 }
 
-int at204_read(struct io_interface *ioif, void *buf, size_t size)
+static void count_status(struct s96at_stats *st, uint8_t status)
+{
+	switch (status) {
+	case STATUS_OK:
+		break;
+	case STATUS_CHECKMAC_FAIL:
+		STATS_ADD(st->errors[S96AT_STATS_ERROR_CHECKMAC_FAIL], 1);
+		break;
+	case STATUS_PARSE_ERROR:
+		STATS_ADD(st->errors[S96AT_STATS_ERROR_PARSE], 1);
+		break;
+	case STATUS_AFTER_WAKE:
+		STATS_ADD(st->errors[S96AT_STATS_ERROR_AFTER_WAKE], 1);
+		break;
+	case STATUS_CRC_ERROR:
+		STATS_ADD(st->errors[S96AT_STATS_ERROR_CRC], 1);
+		break;
+	default:
+		STATS_ADD(st->errors[S96AT_STATS_ERROR_EXEC], 1);
+	}
+}
+
+/*
+ * Reads a response. For command responses (errors set), the status reported
+ * by the device or the reason the response could not be read is counted.
+ * If fail is not NULL, it is set to what went wrong, if anything.
+ */
+static int io_read(struct io_interface *ioif, void *buf, size_t size,
+		   struct s96at_stats *st, bool errors,
+		   enum retry_failure *fail)
 {
 	int n = 0;
 	int ret = STATUS_EXEC_ERROR;
-	uint8_t *resp_buf = NULL;
+	enum retry_failure f = RETRY_BAD_RESPONSE;
+	uint8_t resp_buf[1 + PKT_MAX_RESP_LEN + CRC_LEN] = { 0 };
 	uint8_t resp_size = 0;
 
 	assert(ioif);
 	assert(buf);
 
+	if (size > PKT_MAX_RESP_LEN) {
+		f = RETRY_FATAL;
+		goto out;
+	}
+
 	/*
 	 * Response will be on the format:
 	 *  [packet size: 1 byte | data: size bytes | crc: 2 bytes]
 	 *
-	 * Therefore we need allocate 3 more bytes for the response.
+	 * Therefore we need 3 more bytes for the response.
 	 */
 	resp_size = 1 + size + CRC_LEN;
-	resp_buf = calloc(resp_size, sizeof(uint8_t));
-	if (!resp_buf)
-		return 0;
 
 	n = ioif->read(ioif->ctx, resp_buf, resp_size);
 	logd("Read n: %d bytes -> Resp[0] size: %d\n", n, resp_buf[0]);
 
+	if (st && n > 0)
+		STATS_ADD(st->bytes_read, n);
+	else if (st && errors)
+		STATS_ADD(st->errors[S96AT_STATS_ERROR_NO_RESPONSE], 1);
+
 	/*
 	 * We expect something to be read and if read, we expect either the size
 	 * 4 or the full response length as calculated above.
 	 */
+	if (n <= 0)
+		f = RETRY_READ_NACK;
 	if (n <= 0 || resp_buf[0] > n || (resp_buf[0] != 4 && resp_buf[0] != resp_size))
 		goto out;
 
@@ -80,10 +115,32 @@ int at204_read(struct io_interface *ioif, void *buf, size_t size)
 	if (!crc_valid(resp_buf, resp_buf + (resp_buf[0] - CRC_LEN),
 		       resp_buf[0] - CRC_LEN)) {
 		logd("Got incorrect CRC\n");
+		PROBE2(crc__failure, resp_buf[0], n);
+		if (st && errors)
+			STATS_ADD(st->errors[S96AT_STATS_ERROR_RESPONSE_CRC], 1);
 		ret = STATUS_CRC_ERROR;
 		goto out;
 	}
 
+	if (st && errors && resp_buf[0] == 4)
+		count_status(st, resp_buf[1]);
+
+	/*
+	 * A wake-up in place of the response means the device was asleep and
+	 * lost TempKey, see tempkey_update()
+	 */
+	if (errors && resp_buf[0] == 4 && resp_buf[1] == STATUS_AFTER_WAKE)
+		ioif->woken = true;
+
+	/* A CRC error or a wake-up in place of the response: it did not run */
+	if (resp_buf[0] == 4 && (resp_buf[1] == STATUS_CRC_ERROR ||
+				 resp_buf[1] == STATUS_AFTER_WAKE))
+		f = RETRY_NOT_EXECUTED;
+	else if (resp_buf[0] == resp_size)
+		f = RETRY_NONE;
+	else
+		f = RETRY_FATAL;
+
 	if (resp_buf[0] == resp_size) {
 		memcpy(buf, resp_buf + 1, size);
 		ret = STATUS_OK;
@@ -91,42 +148,115 @@ int at204_read(struct io_interface *ioif, void *buf, size_t size)
 		logd("Something went wrong!\n");
 	}
 out:
-	free(resp_buf);
+	PROBE3(response__read, size, n, ret);
+	if (fail)
+		*fail = f;
 	return ret;
 }
 
+int at204_read(struct io_interface *ioif, void *buf, size_t size)
+{
+	return io_read(ioif, buf, size, stats_local(ioif), false, NULL);
+}
+
 
 int at204_close(struct io_interface *ioif)
 {
 	return ioif->close(ioif->ctx);
 }
 
+void at204_release(struct io_interface *ioif)
+{
+	if (ioif->release)
+		ioif->release(ioif);
+}
+
 int at204_wake(struct io_interface *ioif)
 {
+	struct s96at_stats *st = stats_local(ioif);
+
+	if (st)
+		STATS_ADD(st->wakes, 1);
+
 	return ioif->wake(ioif->ctx);
 }
 
-int at204_write2(struct io_interface *ioif, struct cmd_packet *p)
+int at204_send(struct io_interface *ioif, struct cmd_packet *p)
 {
-	uint8_t *serialized_pkt = NULL;
+	uint8_t serialized_pkt[PKT_MAX_SIZE];
+	size_t pkt_size;
 	int n = 0;
+	struct s96at_stats *st = stats_local(ioif);
+	uint64_t t0 = 0;
 
-	serialized_pkt = serialize(p);
-	if (!serialized_pkt)
+	pkt_size = serialize(p, serialized_pkt, sizeof(serialized_pkt));
+	if (!pkt_size)
 		goto err;
 
-	n = ioif->write(ioif->ctx, serialized_pkt, get_total_packet_size(p));
+	PROBE2(packet__serialized, p->opcode, pkt_size);
+
+	if (st)
+		t0 = stats_now_us();
+
+	n = ioif->write(ioif->ctx, serialized_pkt, pkt_size);
 
 	logd("Wrote n = 0x%02x (%d) bytes to ATSHA204A\n", n, n);
+	PROBE2(write__done, p->opcode, n);
 
-	/* Time in p is in ms */
-	usleep(p->max_time * 1000);
+	if (st) {
+		stats_record(&st->latency[s96at_stats_index(p->opcode)][S96AT_STATS_PHASE_WRITE],
+			     stats_now_us() - t0);
+		if (n > 0)
+			STATS_ADD(st->bytes_written, n);
+	}
 err:
-	free(serialized_pkt);
-
 	return n > 0 ? STATUS_OK : STATUS_EXEC_ERROR;
 }
 
+int at204_write2(struct io_interface *ioif, struct cmd_packet *p)
+{
+	int ret;
+	struct s96at_stats *st = stats_local(ioif);
+	uint64_t t0 = 0;
+
+	ret = at204_send(ioif, p);
+
+	if (st)
+		t0 = stats_now_us();
+
+	/* Time in p is in ms */
+	PROBE2(wait__start, p->opcode, p->max_time);
+	if (ioif->wait)
+		ioif->wait(ioif->ctx, p->max_time);
+	else
+		clock_sleep_us(ioif->clock, p->max_time * 1000ULL);
+	PROBE1(wait__end, p->opcode);
+
+	if (st)
+		stats_record(&st->latency[s96at_stats_index(p->opcode)][S96AT_STATS_PHASE_WAIT],
+			     stats_now_us() - t0);
+
+	return ret;
+}
+
+int at204_recv(struct io_interface *ioif, struct cmd_packet *p, void *resp_buf,
+	       size_t size)
+{
+	int ret;
+	struct s96at_stats *st = stats_local(ioif);
+	uint64_t t0;
+
+	if (!st)
+		return io_read(ioif, resp_buf, size, NULL, true, NULL);
+
+	t0 = stats_now_us();
+	ret = io_read(ioif, resp_buf, size, st, true, NULL);
+	stats_record(&st->latency[s96at_stats_index(p->opcode)][S96AT_STATS_PHASE_READ],
+		     stats_now_us() - t0);
+
+	return ret;
+}
+
 int at204_msg(struct io_interface *ioif, struct cmd_packet *p, void *resp_buf,
 	      size_t size)
 {
@@ -134,11 +264,56 @@ int at204_msg(struct io_interface *ioif, struct cmd_packet *p, void *resp_buf,
 
 	assert(resp_buf);
 
-	ret = at204_write2(ioif, p);
-	if (ret != STATUS_OK) {
-		logd("Didn't write anything\n");
-		return ret;
+	struct s96at_stats *st = stats_local(ioif);
+	struct retry_state rs;
+	enum retry_step step = RETRY_COMMAND;
+	enum retry_failure fail;
+	uint64_t t0;
+
+	PROBE4(command__submit, p->opcode, p->param1,
+	       p->param2[0] | p->param2[1] << 8, p->data_length);
+
+	if (!clock_available(ioif->clock)) {
+		loge("No clock to time the command with\n");
+		return STATUS_EXEC_ERROR;
 	}
 
-	return at204_read(ioif, resp_buf, size);
+	if (st)
+		STATS_ADD(st->commands[s96at_stats_index(p->opcode)], 1);
+
+	retry_init(&rs, ioif->retry, ioif->clock);
+
+	for (;;) {
+		if (step != RETRY_READ && at204_write2(ioif, p) != STATUS_OK) {
+			logd("Didn't write anything\n");
+			if (st)
+				STATS_ADD(st->errors[S96AT_STATS_ERROR_NO_RESPONSE], 1);
+			ret = STATUS_EXEC_ERROR;
+			fail = RETRY_WRITE_NACK;
+		} else if (!st) {
+			ret = io_read(ioif, resp_buf, size, NULL, true, &fail);
+		} else {
+			t0 = stats_now_us();
+			ret = io_read(ioif, resp_buf, size, st, true, &fail);
+			stats_record(&st->latency[s96at_stats_index(p->opcode)][S96AT_STATS_PHASE_READ],
+				     stats_now_us() - t0);
+		}
+
+		step = retry_next(&rs, p->opcode, fail);
+		if (step == RETRY_STOP)
+			break;
+
+		if (st)
+			STATS_ADD(st->retries, 1);
+
+		/* Rewind the output buffer to read the response from the start */
+		if (step == RETRY_READ && fail == RETRY_BAD_RESPONSE)
+			device_reset(ioif);
+		else if (step == RETRY_WAKE)
+			retry_wake(ioif);
+	}
+
+	PROBE2(command__done, p->opcode, ret);
+
+	return ret;
 }
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <cmd.h>
+#include <debug.h>
+#include <mac.h>
+#include <s96at.h>
+#include <sha.h>
+
+/* Number of wake attempts before giving up on the device */
+#define LOG_WAKE_RETRIES		10
+
+/* MAC over Slot[slot] and TempKey, where TempKey holds the chain head */
+#define LOG_MAC_MODE			(S96AT_MAC_MODE_1 | \
+					 (TEMPKEY_SOURCE_INPUT << MAC_MODE_TEMPKEY_SOURCE_SHIFT))
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * head = SHA-256(head || len || record), where len is the record length as
+ * a 64-bit little endian value so that record boundaries are unambiguous.
+ */
+static void log_chain(uint8_t *head, const void *rec, size_t len)
+{
+	size_t i;
+	uint8_t len_le[8];
+	uint64_t l = len;
+	struct sha256_ctx ctx;
+
+	for (i = 0; i < sizeof(len_le); i++)
+		len_le[i] = l >> (8 * i);
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, head, SHA_DIGEST_LEN);
+	sha256_update(&ctx, len_le, sizeof(len_le));
+	sha256_update(&ctx, rec, len);
+	sha256_final(&ctx, head);
+}
+
+uint8_t s96at_log_init(struct s96at_log *log, struct s96at_desc *desc,
+		       uint8_t slot, const uint8_t *iv, uint32_t every,
+		       uint32_t interval_ms)
+{
+	if (!log || !desc)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(log, 0, sizeof(*log));
+	log->desc = desc;
+	log->slot = slot;
+	log->every = every;
+	log->interval_ms = interval_ms;
+	log->last_ms = now_ms();
+
+	if (iv)
+		memcpy(log->head, iv, SHA_DIGEST_LEN);
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_log_checkpoint(struct s96at_log *log,
+			     struct s96at_log_checkpoint *cp)
+{
+	int i;
+	uint8_t ret;
+
+	if (!log || !log->desc || !cp)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	for (i = 0; i < LOG_WAKE_RETRIES; i++) {
+		if (s96at_wake(log->desc) == S96AT_STATUS_READY)
+			break;
+	}
+
+	if (i == LOG_WAKE_RETRIES) {
+		loge("Could not wake up the device\n");
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	ret = s96at_gen_nonce(log->desc, S96AT_NONCE_MODE_PASSTHROUGH, log->head,
+			      NULL);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_get_mac(log->desc, S96AT_MAC_MODE_1, log->slot, NULL,
+			    S96AT_FLAG_TEMPKEY_SOURCE_INPUT, cp->mac);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	cp->seq = log->seq;
+	memcpy(cp->head, log->head, SHA_DIGEST_LEN);
+
+	log->pending = 0;
+	log->last_ms = now_ms();
+out:
+	s96at_idle(log->desc);
+
+	return ret;
+}
+
+uint8_t s96at_log_append(struct s96at_log *log, const void *rec, size_t len,
+			 struct s96at_log_checkpoint *cp, bool *sealed)
+{
+	if (!log || (len && !rec) || !cp || !sealed)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	*sealed = false;
+
+	log_chain(log->head, rec, len);
+	log->seq++;
+	log->pending++;
+
+	if ((log->every && log->pending >= log->every) ||
+	    (log->interval_ms && now_ms() - log->last_ms >= log->interval_ms)) {
+		*sealed = true;
+		return s96at_log_checkpoint(log, cp);
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+void s96at_log_cleanup(struct s96at_log *log)
+{
+	if (log)
+		memset(log, 0, sizeof(*log));
+}
+
+uint8_t s96at_log_verify_init(struct s96at_log_verifier *v, const uint8_t *key,
+			      uint8_t slot, const uint8_t *iv)
+{
+	if (!v || !key)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(v, 0, sizeof(*v));
+	memcpy(v->key, key, S96AT_KEY_LEN);
+	v->slot = slot;
+
+	if (iv)
+		memcpy(v->head, iv, SHA_DIGEST_LEN);
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_log_verify_record(struct s96at_log_verifier *v, const void *rec,
+				size_t len)
+{
+	if (!v || (len && !rec))
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	log_chain(v->head, rec, len);
+	v->seq++;
+
+	return S96AT_STATUS_OK;
+}
+
+uint8_t s96at_log_verify_checkpoint(struct s96at_log_verifier *v,
+				    const struct s96at_log_checkpoint *cp)
+{
+	uint8_t mac[S96AT_MAC_LEN];
+
+	if (!v || !cp)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	if (cp->seq != v->seq || !mac_equal(cp->head, v->head, SHA_DIGEST_LEN))
+		return S96AT_STATUS_CHECKMAC_FAIL;
+
+	mac_compute(v->key, v->head, LOG_MAC_MODE, v->slot, NULL, NULL, mac);
+
+	if (!mac_equal(mac, cp->mac, S96AT_MAC_LEN))
+		return S96AT_STATUS_CHECKMAC_FAIL;
+
+	return S96AT_STATUS_OK;
+}
+
+void s96at_log_verify_cleanup(struct s96at_log_verifier *v)
+{
+	if (v)
+		memset(v, 0, sizeof(*v));
+}
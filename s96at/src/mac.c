@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stddef.h>
+#include <string.h>
+
+#include <cmd.h>
+#include <mac.h>
+#include <sha.h>
+
+/* SN[8] and SN[0:1] are fixed by the manufacturer and always included */
+static const uint8_t sn_default[SERIALNUM_LEN] = {
+	0x01, 0x23, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xee
+};
+
+void mac_compute(const uint8_t *first, const uint8_t *second, uint8_t mode,
+		 uint16_t slot, const uint8_t *otp, const uint8_t *sn,
+		 uint8_t *mac)
+{
+	uint8_t mac_in[88] = { 0 };
+
+	if (!sn)
+		sn = sn_default;
+
+	memcpy(mac_in, first, 32);
+	memcpy(mac_in + 32, second, 32);
+	mac_in[64] = OPCODE_MAC;
+	mac_in[65] = mode;
+	mac_in[66] = slot & 0xff;
+	mac_in[67] = slot >> 8;
+
+	if (otp && (mode & (1 << MAC_MODE_USE_OTP_64_BITS_SHIFT)))
+		memcpy(mac_in + 68, otp, 8);
+
+	if (otp && (mode & (1 << MAC_MODE_USE_OTP_88_BITS_SHIFT)))
+		memcpy(mac_in + 68, otp, 11);
+
+	mac_in[79] = sn[8];
+
+	if (mode & (1 << MAC_MODE_USE_SN_SHIFT))
+		memcpy(mac_in + 80, sn + 4, 4);
+
+	mac_in[84] = sn[0];
+	mac_in[85] = sn[1];
+
+	if (mode & (1 << MAC_MODE_USE_SN_SHIFT))
+		memcpy(mac_in + 86, sn + 2, 2);
+
+	sha256(mac_in, sizeof(mac_in), mac);
+}
+
+void mac_check_mac_data(uint8_t *buf, const uint8_t *challenge,
+			const uint8_t *mac, uint8_t mac_mode, uint8_t slot,
+			const uint8_t *otp, const uint8_t *sn)
+{
+	memset(buf, 0, CHECK_MAC_DATA_LEN);
+
+	/* Challenge sent to the client */
+	if (challenge)
+		memcpy(buf, challenge, 32);
+
+	/* Response generated by the client */
+	memcpy(buf + 32, mac, 32);
+
+	/* OtherData contains the parameters used for the MAC command */
+	buf[64] = OPCODE_MAC;
+	buf[65] = mac_mode;
+	buf[66] = 0x00;	/* Slot ID MSB */
+	buf[67] = slot;	/* Slot ID LSB */
+
+	if (otp) {
+		buf[68] = otp[8];
+		buf[69] = otp[9];
+		buf[70] = otp[10];
+	}
+
+	if (sn) {
+		buf[71] = sn[4];
+		buf[72] = sn[5];
+		buf[73] = sn[6];
+		buf[74] = sn[7];
+		buf[75] = sn[2];
+		buf[76] = sn[3];
+	}
+}
+
+bool mac_equal(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	size_t i;
+	uint8_t diff = 0;
+
+	for (i = 0; i < len; i++)
+		diff |= a[i] ^ b[i];
+
+	return diff == 0;
+}
@@ -4,7 +4,6 @@
  */
 #include <assert.h>
 #include <stdint.h>
-#include <stdlib.h>
 
 #include <crc.h>
 #include <debug.h>
@@ -39,21 +38,20 @@ static size_t get_count_size(struct cmd_packet *p)
 }
 
 
-uint8_t *serialize(struct cmd_packet *p)
+size_t serialize(struct cmd_packet *p, uint8_t *pkt, size_t size)
 {
-	uint8_t *pkt;
 	size_t pkt_size = get_total_packet_size(p);
 	size_t pl_size;
 
 	assert(p);
+	assert(pkt);
+
+	if (pkt_size > size)
+		return 0;
 
 	p->count = get_count_size(p);
 	pl_size = get_payload_size(p);
-	logd("pkt_size: %u, count: %d, payload_size: %u\n", pkt_size, p->count, pl_size);
-
-	pkt = calloc(pkt_size, sizeof(uint8_t));
-	if (!pkt)
-		return NULL;
+	logd("pkt_size: %zu, count: %d, payload_size: %zu\n", pkt_size, p->count, pl_size);
 
 	pkt[0] = p->command;
 	pkt[1] = p->count;
@@ -62,18 +60,16 @@ uint8_t *serialize(struct cmd_packet *p)
 	pkt[4] = p->param2[0];
 	pkt[5] = p->param2[1];
 
-	/*
-	 * No need to set "data" to NULL if there is no data, since calloc
-	 * already set it to 0.
-	 */
-	if (p->data && p->data_length)
+	if (p->data)
 		memcpy(&pkt[6], p->data, p->data_length);
+	else
+		memset(&pkt[6], 0, p->data_length);
 
 	p->checksum = get_serialized_crc(&pkt[1], pl_size);
 	logd("checksum: 0x%x\n", p->checksum);
 
 	memcpy(&pkt[pkt_size - CRC_LEN], &p->checksum, CRC_LEN);
 
-	return pkt;
+	return pkt_size;
 }
 
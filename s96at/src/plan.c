@@ -0,0 +1,388 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <endian.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <batch.h>
+#include <cmd.h>
+#include <crc.h>
+#include <debug.h>
+#include <s96at.h>
+#include <status.h>
+
+/* Number of wake attempts before giving up on the device */
+#define PLAN_WAKE_RETRIES		10
+
+#define CONFIG_FIRST_WRITABLE_WORD	4
+#define CONFIG_LAST_WRITABLE_WORD	19
+
+/* Block 1 of the Config zone (words 8-15) is writable as a whole */
+#define CONFIG_BLOCK1_WORD		8
+#define CONFIG_BLOCK1_NUM_WORDS		8
+
+#define CONFIG_LOCK_DATA_BYTE		86
+#define CONFIG_LOCK_CONFIG_BYTE		87
+
+#define ZONE_OTP_NUM_BLOCKS		2
+
+#define WRITE_MODE_32_BYTES		(1 << 7)
+#define LOCK_MODE_DATA			1
+
+static uint8_t plan_add(struct s96at_plan *plan, uint8_t opcode, uint8_t param1,
+			uint16_t param2, const uint8_t *data, size_t len)
+{
+	struct s96at_plan_step *s;
+
+	if (plan->num_steps == S96AT_PLAN_MAX_STEPS)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	s = &plan->steps[plan->num_steps++];
+	s->opcode = opcode;
+	s->param1 = param1;
+	s->param2 = param2;
+	s->data = data;
+	s->len = len;
+
+	return S96AT_STATUS_OK;
+}
+
+static uint8_t plan_write(struct s96at_plan *plan, uint8_t zone, uint8_t addr,
+			  const uint8_t *data, size_t len)
+{
+	if (len == MAX_WRITE_SIZE)
+		zone |= WRITE_MODE_32_BYTES;
+
+	return plan_add(plan, OPCODE_WRITE, zone, addr, data, len);
+}
+
+/*
+ * Reads the whole Config zone in as few commands as possible: two 32-byte
+ * reads for blocks 0 and 1 and single words for the partial block 2.
+ */
+static uint8_t read_config(struct s96at_desc *desc, uint8_t *config)
+{
+	int i;
+	uint8_t ret;
+
+	for (i = 0; i < 2; i++) {
+		ret = cmd_read(desc->ioif, ZONE_CONFIG, i * 8, 0, MAX_READ_SIZE,
+			       config + i * MAX_READ_SIZE, MAX_READ_SIZE);
+		if (ret != STATUS_OK)
+			return ret;
+	}
+
+	for (i = 2 * MAX_READ_SIZE / WORD_SIZE; i < ZONE_CONFIG_NUM_WORDS; i++) {
+		ret = cmd_read(desc->ioif, ZONE_CONFIG, i, 0, WORD_SIZE,
+			       config + i * WORD_SIZE, WORD_SIZE);
+		if (ret != STATUS_OK)
+			return ret;
+	}
+
+	return STATUS_OK;
+}
+
+static bool word_differs(const uint8_t *current, const uint8_t *target, int word)
+{
+	return memcmp(current + word * WORD_SIZE, target + word * WORD_SIZE,
+		      WORD_SIZE) != 0;
+}
+
+static uint8_t plan_config(struct s96at_plan *plan, const uint8_t *current)
+{
+	int i;
+	int diff = 0;
+	uint8_t ret;
+
+	for (i = CONFIG_BLOCK1_WORD;
+	     i < CONFIG_BLOCK1_WORD + CONFIG_BLOCK1_NUM_WORDS; i++)
+		if (word_differs(current, plan->config, i))
+			diff++;
+
+	/* One 32-byte write is as fast as a single 4-byte one */
+	if (diff > 1) {
+		ret = plan_write(plan, ZONE_CONFIG, CONFIG_BLOCK1_WORD,
+				 plan->config + CONFIG_BLOCK1_WORD * WORD_SIZE,
+				 MAX_WRITE_SIZE);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+	}
+
+	for (i = CONFIG_FIRST_WRITABLE_WORD; i <= CONFIG_LAST_WRITABLE_WORD; i++) {
+		if (diff > 1 && i >= CONFIG_BLOCK1_WORD &&
+		    i < CONFIG_BLOCK1_WORD + CONFIG_BLOCK1_NUM_WORDS)
+			continue;
+
+		if (!word_differs(current, plan->config, i))
+			continue;
+
+		ret = plan_write(plan, ZONE_CONFIG, i, plan->config + i * WORD_SIZE,
+				 WORD_SIZE);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+static int random_key(uint8_t *key)
+{
+	FILE *f;
+	size_t n;
+
+	f = fopen("/dev/urandom", "rb");
+	if (!f)
+		return -1;
+
+	n = fread(key, 1, SLOT_DATA_SIZE, f);
+	fclose(f);
+
+	return n == SLOT_DATA_SIZE ? 0 : -1;
+}
+
+/*
+ * Before the Data and OTP zones are locked they cannot be read and only
+ * accept 32-byte writes (section 8.5.18), so nothing can be skipped here.
+ * The steps point straight into the data and otp images.
+ */
+static uint8_t plan_data(struct s96at_plan *plan, const uint8_t *data,
+			 const uint8_t *otp, uint16_t slots, uint16_t otp_words)
+{
+	int i;
+	uint8_t ret;
+	uint16_t otp_block_mask = (1 << (ZONE_OTP_NUM_WORDS / 2)) - 1;
+
+	for (i = 0; i < ZONE_DATA_NUM_SLOTS; i++) {
+		if (!(slots & (1 << i)))
+			continue;
+
+		ret = plan_write(plan, ZONE_DATA, SLOT_ADDR(i),
+				 data + i * SLOT_DATA_SIZE, MAX_WRITE_SIZE);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+	}
+
+	for (i = 0; i < ZONE_OTP_NUM_BLOCKS; i++) {
+		if (!(otp_words & (otp_block_mask << (i * 8))))
+			continue;
+
+		ret = plan_write(plan, ZONE_OTP, i * 8, otp + i * MAX_WRITE_SIZE,
+				 MAX_WRITE_SIZE);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+/*
+ * Data and OTP images from the profile. When the zones are to be locked,
+ * the slots and OTP blocks not set by the profile are written with zeros
+ * so that the lock CRC is known.
+ */
+static uint8_t plan_profile_data(struct s96at_plan *plan,
+				 const struct s96at_profile *prof)
+{
+	int i;
+	uint8_t ret;
+
+	memcpy(plan->data, prof->data, sizeof(plan->data));
+	memcpy(plan->otp, prof->otp, sizeof(plan->otp));
+
+	for (i = 0; i < ZONE_DATA_NUM_SLOTS; i++) {
+		if ((prof->random_slots & (1 << i)) &&
+		    random_key(plan->data + i * SLOT_DATA_SIZE)) {
+			loge("Could not generate the key of slot %d\n", i);
+			return S96AT_STATUS_EXEC_ERROR;
+		}
+	}
+
+	ret = plan_data(plan, plan->data, plan->otp,
+			prof->lock_data ? 0xffff : prof->slots,
+			prof->lock_data ? 0xffff : prof->otp_words);
+	if (ret != S96AT_STATUS_OK || !prof->lock_data)
+		return ret;
+
+	plan->data_crc = calculate_crc16(plan->data, sizeof(plan->data), 0);
+	plan->data_crc = calculate_crc16(plan->otp, sizeof(plan->otp),
+					 plan->data_crc);
+
+	return S96AT_STATUS_OK;
+}
+
+/*
+ * Data and OTP images from a bundle record. The record covers both zones
+ * in full and carries their lock CRC, so nothing is copied or computed.
+ */
+static uint8_t plan_record_data(struct s96at_plan *plan,
+				const struct s96at_profile *prof,
+				const struct s96at_bundle_record *rec)
+{
+	uint8_t ret;
+
+	ret = plan_data(plan, rec->data, rec->otp, 0xffff, 0xffff);
+	if (ret == S96AT_STATUS_OK && prof->lock_data)
+		plan->data_crc = le16toh(rec->data_crc);
+
+	return ret;
+}
+
+static uint8_t plan_build(struct s96at_desc *desc,
+			  const struct s96at_profile *prof,
+			  const struct s96at_bundle_record *rec,
+			  struct s96at_plan *plan)
+{
+	int i;
+	uint8_t ret;
+	uint8_t current[ZONE_CONFIG_SIZE];
+	bool config_locked;
+	bool data_locked;
+
+	if (!desc || !prof || !plan)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(plan, 0, sizeof(*plan));
+
+	for (i = 0; i < PLAN_WAKE_RETRIES; i++) {
+		if (s96at_wake(desc) == S96AT_STATUS_READY)
+			break;
+	}
+
+	if (i == PLAN_WAKE_RETRIES) {
+		loge("Could not wake up the device\n");
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	ret = read_config(desc, current);
+	s96at_idle(desc);
+	if (ret != STATUS_OK) {
+		loge("Could not read the Config zone\n");
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	config_locked = current[CONFIG_LOCK_CONFIG_BYTE] == LOCK_CONFIG_LOCKED;
+	data_locked = current[CONFIG_LOCK_DATA_BYTE] == LOCK_DATA_LOCKED;
+
+	/* Target image: the current contents with the profile applied */
+	for (i = 0; i < ZONE_CONFIG_SIZE; i++)
+		plan->config[i] = (current[i] & ~prof->config_mask[i]) |
+				  (prof->config[i] & prof->config_mask[i]);
+
+	if (config_locked) {
+		if (memcmp(current, plan->config, ZONE_CONFIG_SIZE)) {
+			loge("Config zone is locked and does not match the profile\n");
+			return S96AT_STATUS_EXEC_ERROR;
+		}
+	} else {
+		ret = plan_config(plan, current);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+
+		if (prof->lock_config) {
+			plan->config_crc = calculate_crc16(plan->config,
+							   ZONE_CONFIG_SIZE, 0);
+			ret = plan_add(plan, OPCODE_LOCK, ZONE_CONFIG,
+				       plan->config_crc, NULL, 0);
+			if (ret != S96AT_STATUS_OK)
+				return ret;
+		}
+	}
+
+	if (!rec && !prof->slots && !prof->otp_words && !prof->lock_data)
+		return S96AT_STATUS_OK;
+
+	if (data_locked) {
+		logd("Data zone already locked, nothing to do\n");
+		return S96AT_STATUS_OK;
+	}
+
+	/* The Data and OTP zones can only be written once Config is locked */
+	if (!config_locked && !prof->lock_config) {
+		loge("Data zone cannot be written before the Config zone is locked\n");
+		return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	if (rec)
+		ret = plan_record_data(plan, prof, rec);
+	else
+		ret = plan_profile_data(plan, prof);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	if (prof->lock_data)
+		ret = plan_add(plan, OPCODE_LOCK, LOCK_MODE_DATA, plan->data_crc,
+			       NULL, 0);
+
+	return ret;
+}
+
+uint8_t s96at_plan_build(struct s96at_desc *desc,
+			 const struct s96at_profile *prof,
+			 struct s96at_plan *plan)
+{
+	return plan_build(desc, prof, NULL, plan);
+}
+
+uint8_t s96at_plan_build_bundle(struct s96at_desc *desc,
+				const struct s96at_profile *prof,
+				const struct s96at_bundle_record *rec,
+				struct s96at_plan *plan)
+{
+	if (!rec)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	return plan_build(desc, prof, rec, plan);
+}
+
+uint8_t s96at_plan_run(struct s96at_desc *desc, struct s96at_plan *plan)
+{
+	size_t i;
+	size_t n;
+	size_t start = 0;
+	uint8_t ret = S96AT_STATUS_OK;
+	struct s96at_batch_cmd cmds[S96AT_PLAN_MAX_STEPS];
+
+	if (!desc || !plan)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(cmds, 0, sizeof(cmds));
+
+	for (i = 0; i < plan->num_steps; i++) {
+		cmds[i].opcode = plan->steps[i].opcode;
+		cmds[i].param1 = plan->steps[i].param1;
+		cmds[i].param2 = plan->steps[i].param2;
+		cmds[i].data = plan->steps[i].len ? plan->steps[i].data : NULL;
+		cmds[i].data_len = plan->steps[i].len;
+	}
+
+	/* Run as many steps as fit in each wake window */
+	while (start < plan->num_steps) {
+		for (n = 1; start + n < plan->num_steps; n++)
+			if (!batch_fits(&cmds[start], n + 1))
+				break;
+
+		ret = s96at_batch(desc, &cmds[start], n, S96AT_FLAG_STOP_ON_ERROR);
+		if (ret != S96AT_STATUS_OK) {
+			for (i = start; i < start + n; i++)
+				if (cmds[i].status != S96AT_STATUS_OK)
+					break;
+			loge("Provisioning step %zu failed: 0x%02x\n", i, ret);
+			break;
+		}
+
+		start += n;
+	}
+
+	s96at_idle(desc);
+
+	return ret;
+}
+
+void s96at_plan_cleanup(struct s96at_plan *plan)
+{
+	if (plan)
+		memset(plan, 0, sizeof(*plan));
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmd.h>
+#include <debug.h>
+#include <s96at.h>
+
+#define PROFILE_MAX_TOKENS		5
+#define PROFILE_DELIM			" \t\r"
+
+/* Config words below this are read-only, the ones above are set by Lock */
+#define CONFIG_FIRST_WRITABLE_WORD	4
+#define CONFIG_LAST_WRITABLE_WORD	19
+
+#define SLOT_CONFIG_BASE		20 /* Byte offset of SlotConfig[0] */
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/* Parses exactly len bytes of hex, with an optional 0x prefix */
+static int parse_hex(const char *s, uint8_t *buf, size_t len)
+{
+	size_t i;
+	int hi, lo;
+
+	if (!strncmp(s, "0x", 2) || !strncmp(s, "0X", 2))
+		s += 2;
+
+	if (strlen(s) != 2 * len)
+		return -1;
+
+	for (i = 0; i < len; i++) {
+		hi = hex_nibble(s[2 * i]);
+		lo = hex_nibble(s[2 * i + 1]);
+		if (hi < 0 || lo < 0)
+			return -1;
+		buf[i] = hi << 4 | lo;
+	}
+
+	return 0;
+}
+
+static int parse_num(const char *s, unsigned long max, unsigned long *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoul(s, &end, 0);
+	if (errno || *end || end == s || *val > max)
+		return -1;
+
+	return 0;
+}
+
+static int read_file(const char *path, uint8_t *buf, size_t len)
+{
+	FILE *f;
+	size_t n;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -1;
+
+	n = fread(buf, 1, len, f);
+	fclose(f);
+
+	return n == len ? 0 : -1;
+}
+
+static int parse_key(char **tok, int num_tok, uint8_t *key)
+{
+	if (num_tok == 4 && !parse_hex(tok[3], key, S96AT_KEY_LEN))
+		return 0;
+
+	if (num_tok == 5 && !strcmp(tok[3], "file"))
+		return read_file(tok[4], key, S96AT_KEY_LEN);
+
+	return -1;
+}
+
+static int parse_line(struct s96at_profile *prof, char **tok, int num_tok)
+{
+	unsigned long n;
+	uint8_t buf[4];
+
+	if (!strcmp(tok[0], "config") && num_tok == 3) {
+		if (parse_num(tok[1], CONFIG_LAST_WRITABLE_WORD, &n) ||
+		    n < CONFIG_FIRST_WRITABLE_WORD ||
+		    parse_hex(tok[2], buf, WORD_SIZE))
+			return -1;
+
+		memcpy(prof->config + n * WORD_SIZE, buf, WORD_SIZE);
+		memset(prof->config_mask + n * WORD_SIZE, 0xff, WORD_SIZE);
+		return 0;
+	}
+
+	if (!strcmp(tok[0], "slot") && num_tok >= 4) {
+		if (parse_num(tok[1], ZONE_DATA_NUM_SLOTS - 1, &n))
+			return -1;
+
+		if (!strcmp(tok[2], "config") && num_tok == 4) {
+			/* SlotConfig is given as a 16-bit value, stored LSB first */
+			if (parse_hex(tok[3], buf, 2))
+				return -1;
+
+			prof->config[SLOT_CONFIG_BASE + 2 * n] = buf[1];
+			prof->config[SLOT_CONFIG_BASE + 2 * n + 1] = buf[0];
+			memset(prof->config_mask + SLOT_CONFIG_BASE + 2 * n, 0xff, 2);
+			return 0;
+		}
+
+		/* Random keys are drawn per device, when the plan is built */
+		if (!strcmp(tok[2], "key") && num_tok == 4 &&
+		    !strcmp(tok[3], "random")) {
+			prof->slots |= 1 << n;
+			prof->random_slots |= 1 << n;
+			return 0;
+		}
+
+		if (!strcmp(tok[2], "key")) {
+			if (parse_key(tok, num_tok, prof->data + n * SLOT_DATA_SIZE))
+				return -1;
+
+			prof->slots |= 1 << n;
+			prof->random_slots &= ~(1 << n);
+			return 0;
+		}
+
+		return -1;
+	}
+
+	if (!strcmp(tok[0], "otp") && num_tok == 3) {
+		if (parse_num(tok[1], ZONE_OTP_NUM_WORDS - 1, &n) ||
+		    parse_hex(tok[2], prof->otp + n * WORD_SIZE, WORD_SIZE))
+			return -1;
+
+		prof->otp_words |= 1 << n;
+		return 0;
+	}
+
+	if (!strcmp(tok[0], "lock") && num_tok == 2) {
+		if (!strcmp(tok[1], "config"))
+			prof->lock_config = true;
+		else if (!strcmp(tok[1], "data"))
+			prof->lock_data = true;
+		else
+			return -1;
+		return 0;
+	}
+
+	return -1;
+}
+
+uint8_t s96at_profile_parse(struct s96at_profile *prof, const char *text)
+{
+	char *copy;
+	char *line;
+	char *next;
+	char *comment;
+	char *save;
+	char *tok[PROFILE_MAX_TOKENS + 1];
+	int num_tok;
+	int line_nbr = 0;
+	uint8_t ret = S96AT_STATUS_OK;
+
+	if (!prof || !text)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(prof, 0, sizeof(*prof));
+
+	copy = strdup(text);
+	if (!copy)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	for (line = copy; line; line = next) {
+		line_nbr++;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+
+		comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		num_tok = 0;
+		tok[0] = strtok_r(line, PROFILE_DELIM, &save);
+		while (tok[num_tok] && num_tok++ < PROFILE_MAX_TOKENS)
+			tok[num_tok] = strtok_r(NULL, PROFILE_DELIM, &save);
+
+		if (!num_tok)
+			continue;
+
+		if (num_tok > PROFILE_MAX_TOKENS || parse_line(prof, tok, num_tok)) {
+			loge("Profile: invalid line %d\n", line_nbr);
+			ret = S96AT_STATUS_BAD_PARAMETERS;
+			break;
+		}
+	}
+
+	memset(copy, 0, strlen(text));
+	free(copy);
+
+	if (ret != S96AT_STATUS_OK)
+		s96at_profile_cleanup(prof);
+
+	return ret;
+}
+
+uint8_t s96at_profile_load(struct s96at_profile *prof, const char *path)
+{
+	FILE *f;
+	long len;
+	char *text;
+	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
+
+	if (!prof || !path)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	f = fopen(path, "r");
+	if (!f) {
+		loge("Could not open %s\n", path);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET))
+		goto out;
+
+	text = calloc(len + 1, 1);
+	if (!text)
+		goto out;
+
+	if (fread(text, 1, len, f) == len)
+		ret = s96at_profile_parse(prof, text);
+
+	memset(text, 0, len);
+	free(text);
+out:
+	fclose(f);
+
+	return ret;
+}
+
+void s96at_profile_cleanup(struct s96at_profile *prof)
+{
+	if (prof)
+		memset(prof, 0, sizeof(*prof));
+}
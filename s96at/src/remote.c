@@ -0,0 +1,347 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/* F_ADD_SEALS */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <daemon.h>
+#include <debug.h>
+#include <device.h>
+#include <io.h>
+#include <s96at.h>
+#include <status.h>
+#include <tempkey.h>
+
+/* How often a client waiting on its ring checks that the daemon is there */
+#define RING_POLL_MS		100
+
+struct remote_ctx {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	bool use_ring;
+	int fd;
+	struct s96atd_ring *ring;
+	struct s96at_tempkey *tk;
+	/* Command packet, sent along with the read of its response */
+	struct s96atd_msg cmd;
+	uint16_t wait_ms;
+};
+
+static bool remote_alive(struct remote_ctx *c)
+{
+	struct pollfd pfd = {
+		.fd = c->fd,
+		.events = POLLIN,
+	};
+
+	/* The daemon never writes to the socket of a ring */
+	return !__atomic_load_n(&c->ring->closed, __ATOMIC_ACQUIRE) &&
+	       poll(&pfd, 1, 0) == 0;
+}
+
+static bool ring_call(struct remote_ctx *c, struct s96atd_msg *msg)
+{
+	struct s96atd_ring *ring = c->ring;
+	uint32_t head = ring->req_head;
+	uint32_t tail = ring->resp_tail;
+
+	memcpy(&ring->req[head % S96ATD_RING_SLOTS], msg, sizeof(*msg));
+	__atomic_store_n(&ring->req_head, head + 1, __ATOMIC_RELEASE);
+	ring_wake(&ring->req_head);
+
+	while (__atomic_load_n(&ring->resp_head, __ATOMIC_ACQUIRE) == tail) {
+		if (!remote_alive(c))
+			return false;
+		ring_wait(&ring->resp_head, tail, RING_POLL_MS);
+	}
+
+	memcpy(msg, &ring->resp[tail % S96ATD_RING_SLOTS], sizeof(*msg));
+	__atomic_store_n(&ring->resp_tail, tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/* Runs a call on the daemon, msg is turned into the response */
+static bool remote_call(struct remote_ctx *c, struct s96atd_msg *msg)
+{
+	ssize_t n;
+
+	if (c->fd < 0)
+		return false;
+
+	if (c->ring) {
+		if (!ring_call(c, msg))
+			return false;
+	} else {
+		n = send(c->fd, msg, S96ATD_MSG_HDR_LEN + msg->len,
+			 MSG_NOSIGNAL);
+		if (n != S96ATD_MSG_HDR_LEN + msg->len)
+			return false;
+
+		n = recv(c->fd, msg, sizeof(*msg), 0);
+		if (n < (ssize_t)S96ATD_MSG_HDR_LEN ||
+		    n != S96ATD_MSG_HDR_LEN + msg->len)
+			return false;
+	}
+
+	if (msg->flags & S96ATD_FLAG_NEW_DEVICE)
+		tempkey_invalidate(c->tk);
+
+	return true;
+}
+
+/* Hands a ring in shared memory over to the daemon */
+static int remote_ring(struct remote_ctx *c)
+{
+	struct s96atd_msg msg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctrl;
+	struct iovec iov = {
+		.iov_base = &msg,
+		.iov_len = S96ATD_MSG_HDR_LEN,
+	};
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctrl.buf,
+		.msg_controllen = sizeof(ctrl.buf),
+	};
+	struct cmsghdr *cmsg;
+	int fd;
+	int ret = -1;
+
+	fd = syscall(SYS_memfd_create, "s96atd-ring",
+		     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+
+	/* The daemon only maps rings that can no longer be resized */
+	if (ftruncate(fd, sizeof(*c->ring)) ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+		goto out;
+
+	c->ring = mmap(NULL, sizeof(*c->ring), PROT_READ | PROT_WRITE,
+		       MAP_SHARED, fd, 0);
+	if (c->ring == MAP_FAILED) {
+		c->ring = NULL;
+		goto out;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = S96ATD_RING;
+
+	memset(&ctrl, 0, sizeof(ctrl));
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+	if (sendmsg(c->fd, &mh, MSG_NOSIGNAL) != S96ATD_MSG_HDR_LEN ||
+	    recv(c->fd, &msg, sizeof(msg), 0) != S96ATD_MSG_HDR_LEN ||
+	    msg.ret != STATUS_OK) {
+		munmap(c->ring, sizeof(*c->ring));
+		c->ring = NULL;
+		goto out;
+	}
+
+	ret = 0;
+out:
+	close(fd);
+
+	return ret;
+}
+
+static uint32_t remote_open(void *ctx)
+{
+	struct remote_ctx *c = ctx;
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, c->path);
+
+	c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (c->fd < 0)
+		return STATUS_EXEC_ERROR;
+
+	if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		loge("Could not connect to %s\n", c->path);
+		goto err;
+	}
+
+	if (c->use_ring && remote_ring(c)) {
+		loge("Could not set up the ring\n");
+		goto err;
+	}
+
+	return STATUS_OK;
+err:
+	close(c->fd);
+	c->fd = -1;
+
+	return STATUS_EXEC_ERROR;
+}
+
+static size_t remote_write(void *ctx, const void *buf, size_t size)
+{
+	struct remote_ctx *c = ctx;
+	struct s96atd_msg msg;
+
+	if (size > S96ATD_MAX_DATA)
+		return 0;
+
+	/* Commands go along with the read of their response */
+	if (size && *(const uint8_t *)buf == PKT_FUNC_COMMAND) {
+		memcpy(c->cmd.data, buf, size);
+		c->cmd.len = size;
+		c->wait_ms = 0;
+		return size;
+	}
+
+	memset(&msg, 0, S96ATD_MSG_HDR_LEN);
+	msg.op = S96ATD_WRITE;
+	msg.len = size;
+	memcpy(msg.data, buf, size);
+
+	return remote_call(c, &msg) ? msg.ret : 0;
+}
+
+static void remote_wait(void *ctx, uint32_t ms)
+{
+	struct remote_ctx *c = ctx;
+
+	/* The daemon waits, right before it reads the response */
+	c->wait_ms = ms;
+}
+
+static size_t remote_read(void *ctx, void *buf, size_t size)
+{
+	struct remote_ctx *c = ctx;
+	struct s96atd_msg *msg = &c->cmd;
+
+	if (size > S96ATD_MAX_DATA)
+		return 0;
+
+	msg->op = S96ATD_XFER;
+	msg->flags = 0;
+	msg->read_len = size;
+	msg->wait_ms = c->wait_ms;
+	msg->ret = 0;
+
+	if (!remote_call(c, msg)) {
+		msg->len = 0;
+		return 0;
+	}
+
+	memcpy(buf, msg->data, msg->len);
+
+	/* A read that follows is a read of the same response */
+	msg->len = 0;
+
+	return msg->ret;
+}
+
+static uint32_t remote_close(void *ctx)
+{
+	struct remote_ctx *c = ctx;
+
+	if (c->ring) {
+		munmap(c->ring, sizeof(*c->ring));
+		c->ring = NULL;
+	}
+
+	if (c->fd >= 0) {
+		close(c->fd);
+		c->fd = -1;
+	}
+
+	return STATUS_OK;
+}
+
+static uint32_t remote_wake(void *ctx)
+{
+	struct remote_ctx *c = ctx;
+	struct s96atd_msg msg;
+
+	memset(&msg, 0, S96ATD_MSG_HDR_LEN);
+	msg.op = S96ATD_WAKE;
+
+	return remote_call(c, &msg) ? msg.ret : STATUS_EXEC_ERROR;
+}
+
+static void remote_release(struct io_interface *ioif)
+{
+	remote_close(ioif->ctx);
+	free(ioif->ctx);
+	free(ioif);
+}
+
+struct io_interface *remote_create(const char *path, bool ring,
+				   struct s96at_tempkey *tk)
+{
+	struct io_interface *ioif;
+	struct remote_ctx *c;
+
+	if (!path || !tk || strlen(path) >= sizeof(c->path))
+		return NULL;
+
+	ioif = calloc(1, sizeof(*ioif));
+	c = calloc(1, sizeof(*c));
+	if (!ioif || !c) {
+		free(c);
+		free(ioif);
+		return NULL;
+	}
+
+	strcpy(c->path, path);
+	c->use_ring = ring;
+	c->fd = -1;
+	c->tk = tk;
+
+	ioif->ctx = c;
+	ioif->open = remote_open;
+	ioif->write = remote_write;
+	ioif->read = remote_read;
+	ioif->close = remote_close;
+	ioif->wake = remote_wake;
+	ioif->wait = remote_wait;
+	ioif->release = remote_release;
+
+	return ioif;
+}
+
+uint8_t s96at_set_priority(struct s96at_desc *desc,
+			   enum s96at_priority priority, uint8_t weight)
+{
+	struct s96atd_msg msg;
+
+	if (!desc || !desc->ioif || desc->ioif->release != remote_release ||
+	    priority >= S96AT_PRIORITY_NUM || !weight)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	memset(&msg, 0, S96ATD_MSG_HDR_LEN);
+	msg.op = S96ATD_PRIORITY;
+	msg.len = 2;
+	msg.data[0] = priority;
+	msg.data[1] = weight;
+
+	if (!remote_call(desc->ioif->ctx, &msg))
+		return S96AT_STATUS_EXEC_ERROR;
+
+	return msg.ret;
+}
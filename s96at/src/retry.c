@@ -0,0 +1,128 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <clock.h>
+#include <cmd.h>
+#include <debug.h>
+#include <device.h>
+#include <io.h>
+#include <retry.h>
+#include <s96at.h>
+#include <status.h>
+
+/* Running these again leaves the device as if they ran once */
+static bool retry_idempotent(uint8_t opcode)
+{
+	switch (opcode) {
+	case OPCODE_DEVREV:
+	case OPCODE_PAUSE:
+	case OPCODE_RANDOM:
+	case OPCODE_READ:
+		return true;
+	default:
+		/*
+		 * CheckMac, HMAC and MAC count a use of a key with a limited
+		 * number of uses; DeriveKey, GenDig, Lock, Nonce, SHA,
+		 * UpdateExtra and Write change the state of the device.
+		 */
+		return false;
+	}
+}
+
+void retry_init(struct retry_state *rs, const struct s96at_retry_policy *policy,
+		const struct s96at_clock *clock)
+{
+	rs->policy = policy;
+	rs->clock = clock;
+	rs->reads = 0;
+	rs->commands = 0;
+	rs->wakes = 0;
+	rs->backoff_us = policy ? policy->backoff_us : 0;
+}
+
+enum retry_step retry_next(struct retry_state *rs, uint8_t opcode,
+			   enum retry_failure fail)
+{
+	const struct s96at_retry_policy *policy = rs->policy;
+	enum retry_step step;
+	bool safe;
+
+	if (!policy || fail == RETRY_NONE || fail == RETRY_FATAL)
+		return RETRY_STOP;
+
+	safe = fail == RETRY_WRITE_NACK || fail == RETRY_NOT_EXECUTED ||
+	       retry_idempotent(opcode);
+
+	if ((fail == RETRY_READ_NACK || fail == RETRY_BAD_RESPONSE) &&
+	    rs->reads < policy->read_retries) {
+		rs->reads++;
+		step = RETRY_READ;
+	} else if (safe && rs->commands < policy->command_retries) {
+		rs->commands++;
+		step = RETRY_COMMAND;
+	} else if (safe && rs->wakes < policy->wake_retries) {
+		rs->wakes++;
+		step = RETRY_WAKE;
+	} else {
+		return RETRY_STOP;
+	}
+
+	logd("Retrying opcode 0x%02x, step %d\n", opcode, step);
+
+	clock_sleep_us(rs->clock, rs->backoff_us);
+
+	rs->backoff_us *= 2;
+	if (policy->max_backoff_us && rs->backoff_us > policy->max_backoff_us)
+		rs->backoff_us = policy->max_backoff_us;
+
+	return step;
+}
+
+void retry_wake(struct io_interface *ioif)
+{
+	int i;
+	uint8_t status;
+
+	device_idle(ioif);
+	/* TempKey may have been lost in the meantime, see tempkey_update() */
+	ioif->woken = true;
+
+	for (i = 0; i < RETRY_WAKE_ATTEMPTS; i++) {
+		if (at204_wake(ioif) == STATUS_OK &&
+		    at204_read(ioif, &status, sizeof(status)) == STATUS_OK &&
+		    status == STATUS_AFTER_WAKE)
+			return;
+	}
+}
+
+uint8_t s96at_set_retry_policy(struct s96at_desc *desc,
+			       const struct s96at_retry_policy *policy)
+{
+#ifndef S96AT_FREESTANDING
+	struct s96at_retry_policy *copy = NULL;
+#endif
+
+	if (!desc || !desc->ioif)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+#ifdef S96AT_FREESTANDING
+	/* No heap, the policy is used in place */
+	desc->ioif->retry = (struct s96at_retry_policy *)policy;
+#else
+	if (policy) {
+		copy = malloc(sizeof(*copy));
+		if (!copy)
+			return S96AT_STATUS_EXEC_ERROR;
+		*copy = *policy;
+	}
+
+	free(desc->ioif->retry);
+	desc->ioif->retry = copy;
+#endif
+
+	return S96AT_STATUS_OK;
+}
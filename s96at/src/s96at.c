@@ -4,43 +4,174 @@
  */
 #include <string.h>
 
+#include <capture.h>
 #include <cmd.h>
 #include <crc.h>
+#include <daemon.h>
+#include <debug.h>
 #include <device.h>
+#include <emulator.h>
+#include <i2c_linux.h>
 #include <io.h>
+#include <mac.h>
 #include <s96at.h>
 #include <sha.h>
+#include <slotcfg.h>
+#include <stats.h>
 #include <status.h>
+#include <tempkey.h>
 
+uint8_t s96at_init_io(enum s96at_device device, struct io_interface *ioif,
+		      struct s96at_desc *desc)
+{
+	if (!ioif || !desc)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	desc->dev = device;
+	memset(&desc->tempkey, 0, sizeof(desc->tempkey));
+	memset(&desc->config, 0, sizeof(desc->config));
+	desc->ioif = ioif;
+
+	return at204_open(desc->ioif);
+}
+
+#ifndef S96AT_FREESTANDING
 uint8_t s96at_init(enum s96at_device device, enum s96at_io_interface_type iface,
 		   struct s96at_desc *desc)
+{
+	if (iface == S96AT_IO_EMULATOR)
+		return s96at_init_emulator(device, 0, desc);
+
+	/* An interface of its own, for the state kept per descriptor */
+	return s96at_init_i2c(device, I2C_DEVICE, ATSHA204A_ADDR, desc);
+}
+
+uint8_t s96at_init_i2c(enum s96at_device device, const char *path, uint8_t addr,
+		       struct s96at_desc *desc)
 {
 	uint8_t ret;
 
+	if (!path || !desc)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
 	desc->dev = device;
+	memset(&desc->tempkey, 0, sizeof(desc->tempkey));
+	memset(&desc->config, 0, sizeof(desc->config));
 
-	ret = register_io_interface(IO_I2C_LINUX, &desc->ioif);
-	if (ret != STATUS_OK)
-		return ret;
+	desc->ioif = i2c_linux_create(path, addr);
+	if (!desc->ioif)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = at204_open(desc->ioif);
+	if (ret != STATUS_OK) {
+		at204_release(desc->ioif);
+		desc->ioif = NULL;
+	}
+
+	return ret;
+}
+
+uint8_t s96at_init_daemon(enum s96at_device device, const char *path,
+			  bool ring, struct s96at_desc *desc)
+{
+	uint8_t ret;
+
+	if (!path || !desc)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	desc->dev = device;
+	memset(&desc->tempkey, 0, sizeof(desc->tempkey));
+	memset(&desc->config, 0, sizeof(desc->config));
+
+	desc->ioif = remote_create(path, ring, &desc->tempkey);
+	if (!desc->ioif)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = at204_open(desc->ioif);
+	if (ret != STATUS_OK) {
+		at204_release(desc->ioif);
+		desc->ioif = NULL;
+	}
+
+	return ret;
+}
+
+uint8_t s96at_init_emulator(enum s96at_device device, uint32_t id,
+			    struct s96at_desc *desc)
+{
+	uint8_t ret;
+
+	if (!desc)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	desc->dev = device;
+	memset(&desc->tempkey, 0, sizeof(desc->tempkey));
+	memset(&desc->config, 0, sizeof(desc->config));
+
+	desc->ioif = emulator_create(id);
+	if (!desc->ioif)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = at204_open(desc->ioif);
+	if (ret != STATUS_OK) {
+		at204_release(desc->ioif);
+		desc->ioif = NULL;
+	}
+
+	return ret;
+}
+
+uint8_t s96at_init_replay(enum s96at_device device, const char *path,
+			  enum s96at_replay_mode mode, struct s96at_desc *desc)
+{
+	uint8_t ret;
+
+	if (!path || !desc)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	desc->dev = device;
+	memset(&desc->tempkey, 0, sizeof(desc->tempkey));
+	memset(&desc->config, 0, sizeof(desc->config));
+
+	desc->ioif = replay_create(path, mode);
+	if (!desc->ioif)
+		return S96AT_STATUS_EXEC_ERROR;
 
 	ret = at204_open(desc->ioif);
+	if (ret != STATUS_OK) {
+		at204_release(desc->ioif);
+		desc->ioif = NULL;
+	}
 
 	return ret;
 }
+#endif
 
 uint8_t s96at_cleanup(struct s96at_desc *desc)
 {
 	uint8_t ret = S96AT_STATUS_OK;
 
-	if (desc->ioif)
+	if (desc->ioif) {
+#ifndef S96AT_FREESTANDING
+		s96at_stats_disable(desc);
+#endif
+		s96at_set_retry_policy(desc, NULL);
 		ret = at204_close(desc->ioif);
+		at204_release(desc->ioif);
+		desc->ioif = NULL;
+	}
 
 	return ret;
 }
 
 uint8_t s96at_idle(struct s96at_desc *desc)
 {
-	return device_idle(desc->ioif);
+	uint8_t ret;
+
+	ret = device_idle(desc->ioif);
+	tempkey_idle(&desc->tempkey);
+
+	return ret;
 }
 
 uint8_t s96at_reset(struct s96at_desc *desc)
@@ -50,28 +181,56 @@ uint8_t s96at_reset(struct s96at_desc *desc)
 
 uint8_t s96at_sleep(struct s96at_desc *desc)
 {
-	return device_sleep(desc->ioif);
+	uint8_t ret;
+
+	ret = device_sleep(desc->ioif);
+	tempkey_sleep(&desc->tempkey);
+
+	return ret;
 }
 
 uint8_t s96at_wake(struct s96at_desc *desc)
 {
 	uint8_t ret;
 	uint8_t buf;
+	struct s96at_stats *st;
 
 	if (at204_wake(desc->ioif) != STATUS_OK)
 		return S96AT_STATUS_EXEC_ERROR;
 
 	ret = at204_read(desc->ioif, &buf, sizeof(buf));
 
-	if (ret == S96AT_STATUS_OK && buf == S96AT_STATUS_READY)
+	if (ret == S96AT_STATUS_OK && buf == S96AT_STATUS_READY) {
+		tempkey_wake(&desc->tempkey);
 		ret = S96AT_STATUS_READY;
+	} else {
+		st = stats_local(desc->ioif);
+		if (st)
+			STATS_ADD(st->wake_retries, 1);
+	}
 
 	return ret;
 }
 
+/*
+ * Commands that the slot configuration does not permit fail the way the
+ * device would have failed them, without going to the device.
+ */
+static inline uint8_t slot_refused(struct s96at_desc *desc)
+{
+	struct s96at_stats *st = stats_local(desc->ioif);
+
+	if (st)
+		STATS_ADD(st->errors[S96AT_STATS_ERROR_REFUSED], 1);
+
+	return S96AT_STATUS_EXEC_ERROR;
+}
+
+#ifdef S96AT_CMD_DERIVEKEY
 uint8_t s96at_derive_key(struct s96at_desc *desc, uint8_t slot, uint8_t *mac,
 			 uint32_t flags)
 {
+	uint8_t ret;
 	size_t len;
 	uint8_t tempkey_source;
 
@@ -79,6 +238,9 @@ uint8_t s96at_derive_key(struct s96at_desc *desc, uint8_t slot, uint8_t *mac,
 	   (flags != S96AT_FLAG_TEMPKEY_SOURCE_RANDOM))
 		return S96AT_STATUS_BAD_PARAMETERS;
 
+	if (!slotcfg_can_derive(&desc->config, slot))
+		return slot_refused(desc);
+
 	if (mac)
 		len = S96AT_MAC_LEN;
 	else
@@ -90,40 +252,55 @@ uint8_t s96at_derive_key(struct s96at_desc *desc, uint8_t slot, uint8_t *mac,
 	if (flags & S96AT_FLAG_TEMPKEY_SOURCE_RANDOM)
 		tempkey_source = (TEMPKEY_SOURCE_RANDOM << MAC_MODE_TEMPKEY_SOURCE_SHIFT);
 
-	return cmd_derive_key(desc->ioif, tempkey_source, slot, mac, len);
+	ret = cmd_derive_key(desc->ioif, tempkey_source, slot, mac, len);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_DERIVEKEY,
+		       tempkey_source, slot, mac, len, ret);
+
+	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_PAUSE
 uint8_t s96at_pause(struct s96at_desc *desc, uint8_t selector)
 {
 	return cmd_pause(desc->ioif, selector);
 }
+#endif
 
 uint16_t s96at_crc(const uint8_t *buf, size_t buf_len, uint16_t current_crc)
 {
 	return calculate_crc16(buf, buf_len, current_crc);
 }
 
+#ifdef S96AT_CMD_RANDOM
 uint8_t s96at_get_random(struct s96at_desc *desc, enum s96at_random_mode mode,
 		     uint8_t *buf)
 {
 	uint8_t ret;
 
 	ret = cmd_get_random(desc->ioif, mode, buf, S96AT_RANDOM_LEN);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_RANDOM, mode, 0, NULL,
+		       0, ret);
 
 	if (ret != STATUS_OK)
 		memset(buf, 0, S96AT_RANDOM_LEN);
 
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_DEVREV
 uint8_t s96at_get_devrev(struct s96at_desc *desc, uint8_t *buf)
 {
 	return cmd_get_devrev(desc->ioif, buf, S96AT_DEVREV_LEN);
 }
+#endif
 
+#ifdef S96AT_CMD_GENDIG
 uint8_t s96at_gen_digest(struct s96at_desc *desc, enum s96at_zone zone,
 			 uint8_t slot, uint8_t *data)
 {
+	uint8_t ret;
 	size_t data_len;
 
 	if (data)
@@ -131,9 +308,15 @@ uint8_t s96at_gen_digest(struct s96at_desc *desc, enum s96at_zone zone,
 	else
 		data_len = 0;
 
-	return cmd_gen_dig(desc->ioif, data, data_len, zone, slot);
+	ret = cmd_gen_dig(desc->ioif, data, data_len, zone, slot);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_GENDIG, zone, slot,
+		       data, data_len, ret);
+
+	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_NONCE
 uint8_t s96at_gen_nonce(struct s96at_desc *desc, enum s96at_nonce_mode mode,
 		    uint8_t *data, uint8_t *random)
 {
@@ -150,6 +333,13 @@ uint8_t s96at_gen_nonce(struct s96at_desc *desc, enum s96at_nonce_mode mode,
 		return S96AT_STATUS_BAD_PARAMETERS;
 
 	if (mode == S96AT_NONCE_MODE_PASSTHROUGH) {
+		/* Nothing to do if TempKey already holds the same value */
+		if (tempkey_matches(&desc->tempkey, desc->ioif, data, false,
+				    0, 0)) {
+			logd("TempKey up to date, skipping Nonce\n");
+			return S96AT_STATUS_OK;
+		}
+
 		data_len = S96AT_CHALLENGE_LEN;
 		out = &nonce_resp;
 		out_len = sizeof(nonce_resp);
@@ -160,68 +350,142 @@ uint8_t s96at_gen_nonce(struct s96at_desc *desc, enum s96at_nonce_mode mode,
 	}
 
 	ret = cmd_get_nonce(desc->ioif, data, data_len, mode, out, out_len);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_NONCE, mode, 0, data,
+		       data_len, ret);
 
 	if (ret != STATUS_OK && random)
 		memset(random, 0, S96AT_RANDOM_LEN);
 
 	return ret;
 }
+#endif
 
-uint8_t s96at_get_mac(struct s96at_desc *desc, enum s96at_mac_mode mode, uint8_t slot,
-		  const uint8_t *challenge, uint32_t flags, uint8_t *mac)
+uint8_t s96at_invalidate_tempkey(struct s96at_desc *desc)
+{
+	tempkey_invalidate(&desc->tempkey);
+
+	return S96AT_STATUS_OK;
+}
+
+#ifdef S96AT_CMD_NONCE
+uint8_t s96at_load_tempkey(struct s96at_desc *desc, const uint8_t *value,
+			   uint32_t flags, enum s96at_zone zone, uint8_t slot)
 {
 	uint8_t ret;
-	uint8_t challenge_len;
+	bool gendig = flags & S96AT_FLAG_GENDIG;
 
-	if ((mode == S96AT_MAC_MODE_0 || mode == S96AT_MAC_MODE_2) && !challenge)
+	if (!value)
 		return S96AT_STATUS_BAD_PARAMETERS;
 
-	if ((flags & S96AT_FLAG_TEMPKEY_SOURCE_INPUT) &&
-	   (flags & S96AT_FLAG_TEMPKEY_SOURCE_RANDOM))
+#ifndef S96AT_CMD_GENDIG
+	if (gendig)
 		return S96AT_STATUS_BAD_PARAMETERS;
+#endif
 
-	if (!(flags & S96AT_FLAG_TEMPKEY_SOURCE_INPUT) &&
-	   !(flags & S96AT_FLAG_TEMPKEY_SOURCE_RANDOM))
-		return S96AT_STATUS_BAD_PARAMETERS;
+	if (tempkey_matches(&desc->tempkey, desc->ioif, value, gendig, zone,
+			    slot)) {
+		logd("TempKey up to date, skipping Nonce / GenDig\n");
+		return S96AT_STATUS_OK;
+	}
+
+	/* Only run the GenDig step if the Nonce part is still in place */
+	if (!gendig || !tempkey_matches(&desc->tempkey, desc->ioif, value,
+					false, 0, 0)) {
+		ret = s96at_gen_nonce(desc, S96AT_NONCE_MODE_PASSTHROUGH,
+				      (uint8_t *)value, NULL);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+	}
 
-	if ((flags & S96AT_FLAG_USE_OTP_64_BITS) && (flags & S96AT_FLAG_USE_OTP_88_BITS))
+#ifdef S96AT_CMD_GENDIG
+	if (gendig)
+		return s96at_gen_digest(desc, zone, slot, NULL);
+#endif
+
+	return S96AT_STATUS_OK;
+}
+#endif
+
+#if defined(S96AT_CMD_MAC) || defined(S96AT_CMD_HMAC)
+uint8_t s96at_mac_mode(enum s96at_mac_mode mode, uint32_t flags,
+		       uint8_t *param1)
+{
+	bool input = flags & S96AT_FLAG_TEMPKEY_SOURCE_INPUT;
+	bool random = flags & S96AT_FLAG_TEMPKEY_SOURCE_RANDOM;
+
+	if (!param1 || mode > S96AT_MAC_MODE_3 || input == random)
 		return S96AT_STATUS_BAD_PARAMETERS;
 
-	if (mode == S96AT_MAC_MODE_0 || mode == S96AT_MAC_MODE_2)
-		challenge_len = S96AT_CHALLENGE_LEN;
-	else
-		challenge_len = 0;
+	if ((flags & S96AT_FLAG_USE_OTP_64_BITS) &&
+	    (flags & S96AT_FLAG_USE_OTP_88_BITS))
+		return S96AT_STATUS_BAD_PARAMETERS;
 
-	if (flags & S96AT_FLAG_TEMPKEY_SOURCE_INPUT)
-		mode |= (TEMPKEY_SOURCE_INPUT << MAC_MODE_TEMPKEY_SOURCE_SHIFT);
+	*param1 = mode;
 
-	if (flags & S96AT_FLAG_TEMPKEY_SOURCE_RANDOM)
-		mode |= (TEMPKEY_SOURCE_RANDOM << MAC_MODE_TEMPKEY_SOURCE_SHIFT);
+	if (input)
+		*param1 |= TEMPKEY_SOURCE_INPUT << MAC_MODE_TEMPKEY_SOURCE_SHIFT;
+	else
+		*param1 |= TEMPKEY_SOURCE_RANDOM << MAC_MODE_TEMPKEY_SOURCE_SHIFT;
 
 	if (flags & S96AT_FLAG_USE_OTP_64_BITS)
-		mode |= (1 << MAC_MODE_USE_OTP_64_BITS_SHIFT);
+		*param1 |= 1 << MAC_MODE_USE_OTP_64_BITS_SHIFT;
 
 	if (flags & S96AT_FLAG_USE_OTP_88_BITS)
-		mode |= (1 << MAC_MODE_USE_OTP_88_BITS_SHIFT);
+		*param1 |= 1 << MAC_MODE_USE_OTP_88_BITS_SHIFT;
 
 	if (flags & S96AT_FLAG_USE_SN)
-		mode |= (1 << MAC_MODE_USE_SN_SHIFT);
+		*param1 |= 1 << MAC_MODE_USE_SN_SHIFT;
+
+	return S96AT_STATUS_OK;
+}
+#endif
+
+#ifdef S96AT_CMD_MAC
+uint8_t s96at_get_mac(struct s96at_desc *desc, enum s96at_mac_mode mode, uint8_t slot,
+		  const uint8_t *challenge, uint32_t flags, uint8_t *mac)
+{
+	uint8_t ret;
+	uint8_t challenge_len;
+	uint8_t param1;
+
+	if ((mode == S96AT_MAC_MODE_0 || mode == S96AT_MAC_MODE_2) && !challenge)
+		return S96AT_STATUS_BAD_PARAMETERS;
 
-	ret = cmd_get_mac(desc->ioif, (uint8_t *)challenge, challenge_len, mode, slot,
-			  mac, S96AT_MAC_LEN);
+	ret = s96at_mac_mode(mode, flags, &param1);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	/* Modes 0 and 1 hash the key in the slot */
+	if ((mode == S96AT_MAC_MODE_0 || mode == S96AT_MAC_MODE_1) &&
+	    !slotcfg_can_use_key(&desc->config, slot)) {
+		memset(mac, 0, S96AT_MAC_LEN);
+		return slot_refused(desc);
+	}
+
+	if (mode == S96AT_MAC_MODE_0 || mode == S96AT_MAC_MODE_2)
+		challenge_len = S96AT_CHALLENGE_LEN;
+	else
+		challenge_len = 0;
+
+	ret = cmd_get_mac(desc->ioif, (uint8_t *)challenge, challenge_len,
+			  param1, slot, mac, S96AT_MAC_LEN);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_MAC, param1, slot,
+		       challenge, challenge_len, ret);
 
 	if (ret != STATUS_OK)
 		memset(mac, 0, S96AT_MAC_LEN);
 
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_CHECKMAC
 uint8_t s96at_check_mac(struct s96at_desc *desc, enum s96at_mac_mode mode,
 			uint8_t slot, uint32_t flags, struct s96at_check_mac_data *data,
 			const uint8_t *mac)
 {
 	uint8_t ret;
-	uint8_t check_mac_data[77] = { 0 };
+	uint8_t check_mac_data[CHECK_MAC_DATA_LEN];
 	uint8_t check_mac_resp;
 	uint8_t mac_mode = mode;
 
@@ -254,64 +518,49 @@ uint8_t s96at_check_mac(struct s96at_desc *desc, enum s96at_mac_mode mode,
 	if (data->flags & S96AT_FLAG_USE_SN)
 		mac_mode |= (1 << MAC_MODE_USE_SN_SHIFT);
 
-	/* Challenge sent to the client */
-	memcpy(check_mac_data, data->challenge, S96AT_CHALLENGE_LEN);
-
-	/* Response generated by the client */
-	memcpy(check_mac_data + S96AT_CHALLENGE_LEN, mac, S96AT_MAC_LEN);
+	mac_check_mac_data(check_mac_data, data->challenge, mac, mac_mode,
+			   data->slot, data->otp, data->sn);
 
-	/* OtherData contains the parameters used for the MAC command */
-	check_mac_data[64] = OPCODE_MAC; /* Opcode */
-	check_mac_data[65] = mac_mode;
-	check_mac_data[66] = 0x00;	 /* Slot ID MSB */
-	check_mac_data[67] = data->slot; /* Slot ID LSB */
-
-	if (data->otp) {
-		check_mac_data[68] = data->otp[8];
-		check_mac_data[69] = data->otp[9];
-		check_mac_data[70] = data->otp[10];
-	}
-
-	if (data->sn) {
-		check_mac_data[71] = data->sn[4];
-		check_mac_data[72] = data->sn[5];
-		check_mac_data[73] = data->sn[6];
-		check_mac_data[74] = data->sn[7];
-		check_mac_data[75] = data->sn[2];
-		check_mac_data[76] = data->sn[3];
-	}
-
-	ret = cmd_check_mac(desc->ioif, check_mac_data, 77, mode, slot,
-			    &check_mac_resp, sizeof(check_mac_resp));
+	ret = cmd_check_mac(desc->ioif, check_mac_data, sizeof(check_mac_data),
+			    mode, slot, &check_mac_resp, sizeof(check_mac_resp));
 	if (ret == STATUS_OK)
 		ret = check_mac_resp;
 
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_CHECKMAC, mode, slot,
+		       check_mac_data, sizeof(check_mac_data), ret);
+
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_HMAC
 uint8_t s96at_get_hmac(struct s96at_desc *desc, uint8_t slot, uint32_t flags,
 		   uint8_t *hmac)
 {
-	uint8_t mode = 0;
-
-	if (flags & S96AT_FLAG_TEMPKEY_SOURCE_INPUT)
-		mode |= (TEMPKEY_SOURCE_INPUT << MAC_MODE_TEMPKEY_SOURCE_SHIFT);
+	uint8_t ret;
+	uint8_t mode;
 
-	if (flags & S96AT_FLAG_TEMPKEY_SOURCE_RANDOM)
-		mode |= (TEMPKEY_SOURCE_RANDOM << MAC_MODE_TEMPKEY_SOURCE_SHIFT);
+	/* Without a TempKey source flag, TempKey comes from a random Nonce */
+	if (!(flags & (S96AT_FLAG_TEMPKEY_SOURCE_INPUT |
+		       S96AT_FLAG_TEMPKEY_SOURCE_RANDOM)))
+		flags |= S96AT_FLAG_TEMPKEY_SOURCE_RANDOM;
 
-	if (flags & S96AT_FLAG_USE_OTP_64_BITS)
-		mode |= (1 << MAC_MODE_USE_OTP_64_BITS_SHIFT);
+	ret = s96at_mac_mode(S96AT_MAC_MODE_0, flags, &mode);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
 
-	if (flags & S96AT_FLAG_USE_OTP_88_BITS)
-		mode |= (1 << MAC_MODE_USE_OTP_88_BITS_SHIFT);
+	if (!slotcfg_can_use_key(&desc->config, slot))
+		return slot_refused(desc);
 
-	if (flags & S96AT_FLAG_USE_SN)
-		mode |= (1 << MAC_MODE_USE_SN_SHIFT);
+	ret = cmd_get_hmac(desc->ioif, mode, slot, hmac);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_HMAC, mode, slot,
+		       NULL, 0, ret);
 
-	return cmd_get_hmac(desc->ioif, mode, slot, hmac);
+	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_READ
 uint8_t s96at_get_lock_config(struct s96at_desc *desc, uint8_t *lock_config)
 {
 	uint8_t _lock_config;
@@ -413,6 +662,43 @@ uint8_t s96at_get_zone_config(struct s96at_desc *desc, uint8_t *buf)
 	return ret;
 }
 
+uint8_t s96at_load_config(struct s96at_desc *desc)
+{
+	int i;
+	int ret = STATUS_EXEC_ERROR;
+	uint8_t buf[ZONE_CONFIG_SIZE] = { 0 };
+
+	/* Blocks 0 and 1 hold SlotConfig, the locks are in the last word */
+	for (i = 0; i < 2; i++) {
+		ret = cmd_read(desc->ioif, ZONE_CONFIG, i * 8, 0, MAX_READ_SIZE,
+			       buf + i * MAX_READ_SIZE, MAX_READ_SIZE);
+		if (ret != STATUS_OK)
+			return ret;
+	}
+
+	ret = cmd_read(desc->ioif, ZONE_CONFIG, LOCK_CONFIG_ADDR, 0, WORD_SIZE,
+		       buf + LOCK_CONFIG_ADDR * WORD_SIZE, WORD_SIZE);
+	if (ret != STATUS_OK)
+		return ret;
+
+	slotcfg_decode(&desc->config, buf);
+
+	return STATUS_OK;
+}
+#endif
+
+uint8_t s96at_get_slot_config(struct s96at_desc *desc, uint8_t slot,
+			      struct s96at_slot_config *cfg)
+{
+	if (!desc || !cfg || !desc->config.loaded || slot >= S96AT_NUM_SLOTS)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	*cfg = desc->config.slots[slot];
+
+	return S96AT_STATUS_OK;
+}
+
+#ifdef S96AT_CMD_SHA
 uint8_t s96at_get_sha(struct s96at_desc *desc, uint8_t *buf,
 		  size_t buf_len, size_t msg_len, uint8_t *hash)
 {
@@ -436,6 +722,10 @@ uint8_t s96at_get_sha(struct s96at_desc *desc, uint8_t *buf,
 
 	ret = cmd_sha(desc->ioif, SHA_MODE_INIT, NULL, 0, &sha_resp,
 		      sizeof(sha_resp));
+
+	/* The SHA context is held in TempKey */
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_SHA, SHA_MODE_INIT, 0,
+		       NULL, 0, ret);
 	if (ret != STATUS_OK)
 		return ret;
 
@@ -448,15 +738,27 @@ uint8_t s96at_get_sha(struct s96at_desc *desc, uint8_t *buf,
 out:
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_LOCK
 uint8_t s96at_lock_zone(struct s96at_desc *desc, enum s96at_zone zone, uint16_t crc)
 {
+	uint8_t ret;
+
 	if (!crc)
 		return S96AT_STATUS_BAD_PARAMETERS;
 
-	return cmd_lock_zone(desc->ioif, zone, &crc);
+	ret = cmd_lock_zone(desc->ioif, zone, &crc);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_LOCK, zone, crc, NULL,
+		       0, ret);
+	slotcfg_update(&desc->config, OPCODE_LOCK, zone != S96AT_ZONE_CONFIG,
+		       ret);
+
+	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_READ
 uint8_t s96at_read_config(struct s96at_desc *desc, uint8_t id, uint8_t *buf,
 			  size_t length)
 {
@@ -491,6 +793,11 @@ uint8_t s96at_read_data(struct s96at_desc *desc, uint8_t id, uint8_t offset,
 	if (length == 32 && offset)
 		return S96AT_STATUS_BAD_PARAMETERS;
 
+	if (!slotcfg_can_read(&desc->config, id, length)) {
+		memset(buf, 0, length);
+		return slot_refused(desc);
+	}
+
 	addr = SLOT_ADDR(id) + offset;
 
 	ret = cmd_read(desc->ioif, ZONE_DATA, addr, 0, length, buf, length);
@@ -514,24 +821,41 @@ uint8_t s96at_read_otp(struct s96at_desc *desc, uint8_t id, uint8_t *buf)
 
 	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_UPDATEEXTRA
 uint8_t s96at_update_extra(struct s96at_desc *desc, enum s96at_update_extra_mode mode,
 			   uint8_t val)
 {
-	return cmd_update_extra(desc->ioif, mode, val);
+	uint8_t ret;
+
+	ret = cmd_update_extra(desc->ioif, mode, val);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_UPDATEEXTRA, mode,
+		       val, NULL, 0, ret);
+
+	return ret;
 }
+#endif
 
+#ifdef S96AT_CMD_WRITE
 uint8_t s96at_write_config(struct s96at_desc *desc, uint8_t id, const uint8_t *buf)
 {
+	uint8_t ret;
+
 	if (id > ZONE_CONFIG_NUM_WORDS - 1)
 		return S96AT_STATUS_BAD_PARAMETERS;
 
-	return cmd_write(desc->ioif, ZONE_CONFIG, id, false, buf, WORD_SIZE);
+	ret = cmd_write(desc->ioif, ZONE_CONFIG, id, false, buf, WORD_SIZE);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_WRITE, ZONE_CONFIG,
+		       id, buf, WORD_SIZE, ret);
+
+	return ret;
 }
 
 uint8_t s96at_write_data(struct s96at_desc *desc, uint8_t id, uint8_t offset,
 			 uint32_t flags, const uint8_t *buf, size_t length)
 {
+	uint8_t ret;
 	uint8_t addr;
 	uint8_t encrypted = false;
 
@@ -546,12 +870,21 @@ uint8_t s96at_write_data(struct s96at_desc *desc, uint8_t id, uint8_t offset,
 	if (flags & S96AT_FLAG_ENCRYPT)
 		encrypted = true;
 
-	return cmd_write(desc->ioif, ZONE_DATA, addr, encrypted, buf, length);
+	if (!slotcfg_can_write(&desc->config, id, length, encrypted))
+		return slot_refused(desc);
+
+	ret = cmd_write(desc->ioif, ZONE_DATA, addr, encrypted, buf, length);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_WRITE, ZONE_DATA,
+		       addr, buf, length, ret);
+
+	return ret;
 }
 
 uint8_t s96at_write_otp(struct s96at_desc *desc, uint8_t id, const uint8_t *buf,
 			size_t length)
 {
+	uint8_t ret;
+
 	if (id > ZONE_OTP_NUM_WORDS - 1)
 		return S96AT_STATUS_BAD_PARAMETERS;
 
@@ -561,6 +894,11 @@ uint8_t s96at_write_otp(struct s96at_desc *desc, uint8_t id, const uint8_t *buf,
 	if (length == 32 && !(id == 0 || id == 8))
 		return S96AT_STATUS_BAD_PARAMETERS;
 
-	return cmd_write(desc->ioif, ZONE_OTP, id, false, buf, length);
+	ret = cmd_write(desc->ioif, ZONE_OTP, id, false, buf, length);
+	tempkey_update(&desc->tempkey, desc->ioif, OPCODE_WRITE, ZONE_OTP, id,
+		       buf, length, ret);
+
+	return ret;
 }
+#endif
 
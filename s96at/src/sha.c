@@ -44,3 +44,219 @@ int sha_apply_padding(uint8_t *buf, size_t buf_len, size_t msg_len, size_t *padd
 	return S96AT_STATUS_OK;
 }
 
+
+/* FIPS 180-2 Sect 4.2.2 */
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(uint32_t *state, const uint8_t *block)
+{
+	int i;
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+	uint32_t t1, t2;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t)block[i * 4] << 24 |
+		       (uint32_t)block[i * 4 + 1] << 16 |
+		       (uint32_t)block[i * 4 + 2] << 8 |
+		       (uint32_t)block[i * 4 + 3];
+
+	for (i = 16; i < 64; i++)
+		w[i] = (ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10)) +
+		       w[i - 7] +
+		       (ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+		       w[i - 16];
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+		     ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+		     ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+	/* FIPS 180-2 Sect 5.3.2 */
+	ctx->state[0] = 0x6a09e667;
+	ctx->state[1] = 0xbb67ae85;
+	ctx->state[2] = 0x3c6ef372;
+	ctx->state[3] = 0xa54ff53a;
+	ctx->state[4] = 0x510e527f;
+	ctx->state[5] = 0x9b05688c;
+	ctx->state[6] = 0x1f83d9ab;
+	ctx->state[7] = 0x5be0cd19;
+	ctx->length = 0;
+	ctx->block_len = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t n;
+
+	ctx->length += len;
+
+	if (ctx->block_len) {
+		n = SHA_BLOCK_LEN - ctx->block_len;
+		if (n > len)
+			n = len;
+		memcpy(ctx->block + ctx->block_len, p, n);
+		ctx->block_len += n;
+		p += n;
+		len -= n;
+
+		if (ctx->block_len < SHA_BLOCK_LEN)
+			return;
+
+		sha256_transform(ctx->state, ctx->block);
+		ctx->block_len = 0;
+	}
+
+	/* Hash full blocks straight from the caller's buffer */
+	while (len >= SHA_BLOCK_LEN) {
+		sha256_transform(ctx->state, p);
+		p += SHA_BLOCK_LEN;
+		len -= SHA_BLOCK_LEN;
+	}
+
+	memcpy(ctx->block, p, len);
+	ctx->block_len = len;
+}
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t *digest)
+{
+	int i;
+	uint64_t bits = ctx->length * 8;
+
+	ctx->block[ctx->block_len++] = 0x80;
+
+	if (ctx->block_len > SHA_BLOCK_LEN - SHA_PADDING_LENGTH_LEN) {
+		memset(ctx->block + ctx->block_len, 0, SHA_BLOCK_LEN - ctx->block_len);
+		sha256_transform(ctx->state, ctx->block);
+		ctx->block_len = 0;
+	}
+
+	memset(ctx->block + ctx->block_len, 0,
+	       SHA_BLOCK_LEN - SHA_PADDING_LENGTH_LEN - ctx->block_len);
+	for (i = 0; i < SHA_PADDING_LENGTH_LEN; i++)
+		ctx->block[SHA_BLOCK_LEN - SHA_PADDING_LENGTH_LEN + i] =
+			(bits >> (56 - i * 8)) & 0xff;
+	sha256_transform(ctx->state, ctx->block);
+
+	for (i = 0; i < 8; i++) {
+		digest[i * 4] = ctx->state[i] >> 24;
+		digest[i * 4 + 1] = ctx->state[i] >> 16;
+		digest[i * 4 + 2] = ctx->state[i] >> 8;
+		digest[i * 4 + 3] = ctx->state[i];
+	}
+
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void sha256(const void *data, size_t len, uint8_t *digest)
+{
+	struct sha256_ctx ctx;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, data, len);
+	sha256_final(&ctx, digest);
+}
+
+/* RFC 2104 */
+void hmac_sha256_init(struct hmac_sha256_ctx *ctx, const uint8_t *key,
+		      size_t key_len)
+{
+	int i;
+	uint8_t pad[SHA_BLOCK_LEN] = { 0 };
+
+	if (key_len > SHA_BLOCK_LEN)
+		sha256(key, key_len, pad);
+	else
+		memcpy(pad, key, key_len);
+
+	for (i = 0; i < SHA_BLOCK_LEN; i++)
+		pad[i] ^= 0x36;
+	sha256_init(&ctx->inner);
+	sha256_update(&ctx->inner, pad, SHA_BLOCK_LEN);
+
+	/* Turn the ipad into the opad */
+	for (i = 0; i < SHA_BLOCK_LEN; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+	sha256_init(&ctx->outer);
+	sha256_update(&ctx->outer, pad, SHA_BLOCK_LEN);
+
+	memset(pad, 0, sizeof(pad));
+}
+
+void hmac_sha256_update(struct hmac_sha256_ctx *ctx, const void *data,
+			size_t len)
+{
+	sha256_update(&ctx->inner, data, len);
+}
+
+void hmac_sha256_final(struct hmac_sha256_ctx *ctx, uint8_t *mac)
+{
+	uint8_t inner[SHA_DIGEST_LEN];
+
+	sha256_final(&ctx->inner, inner);
+	sha256_update(&ctx->outer, inner, sizeof(inner));
+	sha256_final(&ctx->outer, mac);
+
+	memset(inner, 0, sizeof(inner));
+}
+
+void hmac_sha256(const uint8_t *key, size_t key_len, const void *data,
+		 size_t len, uint8_t *mac)
+{
+	struct hmac_sha256_ctx ctx;
+
+	hmac_sha256_init(&ctx, key, key_len);
+	hmac_sha256_update(&ctx, data, len);
+	hmac_sha256_final(&ctx, mac);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+#include <cmd.h>
+#include <debug.h>
+#include <slotcfg.h>
+#include <status.h>
+
+#define CONFIG_SLOT_CONFIG_BYTE	20
+#define CONFIG_LOCK_DATA_BYTE	86
+#define CONFIG_LOCK_CONFIG_BYTE	87
+
+/* SlotConfig bits, section 2.2.1 of the datasheet */
+#define SLOT_READ_KEY(c)	((c) & 0x0f)
+#define SLOT_CHECK_ONLY		(1 << 4)
+#define SLOT_SINGLE_USE		(1 << 5)
+#define SLOT_ENCRYPT_READ	(1 << 6)
+#define SLOT_IS_SECRET		(1 << 7)
+#define SLOT_WRITE_KEY(c)	((c) >> 8 & 0x0f)
+#define SLOT_WRITE_CONFIG(c)	((c) >> 12 & 0x0f)
+
+/* Bit 0 of the Lock mode selects the Data and OTP zones */
+#define LOCK_MODE_DATA		1
+
+void slotcfg_decode(struct s96at_config *cfg, const uint8_t *zone)
+{
+	struct s96at_slot_config *s;
+	uint16_t c;
+	int i;
+
+	memset(cfg, 0, sizeof(*cfg));
+
+	/* SlotConfig may still be written */
+	if (zone[CONFIG_LOCK_CONFIG_BYTE] != LOCK_CONFIG_LOCKED)
+		return;
+
+	for (i = 0; i < S96AT_NUM_SLOTS; i++) {
+		c = zone[CONFIG_SLOT_CONFIG_BYTE + 2 * i] |
+		    zone[CONFIG_SLOT_CONFIG_BYTE + 2 * i + 1] << 8;
+
+		s = &cfg->slots[i];
+		s->read_key = SLOT_READ_KEY(c);
+		s->check_only = c & SLOT_CHECK_ONLY;
+		s->single_use = c & SLOT_SINGLE_USE;
+		s->encrypt_read = c & SLOT_ENCRYPT_READ;
+		s->is_secret = c & SLOT_IS_SECRET;
+		s->write_key = SLOT_WRITE_KEY(c);
+		s->write_config = SLOT_WRITE_CONFIG(c);
+	}
+
+	cfg->data_locked = zone[CONFIG_LOCK_DATA_BYTE] == LOCK_DATA_LOCKED;
+	cfg->loaded = true;
+}
+
+void slotcfg_update(struct s96at_config *cfg, uint8_t opcode, uint8_t param1,
+		    uint8_t status)
+{
+	/* The only change left once the Config zone is locked */
+	if (opcode == OPCODE_LOCK && (param1 & LOCK_MODE_DATA) &&
+	    status == STATUS_OK)
+		cfg->data_locked = true;
+}
+
+/* The configuration of the slot, if its permissions are in force */
+static const struct s96at_slot_config *slot_config(const struct s96at_config *cfg,
+						   uint8_t slot)
+{
+	if (!cfg->loaded || !cfg->data_locked || slot >= S96AT_NUM_SLOTS)
+		return NULL;
+
+	return &cfg->slots[slot];
+}
+
+/* Secrets only leave the device as 32-byte encrypted reads */
+bool slotcfg_can_read(const struct s96at_config *cfg, uint8_t slot,
+		      size_t length)
+{
+	const struct s96at_slot_config *s = slot_config(cfg, slot);
+
+	if (!s || !s->is_secret)
+		return true;
+
+	if (s->encrypt_read && length == MAX_READ_SIZE)
+		return true;
+
+	logd("Slot %u is secret, read refused\n", slot);
+
+	return false;
+}
+
+bool slotcfg_can_write(const struct s96at_config *cfg, uint8_t slot,
+		       size_t length, bool encrypted)
+{
+	const struct s96at_slot_config *s = slot_config(cfg, slot);
+	bool ok;
+
+	if (!s)
+		return true;
+
+	if (s->write_config & S96AT_WRITE_CONFIG_NEVER)
+		ok = false;
+	else if (s->write_config & S96AT_WRITE_CONFIG_ENCRYPT)
+		ok = encrypted && length == MAX_WRITE_SIZE;
+	else
+		ok = !encrypted && (length == MAX_WRITE_SIZE || !s->is_secret);
+
+	if (!ok)
+		logd("Slot %u has WriteConfig 0x%x, write refused\n", slot,
+		     s->write_config);
+
+	return ok;
+}
+
+/* Keys of MAC and HMAC, CheckOnly keys are for CheckMac and GenDig only */
+bool slotcfg_can_use_key(const struct s96at_config *cfg, uint8_t slot)
+{
+	const struct s96at_slot_config *s = slot_config(cfg, slot);
+
+	if (!s || !s->check_only)
+		return true;
+
+	logd("Slot %u is CheckOnly, key use refused\n", slot);
+
+	return false;
+}
+
+bool slotcfg_can_derive(const struct s96at_config *cfg, uint8_t slot)
+{
+	const struct s96at_slot_config *s = slot_config(cfg, slot);
+
+	if (!s || s->write_config & S96AT_WRITE_CONFIG_DERIVEKEY)
+		return true;
+
+	logd("Slot %u has WriteConfig 0x%x, DeriveKey refused\n", slot,
+	     s->write_config);
+
+	return false;
+}
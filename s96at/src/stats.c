@@ -0,0 +1,503 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <debug.h>
+#include <io.h>
+#include <s96at.h>
+#include <stats.h>
+
+/* Values below this are counted exactly, one bucket each */
+#define STATS_LINEAR_LIMIT	(2 * S96AT_STATS_SUB_BUCKETS)
+#define STATS_SUB_BITS		3 /* log2(S96AT_STATS_SUB_BUCKETS) */
+
+struct io_stats_shard {
+	struct io_stats_shard *next;
+	pthread_t thread;
+	struct s96at_stats stats;
+};
+
+struct io_stats {
+	uint64_t id;
+	pthread_mutex_t lock;
+	struct io_stats_shard *shards;
+	/* Counters at the last reset, subtracted from every snapshot */
+	struct s96at_stats base;
+};
+
+static const struct {
+	uint8_t opcode;
+	const char *name;
+} opcodes[S96AT_STATS_NUM_OPCODES - 1] = {
+	{ S96AT_OPCODE_PAUSE, "pause" },
+	{ S96AT_OPCODE_READ, "read" },
+	{ S96AT_OPCODE_MAC, "mac" },
+	{ S96AT_OPCODE_HMAC, "hmac" },
+	{ S96AT_OPCODE_WRITE, "write" },
+	{ S96AT_OPCODE_GENDIG, "gendig" },
+	{ S96AT_OPCODE_NONCE, "nonce" },
+	{ S96AT_OPCODE_LOCK, "lock" },
+	{ S96AT_OPCODE_RANDOM, "random" },
+	{ S96AT_OPCODE_DERIVEKEY, "derivekey" },
+	{ S96AT_OPCODE_UPDATEEXTRA, "updateextra" },
+	{ S96AT_OPCODE_CHECKMAC, "checkmac" },
+	{ S96AT_OPCODE_DEVREV, "devrev" },
+	{ S96AT_OPCODE_SHA, "sha" },
+};
+
+static const char *phases[S96AT_STATS_NUM_PHASES] = {
+	[S96AT_STATS_PHASE_WRITE] = "write",
+	[S96AT_STATS_PHASE_WAIT] = "wait",
+	[S96AT_STATS_PHASE_READ] = "read",
+};
+
+static const char *errors[S96AT_STATS_NUM_ERRORS] = {
+	[S96AT_STATS_ERROR_CHECKMAC_FAIL] = "checkmac_fail",
+	[S96AT_STATS_ERROR_PARSE] = "parse_error",
+	[S96AT_STATS_ERROR_EXEC] = "exec_error",
+	[S96AT_STATS_ERROR_AFTER_WAKE] = "after_wake",
+	[S96AT_STATS_ERROR_CRC] = "crc_error",
+	[S96AT_STATS_ERROR_RESPONSE_CRC] = "response_crc_error",
+	[S96AT_STATS_ERROR_NO_RESPONSE] = "no_response",
+	[S96AT_STATS_ERROR_REFUSED] = "refused",
+};
+
+/* Identifies an io_stats instance, so that stale thread caches never match */
+static uint64_t next_id = 1;
+
+static __thread uint64_t local_id;
+static __thread struct s96at_stats *local_stats;
+
+uint64_t stats_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Log-linear buckets as in HdrHistogram: values below STATS_LINEAR_LIMIT
+ * have a bucket each, above that every power of two is split in
+ * S96AT_STATS_SUB_BUCKETS equal parts.
+ */
+static size_t bucket_index(uint64_t us)
+{
+	int shift;
+	size_t idx;
+
+	if (us < STATS_LINEAR_LIMIT)
+		return us;
+
+	shift = 63 - __builtin_clzll(us) - STATS_SUB_BITS;
+	idx = (shift + 1) * S96AT_STATS_SUB_BUCKETS +
+	      (us >> shift) - S96AT_STATS_SUB_BUCKETS;
+
+	return idx < S96AT_STATS_NUM_BUCKETS ? idx : S96AT_STATS_NUM_BUCKETS - 1;
+}
+
+static uint64_t bucket_lower(size_t idx)
+{
+	size_t shift;
+
+	if (idx < STATS_LINEAR_LIMIT)
+		return idx;
+
+	shift = idx / S96AT_STATS_SUB_BUCKETS - 1;
+
+	return (uint64_t)(S96AT_STATS_SUB_BUCKETS + idx % S96AT_STATS_SUB_BUCKETS)
+	       << shift;
+}
+
+void stats_record(struct s96at_histogram *h, uint64_t us)
+{
+	size_t idx = bucket_index(us);
+
+	STATS_ADD(h->count, 1);
+	STATS_ADD(h->sum_us, us);
+	STATS_ADD(h->buckets[idx], 1);
+}
+
+static struct s96at_stats *stats_attach(struct io_stats *st)
+{
+	struct io_stats_shard *s;
+	pthread_t self = pthread_self();
+
+	pthread_mutex_lock(&st->lock);
+
+	for (s = st->shards; s; s = s->next)
+		if (pthread_equal(s->thread, self))
+			break;
+
+	if (!s) {
+		s = calloc(1, sizeof(*s));
+		if (s) {
+			s->thread = self;
+			s->next = st->shards;
+			st->shards = s;
+		}
+	}
+
+	pthread_mutex_unlock(&st->lock);
+
+	if (!s)
+		return NULL;
+
+	local_id = st->id;
+	local_stats = &s->stats;
+
+	return local_stats;
+}
+
+struct s96at_stats *stats_local(struct io_interface *ioif)
+{
+	struct io_stats *st = ioif->stats;
+
+	if (!st)
+		return NULL;
+
+	if (local_id == st->id)
+		return local_stats;
+
+	return stats_attach(st);
+}
+
+int s96at_stats_index(uint8_t opcode)
+{
+	int i;
+
+	for (i = 0; i < S96AT_STATS_NUM_OPCODES - 1; i++)
+		if (opcodes[i].opcode == opcode)
+			return i;
+
+	return S96AT_STATS_NUM_OPCODES - 1;
+}
+
+uint8_t s96at_stats_enable(struct s96at_desc *desc)
+{
+	struct io_stats *st;
+
+	if (!desc || !desc->ioif)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	if (desc->ioif->stats)
+		return S96AT_STATUS_OK;
+
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	if (pthread_mutex_init(&st->lock, NULL)) {
+		free(st);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	st->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+	desc->ioif->stats = st;
+
+	return S96AT_STATUS_OK;
+}
+
+void s96at_stats_disable(struct s96at_desc *desc)
+{
+	struct io_stats *st;
+	struct io_stats_shard *s;
+
+	if (!desc || !desc->ioif || !desc->ioif->stats)
+		return;
+
+	st = desc->ioif->stats;
+	desc->ioif->stats = NULL;
+
+	while (st->shards) {
+		s = st->shards;
+		st->shards = s->next;
+		free(s);
+	}
+
+	pthread_mutex_destroy(&st->lock);
+	free(st);
+}
+
+#define LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+static void stats_sum(struct s96at_stats *sum, const struct s96at_stats *s)
+{
+	int i, j, k;
+	const struct s96at_histogram *h;
+
+	for (i = 0; i < S96AT_STATS_NUM_OPCODES; i++)
+		sum->commands[i] += LOAD(s->commands[i]);
+	for (i = 0; i < S96AT_STATS_NUM_ERRORS; i++)
+		sum->errors[i] += LOAD(s->errors[i]);
+
+	sum->wakes += LOAD(s->wakes);
+	sum->wake_retries += LOAD(s->wake_retries);
+	sum->retries += LOAD(s->retries);
+	sum->idles += LOAD(s->idles);
+	sum->sleeps += LOAD(s->sleeps);
+	sum->bytes_written += LOAD(s->bytes_written);
+	sum->bytes_read += LOAD(s->bytes_read);
+
+	for (i = 0; i < S96AT_STATS_NUM_OPCODES; i++) {
+		for (j = 0; j < S96AT_STATS_NUM_PHASES; j++) {
+			h = &s->latency[i][j];
+			sum->latency[i][j].count += LOAD(h->count);
+			sum->latency[i][j].sum_us += LOAD(h->sum_us);
+			for (k = 0; k < S96AT_STATS_NUM_BUCKETS; k++)
+				sum->latency[i][j].buckets[k] += LOAD(h->buckets[k]);
+		}
+	}
+}
+
+static void stats_sub(struct s96at_stats *a, const struct s96at_stats *b)
+{
+	int i, j, k;
+
+	for (i = 0; i < S96AT_STATS_NUM_OPCODES; i++)
+		a->commands[i] -= b->commands[i];
+	for (i = 0; i < S96AT_STATS_NUM_ERRORS; i++)
+		a->errors[i] -= b->errors[i];
+
+	a->wakes -= b->wakes;
+	a->wake_retries -= b->wake_retries;
+	a->retries -= b->retries;
+	a->idles -= b->idles;
+	a->sleeps -= b->sleeps;
+	a->bytes_written -= b->bytes_written;
+	a->bytes_read -= b->bytes_read;
+
+	for (i = 0; i < S96AT_STATS_NUM_OPCODES; i++) {
+		for (j = 0; j < S96AT_STATS_NUM_PHASES; j++) {
+			a->latency[i][j].count -= b->latency[i][j].count;
+			a->latency[i][j].sum_us -= b->latency[i][j].sum_us;
+			for (k = 0; k < S96AT_STATS_NUM_BUCKETS; k++)
+				a->latency[i][j].buckets[k] -=
+					b->latency[i][j].buckets[k];
+		}
+	}
+}
+
+/*
+ * The per-thread counters are never written by anyone but their owner, a
+ * reset is done by remembering the totals and subtracting them later on.
+ */
+uint8_t s96at_stats_snapshot(struct s96at_desc *desc, struct s96at_stats *stats,
+			     bool reset)
+{
+	struct io_stats *st;
+	struct io_stats_shard *s;
+
+	if (!desc || !desc->ioif || !stats)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	st = desc->ioif->stats;
+	if (!st)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&st->lock);
+
+	for (s = st->shards; s; s = s->next)
+		stats_sum(stats, &s->stats);
+
+	if (reset) {
+		stats_sub(stats, &st->base);
+		stats_sum(&st->base, stats);
+	} else {
+		stats_sub(stats, &st->base);
+	}
+
+	pthread_mutex_unlock(&st->lock);
+
+	return S96AT_STATUS_OK;
+}
+
+uint64_t s96at_stats_percentile(const struct s96at_histogram *h, double pct)
+{
+	size_t i;
+	uint64_t seen = 0;
+	uint64_t target;
+
+	if (!h || !h->count)
+		return 0;
+
+	target = (uint64_t)(pct / 100.0 * h->count + 0.5);
+	if (target < 1)
+		target = 1;
+	if (target > h->count)
+		target = h->count;
+
+	for (i = 0; i < S96AT_STATS_NUM_BUCKETS - 1; i++) {
+		seen += h->buckets[i];
+		if (seen >= target)
+			return bucket_lower(i + 1) - 1;
+	}
+
+	return bucket_lower(S96AT_STATS_NUM_BUCKETS - 1);
+}
+
+struct om_buf {
+	char *buf;
+	size_t len;
+	size_t pos;
+};
+
+static void om_printf(struct om_buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(b->pos < b->len ? b->buf + b->pos : NULL,
+		      b->pos < b->len ? b->len - b->pos : 0, fmt, ap);
+	va_end(ap);
+
+	if (n > 0)
+		b->pos += n;
+}
+
+/* Label values escape backslash, double quote and newline */
+static void om_labels(struct om_buf *b, const char *device, const char *extra)
+{
+	const char *c;
+
+	om_printf(b, "{");
+
+	if (device) {
+		om_printf(b, "device=\"");
+		for (c = device; *c; c++) {
+			if (*c == '\\' || *c == '"')
+				om_printf(b, "\\%c", *c);
+			else if (*c == '\n')
+				om_printf(b, "\\n");
+			else
+				om_printf(b, "%c", *c);
+		}
+		om_printf(b, "\"%s", extra ? "," : "");
+	}
+
+	om_printf(b, "%s}", extra ? extra : "");
+}
+
+static void om_counter(struct om_buf *b, const char *name, const char *help,
+		       const char *device, uint64_t value)
+{
+	om_printf(b, "# TYPE s96at_%s counter\n# HELP s96at_%s %s\n", name, name,
+		  help);
+	om_printf(b, "s96at_%s_total", name);
+	om_labels(b, device, NULL);
+	om_printf(b, " %llu\n", (unsigned long long)value);
+}
+
+static const char *opcode_name(int idx)
+{
+	return idx < S96AT_STATS_NUM_OPCODES - 1 ? opcodes[idx].name : "other";
+}
+
+size_t s96at_stats_openmetrics(const struct s96at_stats *stats,
+			       const char *device, char *buf, size_t len)
+{
+	int i, j;
+	size_t k;
+	char extra[64];
+	uint64_t cum;
+	const struct s96at_histogram *h;
+	struct om_buf b = { .buf = buf, .len = len, .pos = 0 };
+
+	if (!stats)
+		return 0;
+
+	if (buf && len)
+		buf[0] = '\0';
+
+	om_printf(&b, "# TYPE s96at_commands counter\n"
+		  "# HELP s96at_commands Commands sent to the device.\n");
+	for (i = 0; i < S96AT_STATS_NUM_OPCODES; i++) {
+		if (!stats->commands[i])
+			continue;
+		snprintf(extra, sizeof(extra), "opcode=\"%s\"", opcode_name(i));
+		om_printf(&b, "s96at_commands_total");
+		om_labels(&b, device, extra);
+		om_printf(&b, " %llu\n", (unsigned long long)stats->commands[i]);
+	}
+
+	om_printf(&b, "# TYPE s96at_errors counter\n"
+		  "# HELP s96at_errors Failed commands by status.\n");
+	for (i = 0; i < S96AT_STATS_NUM_ERRORS; i++) {
+		snprintf(extra, sizeof(extra), "status=\"%s\"", errors[i]);
+		om_printf(&b, "s96at_errors_total");
+		om_labels(&b, device, extra);
+		om_printf(&b, " %llu\n", (unsigned long long)stats->errors[i]);
+	}
+
+	om_counter(&b, "wakes", "Wake tokens sent.", device, stats->wakes);
+	om_counter(&b, "wake_retries", "Wake attempts the device did not answer.",
+		   device, stats->wake_retries);
+	om_counter(&b, "retries", "Reads and commands retried by the retry policy.",
+		   device, stats->retries);
+	om_counter(&b, "idles", "Transitions to the idle state.", device,
+		   stats->idles);
+	om_counter(&b, "sleeps", "Transitions to the sleep state.", device,
+		   stats->sleeps);
+	om_counter(&b, "written_bytes", "Bytes written to the bus.", device,
+		   stats->bytes_written);
+	om_counter(&b, "read_bytes", "Bytes read from the bus.", device,
+		   stats->bytes_read);
+
+	om_printf(&b, "# TYPE s96at_command_seconds histogram\n"
+		  "# UNIT s96at_command_seconds seconds\n"
+		  "# HELP s96at_command_seconds Duration of each command phase.\n");
+
+	for (i = 0; i < S96AT_STATS_NUM_OPCODES; i++) {
+		for (j = 0; j < S96AT_STATS_NUM_PHASES; j++) {
+			h = &stats->latency[i][j];
+			if (!h->count)
+				continue;
+
+			/* The last bucket holds everything above, ie +Inf */
+			cum = 0;
+			for (k = 0; k < S96AT_STATS_NUM_BUCKETS - 1; k++) {
+				if (!h->buckets[k])
+					continue;
+				cum += h->buckets[k];
+				snprintf(extra, sizeof(extra),
+					 "opcode=\"%s\",phase=\"%s\",le=\"%.6f\"",
+					 opcode_name(i), phases[j],
+					 bucket_lower(k + 1) / 1e6);
+				om_printf(&b, "s96at_command_seconds_bucket");
+				om_labels(&b, device, extra);
+				om_printf(&b, " %llu\n", (unsigned long long)cum);
+			}
+
+			snprintf(extra, sizeof(extra),
+				 "opcode=\"%s\",phase=\"%s\",le=\"+Inf\"",
+				 opcode_name(i), phases[j]);
+			om_printf(&b, "s96at_command_seconds_bucket");
+			om_labels(&b, device, extra);
+			om_printf(&b, " %llu\n", (unsigned long long)h->count);
+
+			snprintf(extra, sizeof(extra), "opcode=\"%s\",phase=\"%s\"",
+				 opcode_name(i), phases[j]);
+			om_printf(&b, "s96at_command_seconds_count");
+			om_labels(&b, device, extra);
+			om_printf(&b, " %llu\n", (unsigned long long)h->count);
+			om_printf(&b, "s96at_command_seconds_sum");
+			om_labels(&b, device, extra);
+			om_printf(&b, " %.6f\n", h->sum_us / 1e6);
+		}
+	}
+
+	om_printf(&b, "# EOF\n");
+
+	return b.pos;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+#include <clock.h>
+#include <cmd.h>
+#include <debug.h>
+#include <sha.h>
+#include <status.h>
+#include <tempkey.h>
+
+static uint64_t now_ms(struct s96at_tempkey *tk)
+{
+	return clock_now_us(tk->clock) / 1000;
+}
+
+/*
+ * The device enters sleep once the watchdog expires, regardless of what it
+ * is doing, and the contents of TempKey are lost.
+ */
+static void tempkey_check_watchdog(struct s96at_tempkey *tk)
+{
+	if (tk->awake && now_ms(tk) - tk->wake_ms >= S96AT_WATCHDOG_TIME) {
+		logd("Watchdog expired, TempKey lost\n");
+		tk->awake = false;
+		tempkey_invalidate(tk);
+	}
+}
+
+/*
+ * The device may have been asleep before a retry or a command woke it up
+ * again, and the wake restarted the watchdog.
+ */
+static void tempkey_check_woken(struct s96at_tempkey *tk,
+				struct io_interface *ioif)
+{
+	if (!ioif->woken)
+		return;
+
+	logd("Woken up, TempKey lost\n");
+	ioif->woken = false;
+	tempkey_invalidate(tk);
+	tk->awake = true;
+	tk->wake_ms = now_ms(tk);
+}
+
+void tempkey_invalidate(struct s96at_tempkey *tk)
+{
+	tk->valid = false;
+	tk->known = false;
+	tk->gendig = false;
+	memset(tk->value_hash, 0, sizeof(tk->value_hash));
+}
+
+void tempkey_wake(struct s96at_tempkey *tk)
+{
+	tempkey_check_watchdog(tk);
+
+	/* A wake pulse does not restart the watchdog of an awake device */
+	if (!tk->awake) {
+		tk->awake = true;
+		tk->wake_ms = now_ms(tk);
+	}
+}
+
+void tempkey_idle(struct s96at_tempkey *tk)
+{
+	tempkey_check_watchdog(tk);
+
+	/* TempKey is retained in the idle state */
+	tk->awake = false;
+}
+
+void tempkey_sleep(struct s96at_tempkey *tk)
+{
+	tk->awake = false;
+	tempkey_invalidate(tk);
+}
+
+void tempkey_update(struct s96at_tempkey *tk, struct io_interface *ioif,
+		    uint8_t opcode, uint8_t param1, uint16_t param2,
+		    const uint8_t *data, size_t data_len, uint8_t status)
+{
+	tempkey_check_woken(tk, ioif);
+	tempkey_check_watchdog(tk);
+
+	switch (opcode) {
+	case OPCODE_READ:
+	case OPCODE_DEVREV:
+	case OPCODE_PAUSE:
+		/* These never touch TempKey */
+		return;
+	}
+
+	if (status != STATUS_OK) {
+		tempkey_invalidate(tk);
+		return;
+	}
+
+	switch (opcode) {
+	case OPCODE_NONCE:
+		tempkey_invalidate(tk);
+		tk->valid = true;
+
+		if ((param1 & 0x03) == NONCE_MODE_PASSTHROUGH) {
+			tk->known = true;
+			tk->source = TEMPKEY_SOURCE_INPUT;
+			sha256(data, data_len, tk->value_hash);
+		} else {
+			/* The random part is not reproducible */
+			tk->source = TEMPKEY_SOURCE_RANDOM;
+		}
+		break;
+
+	case OPCODE_GENDIG:
+		/* Only a single GenDig on top of a Nonce is tracked */
+		if (tk->valid && tk->known && !tk->gendig && !data_len) {
+			tk->gendig = true;
+			tk->gendig_zone = param1;
+			tk->gendig_slot = param2;
+		} else {
+			tk->known = false;
+		}
+		break;
+
+	default:
+		/*
+		 * MAC, HMAC, CheckMac, DeriveKey and SHA consume or overwrite
+		 * TempKey. Anything else is not modelled and invalidates it too.
+		 */
+		tempkey_invalidate(tk);
+		break;
+	}
+}
+
+bool tempkey_matches(struct s96at_tempkey *tk, struct io_interface *ioif,
+		     const uint8_t *value, bool gendig, uint8_t zone,
+		     uint8_t slot)
+{
+	uint8_t hash[SHA_DIGEST_LEN];
+
+	tempkey_check_woken(tk, ioif);
+	tempkey_check_watchdog(tk);
+
+	if (!tk->valid || !tk->known || tk->source != TEMPKEY_SOURCE_INPUT)
+		return false;
+
+	if (tk->gendig != gendig)
+		return false;
+
+	if (gendig && (tk->gendig_zone != zone || tk->gendig_slot != slot))
+		return false;
+
+	sha256(value, S96AT_CHALLENGE_LEN, hash);
+
+	return memcmp(hash, tk->value_hash, sizeof(hash)) == 0;
+}
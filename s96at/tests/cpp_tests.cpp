@@ -0,0 +1,213 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <s96at.hpp>
+
+extern "C" {
+#include <personalize.h>
+}
+
+struct testcase {
+	const char *name;
+	int (*func)(void);
+};
+
+static const s96at::challenge_t challenge = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF,
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF
+};
+
+/* Number of coroutines sharing the pool, and commands each of them runs */
+#define POOL_TASKS		8
+#define POOL_ROUNDS		3
+
+using mac_t = std::array<uint8_t, S96AT_MAC_LEN>;
+
+static s96at::device emulated(uint32_t id)
+{
+	s96at::device dev = s96at::device::emulator(id);
+
+	atsha204a_personalize(dev.get()->ioif);
+
+	return dev;
+}
+
+static s96at::task<void> pool_task(s96at::pool &p, const mac_t &expected,
+				   int &macs, int &failed)
+{
+	std::array<uint8_t, S96AT_MAC_LEN> mac;
+	std::array<uint8_t, S96AT_RANDOM_LEN> rnd;
+	uint8_t ret;
+
+	for (int i = 0; i < POOL_ROUNDS; i++) {
+		s96at::session s = co_await p.session();
+
+		ret = S96AT_STATUS_EXEC_ERROR;
+		if (s.awake())
+			ret = co_await s.mac(S96AT_MAC_MODE_0, 0, challenge,
+					     mac);
+		if (ret == S96AT_STATUS_OK && mac == expected)
+			macs++;
+		if (ret == S96AT_STATUS_OK)
+			ret = co_await s.random(rnd);
+		if (ret != S96AT_STATUS_OK) {
+			failed++;
+			co_return;
+		}
+	}
+}
+
+/* Runs the tasks on a pool of the devices with the given ids, in usec */
+static uint64_t pool_run(const uint32_t *ids, size_t num, const mac_t &expected,
+			 int &macs, int &failed)
+{
+	s96at::executor exec;
+	s96at::pool p(exec);
+
+	for (size_t i = 0; i < num; i++)
+		p.add(emulated(ids[i]));
+
+	auto t0 = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < POOL_TASKS; i++)
+		s96at::spawn(pool_task(p, expected, macs, failed));
+
+	exec.run();
+
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - t0).count();
+}
+
+static int test_pool(void)
+{
+	static const uint32_t one[] = { 8 };
+	static const uint32_t two[] = { 9, 10 };
+	mac_t expected;
+	uint8_t ret;
+	uint64_t one_us;
+	uint64_t two_us;
+	int macs = 0;
+	int failed = 0;
+
+	/* The expected MAC, all devices are personalized alike */
+	{
+		s96at::device dev = emulated(8);
+
+		while (s96at_wake(dev.get()) != S96AT_STATUS_READY) {};
+		ret = s96at_get_mac(dev.get(), S96AT_MAC_MODE_0, 0,
+				    challenge.data(),
+				    S96AT_FLAG_TEMPKEY_SOURCE_INPUT,
+				    expected.data());
+		s96at_idle(dev.get());
+		if (ret != S96AT_STATUS_OK)
+			return 1;
+	}
+
+	one_us = pool_run(one, 1, expected, macs, failed);
+	two_us = pool_run(two, 2, expected, macs, failed);
+
+	printf("Pool of 1: %llu usec, pool of 2: %llu usec\n",
+	       (unsigned long long)one_us, (unsigned long long)two_us);
+
+	if (failed || macs != 2 * POOL_TASKS * POOL_ROUNDS)
+		return 1;
+
+	/* The commands of the two devices overlap */
+	return two_us * 4 < one_us * 3 ? 0 : 1;
+}
+
+static s96at::task<void> session_cmds(s96at::device &dev,
+				      s96at::executor &exec, int &ret)
+{
+	s96at::session s(dev, exec);
+	std::array<uint8_t, S96AT_DEVREV_LEN> devrev;
+	std::array<uint8_t, S96AT_MAC_LEN> mac;
+	std::array<uint8_t, S96AT_HMAC_LEN> hmac;
+	std::array<uint8_t, 4> word;
+	uint8_t status = S96AT_STATUS_EXEC_ERROR;
+
+	if (s.awake())
+		status = co_await s.devrev(devrev);
+	if (status == S96AT_STATUS_OK)
+		status = co_await s.read(S96AT_ZONE_CONFIG, 0, word);
+	if (status == S96AT_STATUS_OK)
+		status = co_await s.nonce(challenge);
+	if (status == S96AT_STATUS_OK)
+		status = co_await s.hmac(0, hmac);
+	if (status != S96AT_STATUS_OK)
+		co_return;
+
+	/* TempKey was used up by HMAC */
+	if (co_await s.mac(S96AT_MAC_MODE_2, 0, challenge, mac) ==
+	    S96AT_STATUS_OK)
+		co_return;
+
+	/* Flags are checked as in s96at_get_mac(), nothing is sent */
+	if (co_await s.mac(S96AT_MAC_MODE_0, 0, challenge, mac,
+			   S96AT_FLAG_NONE) != S96AT_STATUS_BAD_PARAMETERS ||
+	    co_await s.hmac(0, hmac, S96AT_FLAG_TEMPKEY_SOURCE_INPUT |
+			    S96AT_FLAG_USE_OTP_64_BITS |
+			    S96AT_FLAG_USE_OTP_88_BITS) !=
+	    S96AT_STATUS_BAD_PARAMETERS)
+		co_return;
+
+	ret = 0;
+}
+
+static int test_session(void)
+{
+	s96at::executor exec;
+	s96at::device dev = emulated(11);
+	int ret = 1;
+
+	s96at::spawn(session_cmds(dev, exec, ret));
+	exec.run();
+
+	return ret;
+}
+
+static int test_throw(void)
+{
+	try {
+		s96at::device dev = s96at::device::daemon("/nonexistent");
+	} catch (const s96at::error &e) {
+		return e.status == S96AT_STATUS_OK;
+	}
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int tests_pass = 0;
+	int tests_fail = 0;
+
+	const testcase tests[] = {
+		{"Pool", test_pool},
+		{"Session", test_session},
+		{"Throw", test_throw},
+	};
+
+	for (const testcase &t : tests) {
+		int ret = t.func();
+
+		printf("%-30s %s\n", t.name,
+		       ret ? "\x1B[31m[FAIL]\033[0m" : "\x1B[32m[PASS]\033[0m");
+		if (ret)
+			tests_fail++;
+		else
+			tests_pass++;
+	}
+	printf("All done. Total: %d Passed: %d Failed: %d\n",
+	       tests_pass + tests_fail, tests_pass, tests_fail);
+
+	return tests_fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,15 +2,34 @@
  * Copyright 2017, Linaro Ltd and contributors
  * SPDX-License-Identifier: Apache-2.0
  */
+/* F_ADD_SEALS */
+#define _GNU_SOURCE
+
+#include <openssl/evp.h>
 #include <openssl/hmac.h>
-#include <openssl/sha.h>
+#ifdef S96AT_PROVIDER
+#include <openssl/provider.h>
+#endif
+#include <endian.h>
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include <cmd.h>
+#include <daemon.h>
 #include <debug.h>
 #include <device.h>
+#include <personalize.h>
 #include <s96at.h>
+#include <sha.h>
+#include <stats.h>
+#include <status.h>
 
 #define ARRAY_LEN(arr) (sizeof(arr) / sizeof(arr[0]))
 
@@ -28,6 +47,7 @@ struct atsha204a_testcase {
 };
 
 static struct s96at_desc desc;
+static bool emulated;
 
 #define NONCE_DATA 		\
 	0x00, 0x01, 0x02, 0x03,	\
@@ -46,20 +66,164 @@ uint8_t challenge[S96AT_CHALLENGE_LEN] = { CHALLENGE };
 
 uint8_t nonce_data[S96AT_NONCE_INPUT_LEN] = { NONCE_DATA };
 
-static void sha256(uint8_t *msg, size_t len, uint8_t hash[S96AT_SHA_LEN])
+/* Reference implementations, apart from the library's own in sha.c */
+static void ossl_sha256(uint8_t *msg, size_t len,
+			uint8_t hash[S96AT_SHA_LEN])
 {
-	SHA256_CTX ctx;
-	SHA256_Init(&ctx);
-	SHA256_Update(&ctx, msg, len);
-	SHA256_Final(hash, &ctx);
+	EVP_Digest(msg, len, hash, NULL, EVP_sha256(), NULL);
 }
 
-static unsigned char *hmac_sha256(uint8_t *msg, size_t msg_len, uint8_t *key,
-				  size_t key_len, uint8_t *hmac, unsigned int *hmac_len)
+static unsigned char *ossl_hmac_sha256(uint8_t *msg, size_t msg_len,
+				       uint8_t *key, size_t key_len,
+				       uint8_t *hmac, unsigned int *hmac_len)
 {
 	return HMAC(EVP_sha256(), key, key_len, msg, msg_len, hmac, hmac_len);
 }
 
+static int test_plan(void)
+{
+	uint8_t ret;
+	struct s96at_profile prof;
+	struct s96at_plan plan;
+
+	/* Matches the personalization of the test device */
+	const char *profile =
+		"# Slot configuration used by the tests\n"
+		"slot 0 config 8080\n"
+		"slot 1 config a080\n"
+		"slot 12 config 0000\n"
+		"slot 15 config 8000\n"
+		"lock config\n"
+		"lock data\n";
+
+	ret = s96at_profile_parse(&prof, profile);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	/* Building the plan runs its own wake / idle cycle */
+	s96at_idle(&desc);
+
+	ret = s96at_plan_build(&desc, &prof, &plan);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	/* Everything is in place already, so there is nothing to write */
+	if (plan.num_steps) {
+		loge("Plan has %zu steps, expected none\n", plan.num_steps);
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+out:
+	s96at_plan_cleanup(&plan);
+	s96at_profile_cleanup(&prof);
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	return ret;
+}
+
+/*
+ * A device fresh from the factory. Slot 12 keeps its default SlotConfig,
+ * slots 6 and 8 change two words of block 1 and slot 0 one word outside of
+ * it, so the plan is a 32-byte write, a 4-byte write, the Config lock, the
+ * whole Data and OTP zones and the Data lock.
+ */
+static int test_plan_unlocked(void)
+{
+	uint8_t ret;
+	struct s96at_desc dev;
+	struct s96at_profile prof;
+	struct s96at_plan plan;
+	const struct s96at_plan_step *s;
+	uint8_t zeros[512 + 64] = { 0 };
+	uint16_t crc;
+	size_t i;
+
+	const char *profile =
+		"slot 0 config 8080\n"
+		"slot 6 config 8080\n"
+		"slot 8 config a080\n"
+		"slot 12 config 0000\n"
+		"lock config\n"
+		"lock data\n";
+
+	memset(&plan, 0, sizeof(plan));
+
+	ret = s96at_init_emulator(S96AT_ATSHA204A, 12, &dev);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	ret = s96at_profile_parse(&prof, profile);
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	ret = s96at_plan_build(&dev, &prof, &plan);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = S96AT_STATUS_EXEC_ERROR;
+	if (plan.num_steps != 3 + 16 + 2 + 1) {
+		loge("Plan has %zu steps\n", plan.num_steps);
+		goto out;
+	}
+
+	/*
+	 * Words 8 and 9 in one go, bit 7 of param1 making it a 32-byte write,
+	 * word 5 on its own and the rest skipped.
+	 */
+	s = plan.steps;
+	if (s[0].opcode != S96AT_OPCODE_WRITE ||
+	    s[0].param1 != (ZONE_CONFIG | 0x80) || s[0].param2 != 8 ||
+	    s[0].len != 32 ||
+	    s[1].opcode != S96AT_OPCODE_WRITE || s[1].param1 != ZONE_CONFIG ||
+	    s[1].param2 != 5 || s[1].len != 4) {
+		loge("Unexpected Config writes\n");
+		goto out;
+	}
+
+	crc = s96at_crc(plan.config, sizeof(plan.config), 0);
+	if (s[2].opcode != S96AT_OPCODE_LOCK || s[2].param1 != ZONE_CONFIG ||
+	    s[2].param2 != crc || plan.config_crc != crc ||
+	    plan.config[20] != 0x80 || plan.config[21] != 0x80 ||
+	    plan.config[36] != 0x80 || plan.config[37] != 0xa0) {
+		loge("Unexpected Config lock\n");
+		goto out;
+	}
+
+	for (i = 3; i < plan.num_steps - 1; i++) {
+		if (plan.steps[i].opcode != S96AT_OPCODE_WRITE ||
+		    plan.steps[i].len != 32) {
+			loge("Step %zu is not a 32-byte write\n", i);
+			goto out;
+		}
+	}
+
+	/* Nothing but zeros in the Data and OTP zones */
+	crc = s96at_crc(zeros, sizeof(zeros), 0);
+	s = &plan.steps[plan.num_steps - 1];
+	if (s->opcode != S96AT_OPCODE_LOCK || s->param2 != crc ||
+	    plan.data_crc != crc) {
+		loge("Unexpected Data lock\n");
+		goto out;
+	}
+
+	/* The device takes the lock CRCs, after which nothing is left */
+	ret = s96at_plan_run(&dev, &plan);
+	CHECK_RES("Plan", ret, NULL, 0);
+	s96at_plan_cleanup(&plan);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_plan_build(&dev, &prof, &plan);
+	if (ret == S96AT_STATUS_OK && plan.num_steps) {
+		loge("Plan has %zu steps after the run\n", plan.num_steps);
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+out:
+	s96at_plan_cleanup(&plan);
+	s96at_profile_cleanup(&prof);
+cleanup:
+	s96at_cleanup(&dev);
+
+	return ret;
+}
+
 static int test_random(void)
 {
 	uint8_t ret;
@@ -120,6 +284,64 @@ static int test_nonce_passthrough(void)
 	return s96at_gen_nonce(&desc, S96AT_NONCE_MODE_PASSTHROUGH, challenge, NULL);
 }
 
+static int test_faults(void)
+{
+	uint8_t ret;
+	uint8_t random[S96AT_RANDOM_LEN];
+	struct s96at_fault_report report;
+	struct s96at_fault_config cfg = {
+		.script = "crc@1,sleep@2,wake@1",
+	};
+
+	ret = s96at_fault_attach(&desc, &cfg);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	/* The first response is corrupted, the device still holds it */
+	ret = s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED, random);
+	if (ret == S96AT_STATUS_OK) {
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto out;
+	}
+
+	/* The device falls asleep and the first wake pulse is lost */
+	ret = s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED, random);
+	if (ret == S96AT_STATUS_OK) {
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto out;
+	}
+
+	if (s96at_wake(&desc) == S96AT_STATUS_READY) {
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto out;
+	}
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	ret = s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED, random);
+	CHECK_RES("Random", ret, random, ARRAY_LEN(random));
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_fault_report(&desc, &report);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	if (report.injected[S96AT_FAULT_CRC] != 1 ||
+	    report.recovered[S96AT_FAULT_CRC] != 1 ||
+	    report.injected[S96AT_FAULT_SLEEP] != 1 ||
+	    report.recovered[S96AT_FAULT_SLEEP] != 1 ||
+	    report.injected[S96AT_FAULT_WAKE] != 1 ||
+	    report.recovered[S96AT_FAULT_WAKE] != 1 ||
+	    !report.recovery[S96AT_FAULT_WAKE].count) {
+		loge("Unexpected fault report\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+out:
+	s96at_fault_detach(&desc);
+
+	return ret;
+}
+
 /*
  * GenDig
  *
@@ -207,16 +429,291 @@ static int test_gendig(void)
 		/* 2 bytes SN[2:3] or zeros */
 		0x00, 0x00
 	};
-	sha256(digest_in, sizeof(digest_in), digest_e);
+	ossl_sha256(digest_in, sizeof(digest_in), digest_e);
 	hexdump("Digest (expect)", digest_e, MAC_LEN);
 
 	memcpy(mac_in, digest_e, 32);
-	sha256(mac_in, sizeof(mac_in), buf_e);
+	ossl_sha256(mac_in, sizeof(mac_in), buf_e);
 	hexdump("MAC (expect)", buf_e, MAC_LEN);
 
 	return memcmp(buf_a, buf_e, MAC_LEN);
 }
 
+static uint8_t dev_serial(struct s96at_desc *dev, uint8_t *serial)
+{
+	uint8_t ret;
+
+	while (s96at_wake(dev) != S96AT_STATUS_READY) {};
+	ret = s96at_get_serialnbr(dev, serial);
+	s96at_idle(dev);
+
+	return ret;
+}
+
+static bool dev_data_locked(struct s96at_desc *dev)
+{
+	uint8_t lock = S96AT_ZONE_UNLOCKED;
+
+	while (s96at_wake(dev) != S96AT_STATUS_READY) {};
+	s96at_get_lock_data(dev, &lock);
+	s96at_idle(dev);
+
+	return lock == S96AT_ZONE_LOCKED;
+}
+
+/* Runs the plan of rec on dev, returns the number of steps in *steps */
+static uint8_t bundle_provision(struct s96at_desc *dev,
+				const struct s96at_profile *prof,
+				const struct s96at_bundle_record *rec,
+				size_t *steps)
+{
+	uint8_t ret;
+	struct s96at_plan plan;
+
+	ret = s96at_plan_build_bundle(dev, prof, rec, &plan);
+	*steps = plan.num_steps;
+	if (ret == S96AT_STATUS_OK && plan.num_steps)
+		ret = s96at_plan_run(dev, &plan);
+	s96at_plan_cleanup(&plan);
+
+	return ret;
+}
+
+static int test_bundle(void)
+{
+	uint8_t ret;
+	int fd;
+	int i;
+	size_t steps;
+	char path[] = "/tmp/s96at-bundle-XXXXXX";
+	uint8_t unknown[S96AT_SERIAL_NUMBER_LEN] = { 0xff };
+	struct s96at_bundle_record *recs;
+	const struct s96at_bundle_record *rec;
+	struct s96at_bundle bundle;
+	struct s96at_profile prof;
+	struct s96at_desc dev[2];
+	uint16_t crc;
+
+	recs = calloc(3, sizeof(*recs));
+	if (!recs)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		free(recs);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+	close(fd);
+
+	ret = s96at_init_emulator(S96AT_ATSHA204A, 10, &dev[0]);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_init_emulator(S96AT_ATSHA204A, 11, &dev[1]);
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup0;
+
+	ret = s96at_profile_parse(&prof, "lock config\nlock data\n");
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup1;
+
+	for (i = 0; i < 3; i++) {
+		memset(recs[i].data, 0x10 + i, sizeof(recs[i].data));
+		memset(recs[i].otp, 0x20 + i, sizeof(recs[i].otp));
+		recs[i].flags = 0xff;
+	}
+	memcpy(recs[2].serial, unknown, sizeof(unknown));
+	recs[2].serial[1] = 1;
+
+	ret = dev_serial(&dev[0], recs[0].serial);
+	if (ret == S96AT_STATUS_OK)
+		ret = dev_serial(&dev[1], recs[1].serial);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_bundle_create(path, recs, 3);
+	if (ret != S96AT_STATUS_OK)
+		goto profile;
+
+	/* The lock CRCs are filled in, the flags cleared */
+	ret = S96AT_STATUS_EXEC_ERROR;
+	crc = s96at_crc(recs[0].data, sizeof(recs[0].data), 0);
+	crc = s96at_crc(recs[0].otp, sizeof(recs[0].otp), crc);
+	if (le16toh(recs[0].data_crc) != crc || recs[0].flags)
+		goto profile;
+
+	ret = s96at_bundle_open(&bundle, path);
+	if (ret != S96AT_STATUS_OK)
+		goto profile;
+
+	ret = S96AT_STATUS_EXEC_ERROR;
+	if (s96at_bundle_find(&bundle, unknown, &rec) !=
+	    S96AT_STATUS_EXEC_ERROR ||
+	    s96at_bundle_find(&bundle, recs[2].serial, &rec) !=
+	    S96AT_STATUS_OK || memcmp(rec->otp, recs[2].otp, sizeof(rec->otp)))
+		goto close;
+
+	/* The keys of the first device go to it and are locked in */
+	if (s96at_bundle_find(&bundle, recs[0].serial, &rec) !=
+	    S96AT_STATUS_OK ||
+	    bundle_provision(&dev[0], &prof, rec, &steps) != S96AT_STATUS_OK ||
+	    !steps || !dev_data_locked(&dev[0]))
+		goto close;
+
+	/* Once locked there is nothing to write, the record is not used */
+	if (bundle_provision(&dev[0], &prof, rec, &steps) != S96AT_STATUS_OK ||
+	    steps)
+		goto close;
+
+	if (s96at_bundle_wipe(&bundle, rec) != S96AT_STATUS_OK ||
+	    s96at_bundle_find(&bundle, recs[0].serial, &rec) !=
+	    S96AT_STATUS_EXEC_ERROR)
+		goto close;
+
+	/* A record that does not match its CRC does not get locked */
+	if (s96at_bundle_find(&bundle, recs[1].serial, &rec) != S96AT_STATUS_OK)
+		goto close;
+	bundle.records[rec - bundle.records].data[0] ^= 0x01;
+	if (bundle_provision(&dev[1], &prof, rec, &steps) == S96AT_STATUS_OK ||
+	    dev_data_locked(&dev[1]))
+		goto close;
+
+	/* The wipe made it to the file */
+	s96at_bundle_close(&bundle);
+	if (s96at_bundle_open(&bundle, path) != S96AT_STATUS_OK)
+		goto profile;
+
+	for (i = 0; i < bundle.num_records; i++) {
+		rec = &bundle.records[i];
+		if (memcmp(rec->serial, recs[0].serial, sizeof(rec->serial)))
+			continue;
+		if ((rec->flags & S96AT_BUNDLE_RECORD_USED) && !rec->data_crc &&
+		    !rec->data[0] && !memcmp(rec->data, rec->data + 1,
+					     sizeof(rec->data) - 1))
+			ret = S96AT_STATUS_OK;
+	}
+close:
+	s96at_bundle_close(&bundle);
+profile:
+	s96at_profile_cleanup(&prof);
+cleanup1:
+	s96at_cleanup(&dev[1]);
+cleanup0:
+	s96at_cleanup(&dev[0]);
+out:
+	unlink(path);
+	free(recs);
+
+	return ret;
+}
+
+static int test_bus(void)
+{
+	int ret = 1;
+	int i;
+	uint64_t t0;
+	uint64_t elapsed_ms;
+	uint32_t max_ms = 0;
+	uint32_t ids[] = { 4, 5, 6 };
+	uint8_t mode = S96AT_MAC_MODE_1 | (TEMPKEY_SOURCE_INPUT << MAC_MODE_TEMPKEY_SOURCE_SHIFT);
+	uint8_t random[40][S96AT_RANDOM_LEN];
+	uint8_t random2[8][S96AT_RANDOM_LEN];
+	uint8_t buf_a[S96AT_MAC_LEN] = { 0 }; /* bus */
+	uint8_t buf_e[S96AT_MAC_LEN] = { 0 }; /* single commands */
+	struct s96at_batch_cmd cmds0[40];
+	struct s96at_batch_cmd cmds1[] = {
+		{ .opcode = S96AT_OPCODE_NONCE, .param1 = S96AT_NONCE_MODE_PASSTHROUGH,
+		  .data = challenge, .data_len = sizeof(challenge) },
+		{ .opcode = S96AT_OPCODE_MAC, .param1 = mode,
+		  .out = buf_a, .out_len = sizeof(buf_a) },
+	};
+	struct s96at_batch_cmd cmds2[8];
+	struct s96at_bus_job jobs[] = {
+		{ .chip = 0, .cmds = cmds0, .num = ARRAY_LEN(cmds0) },
+		{ .chip = 1, .cmds = cmds1, .num = ARRAY_LEN(cmds1) },
+		{ .chip = 2, .cmds = cmds2, .num = ARRAY_LEN(cmds2) },
+	};
+	struct s96at_bus bus;
+	size_t n;
+
+	/* 40 Random commands on chip 0 take more than a watchdog window */
+	memset(cmds0, 0, sizeof(cmds0));
+	for (i = 0; i < ARRAY_LEN(cmds0); i++) {
+		cmds0[i].opcode = S96AT_OPCODE_RANDOM;
+		cmds0[i].out = random[i];
+		cmds0[i].out_len = S96AT_RANDOM_LEN;
+	}
+
+	memset(cmds2, 0, sizeof(cmds2));
+	for (i = 0; i < ARRAY_LEN(cmds2); i++) {
+		cmds2[i].opcode = S96AT_OPCODE_RANDOM;
+		cmds2[i].out = random2[i];
+		cmds2[i].out_len = S96AT_RANDOM_LEN;
+	}
+
+	/* Every entry has to be run to get a status */
+	for (i = 0; i < ARRAY_LEN(jobs); i++) {
+		jobs[i].status = S96AT_STATUS_EXEC_ERROR;
+		for (n = 0; n < jobs[i].num; n++)
+			jobs[i].cmds[n].status = S96AT_STATUS_EXEC_ERROR;
+	}
+
+	if (s96at_bus_init_emulator(&bus, S96AT_ATSHA204A, ids,
+				    ARRAY_LEN(ids)) != S96AT_STATUS_OK)
+		return 1;
+
+	for (i = 0; i < bus.num_chips; i++)
+		atsha204a_personalize(bus.chips[i].ioif);
+
+	/* Time the commands take one after the other */
+	max_ms = (ARRAY_LEN(cmds0) + 8) * 50 + 60 + 35;
+
+	t0 = stats_now_us();
+	ret = s96at_bus_run(&bus, jobs, ARRAY_LEN(jobs), S96AT_FLAG_STOP_ON_ERROR);
+	elapsed_ms = (stats_now_us() - t0) / 1000;
+	CHECK_RES("Bus", ret, buf_a, ARRAY_LEN(buf_a));
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	logd("Bus run took %llu ms, %u ms one command after the other\n",
+	     (unsigned long long)elapsed_ms, max_ms);
+
+	ret = 1;
+	for (i = 0; i < ARRAY_LEN(jobs); i++) {
+		if (jobs[i].status != S96AT_STATUS_OK)
+			goto out;
+		for (n = 0; n < jobs[i].num; n++)
+			if (jobs[i].cmds[n].status != S96AT_STATUS_OK)
+				goto out;
+	}
+
+	if (elapsed_ms >= max_ms ||
+	    !memcmp(random[0], random[1], S96AT_RANDOM_LEN) ||
+	    !memcmp(random2[0], random2[1], S96AT_RANDOM_LEN))
+		goto out;
+
+	/* The chips are left idle */
+	while (s96at_wake(&bus.chips[1]) != S96AT_STATUS_READY) {};
+
+	ret = s96at_gen_nonce(&bus.chips[1], S96AT_NONCE_MODE_PASSTHROUGH,
+			      challenge, NULL);
+	CHECK_RES("Nonce", ret, NULL, 0);
+
+	ret = s96at_get_mac(&bus.chips[1], S96AT_MAC_MODE_1, 0, NULL,
+			    S96AT_FLAG_TEMPKEY_SOURCE_INPUT, buf_e);
+	CHECK_RES("MAC", ret, buf_e, ARRAY_LEN(buf_e));
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = memcmp(buf_a, buf_e, S96AT_MAC_LEN);
+out:
+	s96at_bus_cleanup(&bus);
+
+	/* The run outlasts the watchdog of the test device */
+	s96at_idle(&desc);
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	return ret;
+}
+
 static int test_hmac(void)
 {
 	uint8_t ret;
@@ -225,6 +722,8 @@ static int test_hmac(void)
 
 	uint8_t buf_a[S96AT_HMAC_LEN] = { 0 }; /* actual (atsha204a) */
 	uint8_t buf_e[S96AT_HMAC_LEN] = { 0 }; /* expected (openssl) */
+	uint8_t random[S96AT_RANDOM_LEN];
+	uint8_t nonce_in[S96AT_RANDOM_LEN + S96AT_NONCE_INPUT_LEN + 3];
 
 	uint8_t msg[] = {
 		/* 32 bytes: MBZ */
@@ -270,11 +769,88 @@ static int test_hmac(void)
 	ret = s96at_get_hmac(&desc, slot, S96AT_FLAG_TEMPKEY_SOURCE_INPUT, buf_a);
 	CHECK_RES("hmac", ret, buf_a, ARRAY_LEN(buf_a));
 
-	hmac_sha256(msg, sizeof(msg), key, sizeof(key), buf_e, &hmac_len);
+	ossl_hmac_sha256(msg, sizeof(msg), key, sizeof(key), buf_e, &hmac_len);
+
+	if (memcmp(buf_a, buf_e, S96AT_HMAC_LEN))
+		return 1;
+
+	/*
+	 * No source flag means a random TempKey, ie
+	 * SHA-256(RandOut | NumIn | Opcode | Mode | 0x00)
+	 */
+	ret = s96at_gen_nonce(&desc, S96AT_NONCE_MODE_RANDOM, nonce_data,
+			      random);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_get_hmac(&desc, slot, S96AT_FLAG_NONE, buf_a);
+	CHECK_RES("hmac (random)", ret, buf_a, ARRAY_LEN(buf_a));
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	memcpy(nonce_in, random, S96AT_RANDOM_LEN);
+	memcpy(nonce_in + S96AT_RANDOM_LEN, nonce_data, S96AT_NONCE_INPUT_LEN);
+	nonce_in[52] = 0x16;
+	nonce_in[53] = S96AT_NONCE_MODE_RANDOM;
+	nonce_in[54] = 0x00;
+	ossl_sha256(nonce_in, sizeof(nonce_in), msg + 32);
+	msg[65] = 0x00;
+	ossl_hmac_sha256(msg, sizeof(msg), key, sizeof(key), buf_e, &hmac_len);
 
 	return memcmp(buf_a, buf_e, S96AT_HMAC_LEN);
 }
 
+static int test_log(void)
+{
+	uint8_t ret;
+	uint8_t i;
+	uint8_t key[S96AT_KEY_LEN] = { 0 }; /* Slot 0 */
+	uint8_t rec[16];
+	bool sealed;
+	struct s96at_log log;
+	struct s96at_log_verifier v;
+	struct s96at_log_checkpoint cp[3];
+	int num_cp = 0;
+
+	/* Sealing runs its own wake / idle cycle */
+	s96at_idle(&desc);
+
+	s96at_log_init(&log, &desc, 0, NULL, 4, 0);
+
+	for (i = 0; i < 10; i++) {
+		memset(rec, i, sizeof(rec));
+		ret = s96at_log_append(&log, rec, sizeof(rec), &cp[num_cp], &sealed);
+		if (ret != S96AT_STATUS_OK)
+			goto out;
+		if (sealed)
+			num_cp++;
+	}
+
+	/* Seal the last two records */
+	ret = s96at_log_checkpoint(&log, &cp[num_cp++]);
+	CHECK_RES("Checkpoint", ret, cp[num_cp - 1].mac, S96AT_MAC_LEN);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	s96at_log_verify_init(&v, key, 0, NULL);
+
+	for (i = 0, num_cp = 0; i < 10; i++) {
+		memset(rec, i, sizeof(rec));
+		s96at_log_verify_record(&v, rec, sizeof(rec));
+
+		if (i == 3 || i == 7 || i == 9) {
+			ret = s96at_log_verify_checkpoint(&v, &cp[num_cp++]);
+			if (ret != S96AT_STATUS_OK) {
+				loge("Checkpoint %d does not verify\n", num_cp);
+				goto out;
+			}
+		}
+	}
+out:
+	s96at_log_cleanup(&log);
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	return ret;
+}
+
 static int test_mac_mode0(void)
 {
 	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
@@ -320,7 +896,7 @@ static int test_mac_mode0(void)
 		0x00, 0x00
 	};
 
-	sha256(mac_in, ARRAY_LEN(mac_in), buf_e);
+	ossl_sha256(mac_in, ARRAY_LEN(mac_in), buf_e);
 	hexdump("Expected mac", buf_e, ARRAY_LEN(buf_e));
 
 	return memcmp(buf_a, buf_e, S96AT_MAC_LEN);
@@ -370,7 +946,7 @@ static int test_mac_mode1(void)
 		/* 2 bytes SN[2:3] or zeros */
 		0x00, 0x00
 	};
-	sha256(mac_in, ARRAY_LEN(mac_in), buf_e);
+	ossl_sha256(mac_in, ARRAY_LEN(mac_in), buf_e);
 	hexdump("Expected mac", buf_e, ARRAY_LEN(buf_e));
 
 	return memcmp(buf_a, buf_e, S96AT_MAC_LEN);
@@ -418,7 +994,7 @@ static int test_mac_mode2(void)
 		0x00, 0x00
 	};
 
-	sha256(mac_in, ARRAY_LEN(mac_in), buf_e);
+	ossl_sha256(mac_in, ARRAY_LEN(mac_in), buf_e);
 	hexdump("Expected mac", buf_e, ARRAY_LEN(buf_e));
 
 	return memcmp(buf_a, buf_e, S96AT_MAC_LEN);
@@ -465,12 +1041,168 @@ static int test_mac_mode3(void)
 		/* 2 bytes SN[2:3] or zeros */
 		0x00, 0x00
 	};
-	sha256(mac_in, ARRAY_LEN(mac_in), buf_e);
+	ossl_sha256(mac_in, ARRAY_LEN(mac_in), buf_e);
 	hexdump("Expected mac", buf_e, ARRAY_LEN(buf_e));
 
 	return memcmp(buf_a, buf_e, S96AT_MAC_LEN);
 }
 
+static int test_attest(void)
+{
+	uint8_t ret;
+	uint32_t i;
+	uint32_t index;
+	uint8_t key[S96AT_KEY_LEN] = { 0 }; /* Slot 0 */
+	uint8_t chal[5][S96AT_CHALLENGE_LEN];
+	struct s96at_attest att;
+	struct s96at_attestation a;
+
+	ret = s96at_attest_init(&att, &desc, 0, ARRAY_LEN(chal), 0);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	for (i = 0; i < ARRAY_LEN(chal); i++) {
+		memcpy(chal[i], challenge, S96AT_CHALLENGE_LEN);
+		chal[i][0] = 0x80 | i;
+
+		ret = s96at_attest_add(&att, chal[i], &index);
+		if (ret != S96AT_STATUS_OK || index != i)
+			goto out;
+	}
+
+	if (!s96at_attest_ready(&att)) {
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto out;
+	}
+
+	ret = s96at_attest_seal(&att);
+	CHECK_RES("Seal", ret, att.mac, S96AT_MAC_LEN);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	for (i = 0; i < ARRAY_LEN(chal); i++) {
+		ret = s96at_attest_get(&att, i, &a);
+		if (ret != S96AT_STATUS_OK)
+			goto out;
+
+		ret = s96at_attest_verify(key, chal[i], &a);
+		if (ret != S96AT_STATUS_OK) {
+			loge("Attestation %u does not verify\n", i);
+			goto out;
+		}
+	}
+
+	/* A challenge that is not part of the batch must not verify */
+	if (s96at_attest_verify(key, challenge, &a) == S96AT_STATUS_OK)
+		ret = S96AT_STATUS_EXEC_ERROR;
+out:
+	s96at_attest_cleanup(&att);
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	return ret;
+}
+
+static int test_batch(void)
+{
+	uint8_t ret;
+	uint8_t slot = 0;
+	uint8_t mode = S96AT_MAC_MODE_1 | (TEMPKEY_SOURCE_INPUT << MAC_MODE_TEMPKEY_SOURCE_SHIFT);
+
+	uint8_t devrev[S96AT_DEVREV_LEN] = { 0 };
+	uint8_t buf_a[S96AT_MAC_LEN] = { 0 }; /* batch */
+	uint8_t buf_e[S96AT_MAC_LEN] = { 0 }; /* single commands */
+
+	struct s96at_batch_cmd cmds[] = {
+		{ .opcode = S96AT_OPCODE_DEVREV,
+		  .out = devrev, .out_len = sizeof(devrev) },
+		{ .opcode = S96AT_OPCODE_NONCE, .param1 = S96AT_NONCE_MODE_PASSTHROUGH,
+		  .data = challenge, .data_len = sizeof(challenge) },
+		{ .opcode = S96AT_OPCODE_MAC, .param1 = mode, .param2 = slot,
+		  .out = buf_a, .out_len = sizeof(buf_a) },
+	};
+
+	ret = s96at_batch(&desc, cmds, ARRAY_LEN(cmds), S96AT_FLAG_STOP_ON_ERROR);
+	CHECK_RES("Batch", ret, buf_a, ARRAY_LEN(buf_a));
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	hexdump("DevRev", devrev, ARRAY_LEN(devrev));
+
+	ret = s96at_gen_nonce(&desc, S96AT_NONCE_MODE_PASSTHROUGH, challenge, NULL);
+	CHECK_RES("Nonce", ret, NULL, 0);
+
+	ret = s96at_get_mac(&desc, S96AT_MAC_MODE_1, slot, NULL,
+			    S96AT_FLAG_TEMPKEY_SOURCE_INPUT, buf_e);
+	CHECK_RES("MAC", ret, buf_e, ARRAY_LEN(buf_e));
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	return memcmp(buf_a, buf_e, S96AT_MAC_LEN);
+}
+
+/* Commands that are never sent, and the status of each entry of a batch */
+static int test_batch_errors(void)
+{
+	int i;
+	uint8_t ret;
+	uint8_t devrev[2][S96AT_DEVREV_LEN];
+	uint8_t big[256] = { 0 };
+	struct s96at_batch_cmd unknown[] = {
+		{ .opcode = 0x7f },
+	};
+	struct s96at_batch_cmd too_long[] = {
+		{ .opcode = S96AT_OPCODE_SHA, .data = big, .data_len = sizeof(big) },
+	};
+	struct s96at_batch_cmd too_slow[40];
+	/* Nonce takes 20 or 32 bytes, the device reports a parse error */
+	struct s96at_batch_cmd cmds[] = {
+		{ .opcode = S96AT_OPCODE_DEVREV,
+		  .out = devrev[0], .out_len = sizeof(devrev[0]) },
+		{ .opcode = S96AT_OPCODE_NONCE, .param1 = S96AT_NONCE_MODE_PASSTHROUGH,
+		  .data = challenge, .data_len = 5 },
+		{ .opcode = S96AT_OPCODE_DEVREV,
+		  .out = devrev[1], .out_len = sizeof(devrev[1]) },
+	};
+
+	memset(too_slow, 0, sizeof(too_slow));
+	for (i = 0; i < ARRAY_LEN(too_slow); i++)
+		too_slow[i].opcode = S96AT_OPCODE_RANDOM;
+
+	if (s96at_batch(&desc, unknown, ARRAY_LEN(unknown), 0) !=
+	    S96AT_STATUS_BAD_PARAMETERS ||
+	    s96at_batch(&desc, too_long, ARRAY_LEN(too_long), 0) !=
+	    S96AT_STATUS_BAD_PARAMETERS ||
+	    s96at_batch(&desc, too_slow, ARRAY_LEN(too_slow), 0) !=
+	    S96AT_STATUS_BAD_PARAMETERS)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	/* The batch goes on after the failing command */
+	ret = s96at_batch(&desc, cmds, ARRAY_LEN(cmds), 0);
+	if (ret != STATUS_PARSE_ERROR ||
+	    cmds[0].status != S96AT_STATUS_OK ||
+	    cmds[1].status != STATUS_PARSE_ERROR ||
+	    cmds[2].status != S96AT_STATUS_OK ||
+	    memcmp(devrev[0], devrev[1], sizeof(devrev[0]))) {
+		loge("Batch: 0x%02x, entries 0x%02x 0x%02x 0x%02x\n", ret,
+		     cmds[0].status, cmds[1].status, cmds[2].status);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	/* Or stops there, the rest is not run */
+	ret = s96at_batch(&desc, cmds, ARRAY_LEN(cmds),
+			  S96AT_FLAG_STOP_ON_ERROR);
+	if (ret != STATUS_PARSE_ERROR ||
+	    cmds[0].status != S96AT_STATUS_OK ||
+	    cmds[1].status != STATUS_PARSE_ERROR ||
+	    cmds[2].status != S96AT_STATUS_EXEC_ERROR) {
+		loge("Batch: 0x%02x, entries 0x%02x 0x%02x 0x%02x\n", ret,
+		     cmds[0].status, cmds[1].status, cmds[2].status);
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	return S96AT_STATUS_OK;
+}
+
 static int test_checkmac_mode0(void)
 {
 	uint8_t ret;
@@ -596,35 +1328,265 @@ static int test_checkmac_mode3(void)
 	return ret;
 }
 
-static int test_sha(void)
+static int test_retry(void)
 {
 	uint8_t ret;
-
-	uint8_t buf_a[S96AT_SHA_LEN] = { 0 }; /* actual (atsha204a) */
-	uint8_t buf_e[S96AT_SHA_LEN] = { 0 }; /* expected (openssl) */
-
-	uint8_t sha_in[64] = {
-		/* Message (32 bytes) */
-		CHALLENGE,
-		/* Padding space */
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	uint8_t random[S96AT_RANDOM_LEN];
+	struct s96at_stats *stats;
+	struct s96at_retry_policy policy = {
+		.read_retries = 2,
+		.command_retries = 1,
+		.wake_retries = 1,
+		.backoff_us = 1000,
+		.max_backoff_us = 4000,
+	};
+	struct s96at_fault_config cfg = {
+		/* Reads 3 and 4 belong to the idle-wake cycle */
+		.script = "crc@1,sleep@2,crc@6,crc@7,crc@8",
+	};
+	struct s96at_fault_config sleep_cfg = {
+		.script = "sleep@1",
 	};
+	struct s96at_fault_config woken_cfg = {
+		.script = "woken@1",
+	};
+	uint8_t config[32];
+	uint8_t mac[S96AT_MAC_LEN];
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_stats_enable(&desc);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_set_retry_policy(&desc, &policy);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_fault_attach(&desc, &cfg);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
 
-	ret = s96at_get_sha(&desc, sha_in, ARRAY_LEN(sha_in), S96AT_CHALLENGE_LEN, buf_a);
-	CHECK_RES("SHA (actual)", ret, buf_a, ARRAY_LEN(buf_a));
+	/* The response is read again */
+	ret = s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED, random);
+	CHECK_RES("Random (bad CRC)", ret, random, ARRAY_LEN(random));
+	if (ret != S96AT_STATUS_OK)
+		goto detach;
 
-	/* Now compute the expected value. We only pass the message
+	/* The command is issued again, then after an idle-wake cycle */
+	ret = s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED, random);
+	CHECK_RES("Random (asleep)", ret, random, ARRAY_LEN(random));
+	if (ret != S96AT_STATUS_OK)
+		goto detach;
+
+	/* Nonce has run, it must not be issued again once reads are used up */
+	if (s96at_gen_nonce(&desc, S96AT_NONCE_MODE_PASSTHROUGH, challenge,
+			    NULL) == S96AT_STATUS_OK) {
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto detach;
+	}
+
+	ret = s96at_stats_snapshot(&desc, stats, true);
+	if (ret == S96AT_STATUS_OK && stats->retries != 5) {
+		loge("Unexpected number of retries: %llu\n",
+		     (unsigned long long)stats->retries);
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+	s96at_fault_detach(&desc);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	/* The device falls asleep, a Read gets it woken up and loses TempKey */
+	ret = s96at_load_tempkey(&desc, challenge, S96AT_FLAG_NONE, ZONE_DATA, 0);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_stats_snapshot(&desc, stats, true);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_fault_attach(&desc, &sleep_cfg);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_read_config(&desc, 0, config, sizeof(config));
+	CHECK_RES("Read (asleep)", ret, config, ARRAY_LEN(config));
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_load_tempkey(&desc, challenge, S96AT_FLAG_NONE,
+					 ZONE_DATA, 0);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_stats_snapshot(&desc, stats, false);
+	if (ret == S96AT_STATUS_OK &&
+	    stats->commands[s96at_stats_index(S96AT_OPCODE_NONCE)] != 1) {
+		loge("TempKey was not reloaded after the wake\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+	s96at_fault_detach(&desc);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	/* The Read wakes the device up and gets the wake status back */
+	ret = s96at_stats_snapshot(&desc, stats, true);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_fault_attach(&desc, &woken_cfg);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_read_config(&desc, 0, config, sizeof(config));
+	CHECK_RES("Read (woken)", ret, config, ARRAY_LEN(config));
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_load_tempkey(&desc, challenge, S96AT_FLAG_NONE,
+					 ZONE_DATA, 0);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_get_mac(&desc, S96AT_MAC_MODE_1, 0, NULL,
+				    S96AT_FLAG_TEMPKEY_SOURCE_INPUT, mac);
+	CHECK_RES("MAC (woken)", ret, mac, ARRAY_LEN(mac));
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_stats_snapshot(&desc, stats, false);
+	if (ret == S96AT_STATUS_OK &&
+	    stats->commands[s96at_stats_index(S96AT_OPCODE_NONCE)] != 1) {
+		loge("TempKey was not reloaded after the wake status\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+detach:
+	s96at_fault_detach(&desc);
+out:
+	s96at_set_retry_policy(&desc, NULL);
+	s96at_stats_disable(&desc);
+	free(stats);
+
+	return ret;
+}
+
+static int test_sha(void)
+{
+	uint8_t ret;
+
+	uint8_t buf_a[S96AT_SHA_LEN] = { 0 }; /* actual (atsha204a) */
+	uint8_t buf_e[S96AT_SHA_LEN] = { 0 }; /* expected (openssl) */
+
+	uint8_t sha_in[64] = {
+		/* Message (32 bytes) */
+		CHALLENGE,
+		/* Padding space */
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+
+	ret = s96at_get_sha(&desc, sha_in, ARRAY_LEN(sha_in), S96AT_CHALLENGE_LEN, buf_a);
+	CHECK_RES("SHA (actual)", ret, buf_a, ARRAY_LEN(buf_a));
+
+	/* Now compute the expected value. We only pass the message
 	 * part as the padding is computed by openssl.
 	 */
-	sha256(sha_in, S96AT_CHALLENGE_LEN, buf_e);
+	ossl_sha256(sha_in, S96AT_CHALLENGE_LEN, buf_e);
 	hexdump("SHA (expect)", buf_e, S96AT_SHA_LEN);
 
 	return memcmp(buf_a, buf_e, S96AT_SHA_LEN);
 }
 
+/*
+ * Calls the slot configuration does not permit fail without going to the
+ * device, once it is loaded.
+ */
+static int test_slot_config(void)
+{
+	uint8_t ret;
+	uint8_t buf[S96AT_KEY_LEN] = { 0 };
+	uint8_t mac[S96AT_MAC_LEN];
+	struct s96at_desc dev;
+	struct s96at_profile prof;
+	struct s96at_plan plan;
+	struct s96at_slot_config cfg;
+	struct s96at_stats *stats;
+	uint64_t commands = 0;
+	int i;
+
+	/* Secret, CheckOnly and plain slots */
+	const char *profile =
+		"slot 0 config 8080\n"
+		"slot 12 config 0000\n"
+		"slot 13 config 8010\n"
+		"lock config\n"
+		"lock data\n";
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_init_emulator(S96AT_ATSHA204A, 8, &dev);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_profile_parse(&prof, profile);
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	ret = s96at_plan_build(&dev, &prof, &plan);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_plan_run(&dev, &plan);
+	s96at_plan_cleanup(&plan);
+	s96at_profile_cleanup(&prof);
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	while (s96at_wake(&dev) != S96AT_STATUS_READY) {};
+
+	ret = S96AT_STATUS_EXEC_ERROR;
+	if (s96at_get_slot_config(&dev, 0, &cfg) !=
+	    S96AT_STATUS_BAD_PARAMETERS ||
+	    s96at_load_config(&dev) != S96AT_STATUS_OK ||
+	    s96at_stats_enable(&dev) != S96AT_STATUS_OK)
+		goto cleanup;
+
+	if (s96at_get_slot_config(&dev, 0, &cfg) != S96AT_STATUS_OK ||
+	    !cfg.is_secret || cfg.encrypt_read ||
+	    cfg.write_config != S96AT_WRITE_CONFIG_NEVER)
+		goto cleanup;
+
+	if (s96at_get_slot_config(&dev, 13, &cfg) != S96AT_STATUS_OK ||
+	    !cfg.check_only)
+		goto cleanup;
+
+	if (s96at_read_data(&dev, 0, 0, 0, buf, sizeof(buf)) !=
+	    S96AT_STATUS_EXEC_ERROR ||
+	    s96at_write_data(&dev, 0, 0, 0, buf, sizeof(buf)) !=
+	    S96AT_STATUS_EXEC_ERROR ||
+	    s96at_get_mac(&dev, S96AT_MAC_MODE_0, 13, challenge,
+			  S96AT_FLAG_TEMPKEY_SOURCE_INPUT, mac) !=
+	    S96AT_STATUS_EXEC_ERROR ||
+	    s96at_get_hmac(&dev, 13, S96AT_FLAG_TEMPKEY_SOURCE_INPUT, mac) !=
+	    S96AT_STATUS_EXEC_ERROR ||
+	    s96at_derive_key(&dev, 0, NULL, S96AT_FLAG_TEMPKEY_SOURCE_INPUT) !=
+	    S96AT_STATUS_EXEC_ERROR)
+		goto disable;
+
+	if (s96at_stats_snapshot(&dev, stats, true) != S96AT_STATUS_OK)
+		goto disable;
+
+	for (i = 0; i < S96AT_STATS_NUM_OPCODES; i++)
+		commands += stats->commands[i];
+	if (commands || stats->errors[S96AT_STATS_ERROR_REFUSED] != 5) {
+		loge("%llu commands sent, %llu refused\n",
+		     (unsigned long long)commands,
+		     (unsigned long long)stats->errors[S96AT_STATS_ERROR_REFUSED]);
+		goto disable;
+	}
+
+	/* What the configuration permits still goes to the device */
+	ret = s96at_read_data(&dev, 12, 0, 0, buf, sizeof(buf));
+	CHECK_RES("Read (plain slot)", ret, buf, sizeof(buf));
+	if (ret == S96AT_STATUS_OK) {
+		ret = s96at_get_mac(&dev, S96AT_MAC_MODE_0, 0, challenge,
+				    S96AT_FLAG_TEMPKEY_SOURCE_INPUT, mac);
+		CHECK_RES("MAC (secret slot)", ret, mac, sizeof(mac));
+	}
+disable:
+	s96at_stats_disable(&dev);
+cleanup:
+	s96at_cleanup(&dev);
+out:
+	free(stats);
+
+	return ret;
+}
+
 /* DeriveKey
  *
  * Since we cannot read the generated key directly, we
@@ -728,19 +1690,604 @@ static int test_derivekey(void)
 			    S96AT_FLAG_TEMPKEY_SOURCE_INPUT, mac_a);
 	CHECK_RES("MAC (actual)", ret, mac_a, ARRAY_LEN(mac_a));
 
-	sha256(sha_in, ARRAY_LEN(sha_in), key_e);
+	ossl_sha256(sha_in, ARRAY_LEN(sha_in), key_e);
 	hexdump("Key", key_e, ARRAY_LEN(key_e));
 
 	/* Populate the top 32 bytes with the key */
 	memcpy(mac_in, key_e, ARRAY_LEN(key_e));
 
-	sha256(mac_in, ARRAY_LEN(mac_in), mac_e);
+	ossl_sha256(mac_in, ARRAY_LEN(mac_in), mac_e);
 	hexdump("MAC (expect)", mac_e, ARRAY_LEN(mac_e));
 
 out:
 	return memcmp(mac_a, mac_e, S96AT_MAC_LEN);
 }
 
+/* DRBG
+ *
+ * The entropy queue runs its own wake / idle cycle, so the device is put
+ * into the idle state first and woken up again once the test is done.
+ */
+static int test_drbg(void)
+{
+	uint8_t ret;
+	struct s96at_entropy src;
+	struct s96at_drbg drbg;
+	uint8_t buf1[64];
+	uint8_t buf2[64];
+
+	s96at_idle(&desc);
+
+	ret = s96at_entropy_init(&src, &desc);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_drbg_init(&drbg, &src, NULL, 0, sizeof(buf1), 0);
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	ret = s96at_drbg_generate(&drbg, buf1, sizeof(buf1));
+	CHECK_RES("DRBG 1", ret, buf1, ARRAY_LEN(buf1));
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	/* The byte count has been reached, so this one reseeds */
+	ret = s96at_drbg_generate(&drbg, buf2, sizeof(buf2));
+	CHECK_RES("DRBG 2", ret, buf2, ARRAY_LEN(buf2));
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	if (!memcmp(buf1, buf2, sizeof(buf1)))
+		ret = S96AT_STATUS_EXEC_ERROR;
+cleanup:
+	s96at_drbg_cleanup(&drbg);
+	s96at_entropy_cleanup(&src);
+out:
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	return ret;
+}
+
+/*
+ * SP 800-90A HMAC_DRBG (SHA-256) from the NIST CAVP test vectors, without
+ * prediction resistance, personalization string or additional input:
+ * entropy input and nonce, then the second 1024 bits generated.
+ */
+static const uint8_t drbg_kat_seed[] = {
+	0xca, 0x85, 0x19, 0x11, 0x34, 0x93, 0x84, 0xbf,
+	0xfe, 0x89, 0xde, 0x1c, 0xbd, 0xc4, 0x6e, 0x68,
+	0x31, 0xe4, 0x4d, 0x34, 0xa4, 0xfb, 0x93, 0x5e,
+	0xe2, 0x85, 0xdd, 0x14, 0xb7, 0x1a, 0x74, 0x88,
+	0x65, 0x9b, 0xa9, 0x6c, 0x60, 0x1d, 0xc6, 0x9f,
+	0xc9, 0x02, 0x94, 0x08, 0x05, 0xec, 0x0c, 0xa8,
+};
+
+static const uint8_t drbg_kat_out[] = {
+	0xe5, 0x28, 0xe9, 0xab, 0xf2, 0xde, 0xce, 0x54,
+	0xd4, 0x7c, 0x7e, 0x75, 0xe5, 0xfe, 0x30, 0x21,
+	0x49, 0xf8, 0x17, 0xea, 0x9f, 0xb4, 0xbe, 0xe6,
+	0xf4, 0x19, 0x96, 0x97, 0xd0, 0x4d, 0x5b, 0x89,
+	0xd5, 0x4f, 0xbb, 0x97, 0x8a, 0x15, 0xb5, 0xc4,
+	0x43, 0xc9, 0xec, 0x21, 0x03, 0x6d, 0x24, 0x60,
+	0xb6, 0xf7, 0x3e, 0xba, 0xd0, 0xdc, 0x2a, 0xba,
+	0x6e, 0x62, 0x4a, 0xbf, 0x07, 0x74, 0x5b, 0xc1,
+	0x07, 0x69, 0x4b, 0xb7, 0x54, 0x7b, 0xb0, 0x99,
+	0x5f, 0x70, 0xde, 0x25, 0xd6, 0xb2, 0x9e, 0x2d,
+	0x30, 0x11, 0xbb, 0x19, 0xd2, 0x76, 0x76, 0xc0,
+	0x71, 0x62, 0xc8, 0xb5, 0xcc, 0xde, 0x06, 0x68,
+	0x96, 0x1d, 0xf8, 0x68, 0x03, 0x48, 0x2c, 0xb3,
+	0x7e, 0xd6, 0xd5, 0xc0, 0xbb, 0x8d, 0x50, 0xcf,
+	0x1f, 0x50, 0xd4, 0x76, 0xaa, 0x04, 0x58, 0xbd,
+	0xab, 0xa8, 0x06, 0xf4, 0x8b, 0xe9, 0xdc, 0xb8,
+};
+
+/*
+ * The DRBG against a known answer, and the SHA-256 and HMAC it is built on
+ * against OpenSSL, across block boundaries and key lengths.
+ */
+static int test_drbg_kat(void)
+{
+	uint8_t ret;
+	struct s96at_entropy src;
+	struct s96at_drbg drbg;
+	struct sha256_ctx sha;
+	struct hmac_sha256_ctx hmac;
+	uint8_t data[200];
+	uint8_t buf_a[S96AT_SHA_LEN];
+	uint8_t buf_e[S96AT_SHA_LEN];
+	uint8_t out[sizeof(drbg_kat_out)];
+	unsigned int hmac_len;
+	size_t len;
+	size_t key_len = 0;
+
+	for (len = 0; len < sizeof(data); len++)
+		data[len] = len * 7 + 1;
+
+	for (len = 0; len <= sizeof(data); len++) {
+		ossl_sha256(data, len, buf_e);
+
+		sha256(data, len, buf_a);
+		if (memcmp(buf_a, buf_e, sizeof(buf_e)))
+			goto mismatch;
+
+		/* The same in two parts */
+		sha256_init(&sha);
+		sha256_update(&sha, data, len / 3);
+		sha256_update(&sha, data + len / 3, len - len / 3);
+		sha256_final(&sha, buf_a);
+		if (memcmp(buf_a, buf_e, sizeof(buf_e)))
+			goto mismatch;
+	}
+
+	for (key_len = 0; key_len <= 100; key_len += 5) {
+		for (len = 0; len <= 130; len += 13) {
+			ossl_hmac_sha256(data, len, data + 100, key_len,
+					 buf_e, &hmac_len);
+
+			hmac_sha256(data + 100, key_len, data, len, buf_a);
+			if (memcmp(buf_a, buf_e, sizeof(buf_e)))
+				goto mismatch;
+
+			hmac_sha256_init(&hmac, data + 100, key_len);
+			hmac_sha256_update(&hmac, data, len / 2);
+			hmac_sha256_update(&hmac, data + len / 2,
+					   len - len / 2);
+			hmac_sha256_final(&hmac, buf_a);
+			if (memcmp(buf_a, buf_e, sizeof(buf_e)))
+				goto mismatch;
+		}
+	}
+
+	ret = s96at_entropy_init(&src, &desc);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	/* The seed is served from the queue, the device is not used */
+	memcpy(src.buf + sizeof(src.buf) - sizeof(drbg_kat_seed),
+	       drbg_kat_seed, sizeof(drbg_kat_seed));
+	src.avail = sizeof(drbg_kat_seed);
+
+	ret = s96at_drbg_init(&drbg, &src, NULL, 0, 0, 0);
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	ret = s96at_drbg_generate(&drbg, out, sizeof(out));
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_drbg_generate(&drbg, out, sizeof(out));
+	CHECK_RES("DRBG", ret, out, ARRAY_LEN(out));
+	if (ret == S96AT_STATUS_OK && memcmp(out, drbg_kat_out, sizeof(out))) {
+		loge("DRBG output does not match the known answer\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+
+	s96at_drbg_cleanup(&drbg);
+cleanup:
+	s96at_entropy_cleanup(&src);
+
+	return ret;
+mismatch:
+	loge("SHA-256 or HMAC differs from OpenSSL, %zu byte key, %zu bytes\n",
+	     key_len, len);
+
+	return S96AT_STATUS_EXEC_ERROR;
+}
+
+static int test_stats(void)
+{
+	uint8_t ret;
+	uint8_t random[S96AT_RANDOM_LEN];
+	struct s96at_stats *stats;
+	const struct s96at_histogram *h;
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_stats_enable(&desc);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED, random);
+	if (ret != S96AT_STATUS_OK)
+		goto disable;
+
+	ret = s96at_stats_snapshot(&desc, stats, true);
+	if (ret != S96AT_STATUS_OK)
+		goto disable;
+
+	h = stats->latency[s96at_stats_index(S96AT_OPCODE_RANDOM)];
+	if (stats->commands[s96at_stats_index(S96AT_OPCODE_RANDOM)] != 1 ||
+	    h[S96AT_STATS_PHASE_WAIT].count != 1 || !stats->bytes_read) {
+		loge("Unexpected counters after one Random command\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto disable;
+	}
+
+	/* The reset leaves nothing behind */
+	ret = s96at_stats_snapshot(&desc, stats, false);
+	if (ret == S96AT_STATUS_OK &&
+	    stats->commands[s96at_stats_index(S96AT_OPCODE_RANDOM)])
+		ret = S96AT_STATUS_EXEC_ERROR;
+disable:
+	s96at_stats_disable(&desc);
+out:
+	free(stats);
+
+	return ret;
+}
+
+static int test_stats_openmetrics(void)
+{
+	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
+	char buf[8192];
+	char small[16];
+	const char *line;
+	unsigned long long value;
+	size_t len;
+	struct s96at_stats *stats;
+	struct s96at_histogram *h;
+
+	stats = calloc(1, sizeof(*stats));
+	if (!stats)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	stats->commands[s96at_stats_index(S96AT_OPCODE_RANDOM)] = 3;
+	stats->wakes = 2;
+	h = &stats->latency[s96at_stats_index(S96AT_OPCODE_RANDOM)]
+			   [S96AT_STATS_PHASE_WAIT];
+	h->count = 2;
+	h->sum_us = 34;
+	h->buckets[16] = 2; /* 16us and 17us */
+
+	len = s96at_stats_openmetrics(stats, "dev0", buf, sizeof(buf));
+	if (len != strlen(buf) || len < 6 || strcmp(buf + len - 6, "# EOF\n")) {
+		loge("Output not terminated by # EOF\n");
+		goto out;
+	}
+
+	line = strstr(buf, "\ns96at_commands_total{device=\"dev0\","
+			   "opcode=\"random\"} ");
+	if (!line || sscanf(strchr(line, '}') + 1, "%llu", &value) != 1 ||
+	    value != 3) {
+		loge("Random command counter not found\n");
+		goto out;
+	}
+
+	line = strstr(buf, "\ns96at_wakes_total{device=\"dev0\"} ");
+	if (!line || sscanf(strchr(line, '}') + 1, "%llu", &value) != 1 ||
+	    value != 2) {
+		loge("Wake counter not found\n");
+		goto out;
+	}
+
+	line = strstr(buf, "\ns96at_command_seconds_bucket{device=\"dev0\","
+			   "opcode=\"random\",phase=\"wait\","
+			   "le=\"0.000018\"} ");
+	if (!line || sscanf(strchr(line, '}') + 1, "%llu", &value) != 1 ||
+	    value != 2) {
+		loge("Latency bucket not found\n");
+		goto out;
+	}
+
+	/* Only commands that ran are listed */
+	if (strstr(buf, "opcode=\"nonce\"")) {
+		loge("Unexpected Nonce counter\n");
+		goto out;
+	}
+
+	/* Truncated output still reports the full length, like snprintf */
+	if (s96at_stats_openmetrics(stats, "dev0", small,
+				    sizeof(small)) != len ||
+	    strlen(small) != sizeof(small) - 1) {
+		loge("Unexpected length of truncated output\n");
+		goto out;
+	}
+
+	ret = S96AT_STATUS_OK;
+out:
+	free(stats);
+
+	return ret;
+}
+
+static int test_stats_percentile(void)
+{
+	size_t i;
+	uint64_t us;
+	struct s96at_histogram h = { 0 };
+	const struct {
+		double pct;
+		uint64_t us;
+	} cases[] = {
+		{ 0, 3 },	/* Linear bucket 3 holds exactly 3us */
+		{ 50, 3 },
+		{ 51, 17 },	/* Bucket 16 holds 16us and 17us */
+		{ 90, 17 },
+		{ 91, 26623 },	/* Bucket 100 holds 24576us to 26623us */
+		{ 100, 26623 },
+	};
+
+	if (s96at_stats_percentile(&h, 50) != 0) {
+		loge("Empty histogram has a percentile\n");
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	h.count = 100;
+	h.buckets[3] = 50;
+	h.buckets[16] = 40;
+	h.buckets[100] = 10;
+
+	for (i = 0; i < ARRAY_LEN(cases); i++) {
+		us = s96at_stats_percentile(&h, cases[i].pct);
+		if (us != cases[i].us) {
+			loge("p%g is %llu, expected %llu\n", cases[i].pct,
+			     (unsigned long long)us,
+			     (unsigned long long)cases[i].us);
+			return S96AT_STATUS_EXEC_ERROR;
+		}
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+static int test_tempkey(void)
+{
+	uint8_t ret;
+	uint8_t slot = 0;
+	uint8_t mode = S96AT_MAC_MODE_1; /* 1st 32 bytes: Slot, 2nd 32 bytes: TempKey */
+	uint64_t *nonces;
+	struct s96at_stats *stats;
+
+	uint8_t buf_1[S96AT_MAC_LEN] = { 0 };
+	uint8_t buf_2[S96AT_MAC_LEN] = { 0 };
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return S96AT_STATUS_EXEC_ERROR;
+	nonces = &stats->commands[s96at_stats_index(S96AT_OPCODE_NONCE)];
+
+	ret = s96at_stats_enable(&desc);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_load_tempkey(&desc, challenge, S96AT_FLAG_NONE, ZONE_DATA, slot);
+	CHECK_RES("Load TempKey", ret, NULL, 0);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_stats_snapshot(&desc, stats, true);
+	if (ret != S96AT_STATUS_OK)
+		goto disable;
+
+	/* TempKey already holds the challenge, so no command is sent */
+	ret = s96at_load_tempkey(&desc, challenge, S96AT_FLAG_NONE, ZONE_DATA, slot);
+	CHECK_RES("Load TempKey (cached)", ret, NULL, 0);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_stats_snapshot(&desc, stats, false);
+	if (ret == S96AT_STATUS_OK && *nonces) {
+		loge("Nonce sent for a cached TempKey\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+	if (ret != S96AT_STATUS_OK)
+		goto disable;
+
+	ret = s96at_get_mac(&desc, mode, slot, NULL, S96AT_FLAG_TEMPKEY_SOURCE_INPUT, buf_1);
+	CHECK_RES("MAC 1", ret, buf_1, ARRAY_LEN(buf_1));
+	if (ret != S96AT_STATUS_OK)
+		goto disable;
+
+	/* MAC has consumed TempKey; the reload must reach the device */
+	ret = s96at_load_tempkey(&desc, challenge, S96AT_FLAG_NONE, ZONE_DATA, slot);
+	CHECK_RES("Load TempKey", ret, NULL, 0);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_stats_snapshot(&desc, stats, false);
+	if (ret == S96AT_STATUS_OK && *nonces != 1) {
+		loge("TempKey not reloaded after MAC\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
+	if (ret != S96AT_STATUS_OK)
+		goto disable;
+
+	ret = s96at_get_mac(&desc, mode, slot, NULL, S96AT_FLAG_TEMPKEY_SOURCE_INPUT, buf_2);
+	CHECK_RES("MAC 2", ret, buf_2, ARRAY_LEN(buf_2));
+	if (ret == S96AT_STATUS_OK)
+		ret = memcmp(buf_1, buf_2, S96AT_MAC_LEN);
+disable:
+	s96at_stats_disable(&desc);
+out:
+	free(stats);
+
+	return ret;
+}
+
+/* Number of wake windows and Random commands in each of them */
+#define VCLOCK_ROUNDS		5
+#define VCLOCK_RANDOMS		10
+
+static int test_virtual_clock(void)
+{
+	uint8_t ret;
+	uint8_t random[S96AT_RANDOM_LEN];
+	struct s96at_desc dev;
+	struct s96at_virtual_clock vc;
+	struct s96at_fault_config cfg;
+	struct s96at_stats *stats;
+	uint64_t t0;
+	uint64_t real_us;
+	uint64_t virtual_us;
+	int i;
+	int n;
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_init_emulator(S96AT_ATSHA204A, 9, &dev);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	/* The clock reaches the device through a wrapper attached first */
+	memset(&cfg, 0, sizeof(cfg));
+	ret = s96at_fault_attach(&dev, &cfg);
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	s96at_clock_virtual_init(&vc, 0);
+	ret = s96at_set_clock(&dev, &vc.clock);
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	/* The commands take as long as on the device, but in virtual time */
+	t0 = stats_now_us();
+	for (i = 0; i < VCLOCK_ROUNDS && ret == S96AT_STATUS_OK; i++) {
+		while (s96at_wake(&dev) != S96AT_STATUS_READY) {};
+		for (n = 0; n < VCLOCK_RANDOMS && ret == S96AT_STATUS_OK; n++)
+			ret = s96at_get_random(&dev, S96AT_RANDOM_MODE_UPDATE_SEED,
+					       random);
+		s96at_idle(&dev);
+	}
+	real_us = stats_now_us() - t0;
+	virtual_us = vc.now_us;
+	if (ret != S96AT_STATUS_OK)
+		goto cleanup;
+
+	logd("%d Random commands: %llu usec virtual, %llu usec real\n",
+	     VCLOCK_ROUNDS * VCLOCK_RANDOMS, (unsigned long long)virtual_us,
+	     (unsigned long long)real_us);
+
+	ret = S96AT_STATUS_EXEC_ERROR;
+	if (virtual_us < VCLOCK_ROUNDS * VCLOCK_RANDOMS * 11000ULL ||
+	    real_us * 10 > virtual_us)
+		goto cleanup;
+
+	/* The watchdog expires on the virtual clock, TempKey is lost */
+	if (s96at_stats_enable(&dev) != S96AT_STATUS_OK)
+		goto cleanup;
+
+	while (s96at_wake(&dev) != S96AT_STATUS_READY) {};
+	if (s96at_load_tempkey(&dev, challenge, S96AT_FLAG_NONE, ZONE_DATA, 0) !=
+	    S96AT_STATUS_OK ||
+	    s96at_load_tempkey(&dev, challenge, S96AT_FLAG_NONE, ZONE_DATA, 0) !=
+	    S96AT_STATUS_OK)
+		goto disable;
+
+	s96at_clock_advance(&vc, S96AT_WATCHDOG_TIME * 1000ULL);
+	if (s96at_get_random(&dev, S96AT_RANDOM_MODE_UPDATE_SEED, random) ==
+	    S96AT_STATUS_OK)
+		goto disable;
+
+	while (s96at_wake(&dev) != S96AT_STATUS_READY) {};
+	if (s96at_load_tempkey(&dev, challenge, S96AT_FLAG_NONE, ZONE_DATA, 0) !=
+	    S96AT_STATUS_OK ||
+	    s96at_stats_snapshot(&dev, stats, false) != S96AT_STATUS_OK)
+		goto disable;
+
+	if (stats->commands[s96at_stats_index(S96AT_OPCODE_NONCE)] == 2)
+		ret = S96AT_STATUS_OK;
+	else
+		loge("%llu Nonce commands sent\n", (unsigned long long)
+		     stats->commands[s96at_stats_index(S96AT_OPCODE_NONCE)]);
+disable:
+	s96at_stats_disable(&dev);
+cleanup:
+	s96at_cleanup(&dev);
+out:
+	free(stats);
+
+	return ret;
+}
+
+#ifdef S96AT_PROVIDER
+/*
+ * The provider runs in a library context of its own, on a device of its own
+ * when emulated and on the test device otherwise.
+ */
+static int test_provider(void)
+{
+	int ret = 1;
+	size_t len;
+	unsigned int hmac_len;
+	unsigned int slot = 0;
+	OSSL_LIB_CTX *libctx;
+	OSSL_PROVIDER *prov = NULL;
+	EVP_RAND *rand = NULL;
+	EVP_RAND_CTX *rctx = NULL;
+	EVP_MAC *mac = NULL;
+	EVP_MAC_CTX *mctx = NULL;
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_uint("slot", &slot),
+		OSSL_PARAM_END
+	};
+
+	uint8_t data[] = "The quick brown fox jumps over the lazy dog";
+	uint8_t buf1[100];
+	uint8_t buf2[100];
+	uint8_t key[32] = { 0 };
+	uint8_t msg[88] = { 0 };
+
+	uint8_t buf_a[S96AT_HMAC_LEN] = { 0 }; /* actual (provider) */
+	uint8_t buf_e[S96AT_HMAC_LEN] = { 0 }; /* expected (openssl) */
+
+	if (emulated)
+		setenv("S96AT_DEVICES", "emulator:1", 1);
+	s96at_idle(&desc);
+
+	libctx = OSSL_LIB_CTX_new();
+	if (libctx)
+		prov = OSSL_PROVIDER_load(libctx, S96AT_PROVIDER);
+	if (!prov) {
+		loge("Could not load %s\n", S96AT_PROVIDER);
+		goto out;
+	}
+
+	rand = EVP_RAND_fetch(libctx, "S96AT", NULL);
+	if (rand)
+		rctx = EVP_RAND_CTX_new(rand, NULL);
+	if (!rctx || !EVP_RAND_instantiate(rctx, 256, 0, NULL, 0, NULL) ||
+	    !EVP_RAND_generate(rctx, buf1, sizeof(buf1), 256, 0, NULL, 0) ||
+	    !EVP_RAND_generate(rctx, buf2, sizeof(buf2), 256, 0, NULL, 0))
+		goto out;
+	hexdump("EVP_RAND", buf1, ARRAY_LEN(buf1));
+
+	if (!memcmp(buf1, buf2, sizeof(buf1)))
+		goto out;
+
+	mac = EVP_MAC_fetch(libctx, "S96AT-HMAC", NULL);
+	if (mac)
+		mctx = EVP_MAC_CTX_new(mac);
+	if (!mctx || !EVP_MAC_init(mctx, NULL, 0, params) ||
+	    !EVP_MAC_update(mctx, data, sizeof(data)) ||
+	    !EVP_MAC_final(mctx, buf_a, &len, sizeof(buf_a)))
+		goto out;
+	hexdump("EVP_MAC", buf_a, len);
+
+	/* Same message as in test_hmac, with the digest of data in TempKey */
+	ossl_sha256(data, sizeof(data), msg + 32);
+	msg[64] = 0x11;		/* Opcode */
+	msg[65] = 0x04;		/* Mode */
+	msg[66] = slot;		/* SlotID */
+	msg[79] = 0xee;		/* SN[8] */
+	msg[84] = 0x01;		/* SN[0:1] */
+	msg[85] = 0x23;
+
+	ossl_hmac_sha256(msg, sizeof(msg), key, sizeof(key), buf_e, &hmac_len);
+
+	ret = len != S96AT_HMAC_LEN || memcmp(buf_a, buf_e, S96AT_HMAC_LEN);
+out:
+	EVP_MAC_CTX_free(mctx);
+	EVP_MAC_free(mac);
+	EVP_RAND_CTX_free(rctx);
+	EVP_RAND_free(rand);
+	if (prov)
+		OSSL_PROVIDER_unload(prov);
+	OSSL_LIB_CTX_free(libctx);
+
+	/* The provider may have used the test device */
+	s96at_invalidate_tempkey(&desc);
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	return ret;
+}
+#endif
+
 static int test_read_config(void)
 {
 	uint8_t ret;
@@ -814,6 +2361,514 @@ static int test_read_otp(void)
 	return memcmp(buf_a, buf_e, ARRAY_LEN(buf_e));
 }
 
+#define DAEMON_ROUNDS 20
+
+static void *daemon_server(void *arg)
+{
+	server_run(arg);
+
+	return NULL;
+}
+
+/* Wake, Random and idle, over and over again, next to the other client */
+static void *daemon_client(void *arg)
+{
+	struct s96at_desc *d = arg;
+	uint8_t random[S96AT_RANDOM_LEN];
+	intptr_t failed = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < DAEMON_ROUNDS; i++) {
+		for (j = 0; j < 10; j++)
+			if (s96at_wake(d) == S96AT_STATUS_READY)
+				break;
+
+		if (s96at_get_random(d, S96AT_RANDOM_MODE_UPDATE_SEED,
+				     random) != S96AT_STATUS_OK)
+			failed++;
+
+		s96at_idle(d);
+	}
+
+	return (void *)failed;
+}
+
+/*
+ * A server on two emulated devices of its own, with clients over the socket
+ * and over a ring. Each kind of client runs the HMAC and Read tests in turn
+ * and then both kinds run side by side.
+ */
+static int test_daemon(void)
+{
+	int ret = 1;
+	int i;
+	void *failed;
+	char path[64];
+	pthread_t server;
+	pthread_t clients[2];
+	struct server *srv;
+	struct s96at_desc saved = desc;
+	struct s96at_desc devs[2];
+	struct s96at_desc remote[2];
+	struct io_interface *ioifs[2];
+
+	memset(remote, 0, sizeof(remote));
+	snprintf(path, sizeof(path), "/tmp/s96atd-test-%d.sock", getpid());
+
+	for (i = 0; i < 2; i++) {
+		if (s96at_init_emulator(S96AT_ATSHA204A, 2 + i, &devs[i]) !=
+		    S96AT_STATUS_OK)
+			return 1;
+		atsha204a_personalize(devs[i].ioif);
+		ioifs[i] = devs[i].ioif;
+	}
+
+	srv = server_create(path, ioifs, 2);
+	if (!srv || pthread_create(&server, NULL, daemon_server, srv))
+		goto out;
+
+	for (i = 0; i < 2; i++) {
+		/* The remote TempKey shadow has to be the one of desc */
+		if (s96at_init_daemon(S96AT_ATSHA204A, path, i,
+				      &desc) != S96AT_STATUS_OK)
+			break;
+
+		while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+		ret = test_hmac() || test_read_data();
+		s96at_idle(&desc);
+		s96at_cleanup(&desc);
+		if (ret)
+			break;
+	}
+
+	for (i = 0; !ret && i < 2; i++)
+		if (s96at_init_daemon(S96AT_ATSHA204A, path, i,
+				      &remote[i]) != S96AT_STATUS_OK)
+			ret = 1;
+
+	for (i = 0; !ret && i < 2; i++)
+		pthread_create(&clients[i], NULL, daemon_client, &remote[i]);
+
+	for (i = 0; !ret && i < 2; i++) {
+		pthread_join(clients[i], &failed);
+		if (failed)
+			ret = 1;
+	}
+
+	for (i = 0; i < 2; i++)
+		if (remote[i].ioif)
+			s96at_cleanup(&remote[i]);
+
+	server_stop(srv);
+	pthread_join(server, NULL);
+out:
+	server_free(srv);
+	for (i = 0; i < 2; i++)
+		s96at_cleanup(&devs[i]);
+	desc = saved;
+
+	return ret;
+}
+
+/*
+ * Connects to the server at path and hands it a ring of size bytes with the
+ * given seals. Returns the status the server answers, or -1 on no answer.
+ */
+static int daemon_offer_ring(const char *path, size_t size, int seals)
+{
+	int ret = -1;
+	int sock;
+	int fd;
+	struct s96atd_msg msg;
+	struct sockaddr_un addr;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctrl;
+	struct iovec iov = {
+		.iov_base = &msg,
+		.iov_len = S96ATD_MSG_HDR_LEN,
+	};
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctrl.buf,
+		.msg_controllen = sizeof(ctrl.buf),
+	};
+
+	fd = syscall(SYS_memfd_create, "s96atd-test", MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size) || (seals && fcntl(fd, F_ADD_SEALS, seals)))
+		goto close_fd;
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (sock < 0)
+		goto close_fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)))
+		goto close_sock;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = S96ATD_RING;
+	memset(&ctrl, 0, sizeof(ctrl));
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+	if (sendmsg(sock, &mh, MSG_NOSIGNAL) == S96ATD_MSG_HDR_LEN &&
+	    recv(sock, &msg, sizeof(msg), 0) == S96ATD_MSG_HDR_LEN)
+		ret = msg.ret;
+close_sock:
+	close(sock);
+close_fd:
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * The server only maps rings that are large enough and can no longer be
+ * resized, and keeps serving other clients after turning one down.
+ */
+static int test_daemon_ring(void)
+{
+	int ret = 1;
+	int i;
+	char path[64];
+	pthread_t server;
+	uint8_t random[S96AT_RANDOM_LEN];
+	struct server *srv;
+	struct s96at_desc dev;
+	struct s96at_desc remote;
+	struct io_interface *ioif;
+	const int sealed = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+	const struct {
+		size_t size;
+		int seals;
+		int ret;
+	} rings[] = {
+		{ 0, sealed, STATUS_EXEC_ERROR },
+		{ sizeof(struct s96atd_ring) / 2, sealed, STATUS_EXEC_ERROR },
+		{ sizeof(struct s96atd_ring), 0, STATUS_EXEC_ERROR },
+		{ sizeof(struct s96atd_ring), F_SEAL_GROW, STATUS_EXEC_ERROR },
+		{ sizeof(struct s96atd_ring), sealed, STATUS_OK },
+	};
+
+	memset(&remote, 0, sizeof(remote));
+	snprintf(path, sizeof(path), "/tmp/s96atd-ring-%d.sock", getpid());
+
+	if (s96at_init_emulator(S96AT_ATSHA204A, 13, &dev) != S96AT_STATUS_OK)
+		return 1;
+	atsha204a_personalize(dev.ioif);
+	ioif = dev.ioif;
+
+	srv = server_create(path, &ioif, 1);
+	if (!srv || pthread_create(&server, NULL, daemon_server, srv))
+		goto out;
+
+	for (i = 0; i < ARRAY_LEN(rings); i++) {
+		if (daemon_offer_ring(path, rings[i].size,
+				      rings[i].seals) != rings[i].ret) {
+			loge("Ring %d not answered as expected\n", i);
+			goto stop;
+		}
+	}
+
+	if (s96at_init_daemon(S96AT_ATSHA204A, path, true,
+			      &remote) != S96AT_STATUS_OK)
+		goto stop;
+
+	while (s96at_wake(&remote) != S96AT_STATUS_READY) {};
+	ret = s96at_get_random(&remote, S96AT_RANDOM_MODE_UPDATE_SEED, random);
+	s96at_idle(&remote);
+	s96at_cleanup(&remote);
+stop:
+	server_stop(srv);
+	pthread_join(server, NULL);
+out:
+	server_free(srv);
+	s96at_cleanup(&dev);
+
+	return ret;
+}
+
+#define PRIORITY_SHA_BLOCKS 40
+
+struct priority_bulk {
+	struct s96at_desc desc;
+	uint8_t buf[PRIORITY_SHA_BLOCKS * 64];
+	uint8_t hash[S96AT_SHA_LEN];
+	uint8_t ret;
+};
+
+/* A firmware image sized hash, as a bulk client */
+static void *priority_bulk(void *arg)
+{
+	struct priority_bulk *b = arg;
+
+	b->ret = s96at_set_priority(&b->desc, S96AT_PRIORITY_BULK, 1);
+	if (b->ret != S96AT_STATUS_OK)
+		return NULL;
+
+	while (s96at_wake(&b->desc) != S96AT_STATUS_READY) {};
+	b->ret = s96at_get_sha(&b->desc, b->buf, sizeof(b->buf),
+			       sizeof(b->buf) - 64, b->hash);
+	s96at_idle(&b->desc);
+
+	return NULL;
+}
+
+/*
+ * A critical client runs MACs on the single device of a server while a
+ * bulk client hashes a long message. The MACs go in between the blocks of
+ * the hash rather than after it, and the hash comes out right.
+ */
+static int test_daemon_priority(void)
+{
+	int ret = 1;
+	int i;
+	char path[64];
+	pthread_t server;
+	pthread_t bulk;
+	uint64_t t0;
+	uint64_t latency_us;
+	uint64_t max_us = 0;
+	uint8_t mac[S96AT_MAC_LEN];
+	uint8_t mac_e[S96AT_MAC_LEN];
+	uint8_t hash_e[S96AT_SHA_LEN];
+	struct server *srv;
+	struct s96at_desc dev;
+	struct s96at_desc crit;
+	struct priority_bulk b;
+	struct io_interface *ioif;
+	struct s96atd_class_stats stats[S96AT_PRIORITY_NUM];
+
+	memset(&crit, 0, sizeof(crit));
+	memset(&b, 0, sizeof(b));
+	for (i = 0; i < sizeof(b.buf); i++)
+		b.buf[i] = i;
+	snprintf(path, sizeof(path), "/tmp/s96atd-prio-%d.sock", getpid());
+
+	if (s96at_init_emulator(S96AT_ATSHA204A, 7, &dev) != S96AT_STATUS_OK)
+		return 1;
+	atsha204a_personalize(dev.ioif);
+	ioif = dev.ioif;
+
+	srv = server_create(path, &ioif, 1);
+	if (!srv || pthread_create(&server, NULL, daemon_server, srv))
+		goto out;
+
+	if (s96at_init_daemon(S96AT_ATSHA204A, path, false,
+			      &crit) != S96AT_STATUS_OK ||
+	    s96at_init_daemon(S96AT_ATSHA204A, path, false,
+			      &b.desc) != S96AT_STATUS_OK)
+		goto stop;
+
+	/* Only the clients the server allows are critical */
+	server_allow_critical(srv, (uid_t)-1, (gid_t)-1);
+	if (s96at_set_priority(&crit, S96AT_PRIORITY_CRITICAL,
+			       1) == S96AT_STATUS_OK ||
+	    s96at_set_priority(&crit, S96AT_PRIORITY_NORMAL,
+			       2) != S96AT_STATUS_OK) {
+		loge("Critical priority not restricted\n");
+		goto stop;
+	}
+
+	server_allow_critical(srv, geteuid(), (gid_t)-1);
+	if (s96at_set_priority(&crit, S96AT_PRIORITY_CRITICAL,
+			       1) != S96AT_STATUS_OK)
+		goto stop;
+
+	/* The expected MAC, on a device of its own */
+	while (s96at_wake(&crit) != S96AT_STATUS_READY) {};
+	ret = s96at_get_mac(&crit, S96AT_MAC_MODE_0, 0, challenge,
+			    S96AT_FLAG_TEMPKEY_SOURCE_INPUT, mac_e);
+	s96at_idle(&crit);
+	if (ret != S96AT_STATUS_OK)
+		goto stop;
+
+	ret = 1;
+	if (pthread_create(&bulk, NULL, priority_bulk, &b))
+		goto stop;
+
+	/* The hash takes 40 blocks of 22 msec */
+	for (i = 0; i < 3; i++) {
+		usleep(100000);
+
+		t0 = stats_now_us();
+		while (s96at_wake(&crit) != S96AT_STATUS_READY) {};
+		ret = s96at_get_mac(&crit, S96AT_MAC_MODE_0, 0, challenge,
+				    S96AT_FLAG_TEMPKEY_SOURCE_INPUT, mac);
+		s96at_idle(&crit);
+		latency_us = stats_now_us() - t0;
+		if (latency_us > max_us)
+			max_us = latency_us;
+
+		if (ret != S96AT_STATUS_OK || memcmp(mac, mac_e, sizeof(mac)))
+			ret = 1;
+		if (ret)
+			break;
+	}
+
+	pthread_join(bulk, NULL);
+	if (ret || b.ret != S96AT_STATUS_OK)
+		goto stop;
+
+	ossl_sha256(b.buf, sizeof(b.buf) - 64, hash_e);
+	ret = memcmp(b.hash, hash_e, sizeof(hash_e));
+	CHECK_RES("SHA (bulk)", ret, b.hash, ARRAY_LEN(b.hash));
+
+	server_stats(srv, stats, false);
+	logd("Critical MAC took %llu us at most, p99 wait %llu us\n",
+	     (unsigned long long)max_us,
+	     (unsigned long long)s96at_stats_percentile(&stats[S96AT_PRIORITY_CRITICAL].wait, 99));
+
+	/* Far less than what is left of the hash when a MAC comes along */
+	if (max_us > 200000 || stats[S96AT_PRIORITY_BULK].preempted < 3 ||
+	    stats[S96AT_PRIORITY_CRITICAL].depth)
+		ret = 1;
+stop:
+	if (crit.ioif)
+		s96at_cleanup(&crit);
+	if (b.desc.ioif)
+		s96at_cleanup(&b.desc);
+	server_stop(srv);
+	pthread_join(server, NULL);
+out:
+	server_free(srv);
+	s96at_cleanup(&dev);
+
+	/* The hash outlasts the watchdog of the test device */
+	s96at_idle(&desc);
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	return ret;
+}
+
+static int test_record(void)
+{
+	uint8_t ret;
+	int fd;
+	char path[] = "/tmp/s96at-capture-XXXXXX";
+	uint8_t random[2][S96AT_RANDOM_LEN];
+	uint8_t config[2][32];
+	struct s96at_desc replay;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return S96AT_STATUS_EXEC_ERROR;
+	close(fd);
+
+	ret = s96at_record_start(&desc, path);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED, random[0]);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_read_config(&desc, 0, config[0], sizeof(config[0]));
+
+	if (s96at_record_stop(&desc) != S96AT_STATUS_OK || ret != S96AT_STATUS_OK) {
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto out;
+	}
+
+	/* The same calls get the same responses, without waiting for them */
+	ret = s96at_init_replay(S96AT_ATSHA204A, path, S96AT_REPLAY_FAST, &replay);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_get_random(&replay, S96AT_RANDOM_MODE_UPDATE_SEED, random[1]);
+	CHECK_RES("Random (replay)", ret, random[1], ARRAY_LEN(random[1]));
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_read_config(&replay, 0, config[1], sizeof(config[1]));
+
+	if (ret == S96AT_STATUS_OK &&
+	    (memcmp(random[0], random[1], sizeof(random[0])) ||
+	     memcmp(config[0], config[1], sizeof(config[0]))))
+		ret = S96AT_STATUS_EXEC_ERROR;
+
+	/* There is nothing left to play back */
+	if (ret == S96AT_STATUS_OK &&
+	    s96at_get_random(&replay, S96AT_RANDOM_MODE_UPDATE_SEED,
+			     random[1]) == S96AT_STATUS_OK)
+		ret = S96AT_STATUS_EXEC_ERROR;
+
+	s96at_cleanup(&replay);
+out:
+	unlink(path);
+
+	return ret;
+}
+
+/* A read that fails is recorded, and played back, as failing */
+static int test_record_errors(void)
+{
+	uint8_t ret;
+	int fd;
+	char path[] = "/tmp/s96at-capture-XXXXXX";
+	uint8_t random[2][S96AT_RANDOM_LEN];
+	struct s96at_desc replay;
+	struct s96at_fault_config cfg = {
+		.script = "nack@1",
+	};
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return S96AT_STATUS_EXEC_ERROR;
+	close(fd);
+
+	ret = s96at_fault_attach(&desc, &cfg);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_record_start(&desc, path);
+	if (ret != S96AT_STATUS_OK) {
+		s96at_fault_detach(&desc);
+		goto out;
+	}
+
+	/* The response of the first command is not acknowledged */
+	ret = S96AT_STATUS_EXEC_ERROR;
+	if (s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED,
+			     random[0]) != S96AT_STATUS_OK)
+		ret = s96at_get_random(&desc, S96AT_RANDOM_MODE_UPDATE_SEED,
+				       random[0]);
+
+	if (s96at_record_stop(&desc) != S96AT_STATUS_OK)
+		ret = S96AT_STATUS_EXEC_ERROR;
+	s96at_fault_detach(&desc);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_init_replay(S96AT_ATSHA204A, path, S96AT_REPLAY_FAST, &replay);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = S96AT_STATUS_EXEC_ERROR;
+	if (s96at_get_random(&replay, S96AT_RANDOM_MODE_UPDATE_SEED,
+			     random[1]) != S96AT_STATUS_OK)
+		ret = s96at_get_random(&replay, S96AT_RANDOM_MODE_UPDATE_SEED,
+				       random[1]);
+
+	if (ret == S96AT_STATUS_OK &&
+	    memcmp(random[0], random[1], sizeof(random[0])))
+		ret = S96AT_STATUS_EXEC_ERROR;
+
+	s96at_cleanup(&replay);
+out:
+	unlink(path);
+
+	return ret;
+}
+
 static int test_reset(void)
 {
 	uint8_t ret;
@@ -839,14 +2894,26 @@ int main(int argc, char *argv[])
 	uint32_t tests_fail = 0;
 
 	struct atsha204a_testcase tests[] = {
+		{"Attest", test_attest},
+		{"Batch", test_batch},
+		{"Batch: Errors", test_batch_errors},
+		{"Bundle", test_bundle},
+		{"Bus", test_bus},
 		{"CheckMAC: Mode 0", test_checkmac_mode0},
 		{"CheckMAC: Mode 1", test_checkmac_mode1},
 		{"CheckMAC: Mode 2", test_checkmac_mode2},
 		{"CheckMAC: Mode 3", test_checkmac_mode3},
+		{"Daemon", test_daemon},
+		{"Daemon: Priority", test_daemon_priority},
+		{"Daemon: Ring", test_daemon_ring},
 		{"DeriveKey", test_derivekey},
 		{"DevRev", test_devrev},
+		{"DRBG", test_drbg},
+		{"DRBG: Known answer", test_drbg_kat},
+		{"Faults", test_faults},
 		{"GenDig", test_gendig},
 		{"HMAC", test_hmac},
+		{"Log", test_log},
 		{"MAC: Mode 0", test_mac_mode0},
 		{"MAC: Mode 1", test_mac_mode1},
 		{"MAC: Mode 2", test_mac_mode2},
@@ -854,6 +2921,11 @@ int main(int argc, char *argv[])
 		{"Nonce: Mode Random", test_nonce_random},
 		{"Nonce: Mode Random No Seed", test_nonce_random_no_seed},
 		{"Nonce: Mode Passthrough", test_nonce_passthrough},
+#ifdef S96AT_PROVIDER
+		{"Provider", test_provider},
+#endif
+		{"Provisioning plan", test_plan},
+		{"Provisioning plan: Unlocked", test_plan_unlocked},
 		{"Random: Update seed", test_random},
 		{"Random: No update seed", test_random_no_seed},
 		{"Read: Config (32 bytes)", test_read_config},
@@ -861,14 +2933,28 @@ int main(int argc, char *argv[])
 		{"Read: Data (32 bytes)", test_read_data},
 		{"Read: Data (4 bytes)", test_read_data_4byte},
 		{"Read: OTP", test_read_otp},
+		{"Record and replay", test_record},
+		{"Record and replay: Errors", test_record_errors},
 		{"Reset", test_reset},
+		{"Retry", test_retry},
 		{"SHA", test_sha},
+		{"Slot config", test_slot_config},
+		{"Stats", test_stats},
+		{"Stats: OpenMetrics", test_stats_openmetrics},
+		{"Stats: Percentile", test_stats_percentile},
+		{"TempKey", test_tempkey},
+		{"Virtual clock", test_virtual_clock},
 		{0, NULL}
 	};
 
-	printf("ATSHA204A on %s @ addr 0x%x\n", I2C_DEVICE, ATSHA204A_ADDR);
-
-	ret = s96at_init(S96AT_ATSHA204A, IO_I2C_LINUX, &desc);
+	emulated = argc > 1 && !strcmp(argv[1], "-e");
+	if (emulated) {
+		printf("Emulated ATSHA204A\n");
+		ret = s96at_init(S96AT_ATSHA204A, S96AT_IO_EMULATOR, &desc);
+	} else {
+		printf("ATSHA204A on %s @ addr 0x%x\n", I2C_DEVICE, ATSHA204A_ADDR);
+		ret = s96at_init(S96AT_ATSHA204A, IO_I2C_LINUX, &desc);
+	}
 	if (ret != S96AT_STATUS_OK) {
 	    logd("Could not initialize the device\n");
 	    goto out;
@@ -878,6 +2964,19 @@ int main(int argc, char *argv[])
 	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
 	logd("ATSHA204A is awake\n");
 
+	/* The emulated device starts out factory fresh */
+	if (emulated) {
+		s96at_idle(&desc);
+		ret = atsha204a_personalize(desc.ioif);
+		if (ret != S96AT_STATUS_OK) {
+			loge("Could not personalize the device\n");
+			goto out;
+		}
+
+		s96at_idle(&desc);
+		while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+	}
+
 	for (int i = 0 ; tests[i].func != NULL; i++) {
 		logd("\n - %s -\n", tests[i].name);
 		ret = tests[i].func();
@@ -900,9 +2999,9 @@ int main(int argc, char *argv[])
 	printf("All done. Total: %d Passed: %d Failed: %d\n",
 	       tests_total, tests_pass, tests_fail);
 out:
-	ret = s96at_cleanup(&desc);
-	if (ret != S96AT_STATUS_OK)
+	if (s96at_cleanup(&desc) != S96AT_STATUS_OK)
 		logd("Couldn't close the device\n");
-	return ret;
+
+	return ret || tests_fail ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
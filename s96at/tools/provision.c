@@ -0,0 +1,595 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <device.h>
+#include <s96at.h>
+
+#define MAX_BUSES		16
+#define MAX_DEVICES		32 /* per bus */
+#define WAKE_RETRIES		10
+
+/* A device that does not answer the second wake is not there */
+#define SCAN_WAKE_RETRIES	2
+#define SCAN_FIRST_ADDR		0x08
+#define SCAN_LAST_ADDR		0x77
+
+#define PROGRESS_INTERVAL_MS	250
+
+#define SN_HEX_LEN		(2 * S96AT_SERIAL_NUMBER_LEN)
+
+enum result {
+	RESULT_OK,		/* provisioned */
+	RESULT_UNCHANGED,	/* already matched the profile */
+	RESULT_SKIPPED,		/* done according to the journal */
+	RESULT_FAILED
+};
+
+static const char *result_str[] = {
+	[RESULT_OK] = "ok",
+	[RESULT_UNCHANGED] = "unchanged",
+	[RESULT_SKIPPED] = "skipped",
+	[RESULT_FAILED] = "failed",
+};
+
+struct bus {
+	char name[64];
+	const char *path;	/* NULL for emulated buses */
+	unsigned int index;
+	uint8_t addrs[MAX_DEVICES];
+	unsigned int num_addrs;
+	unsigned int num_emulated;
+	pthread_t thread;
+	bool started;
+	/* Updated by the worker, read by the progress report */
+	unsigned int total;
+	unsigned int done;
+	unsigned int failed;
+	bool finished;
+};
+
+static struct bus buses[MAX_BUSES];
+static unsigned int num_buses;
+
+static struct s96at_profile profile;
+static struct s96at_bundle bundle;
+static bool use_bundle;
+
+static FILE *journal;
+static char (*journal_done)[SN_HEX_LEN + 1];
+static size_t journal_num;
+static size_t journal_cap;
+
+static FILE *results;
+
+/* Serializes the journal and the result records */
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile sig_atomic_t stop;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] -p profile\n"
+		"  -p path             provisioning profile\n"
+		"  -b path[@addr,...]  I2C bus and device addresses, may be\n"
+		"                      repeated. The bus is scanned when no\n"
+		"                      address is given\n"
+		"  -e count            add a bus of count emulated devices, may\n"
+		"                      be repeated\n"
+		"  -k path             take the Data and OTP zones from the\n"
+		"                      records of a key bundle\n"
+		"  -j path             journal (default s96at-provision.journal)\n"
+		"  -o path             append result records to path instead\n"
+		"                      of writing them to stdout\n"
+		"  -q                  do not show progress\n",
+		prog);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static struct bus *new_bus(void)
+{
+	struct bus *b;
+
+	if (num_buses == MAX_BUSES) {
+		fprintf(stderr, "Too many buses, max %d\n", MAX_BUSES);
+		return NULL;
+	}
+
+	b = &buses[num_buses];
+	b->index = num_buses++;
+
+	return b;
+}
+
+static int parse_bus(char *spec)
+{
+	char *at;
+	char *addr;
+	char *save;
+	struct bus *b = new_bus();
+
+	if (!b)
+		return -1;
+
+	at = strchr(spec, '@');
+	if (at)
+		*at = '\0';
+
+	b->path = spec;
+	snprintf(b->name, sizeof(b->name), "%s", spec);
+
+	if (!at)
+		return 0;
+
+	for (addr = strtok_r(at + 1, ",", &save); addr;
+	     addr = strtok_r(NULL, ",", &save)) {
+		if (b->num_addrs == MAX_DEVICES) {
+			fprintf(stderr, "Too many devices on %s, max %d\n",
+				spec, MAX_DEVICES);
+			return -1;
+		}
+		b->addrs[b->num_addrs++] = strtoul(addr, NULL, 0);
+	}
+
+	return 0;
+}
+
+static int parse_emulated(const char *count)
+{
+	struct bus *b = new_bus();
+
+	if (!b)
+		return -1;
+
+	b->num_emulated = strtoul(count, NULL, 0);
+	if (!b->num_emulated || b->num_emulated > MAX_DEVICES) {
+		fprintf(stderr, "Emulated buses hold 1-%d devices\n", MAX_DEVICES);
+		return -1;
+	}
+
+	snprintf(b->name, sizeof(b->name), "emu%u", b->index);
+
+	return 0;
+}
+
+static bool journal_is_done(const char *sn)
+{
+	size_t i;
+
+	for (i = 0; i < journal_num; i++)
+		if (!strcmp(journal_done[i], sn))
+			return true;
+
+	return false;
+}
+
+static int journal_mark_done(const char *sn)
+{
+	void *p;
+
+	if (journal_is_done(sn))
+		return 0;
+
+	if (journal_num == journal_cap) {
+		journal_cap = journal_cap ? 2 * journal_cap : 64;
+		p = realloc(journal_done, journal_cap * sizeof(*journal_done));
+		if (!p)
+			return -1;
+		journal_done = p;
+	}
+
+	snprintf(journal_done[journal_num++], SN_HEX_LEN + 1, "%s", sn);
+
+	return 0;
+}
+
+/*
+ * The journal is a line per event, "<serial> start|done|failed". Only the
+ * devices that reached "done" are skipped on the next run, a line cut short
+ * by a crash is ignored.
+ */
+static int journal_open(const char *path)
+{
+	char line[128];
+	char sn[SN_HEX_LEN + 1];
+	char state[16];
+
+	journal = fopen(path, "a+");
+	if (!journal) {
+		perror("journal");
+		return -1;
+	}
+
+	rewind(journal);
+
+	while (fgets(line, sizeof(line), journal)) {
+		if (!strchr(line, '\n'))
+			continue;
+
+		if (sscanf(line, "%18s %15s", sn, state) != 2 ||
+		    strlen(sn) != SN_HEX_LEN)
+			continue;
+
+		if (!strcmp(state, "done") && journal_mark_done(sn))
+			return -1;
+	}
+
+	return 0;
+}
+
+static void journal_append(const char *sn, const char *state)
+{
+	fprintf(journal, "%s %s\n", sn, state);
+	fflush(journal);
+	fsync(fileno(journal));
+}
+
+static void record(const struct bus *b, uint8_t addr, const char *sn,
+		   enum result res, uint8_t status, const struct s96at_plan *plan,
+		   uint64_t ms)
+{
+	pthread_mutex_lock(&out_lock);
+
+	fprintf(results,
+		"sn=%s bus=%s addr=0x%02x result=%s status=0x%02x steps=%zu "
+		"config_crc=0x%04x data_crc=0x%04x time_ms=%llu\n",
+		sn, b->name, addr, result_str[res], status, plan->num_steps,
+		plan->config_crc, plan->data_crc, (unsigned long long)ms);
+	fflush(results);
+
+	pthread_mutex_unlock(&out_lock);
+}
+
+static uint8_t read_serial(struct s96at_desc *desc, uint8_t *buf, char *sn)
+{
+	int i;
+	uint8_t ret;
+
+	for (i = 0; i < WAKE_RETRIES; i++) {
+		if (s96at_wake(desc) == S96AT_STATUS_READY)
+			break;
+	}
+
+	if (i == WAKE_RETRIES)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_get_serialnbr(desc, buf);
+	s96at_idle(desc);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	for (i = 0; i < S96AT_SERIAL_NUMBER_LEN; i++)
+		sprintf(sn + 2 * i, "%02x", buf[i]);
+
+	return S96AT_STATUS_OK;
+}
+
+/*
+ * Bring one device to the state of the profile. The plan is built from the
+ * locks read back from the device, so a device that was interrupted after
+ * locking a zone is never asked to lock it again.
+ */
+static enum result provision(struct bus *b, uint8_t addr,
+			     struct s96at_desc *desc)
+{
+	char sn[SN_HEX_LEN + 1] = "unknown";
+	uint8_t serial[S96AT_SERIAL_NUMBER_LEN];
+	enum result res = RESULT_FAILED;
+	uint8_t ret;
+	uint64_t start = now_ms();
+	struct s96at_plan plan;
+	const struct s96at_bundle_record *rec = NULL;
+
+	memset(&plan, 0, sizeof(plan));
+
+	ret = read_serial(desc, serial, sn);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	pthread_mutex_lock(&out_lock);
+	if (journal_is_done(sn))
+		res = RESULT_SKIPPED;
+	else
+		journal_append(sn, "start");
+	pthread_mutex_unlock(&out_lock);
+
+	if (res == RESULT_SKIPPED)
+		goto out;
+
+	if (use_bundle) {
+		ret = s96at_bundle_find(&bundle, serial, &rec);
+		if (ret == S96AT_STATUS_OK)
+			ret = s96at_plan_build_bundle(desc, &profile, rec, &plan);
+	} else {
+		ret = s96at_plan_build(desc, &profile, &plan);
+	}
+
+	if (ret == S96AT_STATUS_OK && plan.num_steps)
+		ret = s96at_plan_run(desc, &plan);
+
+	if (ret == S96AT_STATUS_OK)
+		res = plan.num_steps ? RESULT_OK : RESULT_UNCHANGED;
+
+	/*
+	 * The keys are on the device, they are not needed anymore. A device
+	 * that was locked already did not get them, so they are kept.
+	 */
+	if (rec && res == RESULT_OK && s96at_bundle_wipe(&bundle, rec))
+		fprintf(stderr, "%s: could not wipe the bundle record\n", sn);
+
+	pthread_mutex_lock(&out_lock);
+	if (res == RESULT_FAILED) {
+		journal_append(sn, "failed");
+	} else {
+		journal_append(sn, "done");
+		if (journal_mark_done(sn))
+			fprintf(stderr, "%s: out of memory for the journal\n", sn);
+	}
+	pthread_mutex_unlock(&out_lock);
+out:
+	record(b, addr, sn, res, ret, &plan, now_ms() - start);
+	s96at_plan_cleanup(&plan);
+
+	return res;
+}
+
+static bool probe(struct s96at_desc *desc)
+{
+	int i;
+
+	for (i = 0; i < SCAN_WAKE_RETRIES; i++) {
+		if (s96at_wake(desc) == S96AT_STATUS_READY) {
+			s96at_idle(desc);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Devices on a bus share the wires, so they are provisioned one after the
+ * other. Note that a wake pulse wakes all of them, the ones not addressed
+ * go back to sleep when their watchdog expires.
+ */
+static void *bus_worker(void *arg)
+{
+	struct bus *b = arg;
+	struct s96at_desc descs[MAX_DEVICES];
+	uint8_t addrs[MAX_DEVICES];
+	unsigned int num = 0;
+	unsigned int i;
+	unsigned int addr;
+	uint8_t ret;
+
+	if (b->num_emulated) {
+		for (i = 0; i < b->num_emulated; i++) {
+			ret = s96at_init_emulator(S96AT_ATSHA204A,
+						  (b->index + 1) << 16 | i,
+						  &descs[num]);
+			if (ret == S96AT_STATUS_OK)
+				addrs[num++] = ATSHA204A_ADDR;
+		}
+	} else if (b->num_addrs) {
+		for (i = 0; i < b->num_addrs; i++) {
+			ret = s96at_init_i2c(S96AT_ATSHA204A, b->path, b->addrs[i],
+					     &descs[num]);
+			if (ret == S96AT_STATUS_OK)
+				addrs[num++] = b->addrs[i];
+			else
+				fprintf(stderr, "%s@0x%02x: could not initialize the device\n",
+					b->path, b->addrs[i]);
+		}
+	} else {
+		for (addr = SCAN_FIRST_ADDR;
+		     addr <= SCAN_LAST_ADDR && num < MAX_DEVICES && !stop; addr++) {
+			if (s96at_init_i2c(S96AT_ATSHA204A, b->path, addr,
+					   &descs[num]) != S96AT_STATUS_OK)
+				continue;
+
+			if (probe(&descs[num]))
+				addrs[num++] = addr;
+			else
+				s96at_cleanup(&descs[num]);
+		}
+	}
+
+	__atomic_store_n(&b->total, num, __ATOMIC_RELAXED);
+
+	for (i = 0; i < num; i++) {
+		if (!stop) {
+			if (provision(b, addrs[i], &descs[i]) == RESULT_FAILED)
+				__atomic_add_fetch(&b->failed, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&b->done, 1, __ATOMIC_RELAXED);
+		}
+
+		s96at_cleanup(&descs[i]);
+	}
+
+	__atomic_store_n(&b->finished, true, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+static bool progress(bool show)
+{
+	unsigned int i;
+	unsigned int done = 0;
+	unsigned int total = 0;
+	unsigned int failed = 0;
+	bool finished = true;
+	struct bus *b;
+
+	for (i = 0; i < num_buses; i++) {
+		b = &buses[i];
+		if (b->started &&
+		    !__atomic_load_n(&b->finished, __ATOMIC_ACQUIRE))
+			finished = false;
+		done += __atomic_load_n(&b->done, __ATOMIC_RELAXED);
+		total += __atomic_load_n(&b->total, __ATOMIC_RELAXED);
+		failed += __atomic_load_n(&b->failed, __ATOMIC_RELAXED);
+	}
+
+	if (show) {
+		fprintf(stderr, "\r");
+		for (i = 0; i < num_buses && num_buses <= 4; i++)
+			fprintf(stderr, "%s %u/%u  ", buses[i].name,
+				__atomic_load_n(&buses[i].done, __ATOMIC_RELAXED),
+				__atomic_load_n(&buses[i].total, __ATOMIC_RELAXED));
+		fprintf(stderr, "total %u/%u, %u failed ", done, total, failed);
+		fflush(stderr);
+	}
+
+	return finished;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned int i;
+	unsigned int failed = 0;
+	const char *profile_path = NULL;
+	const char *journal_path = "s96at-provision.journal";
+	const char *results_path = NULL;
+	const char *bundle_path = NULL;
+	bool quiet = false;
+	bool show;
+	uint64_t start;
+
+	while ((opt = getopt(argc, argv, "p:b:e:k:j:o:qh")) != -1) {
+		switch (opt) {
+		case 'p':
+			profile_path = optarg;
+			break;
+		case 'b':
+			if (parse_bus(optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'e':
+			if (parse_emulated(optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'k':
+			bundle_path = optarg;
+			break;
+		case 'j':
+			journal_path = optarg;
+			break;
+		case 'o':
+			results_path = optarg;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!profile_path || !num_buses) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (s96at_profile_load(&profile, profile_path) != S96AT_STATUS_OK) {
+		fprintf(stderr, "%s: invalid profile\n", profile_path);
+		return EXIT_FAILURE;
+	}
+
+	if (bundle_path) {
+		if (s96at_bundle_open(&bundle, bundle_path) != S96AT_STATUS_OK) {
+			fprintf(stderr, "%s: invalid key bundle\n", bundle_path);
+			return EXIT_FAILURE;
+		}
+		use_bundle = true;
+	}
+
+	if (journal_open(journal_path))
+		return EXIT_FAILURE;
+
+	results = stdout;
+	if (results_path) {
+		results = fopen(results_path, "a");
+		if (!results) {
+			perror("results");
+			return EXIT_FAILURE;
+		}
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	/* Progress goes to the terminal only, records may be on stdout */
+	show = !quiet && isatty(STDERR_FILENO);
+
+	fprintf(stderr, "%u bus(es), %zu device(s) already done\n", num_buses,
+		journal_num);
+
+	start = now_ms();
+
+	for (i = 0; i < num_buses; i++) {
+		if (pthread_create(&buses[i].thread, NULL, bus_worker, &buses[i])) {
+			fprintf(stderr, "%s: could not start the worker\n",
+				buses[i].name);
+			failed++;
+			continue;
+		}
+		buses[i].started = true;
+	}
+
+	while (!progress(show))
+		usleep(PROGRESS_INTERVAL_MS * 1000);
+
+	for (i = 0; i < num_buses; i++)
+		if (buses[i].started)
+			pthread_join(buses[i].thread, NULL);
+
+	progress(show);
+	if (show)
+		fprintf(stderr, "\n");
+
+	for (i = 0; i < num_buses; i++) {
+		failed += buses[i].failed;
+		fprintf(stderr, "%s: %u device(s), %u failed\n", buses[i].name,
+			buses[i].done, buses[i].failed);
+	}
+
+	fprintf(stderr, "Finished in %llu ms%s\n",
+		(unsigned long long)(now_ms() - start),
+		stop ? ", interrupted" : "");
+
+	s96at_profile_cleanup(&profile);
+	s96at_bundle_close(&bundle);
+
+	if (results != stdout)
+		fclose(results);
+	fclose(journal);
+	free(journal_done);
+
+	return failed || stop ? EXIT_FAILURE : EXIT_SUCCESS;
+}
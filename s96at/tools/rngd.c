@@ -0,0 +1,443 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmd.h>
+#include <device.h>
+#include <packet.h>
+#include <s96at.h>
+
+#define MAX_CHIPS		16
+#define WAKE_RETRIES		10
+
+/* Keep a safety margin of the watchdog budget for wake, idle and I2C */
+#define WATCHDOG_MARGIN_PCT	10
+
+/* SP 800-90B Sect 4.4: false positive probability of 2^-20 */
+#define HEALTH_ALPHA_LOG2	20
+
+/* SP 800-90B Sect 4.4.2: window size for non-binary sources */
+#define APT_WINDOW		512
+
+struct health {
+	unsigned int rct_cutoff;
+	unsigned int apt_cutoff;
+	uint8_t rct_last;
+	unsigned int rct_count;
+	uint8_t apt_ref;
+	unsigned int apt_count;
+	unsigned int apt_pos;
+};
+
+struct chip {
+	const char *path;
+	uint8_t addr;
+	struct s96at_desc desc;
+	struct health health;
+	pthread_t thread;
+	uint64_t bytes;
+	bool failed;
+};
+
+static struct chip chips[MAX_CHIPS];
+static int num_chips;
+
+static int out_fd = STDOUT_FILENO;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t out_bytes;
+static uint64_t out_limit;
+
+static unsigned int batch_len;
+static volatile sig_atomic_t stop;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d path[@addr]  I2C bus and device address, may be repeated\n"
+		"                  (default %s@0x%02x)\n"
+		"  -o path         write to path instead of stdout\n"
+		"  -F              create path as a FIFO if it does not exist\n"
+		"  -n bytes        stop after writing this many bytes\n"
+		"  -H bits         min-entropy per output byte used by the\n"
+		"                  health tests, 1-8 (default 8)\n"
+		"  -r sec          throughput report interval (default 10)\n",
+		prog, I2C_DEVICE, ATSHA204A_ADDR);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+/*
+ * C = 1 + CRITBINOM(W, 2^-H, 1 - alpha), SP 800-90B Sect 4.4.2. The
+ * binomial distribution is small enough to be summed up directly.
+ */
+static unsigned int apt_cutoff(unsigned int h)
+{
+	unsigned int k;
+	double p = 1.0 / (1 << h);
+	double alpha = 1.0 / (1 << HEALTH_ALPHA_LOG2);
+	double pk = 1.0;
+	double cdf;
+
+	for (k = 0; k < APT_WINDOW; k++)
+		pk *= 1.0 - p;
+
+	cdf = pk;
+	for (k = 0; k < APT_WINDOW && cdf < 1.0 - alpha; k++) {
+		pk *= (double)(APT_WINDOW - k) / (k + 1) * p / (1.0 - p);
+		cdf += pk;
+	}
+
+	return k + 1;
+}
+
+static void health_init(struct health *h, unsigned int bits)
+{
+	memset(h, 0, sizeof(*h));
+
+	/* C = 1 + ceil(-log2(alpha) / H), SP 800-90B Sect 4.4.1 */
+	h->rct_cutoff = 1 + (HEALTH_ALPHA_LOG2 + bits - 1) / bits;
+	h->apt_cutoff = apt_cutoff(bits);
+}
+
+/*
+ * Run the Repetition Count and Adaptive Proportion tests over a block of
+ * samples. Returns false as soon as one of the tests fails.
+ */
+static bool health_check(struct health *h, const uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		/* Repetition Count Test, SP 800-90B Sect 4.4.1 */
+		if (h->rct_count && buf[i] == h->rct_last) {
+			if (++h->rct_count >= h->rct_cutoff) {
+				fprintf(stderr, "Repetition count test failed\n");
+				return false;
+			}
+		} else {
+			h->rct_last = buf[i];
+			h->rct_count = 1;
+		}
+
+		/* Adaptive Proportion Test, SP 800-90B Sect 4.4.2 */
+		if (!h->apt_pos) {
+			h->apt_ref = buf[i];
+			h->apt_count = 1;
+		} else if (buf[i] == h->apt_ref) {
+			if (++h->apt_count >= h->apt_cutoff) {
+				fprintf(stderr, "Adaptive proportion test failed\n");
+				return false;
+			}
+		}
+
+		if (++h->apt_pos == APT_WINDOW)
+			h->apt_pos = 0;
+	}
+
+	return true;
+}
+
+static bool output(const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+	bool ok = true;
+
+	pthread_mutex_lock(&out_lock);
+
+	if (out_limit && out_bytes + len > out_limit)
+		len = out_limit - out_bytes;
+
+	while (len) {
+		n = write(out_fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			ok = false;
+			break;
+		}
+		buf += n;
+		len -= n;
+		out_bytes += n;
+	}
+
+	if (out_limit && out_bytes >= out_limit)
+		ok = false;
+
+	pthread_mutex_unlock(&out_lock);
+
+	return ok;
+}
+
+/*
+ * Wake the device, run as many Random commands as fit in the watchdog
+ * budget and put the device back to idle. Returns the number of bytes
+ * stored in buf.
+ */
+static size_t read_batch(struct chip *c, uint8_t *buf)
+{
+	int i;
+	size_t n = 0;
+
+	for (i = 0; i < WAKE_RETRIES; i++) {
+		if (s96at_wake(&c->desc) == S96AT_STATUS_READY)
+			break;
+	}
+
+	if (i == WAKE_RETRIES) {
+		fprintf(stderr, "%s@0x%02x: could not wake up the device\n",
+			c->path, c->addr);
+		return 0;
+	}
+
+	for (i = 0; i < batch_len; i++) {
+		if (cmd_get_random(c->desc.ioif, S96AT_RANDOM_MODE_UPDATE_SEED,
+				   buf + n, S96AT_RANDOM_LEN) != S96AT_STATUS_OK)
+			break;
+		n += S96AT_RANDOM_LEN;
+	}
+
+	s96at_idle(&c->desc);
+
+	return n;
+}
+
+static void *chip_worker(void *arg)
+{
+	struct chip *c = arg;
+	uint8_t *buf;
+	size_t n;
+	int errors = 0;
+
+	buf = calloc(batch_len, S96AT_RANDOM_LEN);
+	if (!buf) {
+		c->failed = true;
+		return NULL;
+	}
+
+	while (!stop) {
+		n = read_batch(c, buf);
+		if (!n) {
+			if (++errors == WAKE_RETRIES) {
+				c->failed = true;
+				break;
+			}
+			continue;
+		}
+		errors = 0;
+
+		/* Never hand out data from a block that failed the tests */
+		if (!health_check(&c->health, buf, n)) {
+			fprintf(stderr, "%s@0x%02x: health test failure, disabling\n",
+				c->path, c->addr);
+			c->failed = true;
+			break;
+		}
+
+		__atomic_add_fetch(&c->bytes, n, __ATOMIC_RELAXED);
+
+		if (!output(buf, n)) {
+			stop = 1;
+			break;
+		}
+	}
+
+	memset(buf, 0, batch_len * S96AT_RANDOM_LEN);
+	free(buf);
+
+	return NULL;
+}
+
+static int parse_chip(char *spec)
+{
+	char *at;
+	struct chip *c;
+
+	if (num_chips == MAX_CHIPS) {
+		fprintf(stderr, "Too many devices, max %d\n", MAX_CHIPS);
+		return -1;
+	}
+
+	c = &chips[num_chips++];
+	c->path = spec;
+	c->addr = ATSHA204A_ADDR;
+
+	at = strchr(spec, '@');
+	if (at) {
+		*at = '\0';
+		c->addr = strtoul(at + 1, NULL, 0);
+	}
+
+	return 0;
+}
+
+static void report(uint64_t start, uint64_t last, uint64_t *last_bytes)
+{
+	int i;
+	uint64_t now = now_ms();
+	uint64_t total = 0;
+
+	for (i = 0; i < num_chips; i++)
+		total += __atomic_load_n(&chips[i].bytes, __ATOMIC_RELAXED);
+
+	fprintf(stderr, "%llu bytes, %.1f B/s (avg %.1f B/s)\n",
+		(unsigned long long)total,
+		now > last ? (total - *last_bytes) * 1000.0 / (now - last) : 0.0,
+		now > start ? total * 1000.0 / (now - start) : 0.0);
+
+	*last_bytes = total;
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	int opt;
+	int alive;
+	unsigned int bits = 8;
+	unsigned int interval = 10;
+	const char *out_path = NULL;
+	bool fifo = false;
+	struct cmd_packet p;
+	uint64_t start, last, last_bytes = 0;
+	int ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "d:o:Fn:H:r:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			if (parse_chip(optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'F':
+			fifo = true;
+			break;
+		case 'n':
+			out_limit = strtoull(optarg, NULL, 0);
+			break;
+		case 'H':
+			bits = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			interval = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (bits < 1 || bits > 8 || !interval) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (!num_chips) {
+		chips[0].path = I2C_DEVICE;
+		chips[0].addr = ATSHA204A_ADDR;
+		num_chips = 1;
+	}
+
+	if (out_path) {
+		if (fifo && mkfifo(out_path, 0600) && errno != EEXIST) {
+			perror("mkfifo");
+			return EXIT_FAILURE;
+		}
+
+		out_fd = open(out_path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+		if (out_fd < 0) {
+			perror("open");
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* Fit as many Random commands as possible in one wake window */
+	get_command(&p, OPCODE_RANDOM);
+	batch_len = S96AT_WATCHDOG_TIME * (100 - WATCHDOG_MARGIN_PCT) / 100 /
+		    p.max_time;
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < num_chips; i++) {
+		health_init(&chips[i].health, bits);
+
+		if (s96at_init_i2c(S96AT_ATSHA204A, chips[i].path, chips[i].addr,
+				   &chips[i].desc) != S96AT_STATUS_OK) {
+			fprintf(stderr, "%s@0x%02x: could not initialize the device\n",
+				chips[i].path, chips[i].addr);
+			chips[i].failed = true;
+			continue;
+		}
+
+		if (pthread_create(&chips[i].thread, NULL, chip_worker, &chips[i])) {
+			chips[i].failed = true;
+			s96at_cleanup(&chips[i].desc);
+		}
+	}
+
+	fprintf(stderr, "%d device(s), %u Random commands per wake, RCT cutoff %u, APT cutoff %u/%u\n",
+		num_chips, batch_len, chips[0].health.rct_cutoff,
+		chips[0].health.apt_cutoff, APT_WINDOW);
+
+	start = last = now_ms();
+
+	do {
+		for (i = 0; i < interval && !stop; i++)
+			sleep(1);
+
+		report(start, last, &last_bytes);
+		last = now_ms();
+
+		alive = 0;
+		for (i = 0; i < num_chips; i++)
+			if (!chips[i].failed)
+				alive++;
+	} while (!stop && alive);
+
+	stop = 1;
+
+	for (i = 0; i < num_chips; i++) {
+		if (chips[i].desc.ioif) {
+			pthread_join(chips[i].thread, NULL);
+			s96at_cleanup(&chips[i].desc);
+		}
+		if (chips[i].failed)
+			ret = EXIT_FAILURE;
+	}
+
+	report(start, last, &last_bytes);
+
+	if (out_fd != STDOUT_FILENO)
+		close(out_fd);
+
+	return ret;
+}
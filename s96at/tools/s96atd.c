@@ -0,0 +1,235 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <getopt.h>
+#include <grp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <daemon.h>
+#include <device.h>
+#include <personalize.h>
+#include <s96at.h>
+
+#define MAX_CHIPS		16
+
+struct chip {
+	const char *path;
+	uint8_t addr;
+	long emu_id;
+	struct s96at_desc desc;
+};
+
+static struct chip chips[MAX_CHIPS];
+static int num_chips;
+
+static struct server *srv;
+
+static const char *class_names[S96AT_PRIORITY_NUM] = {
+	"critical", "normal", "bulk"
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d path[@addr]  I2C bus and device address, may be repeated\n"
+		"                  (default %s@0x%02x)\n"
+		"  -e id           an emulated device with the given id,\n"
+		"                  personalized like the test device, may be\n"
+		"                  repeated\n"
+		"  -s path         listen on path (default %s)\n"
+		"  -m mode         permissions of the socket, in octal\n"
+		"                  (default 0660)\n"
+		"  -g group        also allow the clients of group, by name or\n"
+		"                  id, in the critical priority class\n",
+		prog, I2C_DEVICE, ATSHA204A_ADDR, S96ATD_SOCKET);
+}
+
+static void on_signal(int sig)
+{
+	server_stop(srv);
+}
+
+static struct chip *add_chip(void)
+{
+	if (num_chips == MAX_CHIPS) {
+		fprintf(stderr, "Too many devices, max %d\n", MAX_CHIPS);
+		return NULL;
+	}
+
+	chips[num_chips].emu_id = -1;
+
+	return &chips[num_chips++];
+}
+
+static int parse_chip(char *spec)
+{
+	struct chip *c = add_chip();
+	char *at;
+
+	if (!c)
+		return -1;
+
+	c->path = spec;
+	c->addr = ATSHA204A_ADDR;
+
+	at = strchr(spec, '@');
+	if (at) {
+		*at = '\0';
+		c->addr = strtoul(at + 1, NULL, 0);
+	}
+
+	return 0;
+}
+
+static void print_stats(void)
+{
+	struct s96atd_class_stats stats[S96AT_PRIORITY_NUM];
+	int i;
+
+	server_stats(srv, stats, false);
+
+	for (i = 0; i < S96AT_PRIORITY_NUM; i++) {
+		if (!stats[i].calls)
+			continue;
+		fprintf(stderr, "%s: %llu calls, wait p50 %llu us p99 %llu us, "
+			"max depth %u, %llu preempted\n", class_names[i],
+			(unsigned long long)stats[i].calls,
+			(unsigned long long)s96at_stats_percentile(&stats[i].wait, 50),
+			(unsigned long long)s96at_stats_percentile(&stats[i].wait, 99),
+			stats[i].max_depth,
+			(unsigned long long)stats[i].preempted);
+	}
+}
+
+static int parse_group(const char *name, gid_t *gid)
+{
+	struct group *gr = getgrnam(name);
+	char *end;
+
+	if (gr) {
+		*gid = gr->gr_gid;
+		return 0;
+	}
+
+	*gid = strtoul(name, &end, 0);
+	if (!*name || *end) {
+		fprintf(stderr, "Unknown group %s\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int open_chip(struct chip *c)
+{
+	if (c->emu_id < 0) {
+		if (s96at_init_i2c(S96AT_ATSHA204A, c->path, c->addr,
+				   &c->desc) != S96AT_STATUS_OK) {
+			fprintf(stderr, "%s@0x%02x: could not initialize the device\n",
+				c->path, c->addr);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (s96at_init_emulator(S96AT_ATSHA204A, c->emu_id,
+				&c->desc) != S96AT_STATUS_OK ||
+	    atsha204a_personalize(c->desc.ioif) != S96AT_STATUS_OK) {
+		fprintf(stderr, "emulator:%ld: could not initialize the device\n",
+			c->emu_id);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct io_interface *ioifs[MAX_CHIPS];
+	const char *path = S96ATD_SOCKET;
+	mode_t mode = 0660;
+	gid_t crit_gid = (gid_t)-1;
+	struct chip *c;
+	int ret = EXIT_FAILURE;
+	int opened = 0;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "d:e:s:m:g:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			if (parse_chip(optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'e':
+			c = add_chip();
+			if (!c)
+				return EXIT_FAILURE;
+			c->emu_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			path = optarg;
+			break;
+		case 'm':
+			mode = strtoul(optarg, NULL, 8);
+			break;
+		case 'g':
+			if (parse_group(optarg, &crit_gid))
+				return EXIT_FAILURE;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!num_chips) {
+		chips[0].path = I2C_DEVICE;
+		chips[0].addr = ATSHA204A_ADDR;
+		chips[0].emu_id = -1;
+		num_chips = 1;
+	}
+
+	for (opened = 0; opened < num_chips; opened++) {
+		if (open_chip(&chips[opened]))
+			goto out;
+		ioifs[opened] = chips[opened].desc.ioif;
+	}
+
+	srv = server_create(path, ioifs, num_chips);
+	if (!srv) {
+		fprintf(stderr, "Could not listen on %s\n", path);
+		goto out;
+	}
+
+	if (chmod(path, mode))
+		perror("chmod");
+
+	server_allow_critical(srv, geteuid(), crit_gid);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	fprintf(stderr, "Serving %d device(s) on %s\n", num_chips, path);
+
+	if (!server_run(srv))
+		ret = EXIT_SUCCESS;
+
+	print_stats();
+	server_free(srv);
+out:
+	for (i = 0; i < opened; i++) {
+		s96at_idle(&chips[i].desc);
+		s96at_cleanup(&chips[i].desc);
+	}
+
+	return ret;
+}